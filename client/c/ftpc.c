@@ -0,0 +1,1040 @@
+#include "ftpc.h"
+#include "delta.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#define FTPC_CHUNK (1 << 20)      // 每次 sendfile/splice 的最大字节数
+#define FTPC_PIPE_SIZE (1 << 20)  // splice 中转管道的期望容量
+#define FTPC_SEGMENT_ALIGN 65536  // 分段边界的对齐粒度
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static int send_all(int sock, const char *buffer, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(sock, buffer, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buffer += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * 从控制连接读取一行（去掉 CRLF），数据先进入接收缓冲区，一次 recv 可以取回多条流水线响应
+ * @return 行长度，连接关闭或出错返回-1
+ */
+static int read_ctrl_line(ftpc_conn *c, char *line, size_t max)
+{
+    size_t out = 0;
+    while (1)
+    {
+        while (c->rpos < c->rlen)
+        {
+            char ch = c->rbuf[c->rpos++];
+            if (ch == '\n')
+            {
+                if (out > 0 && line[out - 1] == '\r')
+                    out--;
+                line[out] = '\0';
+                return (int)out;
+            }
+            if (out + 1 < max)
+                line[out++] = ch;
+        }
+        ssize_t n = recv(c->ctrl, c->rbuf, sizeof(c->rbuf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        c->rlen = (size_t)n;
+        c->rpos = 0;
+    }
+}
+
+/**
+ * 读取一个完整的响应（支持 "ddd-" 开头的多行响应）
+ * @return 响应码，连接关闭或格式错误返回-1
+ */
+int ftpc_reply(ftpc_conn *c)
+{
+    char line[FTPC_REPLY_MAX];
+    if (read_ctrl_line(c, line, sizeof(line)) < 4)
+        return -1;
+    int code = atoi(line);
+    if (line[3] == '-')
+    {
+        // 多行响应以 "ddd " 开头的行结束，中间行可以是任意内容
+        while (1)
+        {
+            if (read_ctrl_line(c, line, sizeof(line)) < 0)
+                return -1;
+            if (strlen(line) >= 4 && atoi(line) == code && line[3] == ' ')
+                break;
+        }
+    }
+    if (c->pending > 0)
+        c->pending--;
+    c->code = code;
+    snprintf(c->reply, sizeof(c->reply), "%s", line);
+    return code;
+}
+
+static int vformat_command(char *out, size_t outsz, const char *fmt, va_list ap)
+{
+    int len = vsnprintf(out, outsz - 2, fmt, ap);
+    if (len < 0 || (size_t)len >= outsz - 2)
+        return -1;
+    out[len++] = '\r';
+    out[len++] = '\n';
+    return len;
+}
+
+/**
+ * 发送一条命令但不等待响应，之后必须用 ftpc_reply 按顺序读取
+ * @return 0 成功，-1 命令过长或发送失败
+ */
+int ftpc_send(ftpc_conn *c, const char *fmt, ...)
+{
+    char line[FTPC_REPLY_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vformat_command(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0 || send_all(c->ctrl, line, (size_t)len) != 0)
+        return -1;
+    c->pending++;
+    return 0;
+}
+
+/**
+ * 发送一条命令并等待它的响应
+ * @return 响应码，失败返回-1
+ */
+int ftpc_command(ftpc_conn *c, const char *fmt, ...)
+{
+    char line[FTPC_REPLY_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vformat_command(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0 || send_all(c->ctrl, line, (size_t)len) != 0)
+        return -1;
+    c->pending++;
+    return ftpc_reply(c);
+}
+
+/**
+ * 流水线发送一组命令：全部命令合并为一次写入，再依次读取响应
+ * @param commands 命令（不含 CRLF）
+ * @param count 命令条数
+ * @param codes 输出每条命令的响应码，可以为 NULL
+ * @return 0 全部读到响应，-1 发送失败或连接中断
+ */
+int ftpc_pipeline(ftpc_conn *c, const char *const *commands, int count, int *codes)
+{
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += strlen(commands[i]) + 2;
+    char *batch = malloc(total + 1);
+    if (batch == NULL)
+        return -1;
+    size_t pos = 0;
+    for (int i = 0; i < count; i++)
+        pos += (size_t)sprintf(batch + pos, "%s\r\n", commands[i]);
+    int rc = send_all(c->ctrl, batch, pos);
+    free(batch);
+    if (rc != 0)
+        return -1;
+    c->pending += count;
+    for (int i = 0; i < count; i++)
+    {
+        int code = ftpc_reply(c);
+        if (code < 0)
+            return -1;
+        if (codes != NULL)
+            codes[i] = code;
+    }
+    return 0;
+}
+
+/**
+ * 连接服务器并以匿名用户登录，USER/PASS/TYPE I 作为一组流水线命令发送
+ * @return 0 成功，-1 连接失败，-2 登录失败
+ */
+int ftpc_connect(ftpc_conn *c, const char *host, uint16_t port)
+{
+    memset(c, 0, sizeof(*c));
+    c->ctrl = -1;
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || res == NULL)
+        return -1;
+    memcpy(&c->server, res->ai_addr, sizeof(c->server));
+    freeaddrinfo(res);
+    c->server.sin_port = htons(port);
+
+    c->ctrl = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->ctrl < 0)
+        return -1;
+    if (connect(c->ctrl, (struct sockaddr *)&c->server, sizeof(c->server)) != 0 || ftpc_reply(c) != 220)
+    {
+        close(c->ctrl);
+        c->ctrl = -1;
+        return -1;
+    }
+
+    static const char *const login[] = {"USER anonymous", "PASS ftpc@", "TYPE I"};
+    int codes[3];
+    if (ftpc_pipeline(c, login, 3, codes) != 0 || codes[0] != 331 || codes[1] != 230 || codes[2] != 200)
+    {
+        close(c->ctrl);
+        c->ctrl = -1;
+        return -2;
+    }
+    return 0;
+}
+
+/**
+ * 发送 QUIT 并关闭控制连接
+ */
+void ftpc_close(ftpc_conn *c)
+{
+    if (c->ctrl < 0)
+        return;
+    ftpc_command(c, "QUIT");
+    close(c->ctrl);
+    c->ctrl = -1;
+}
+
+/**
+ * 查询文件大小（SIZE）
+ * @return 0 成功，-1 失败
+ */
+int ftpc_size(ftpc_conn *c, const char *remote, uint64_t *size)
+{
+    if (ftpc_command(c, "SIZE %s", remote) != 213)
+        return -1;
+    *size = strtoull(c->reply + 4, NULL, 10);
+    return 0;
+}
+
+/**
+ * 进入被动模式并连接服务器给出的数据端口
+ * @return 数据连接socket，失败返回-1
+ */
+static int open_pasv(ftpc_conn *c)
+{
+    if (ftpc_command(c, "PASV") != 227)
+        return -1;
+    unsigned h[4], p[2];
+    const char *open_paren = strchr(c->reply, '(');
+    if (open_paren == NULL ||
+        sscanf(open_paren, "(%u,%u,%u,%u,%u,%u)", &h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) != 6)
+        return -1;
+    struct sockaddr_in addr = c->server;
+    uint32_t ip = (h[0] << 24) | (h[1] << 16) | (h[2] << 8) | h[3];
+    if (ip != 0)
+        addr.sin_addr.s_addr = htonl(ip); // 0.0.0.0 时沿用控制连接的地址
+    addr.sin_port = htons((uint16_t)((p[0] << 8) | p[1]));
+
+    int data = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (data < 0)
+        return -1;
+    if (connect(data, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(data);
+        return -1;
+    }
+    return data;
+}
+
+/**
+ * 开始一次传输：PASV 后把 REST 与 RETR/STOR 作为流水线命令一起发送
+ * @param verb "RETR" 或 "STOR"
+ * @param offset 起始偏移，0 时不发送 REST（STOR 会清空文件）
+ * @return 已建立的数据连接，失败返回-1
+ */
+static int start_transfer(ftpc_conn *c, const char *verb, const char *remote, uint64_t offset)
+{
+    int data = open_pasv(c);
+    if (data < 0)
+        return -1;
+    char rest[48], xfer[FTPC_REPLY_MAX];
+    snprintf(rest, sizeof(rest), "REST %llu", (unsigned long long)offset);
+    if (snprintf(xfer, sizeof(xfer), "%s %s", verb, remote) >= (int)sizeof(xfer))
+    {
+        close(data);
+        return -1;
+    }
+    const char *commands[2] = {rest, xfer};
+    int codes[2] = {350, 0};
+    int rc = offset > 0 ? ftpc_pipeline(c, commands, 2, codes) : ftpc_pipeline(c, commands + 1, 1, codes + 1);
+    if (rc != 0 || codes[0] != 350 || (codes[1] != 150 && codes[1] != 125))
+    {
+        close(data);
+        return -1;
+    }
+    return data;
+}
+
+/**
+ * 结束一次传输：关闭数据连接并读取最终响应
+ * @param cut_short 下载时客户端已拿到所需区间并提前关闭了连接，此时服务器返回 426 也算成功
+ * @return 0 成功，-1 失败
+ */
+static int finish_transfer(ftpc_conn *c, int data, int cut_short)
+{
+    close(data);
+    int code = ftpc_reply(c);
+    if (code == 226 || code == 250)
+        return 0;
+    return cut_short && (code == 426 || code == 451) ? 0 : -1;
+}
+
+/**
+ * 接收数据写入文件的指定偏移：优先 splice(2) 经管道搬运（数据不进入用户态），不支持时回退到 recv/pwrite
+ * @param length 要接收的字节数，-1 表示接收到连接关闭
+ * @return 接收的字节数，失败返回-1
+ */
+static int64_t recv_to_file(int data, int fd, uint64_t offset, int64_t length, const char **method)
+{
+    int64_t got = 0;
+    loff_t off = (loff_t)offset;
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == 0)
+    {
+        fcntl(pipefd[1], F_SETPIPE_SZ, FTPC_PIPE_SIZE); // 失败时沿用默认容量
+        *method = "splice";
+        while (length < 0 || got < length)
+        {
+            size_t want = FTPC_CHUNK;
+            if (length >= 0 && (uint64_t)(length - got) < want)
+                want = (size_t)(length - got);
+            ssize_t n = splice(data, NULL, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && got == 0 && errno == EINVAL)
+                break; // 文件系统不支持 splice，改用 recv/pwrite
+            if (n <= 0)
+            {
+                close(pipefd[0]);
+                close(pipefd[1]);
+                return n == 0 ? got : -1;
+            }
+            ssize_t left = n;
+            while (left > 0)
+            {
+                ssize_t m = splice(pipefd[0], NULL, fd, &off, (size_t)left, SPLICE_F_MOVE);
+                if (m <= 0)
+                {
+                    close(pipefd[0]);
+                    close(pipefd[1]);
+                    return -1;
+                }
+                left -= m;
+            }
+            got += n;
+        }
+        close(pipefd[0]);
+        close(pipefd[1]);
+        if (length >= 0 && got >= length)
+            return got;
+    }
+
+    *method = "read/write";
+    char *buffer = malloc(FTPC_CHUNK);
+    if (buffer == NULL)
+        return -1;
+    while (length < 0 || got < length)
+    {
+        size_t want = FTPC_CHUNK;
+        if (length >= 0 && (uint64_t)(length - got) < want)
+            want = (size_t)(length - got);
+        ssize_t n = recv(data, buffer, want, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            free(buffer);
+            return n == 0 ? got : -1;
+        }
+        if (pwrite(fd, buffer, (size_t)n, (off_t)(offset + got)) != n)
+        {
+            free(buffer);
+            return -1;
+        }
+        got += n;
+    }
+    free(buffer);
+    return got;
+}
+
+/**
+ * 用 sendfile(2) 把文件的一个区间发送到数据连接
+ * @param length 要发送的字节数，-1 表示发送到文件末尾
+ * @return 发送的字节数，失败返回-1
+ */
+static int64_t send_from_file(int data, int fd, uint64_t offset, int64_t length)
+{
+    off_t off = (off_t)offset;
+    int64_t sent = 0;
+    while (length < 0 || sent < length)
+    {
+        size_t want = FTPC_CHUNK;
+        if (length >= 0 && (uint64_t)(length - sent) < want)
+            want = (size_t)(length - sent);
+        ssize_t n = sendfile(data, fd, &off, want);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break; // 文件结束
+        sent += n;
+    }
+    return sent;
+}
+
+/**
+ * 下载远程文件的一个区间（REST + RETR），写入本地文件的相同偏移
+ * @param fd 本地文件
+ * @param offset 区间起点
+ * @param length 区间长度，-1 表示到文件末尾
+ * @param stats 累加传输统计，可以为 NULL
+ * @return 0 成功，-1 失败
+ */
+int ftpc_get_range(ftpc_conn *c, const char *remote, int fd, uint64_t offset, int64_t length, ftpc_stats *stats)
+{
+    uint64_t start = now_us();
+    int data = start_transfer(c, "RETR", remote, offset);
+    if (data < 0)
+        return -1;
+    const char *method = NULL;
+    int64_t got = recv_to_file(data, fd, offset, length, &method);
+    int cut_short = length >= 0 && got == length;
+    if (finish_transfer(c, data, cut_short) != 0 || got < 0 || (length >= 0 && got != length))
+        return -1;
+    if (stats != NULL)
+    {
+        stats->bytes += (uint64_t)got;
+        stats->elapsed_us += now_us() - start;
+        stats->method = method;
+    }
+    return 0;
+}
+
+/**
+ * 上传本地文件的一个区间（REST + STOR），写入远程文件的相同偏移；offset 为0时服务器会清空远程文件
+ * @return 0 成功，-1 失败
+ */
+int ftpc_put_range(ftpc_conn *c, const char *remote, int fd, uint64_t offset, int64_t length, ftpc_stats *stats)
+{
+    uint64_t start = now_us();
+    int data = start_transfer(c, "STOR", remote, offset);
+    if (data < 0)
+        return -1;
+    int64_t sent = send_from_file(data, fd, offset, length);
+    if (finish_transfer(c, data, 0) != 0 || sent < 0)
+        return -1;
+    if (stats != NULL)
+    {
+        stats->bytes += (uint64_t)sent;
+        stats->elapsed_us += now_us() - start;
+        stats->method = "sendfile";
+    }
+    return 0;
+}
+
+typedef struct
+{
+    const char *host;
+    uint16_t port;
+    const char *remote;
+    int fd;           // 本地文件，所有流共享，各自按偏移读写
+    uint64_t offset;  // 本流负责的区间
+    uint64_t length;
+    int upload;
+    ftpc_conn *conn;  // 已登录的控制连接，NULL 时由流自己建立
+    int data;         // 已开始的上传数据连接（第一段），-1 表示由流自己开始
+    ftpc_stats stats;
+    int rc;
+} stream_job;
+
+static void *stream_main(void *arg)
+{
+    stream_job *job = arg;
+    ftpc_conn own;
+    ftpc_conn *c = job->conn;
+    if (c == NULL)
+    {
+        if (ftpc_connect(&own, job->host, job->port) != 0)
+        {
+            job->rc = -1;
+            return NULL;
+        }
+        c = &own;
+    }
+    if (!job->upload)
+    {
+        job->rc = ftpc_get_range(c, job->remote, job->fd, job->offset, (int64_t)job->length, &job->stats);
+    }
+    else if (job->data < 0)
+    {
+        job->rc = ftpc_put_range(c, job->remote, job->fd, job->offset, (int64_t)job->length, &job->stats);
+    }
+    else
+    {
+        int64_t sent = send_from_file(job->data, job->fd, job->offset, (int64_t)job->length);
+        job->rc = finish_transfer(c, job->data, 0) != 0 || sent != (int64_t)job->length ? -1 : 0;
+        job->stats.bytes = sent > 0 ? (uint64_t)sent : 0;
+        job->stats.method = "sendfile";
+    }
+    if (c == &own)
+        ftpc_close(&own);
+    return NULL;
+}
+
+/**
+ * 把 size 字节拆成若干对齐的区间，每个区间至少 FTPC_MIN_SPLIT 字节
+ * @return 实际的流数
+ */
+static int plan_segments(uint64_t size, int streams, uint64_t *segment)
+{
+    if (streams < 1)
+        streams = 1;
+    if ((uint64_t)streams > size / FTPC_MIN_SPLIT)
+        streams = size / FTPC_MIN_SPLIT > 0 ? (int)(size / FTPC_MIN_SPLIT) : 1;
+    uint64_t seg = (size + (uint64_t)streams - 1) / (uint64_t)streams;
+    seg = (seg + FTPC_SEGMENT_ALIGN - 1) / FTPC_SEGMENT_ALIGN * FTPC_SEGMENT_ALIGN;
+    *segment = seg > 0 ? seg : 1;
+    return size > 0 ? (int)((size + *segment - 1) / *segment) : 1;
+}
+
+/**
+ * 运行一组并行流，第一个流使用调用者的控制连接，其余流各自建立连接
+ */
+static int run_streams(stream_job *jobs, int count, ftpc_stats *stats)
+{
+    pthread_t *threads = calloc((size_t)count, sizeof(pthread_t));
+    if (threads == NULL)
+        return -1;
+    int started = 1;
+    for (; started < count; started++)
+        if (pthread_create(&threads[started], NULL, stream_main, &jobs[started]) != 0)
+            break;
+    stream_main(&jobs[0]);
+    int rc = started == count ? 0 : -1;
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    for (int i = 0; i < started; i++)
+    {
+        if (jobs[i].rc != 0)
+            rc = -1;
+        stats->bytes += jobs[i].stats.bytes;
+        if (jobs[i].stats.method != NULL)
+            stats->method = jobs[i].stats.method;
+    }
+    stats->streams = count;
+    return rc;
+}
+
+/**
+ * 并行分段下载：SIZE 得到文件大小后拆成区间，每个流一条控制连接 + 一条数据连接
+ * @param streams 期望的并行流数，小文件会自动减少
+ * @param stats 输出传输统计
+ * @return 0 成功，-1 失败
+ */
+int ftpc_parallel_get(const char *host, uint16_t port, const char *remote, const char *local, int streams,
+                      ftpc_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    uint64_t start = now_us();
+    ftpc_conn c0;
+    if (ftpc_connect(&c0, host, port) != 0)
+        return -1;
+    uint64_t size = 0;
+    if (ftpc_size(&c0, remote, &size) != 0)
+    {
+        ftpc_close(&c0);
+        return -1;
+    }
+    int fd = open(local, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        ftpc_close(&c0);
+        return -1;
+    }
+
+    uint64_t segment;
+    int count = plan_segments(size, streams, &segment);
+    stream_job *jobs = calloc((size_t)count, sizeof(stream_job));
+    int rc = -1;
+    if (jobs != NULL)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            jobs[i] = (stream_job){host, port, remote, fd, (uint64_t)i * segment, segment, 0, NULL, -1, {0}, 0};
+            if (jobs[i].offset + jobs[i].length > size)
+                jobs[i].length = size - jobs[i].offset;
+        }
+        jobs[0].conn = &c0;
+        rc = run_streams(jobs, count, stats);
+        free(jobs);
+    }
+    if (close(fd) != 0)
+        rc = -1;
+    ftpc_close(&c0);
+    stats->elapsed_us = now_us() - start;
+    return rc;
+}
+
+/**
+ * 并行分段上传：第一段先发出 STOR 并等到 150（服务器此时已清空远程文件），
+ * 其余各段再用 REST + STOR 写入各自的偏移，避免第一段的清空覆盖其它段已写入的数据
+ * @return 0 成功，-1 失败
+ */
+int ftpc_parallel_put(const char *host, uint16_t port, const char *local, const char *remote, int streams,
+                      ftpc_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    uint64_t start = now_us();
+    int fd = open(local, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    ftpc_conn c0;
+    if (ftpc_connect(&c0, host, port) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t segment;
+    int count = plan_segments(size, streams, &segment);
+    int data0 = start_transfer(&c0, "STOR", remote, 0);
+    stream_job *jobs = data0 >= 0 ? calloc((size_t)count, sizeof(stream_job)) : NULL;
+    int rc = -1;
+    if (jobs != NULL)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            jobs[i] = (stream_job){host, port, remote, fd, (uint64_t)i * segment, segment, 1, NULL, -1, {0}, 0};
+            if (jobs[i].offset + jobs[i].length > size)
+                jobs[i].length = size - jobs[i].offset;
+        }
+        jobs[0].conn = &c0;
+        jobs[0].data = data0;
+        rc = run_streams(jobs, count, stats);
+        free(jobs);
+    }
+    else if (data0 >= 0)
+    {
+        close(data0);
+    }
+    close(fd);
+    ftpc_close(&c0);
+    stats->elapsed_us = now_us() - start;
+    return rc;
+}
+
+/* ---------- 增量上传（SITE SIGS + SITE DELTA） ---------- */
+
+typedef struct
+{
+    uint32_t weak;
+    uint64_t strong;
+    uint64_t index; // 块号
+} sig_entry;
+
+typedef struct
+{
+    int data;                      // 数据连接
+    char buf[FTPC_DELTA_OUTBUF];   // 指令头与短字面数据先拼接在这里
+    size_t used;
+    uint64_t sent;                 // 写入数据连接的总字节数
+    uint64_t run_first;            // 尚未发出的连续块引用
+    uint32_t run_count;
+} delta_out;
+
+static int compare_sig_entry(const void *a, const void *b)
+{
+    const sig_entry *x = a, *y = b;
+    if (x->weak != y->weak)
+        return x->weak < y->weak ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static uint16_t sig_filter_key(uint32_t weak)
+{
+    return (uint16_t)(weak ^ (weak >> 16));
+}
+
+static int out_flush(delta_out *o)
+{
+    if (o->used > 0 && send_all(o->data, o->buf, o->used) != 0)
+        return -1;
+    o->sent += o->used;
+    o->used = 0;
+    return 0;
+}
+
+static int out_put(delta_out *o, const void *p, size_t len)
+{
+    if (o->used + len > sizeof(o->buf) && out_flush(o) != 0)
+        return -1;
+    if (len >= sizeof(o->buf))
+    {
+        // 大段字面数据直接从映射的文件发送，不再复制
+        if (send_all(o->data, p, len) != 0)
+            return -1;
+        o->sent += len;
+        return 0;
+    }
+    memcpy(o->buf + o->used, p, len);
+    o->used += len;
+    return 0;
+}
+
+static int out_flush_run(delta_out *o)
+{
+    if (o->run_count == 0)
+        return 0;
+    char op[13];
+    op[0] = DELTA_OP_BLOCKS;
+    memcpy(op + 1, &o->run_first, 8); // 协议规定小端序，客户端同样只运行在小端的 Linux 上
+    memcpy(op + 9, &o->run_count, 4);
+    o->run_count = 0;
+    return out_put(o, op, sizeof(op));
+}
+
+static int out_literal(delta_out *o, const uint8_t *p, uint64_t len)
+{
+    if (len > 0 && out_flush_run(o) != 0)
+        return -1;
+    while (len > 0)
+    {
+        uint32_t n = len < DELTA_MAX_LITERAL ? (uint32_t)len : DELTA_MAX_LITERAL;
+        char op[5];
+        op[0] = DELTA_OP_LITERAL;
+        memcpy(op + 1, &n, 4);
+        if (out_put(o, op, sizeof(op)) != 0 || out_put(o, p, n) != 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * 引用原文件的一个块，与上一个引用相邻时合并成一条指令
+ */
+static int out_block(delta_out *o, uint64_t index)
+{
+    if (o->run_count > 0 && index == o->run_first + o->run_count && o->run_count < UINT32_MAX)
+    {
+        o->run_count++;
+        return 0;
+    }
+    if (out_flush_run(o) != 0)
+        return -1;
+    o->run_first = index;
+    o->run_count = 1;
+    return 0;
+}
+
+/**
+ * 按文件大小选择块大小：约为文件大小的平方根，取2的幂
+ */
+static uint32_t delta_block_size(uint64_t size)
+{
+    uint32_t block = FTPC_DELTA_MIN_BLOCK;
+    while (block < DELTA_MAX_BLOCK && (uint64_t)block * block < size)
+        block <<= 1;
+    return block;
+}
+
+/**
+ * SITE SIGS 取回远程文件的块签名，按弱校验和排序
+ * @param count 输出签名个数
+ * @param remote_size 输出远程文件大小
+ * @return 签名数组（调用者释放），失败返回 NULL，远程文件不存在时 c->code 为 550
+ */
+static sig_entry *fetch_signatures(ftpc_conn *c, const char *remote, uint32_t block_size, size_t *count,
+                                   uint64_t *remote_size)
+{
+    int data = open_pasv(c);
+    if (data < 0)
+        return NULL;
+    int code = ftpc_command(c, "SITE SIGS %u %s", block_size, remote);
+    if (code != 150 && code != 125)
+    {
+        close(data);
+        return NULL;
+    }
+    size_t cap = 1 << 16, len = 0;
+    char *raw = malloc(cap);
+    ssize_t n = 0;
+    while (raw != NULL)
+    {
+        if (len == cap)
+        {
+            char *grown = realloc(raw, cap * 2);
+            if (grown == NULL)
+                break;
+            raw = grown;
+            cap *= 2;
+        }
+        n = recv(data, raw + len, cap - len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+    }
+    if (finish_transfer(c, data, 0) != 0 || raw == NULL || n != 0 || len < sizeof(delta_sig_header))
+    {
+        free(raw);
+        return NULL;
+    }
+    delta_sig_header header;
+    memcpy(&header, raw, sizeof(header));
+    size_t nsigs = (len - sizeof(header)) / sizeof(delta_sig);
+    sig_entry *sigs = header.magic == DELTA_SIG_MAGIC && header.block_size == block_size
+                          ? malloc((nsigs > 0 ? nsigs : 1) * sizeof(sig_entry))
+                          : NULL;
+    for (size_t i = 0; sigs != NULL && i < nsigs; i++)
+    {
+        delta_sig sig;
+        memcpy(&sig, raw + sizeof(header) + i * sizeof(delta_sig), sizeof(sig));
+        sigs[i] = (sig_entry){sig.weak, sig.strong, i};
+    }
+    free(raw);
+    if (sigs != NULL)
+    {
+        qsort(sigs, nsigs, sizeof(sig_entry), compare_sig_entry);
+        *count = nsigs;
+        *remote_size = header.file_size;
+    }
+    return sigs;
+}
+
+/**
+ * 在签名表中查找内容相同的块：先比较弱校验和，相同时再比较 XXH64；
+ * 多个块内容相同时优先选择紧接上一个引用的块，使引用能合并成一条指令
+ * @param full_blocks 只匹配块号小于它的完整块
+ * @return 块号，没有匹配返回-1
+ */
+static int64_t find_block(const sig_entry *sigs, size_t count, uint64_t full_blocks, uint32_t weak,
+                          const uint8_t *p, size_t len, const delta_out *o)
+{
+    size_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sigs[mid].weak < weak)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int have_strong = 0;
+    uint64_t strong = 0;
+    int64_t found = -1;
+    uint64_t preferred = o->run_count > 0 ? o->run_first + o->run_count : UINT64_MAX;
+    for (size_t i = lo; i < count && sigs[i].weak == weak; i++)
+    {
+        if (sigs[i].index >= full_blocks)
+            continue;
+        if (!have_strong)
+        {
+            strong = checksum_xxh64(p, len);
+            have_strong = 1;
+        }
+        if (sigs[i].strong != strong)
+            continue;
+        if (found < 0 || sigs[i].index == preferred)
+            found = (int64_t)sigs[i].index;
+        if (sigs[i].index == preferred)
+            break;
+    }
+    return found;
+}
+
+/**
+ * 逐字节滑动窗口扫描本地文件，生成增量指令流
+ * @return 0 成功，-1 发送失败
+ */
+static int emit_delta(delta_out *o, const uint8_t *p, uint64_t size, uint32_t block, const sig_entry *sigs,
+                      size_t count, uint64_t remote_size)
+{
+    static uint8_t filter[65536 / 8]; // 弱校验和的位图，绝大多数不匹配的位置不需要二分查找
+    memset(filter, 0, sizeof(filter));
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t key = sig_filter_key(sigs[i].weak);
+        filter[key >> 3] |= (uint8_t)(1u << (key & 7));
+    }
+    uint64_t full_blocks = remote_size / block;
+    uint64_t pos = 0, literal = 0;
+    uint32_t weak = 0;
+    int have_weak = 0;
+    while (pos + block <= size)
+    {
+        if (!have_weak)
+        {
+            weak = delta_weak(p + pos, block);
+            have_weak = 1;
+        }
+        uint16_t key = sig_filter_key(weak);
+        int64_t match = -1;
+        if (filter[key >> 3] & (1u << (key & 7)))
+            match = find_block(sigs, count, full_blocks, weak, p + pos, block, o);
+        if (match >= 0)
+        {
+            if (out_literal(o, p + literal, pos - literal) != 0 || out_block(o, (uint64_t)match) != 0)
+                return -1;
+            pos += block;
+            literal = pos;
+            have_weak = 0;
+            continue;
+        }
+        if (pos + block < size)
+            weak = delta_roll(weak, p[pos], p[pos + block], block);
+        pos++;
+    }
+    // 原文件最后一个不足一块的块只能与本地文件的结尾匹配
+    uint64_t tail = remote_size - full_blocks * block;
+    if (tail > 0 && size >= tail && literal <= size - tail)
+    {
+        const uint8_t *end = p + size - tail;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (sigs[i].index != full_blocks)
+                continue;
+            if (sigs[i].weak == delta_weak(end, tail) && sigs[i].strong == checksum_xxh64(end, tail))
+            {
+                if (out_literal(o, p + literal, size - tail - literal) != 0 || out_block(o, full_blocks) != 0)
+                    return -1;
+                literal = size;
+            }
+            break;
+        }
+    }
+    if (out_literal(o, p + literal, size - literal) != 0 || out_flush_run(o) != 0)
+        return -1;
+
+    char op[17];
+    uint64_t digest = checksum_xxh64(size > 0 ? (const void *)p : "", size);
+    op[0] = DELTA_OP_END;
+    memcpy(op + 1, &size, 8);
+    memcpy(op + 9, &digest, 8);
+    if (out_put(o, op, sizeof(op)) != 0)
+        return -1;
+    return out_flush(o);
+}
+
+/**
+ * 增量上传：取回远程文件的块签名，只发送本地文件中与远程不同的部分；
+ * 远程文件不存在时退回到普通的 STOR 上传
+ * @param block_size 块大小，0 表示按文件大小自动选择
+ * @param stats 输出传输统计，bytes 为实际经数据连接发送的字节数（不含签名）
+ * @return 0 成功，-1 失败
+ */
+int ftpc_delta_put(ftpc_conn *c, const char *local, const char *remote, uint32_t block_size, ftpc_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->streams = 1;
+    uint64_t start = now_us();
+    int fd = open(local, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    if (block_size == 0)
+        block_size = delta_block_size(size);
+    if (block_size < DELTA_MIN_BLOCK || block_size > DELTA_MAX_BLOCK)
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t count = 0;
+    uint64_t remote_size = 0;
+    sig_entry *sigs = fetch_signatures(c, remote, block_size, &count, &remote_size);
+    if (sigs == NULL)
+    {
+        int rc = c->code == 550 ? ftpc_put_range(c, remote, fd, 0, -1, stats) : -1;
+        close(fd);
+        stats->elapsed_us = now_us() - start;
+        return rc;
+    }
+
+    void *map = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    delta_out *o = calloc(1, sizeof(delta_out));
+    int rc = -1;
+    if (map != MAP_FAILED && o != NULL)
+    {
+        if (map != NULL)
+            madvise(map, size, MADV_SEQUENTIAL);
+        o->data = open_pasv(c);
+        int code = o->data >= 0 ? ftpc_command(c, "SITE DELTA %s", remote) : -1;
+        if (code == 150 || code == 125)
+        {
+            delta_header header = {DELTA_MAGIC, block_size};
+            int sent_ok = out_put(o, &header, sizeof(header)) == 0 &&
+                          emit_delta(o, map, size, block_size, sigs, count, remote_size) == 0;
+            rc = finish_transfer(c, o->data, 0) == 0 && sent_ok ? 0 : -1;
+        }
+        else if (o->data >= 0)
+        {
+            close(o->data);
+        }
+        stats->bytes = o->sent;
+    }
+    if (map != NULL && map != MAP_FAILED)
+        munmap(map, size);
+    free(o);
+    free(sigs);
+    close(fd);
+    stats->method = "delta";
+    stats->elapsed_us = now_us() - start;
+    return rc;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/*
+ * C 客户端库：面向批量传输任务，使用被动模式与二进制类型。
+ *  - 流水线：多条控制命令一次写出，再按顺序读取各自的响应，减少往返
+ *  - 分段传输：REST + RETR/STOR 传输文件的一个区间，大文件拆成多个区间由多条连接并行传输
+ *  - 本地零拷贝：上传用 sendfile(2) 从文件直接发送，下载用 splice(2) 经管道写入文件
+ *  - 增量上传：SITE SIGS 取回远程文件的块签名，SITE DELTA 只发送变化的部分（rsync 算法）
+ * 函数出错时返回负数，服务器的最近一个响应保存在 ftpc_conn.reply 中。
+ */
+
+#define FTPC_REPLY_MAX 1024      // 保存的响应文本长度上限
+#define FTPC_RECV_BUFFER 4096    // 控制连接接收缓冲区大小
+#define FTPC_DEFAULT_STREAMS 4   // 默认并行流数
+#define FTPC_MIN_SPLIT (8 << 20) // 每个流至少传输的字节数，小文件不拆分
+#define FTPC_DELTA_MIN_BLOCK 2048    // 增量上传自动选择块大小时的下限
+#define FTPC_DELTA_OUTBUF (64 << 10) // 增量指令的发送缓冲区大小
+
+typedef struct
+{
+    int ctrl;                     // 控制连接
+    struct sockaddr_in server;    // 服务器地址，PASV 返回的地址不可用时使用它
+    char rbuf[FTPC_RECV_BUFFER];  // 控制连接接收缓冲区
+    size_t rlen;                  // 缓冲区中的字节数
+    size_t rpos;                  // 缓冲区中下一个未读字节
+    int pending;                  // 已发送但尚未读取响应的命令数
+    int code;                     // 最近一个响应的响应码
+    char reply[FTPC_REPLY_MAX];   // 最近一个响应的最后一行
+} ftpc_conn;
+
+typedef struct
+{
+    uint64_t bytes;       // 传输的字节数
+    uint64_t elapsed_us;  // 耗时（微秒）
+    int streams;          // 实际使用的并行流数
+    const char *method;   // 本地使用的数据路径（sendfile/splice/read-write）
+} ftpc_stats;
+
+int ftpc_connect(ftpc_conn *c, const char *host, uint16_t port);
+void ftpc_close(ftpc_conn *c);
+int ftpc_send(ftpc_conn *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int ftpc_reply(ftpc_conn *c);
+int ftpc_command(ftpc_conn *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int ftpc_pipeline(ftpc_conn *c, const char *const *commands, int count, int *codes);
+int ftpc_size(ftpc_conn *c, const char *remote, uint64_t *size);
+int ftpc_get_range(ftpc_conn *c, const char *remote, int fd, uint64_t offset, int64_t length, ftpc_stats *stats);
+int ftpc_put_range(ftpc_conn *c, const char *remote, int fd, uint64_t offset, int64_t length, ftpc_stats *stats);
+int ftpc_parallel_get(const char *host, uint16_t port, const char *remote, const char *local, int streams,
+                      ftpc_stats *stats);
+int ftpc_parallel_put(const char *host, uint16_t port, const char *local, const char *remote, int streams,
+                      ftpc_stats *stats);
+int ftpc_delta_put(ftpc_conn *c, const char *local, const char *remote, uint32_t block_size, ftpc_stats *stats);
@@ -0,0 +1,148 @@
+#include "ftpc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: ftpc [-ip host] [-port port] [-streams n] <command> [args]\n"
+            "  get <remote> [local]   parallel ranged download (REST + RETR, splice)\n"
+            "  put <local> [remote]   parallel ranged upload (REST + STOR, sendfile)\n"
+            "  sync <local> [remote]  delta upload, sends only changed blocks (SITE SIGS + SITE DELTA)\n"
+            "  size <remote>...       pipelined SIZE queries\n"
+            "  raw <command>...       send commands pipelined and print the replies\n");
+}
+
+static const char *basename_of(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static void print_stats(const char *what, const char *name, const ftpc_stats *stats)
+{
+    double secs = stats->elapsed_us / 1e6;
+    printf("%s %s: %llu bytes in %.3f s, %.1f MB/s, %d stream(s) (%s)\n", what, name,
+           (unsigned long long)stats->bytes, secs, secs > 0 ? stats->bytes / secs / 1e6 : 0.0, stats->streams,
+           stats->method != NULL ? stats->method : "-");
+}
+
+/**
+ * 流水线执行一组命令，逐条打印响应的最后一行
+ */
+static int run_pipeline(const char *host, int port, const char *prefix, char **args, int count)
+{
+    ftpc_conn c;
+    if (ftpc_connect(&c, host, (uint16_t)port) != 0)
+    {
+        fprintf(stderr, "ftpc: cannot connect to %s:%d\n", host, port);
+        return 1;
+    }
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int rc = prefix != NULL ? ftpc_send(&c, "%s %s", prefix, args[i]) : ftpc_send(&c, "%s", args[i]);
+        if (rc != 0)
+        {
+            failed = 1;
+            count = i;
+            break;
+        }
+    }
+    // 全部命令已经写出，响应按发送顺序到达
+    for (int i = 0; i < count; i++)
+    {
+        int code = ftpc_reply(&c);
+        if (code < 0)
+        {
+            failed = 1;
+            break;
+        }
+        if (prefix != NULL)
+            printf("%s\t%s\n", args[i], code == 213 ? c.reply + 4 : c.reply);
+        else
+            printf("%s\n", c.reply);
+        if (code >= 400)
+            failed = 1;
+    }
+    ftpc_close(&c);
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    int port = 21;
+    int streams = FTPC_DEFAULT_STREAMS;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-ip") == 0 && i + 1 < argc)
+            host = argv[++i];
+        else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-streams") == 0 && i + 1 < argc)
+            streams = atoi(argv[++i]);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (i >= argc)
+    {
+        usage();
+        return 2;
+    }
+    const char *command = argv[i++];
+    int nargs = argc - i;
+    char **args = argv + i;
+
+    ftpc_stats stats;
+    if (strcmp(command, "get") == 0 && nargs >= 1)
+    {
+        const char *local = nargs >= 2 ? args[1] : basename_of(args[0]);
+        if (ftpc_parallel_get(host, (uint16_t)port, args[0], local, streams, &stats) != 0)
+        {
+            fprintf(stderr, "ftpc: get %s failed\n", args[0]);
+            return 1;
+        }
+        print_stats("get", args[0], &stats);
+        return 0;
+    }
+    if (strcmp(command, "put") == 0 && nargs >= 1)
+    {
+        const char *remote = nargs >= 2 ? args[1] : basename_of(args[0]);
+        if (ftpc_parallel_put(host, (uint16_t)port, args[0], remote, streams, &stats) != 0)
+        {
+            fprintf(stderr, "ftpc: put %s failed\n", args[0]);
+            return 1;
+        }
+        print_stats("put", remote, &stats);
+        return 0;
+    }
+    if (strcmp(command, "sync") == 0 && nargs >= 1)
+    {
+        const char *remote = nargs >= 2 ? args[1] : basename_of(args[0]);
+        ftpc_conn c;
+        if (ftpc_connect(&c, host, (uint16_t)port) != 0)
+        {
+            fprintf(stderr, "ftpc: cannot connect to %s:%d\n", host, port);
+            return 1;
+        }
+        int rc = ftpc_delta_put(&c, args[0], remote, 0, &stats);
+        if (rc != 0)
+            fprintf(stderr, "ftpc: sync %s failed: %s\n", args[0], c.reply);
+        else
+            print_stats("sync", remote, &stats);
+        ftpc_close(&c);
+        return rc != 0;
+    }
+    if (strcmp(command, "size") == 0 && nargs >= 1)
+        return run_pipeline(host, port, "SIZE", args, nargs);
+    if (strcmp(command, "raw") == 0 && nargs >= 1)
+        return run_pipeline(host, port, NULL, args, nargs);
+    usage();
+    return 2;
+}
@@ -0,0 +1,220 @@
+#include "admission.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+/*
+ * 每IP状态表位于 fork() 之前创建的共享内存中，开放寻址 + 有界线性探测。
+ * 只有父进程（accept 循环）插入条目和更新令牌桶；子进程退出时仅原子地递减并发计数，
+ * 因此令牌桶字段不需要原子操作。
+ */
+typedef struct
+{
+    _Atomic uint32_t ip;     // 网络字节序的IPv4地址，0 表示空桶
+    _Atomic int32_t active;  // 该IP当前的并发会话数
+    double tokens;           // 令牌桶中剩余的令牌
+    uint64_t refill_us;      // 上一次补充令牌的时间
+} admission_entry;
+
+typedef struct
+{
+    _Atomic uint64_t rejected; // 被拒绝的连接总数
+    admission_entry entries[ADMISSION_TABLE_SIZE];
+} admission_table;
+
+static admission_table *table = NULL;
+static admission_config limits;
+static double global_tokens = 0;
+static uint64_t global_refill_us = 0;
+
+/**
+ * 按时间补充令牌，令牌数不超过突发上限
+ */
+static void refill(double *tokens, uint64_t *last_us, double rate, double burst, uint64_t now)
+{
+    *tokens += (double)(now - *last_us) * rate / 1000000.0;
+    if (*tokens > burst)
+        *tokens = burst;
+    *last_us = now;
+}
+
+static uint32_t hash_ip(uint32_t ip)
+{
+    // Fibonacci 散列，使相邻地址分散到不同的桶
+    return (uint32_t)((ip * 2654435761u) >> 8) & (ADMISSION_TABLE_SIZE - 1);
+}
+
+/**
+ * 初始化准入控制，必须在 fork() 之前由父进程调用
+ * @param config 限制参数
+ * @return 0 成功，-1 失败
+ */
+int admission_init(const admission_config *config)
+{
+    void *mem = mmap(NULL, sizeof(admission_table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("mmap admission table failed");
+        return -1;
+    }
+    table = (admission_table *)mem;
+    limits = *config;
+    if (limits.burst_per_ip < 1)
+        limits.burst_per_ip = limits.rate_per_ip > 1 ? limits.rate_per_ip : 1;
+    if (limits.global_burst < 1)
+        limits.global_burst = limits.global_rate > 1 ? limits.global_rate : 1;
+    global_tokens = limits.global_burst;
+    global_refill_us = monotonic_us();
+    return 0;
+}
+
+/**
+ * 查找IP对应的条目，不存在时复用探测链上第一个空闲条目或空桶
+ * @return 条目编号，探测链已满时返回-1
+ */
+static int lookup(uint32_t ip, uint64_t now)
+{
+    uint32_t start = hash_ip(ip);
+    int reusable = -1;
+    for (int i = 0; i < ADMISSION_MAX_PROBE; i++)
+    {
+        int idx = (start + i) & (ADMISSION_TABLE_SIZE - 1);
+        admission_entry *e = &table->entries[idx];
+        uint32_t cur = atomic_load(&e->ip);
+        if (cur == ip)
+            return idx;
+        if (cur == 0)
+        {
+            // 空桶意味着探测链结束，该IP不在表中
+            if (reusable < 0)
+                reusable = idx;
+            break;
+        }
+        if (reusable < 0 && atomic_load(&e->active) == 0)
+        {
+            // 没有活动会话且令牌已补满的条目不再携带任何状态，可以被其它IP复用
+            refill(&e->tokens, &e->refill_us, limits.rate_per_ip, limits.burst_per_ip, now);
+            if (limits.rate_per_ip <= 0 || e->tokens >= limits.burst_per_ip)
+                reusable = idx;
+        }
+    }
+    if (reusable < 0)
+        return -1;
+
+    admission_entry *e = &table->entries[reusable];
+    atomic_store(&e->active, 0);
+    e->tokens = limits.burst_per_ip;
+    e->refill_us = now;
+    atomic_store(&e->ip, ip);
+    return reusable;
+}
+
+/**
+ * 判断是否接纳一个新连接，由父进程在 fork() 之前调用
+ * @param peer 客户端地址
+ * @param entry 输出该IP的条目编号，连接结束时传给 admission_release；表已满时为-1
+ * @return ADMIT_OK 接纳，其它值为拒绝原因
+ */
+int admission_admit(const struct sockaddr_in *peer, int *entry)
+{
+    *entry = -1;
+    if (table == NULL)
+        return ADMIT_OK;
+
+    uint64_t now = monotonic_us();
+    if (limits.global_rate > 0)
+    {
+        refill(&global_tokens, &global_refill_us, limits.global_rate, limits.global_burst, now);
+        if (global_tokens < 1)
+        {
+            atomic_fetch_add(&table->rejected, 1);
+            return ADMIT_GLOBAL_RATE;
+        }
+    }
+
+    int idx = lookup(peer->sin_addr.s_addr, now);
+    if (idx >= 0)
+    {
+        admission_entry *e = &table->entries[idx];
+        if (limits.max_per_ip > 0 && atomic_load(&e->active) >= limits.max_per_ip)
+        {
+            atomic_fetch_add(&table->rejected, 1);
+            return ADMIT_PER_IP_SESSIONS;
+        }
+        if (limits.rate_per_ip > 0)
+        {
+            refill(&e->tokens, &e->refill_us, limits.rate_per_ip, limits.burst_per_ip, now);
+            if (e->tokens < 1)
+            {
+                atomic_fetch_add(&table->rejected, 1);
+                return ADMIT_PER_IP_RATE;
+            }
+            e->tokens -= 1;
+        }
+        atomic_fetch_add(&e->active, 1);
+        *entry = idx;
+    }
+    // 探测链已满时不做每IP限制（全局上限仍然有效），避免误伤
+
+    if (limits.global_rate > 0)
+        global_tokens -= 1;
+    return ADMIT_OK;
+}
+
+/**
+ * 会话结束时释放该IP的并发计数，可在子进程中调用
+ */
+void admission_release(int entry)
+{
+    if (table == NULL || entry < 0 || entry >= ADMISSION_TABLE_SIZE)
+        return;
+    atomic_fetch_sub(&table->entries[entry].active, 1);
+}
+
+/**
+ * 某个IP当前的并发会话数（只读查询，可在子进程中调用）
+ * @param ip 网络字节序的IPv4地址
+ * @return 并发会话数，不在表中时为0
+ */
+int admission_active(uint32_t ip)
+{
+    if (table == NULL)
+        return 0;
+    uint32_t start = hash_ip(ip);
+    for (int i = 0; i < ADMISSION_MAX_PROBE; i++)
+    {
+        admission_entry *e = &table->entries[(start + i) & (ADMISSION_TABLE_SIZE - 1)];
+        uint32_t cur = atomic_load(&e->ip);
+        if (cur == ip)
+            return atomic_load(&e->active);
+        if (cur == 0)
+            break;
+    }
+    return 0;
+}
+
+/**
+ * 被拒绝的连接总数
+ */
+uint64_t admission_rejected(void)
+{
+    return table != NULL ? atomic_load(&table->rejected) : 0;
+}
+
+/**
+ * 拒绝原因的可读描述，用于 421 响应
+ */
+const char *admission_reason(int result)
+{
+    switch (result)
+    {
+    case ADMIT_PER_IP_SESSIONS:
+        return "Too many connections from your address, please try again later.";
+    case ADMIT_PER_IP_RATE:
+        return "Connecting too fast from your address, please slow down.";
+    case ADMIT_GLOBAL_RATE:
+        return "Server is busy, please try again later.";
+    default:
+        return "Service not available.";
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define ADMISSION_TABLE_SIZE 4096 // 每IP状态表的桶数量（2的幂）
+#define ADMISSION_MAX_PROBE 32    // 线性探测的最大步数，保证每次查询为常数时间
+
+typedef struct
+{
+    int max_per_ip;       // 单个IP的最大并发会话数，0 表示不限制
+    double rate_per_ip;   // 单个IP每秒允许的新连接数，0 表示不限制
+    double burst_per_ip;  // 单个IP的突发连接数上限
+    double global_rate;   // 全局每秒允许的新连接数，0 表示不限制
+    double global_burst;  // 全局突发连接数上限
+} admission_config;
+
+typedef enum
+{
+    ADMIT_OK = 0,
+    ADMIT_PER_IP_SESSIONS = -1, // 该IP并发会话数超限
+    ADMIT_PER_IP_RATE = -2,     // 该IP连接速率超限
+    ADMIT_GLOBAL_RATE = -3      // 全局连接速率超限
+} admission_result_t;
+
+int admission_init(const admission_config *config);
+int admission_admit(const struct sockaddr_in *peer, int *entry);
+void admission_release(int entry);
+int admission_active(uint32_t ip);
+uint64_t admission_rejected(void);
+const char *admission_reason(int result);
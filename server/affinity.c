@@ -0,0 +1,210 @@
+#include "affinity.h"
+#include "scoreboard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#define AFFINITY_MAX_NODES 1024 // 内存策略节点掩码的位数
+
+static int enabled = 0;
+static affinity_pin_t pin_mode = AFFINITY_PIN_CORE;
+static cpu_set_t allowed;           // -cpus 指定的 CPU 集合
+static int16_t cpu_node[CPU_SETSIZE]; // 每个 CPU 所在的 NUMA 节点，-1 表示未知
+static int next_cpu = 0;            // 没有计分板时轮流分配
+
+// 以下由父进程在 fork 之前设置，子进程继承后用于 STAT 输出
+static int incoming_cpu = -1; // 连接的 SO_INCOMING_CPU
+static int session_cpu = -1;  // 会话绑定的 CPU
+
+/**
+ * 解析 CPU 列表，格式与 taskset -c 相同，如 "0-7,16-23"
+ * @return 0 成功，-1 格式错误
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p != '\0')
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0)
+            return -1;
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+        }
+        if (last >= CPU_SETSIZE)
+            return -1;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET((int)cpu, set);
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+/**
+ * 从 sysfs 读取 CPU 所在的 NUMA 节点（/sys/devices/system/cpu/cpuN/nodeK）
+ * @return 节点号，非 NUMA 内核或读取失败时返回 -1
+ */
+static int read_cpu_node(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+    int node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char *end;
+        if (strncmp(entry->d_name, "node", 4) != 0)
+            continue;
+        long n = strtol(entry->d_name + 4, &end, 10);
+        if (end != entry->d_name + 4 && *end == '\0')
+        {
+            node = (int)n;
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/**
+ * 配置会话的 CPU 绑定，必须在 fork() 之前调用
+ * @param cpus CPU 列表，"all" 表示当前进程允许的全部 CPU，NULL 表示不绑定
+ * @param pin 绑定粒度
+ * @return 0 成功，-1 参数错误
+ */
+int affinity_init(const char *cpus, affinity_pin_t pin)
+{
+    if (cpus == NULL)
+        return 0;
+    cpu_set_t usable;
+    if (sched_getaffinity(0, sizeof(usable), &usable) != 0)
+    {
+        perror("sched_getaffinity failed");
+        return -1;
+    }
+    if (strcmp(cpus, "all") == 0)
+    {
+        allowed = usable;
+    }
+    else if (parse_cpu_list(cpus, &allowed) != 0)
+    {
+        fprintf(stderr, "invalid cpu list: %s\n", cpus);
+        return -1;
+    }
+    // 只保留本进程实际可以运行的 CPU（taskset/cgroup 的限制）
+    CPU_AND(&allowed, &allowed, &usable);
+    if (CPU_COUNT(&allowed) == 0)
+    {
+        fprintf(stderr, "none of the cpus in %s are available\n", cpus);
+        return -1;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        cpu_node[cpu] = CPU_ISSET(cpu, &allowed) ? (int16_t)read_cpu_node(cpu) : -1;
+    pin_mode = pin;
+    enabled = 1;
+    return 0;
+}
+
+int affinity_enabled(void)
+{
+    return enabled;
+}
+
+/**
+ * 父进程为刚接受的连接选择 CPU：优先使用处理该连接网卡队列的 CPU，
+ * 不在允许的集合内或明显比最空闲的 CPU 忙时，选择活动会话最少的 CPU
+ * @return CPU 编号，未开启绑定时返回 -1
+ */
+int affinity_pick(int connected_socket)
+{
+    if (!enabled)
+        return -1;
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (getsockopt(connected_socket, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) != 0)
+        cpu = -1;
+    incoming_cpu = cpu;
+
+    static uint32_t load[CPU_SETSIZE];
+    scoreboard_cpu_load(load, CPU_SETSIZE);
+    int best = -1;
+    for (int i = 0; i < CPU_SETSIZE; i++)
+    {
+        // 从上次分配的位置开始找，负载相同的 CPU 之间轮流分配
+        int c = (next_cpu + i) % CPU_SETSIZE;
+        if (CPU_ISSET(c, &allowed) && (best < 0 || load[c] < load[best]))
+            best = c;
+    }
+    if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed) || load[cpu] >= load[best] + AFFINITY_IMBALANCE)
+        cpu = best;
+    next_cpu = (cpu + 1) % CPU_SETSIZE;
+    session_cpu = cpu;
+    return cpu;
+}
+
+/**
+ * 子进程绑定到父进程选择的 CPU，并把内存策略设为优先使用该 CPU 所在的节点，
+ * 应在分配会话内存之前调用；失败时不影响服务，只是失去就近分配
+ */
+void affinity_apply(int cpu)
+{
+    if (!enabled || cpu < 0)
+        return;
+    session_cpu = cpu;
+    int node = cpu_node[cpu];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pin_mode == AFFINITY_PIN_NODE && node >= 0)
+    {
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &allowed) && cpu_node[c] == node)
+                CPU_SET(c, &set);
+    }
+    else
+    {
+        CPU_SET(cpu, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+
+    if (node >= 0 && node < AFFINITY_MAX_NODES)
+    {
+        unsigned long mask[AFFINITY_MAX_NODES / (8 * sizeof(unsigned long))];
+        memset(mask, 0, sizeof(mask));
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, (unsigned long)AFFINITY_MAX_NODES + 1);
+    }
+}
+
+/**
+ * 生成 STAT 中的一行：会话绑定的 CPU、NUMA 节点与连接的接收 CPU
+ * @return 0 已生成，-1 未开启绑定
+ */
+int affinity_describe(char *out, size_t outsz)
+{
+    if (!enabled || session_cpu < 0)
+        return -1;
+    snprintf(out, outsz, "Worker CPU: %d (%s), NUMA node %d, incoming CPU %d", session_cpu,
+             pin_mode == AFFINITY_PIN_NODE ? "node" : "core", cpu_node[session_cpu], incoming_cpu);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+#define AFFINITY_IMBALANCE 4 // 接收 CPU 上的会话数比最空闲的 CPU 多出这么多时，改为分配到最空闲的 CPU
+
+/*
+ * CPU 亲和性与 NUMA 就近分配（-cpus 开启，默认关闭）：
+ *  - 父进程 accept 之后读取连接的 SO_INCOMING_CPU（处理该连接网卡队列中断的 CPU），
+ *    在允许的 CPU 集合内时就把会话分配到这个 CPU，使协议栈与会话进程共享缓存；
+ *    不在集合内或该 CPU 已明显过载时，分配到活动会话最少的 CPU（按计分板统计）
+ *  - 子进程启动后立即绑定：core 模式绑定到这一个 CPU，node 模式绑定到同一 NUMA 节点内允许的所有 CPU
+ *  - 同时把内存策略设为优先从该节点分配。slab 池在子进程中按需映射，
+ *    会话结构与传输缓冲区因此都在本节点上，读文件时的页缓存也由本节点的 CPU 首次访问
+ */
+
+typedef enum
+{
+    AFFINITY_PIN_CORE = 0, // 绑定到单个 CPU
+    AFFINITY_PIN_NODE      // 绑定到 CPU 所在 NUMA 节点的 CPU 集合
+} affinity_pin_t;
+
+int affinity_init(const char *cpus, affinity_pin_t pin);
+int affinity_enabled(void);
+int affinity_pick(int connected_socket);
+void affinity_apply(int cpu);
+int affinity_describe(char *out, size_t outsz);
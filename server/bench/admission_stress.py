@@ -0,0 +1,148 @@
+#! /usr/bin/python3
+"""
+准入控制压力测试：从同一个IP反复连接、登录、退出（其中一部分不发 QUIT 直接断开），
+结束后检查该IP的并发计数回到 0，且仍能建立 -max-per-ip 个并发会话。
+
+用法: python3 bench/admission_stress.py [--threads N] [--rounds N] [--max-per-ip N]
+
+会话结束时父进程与子进程可能同时释放计分板槽位，若释放钩子拿到的不是
+正在退出的会话的附加值，该IP的计数会泄漏，最终所有新连接都被 421 拒绝。
+"""
+import argparse
+import ftplib
+import os
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+SERVER_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(('127.0.0.1', 0))
+        return s.getsockname()[1]
+
+
+def start_server(root, port, max_per_ip):
+    # 关闭每IP速率限制，只测试并发计数
+    args = [os.path.join(SERVER_DIR, 'ftpserver'), '-port', str(port), '-root', root,
+            '-max-per-ip', str(max_per_ip), '-rate-per-ip', '0']
+    proc = subprocess.Popen(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    for _ in range(50):
+        try:
+            socket.create_connection(('127.0.0.1', port), timeout=0.1).close()
+            return proc
+        except OSError:
+            time.sleep(0.05)
+    proc.kill()
+    raise RuntimeError('server did not start')
+
+
+def storm(port, rounds, counts, lock):
+    ok = rejected = 0
+    for i in range(rounds):
+        ftp = ftplib.FTP()
+        try:
+            ftp.connect('127.0.0.1', port, timeout=10)
+            ftp.login('anonymous', 'stress@')
+            if i % 3 == 0:
+                ftp.close()  # 不发 QUIT，直接断开
+            else:
+                ftp.quit()
+            ok += 1
+        except ftplib.error_temp:
+            rejected += 1  # 421：并发数已达上限
+            ftp.close()
+        except (OSError, EOFError):
+            rejected += 1
+            ftp.close()
+    with lock:
+        counts[0] += ok
+        counts[1] += rejected
+
+
+def active_from_stat(ftp):
+    reply = ftp.sendcmd('STAT')
+    m = re.search(r'from your address: (\d+) active', reply)
+    return int(m.group(1)) if m else None
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--threads', type=int, default=16)
+    parser.add_argument('--rounds', type=int, default=100)
+    parser.add_argument('--max-per-ip', type=int, default=8)
+    args = parser.parse_args()
+
+    root = tempfile.mkdtemp(prefix='ftp-admission-')
+    port = free_port()
+    proc = start_server(root, port, args.max_per_ip)
+    failures = []
+    try:
+        counts, lock = [0, 0], threading.Lock()
+        threads = [threading.Thread(target=storm, args=(port, args.rounds, counts, lock))
+                   for _ in range(args.threads)]
+        start = time.time()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        print(f'{counts[0]} sessions, {counts[1]} rejected in {time.time() - start:.1f}s')
+
+        # 子进程异步退出，等待计数回落（检查用的会话自身计 1）
+        probe = ftplib.FTP()
+        probe.connect('127.0.0.1', port, timeout=10)
+        probe.login('anonymous', 'stress@')
+        active = None
+        for _ in range(100):
+            active = active_from_stat(probe)
+            if active == 1:
+                break
+            time.sleep(0.05)
+        print(f'active sessions from this address after the storm: {active} (expected 1)')
+        if active != 1:
+            failures.append(f'per-IP active count is {active}, expected 1')
+        global_line = re.search(r'Active sessions: (\d+)', probe.sendcmd('STAT'))
+        if global_line is None or int(global_line.group(1)) != 1:
+            failures.append(f'global active count: {global_line.group(1) if global_line else "missing"}')
+
+        # 计数没有泄漏时，还能再建立 max_per_ip - 1 个并发会话，再多一个则被拒绝
+        extra = []
+        for _ in range(args.max_per_ip - 1):
+            ftp = ftplib.FTP()
+            try:
+                ftp.connect('127.0.0.1', port, timeout=10)
+                extra.append(ftp)
+            except ftplib.error_temp as e:
+                failures.append(f'rejected below the limit: {e}')
+                break
+        over = ftplib.FTP()
+        try:
+            over.connect('127.0.0.1', port, timeout=10)
+            failures.append('connection above -max-per-ip was accepted')
+        except ftplib.error_temp:
+            pass
+        finally:
+            over.close()
+        for ftp in extra:
+            ftp.close()
+        probe.quit()
+    finally:
+        proc.terminate()
+        proc.wait()
+        shutil.rmtree(root, ignore_errors=True)
+
+    for f in failures:
+        print('FAIL:', f)
+    print('PASS' if not failures else 'FAILED')
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,431 @@
+/*
+ * 控制通道基本操作的微基准：read_line、parse_cmd_param、send_response、is_path_safe，
+ * 以及 handle_connection 的命令分发链（通过 socketpair 驱动一个真实的会话）。
+ *
+ * 每个用例先预热，再重复若干轮，每轮执行固定次数的操作，报告：
+ *  - 每次操作的耗时（各轮的中位数与最小值，纳秒）
+ *  - 每次操作的周期数（x86 上使用 rdtsc，其他平台为 0）
+ *  - 每次操作的内存分配次数（替换 malloc/calloc/realloc 计数，转发给 glibc）
+ * 结果可写成 JSON，用 bench/compare.py 对比两次提交之间的差异。
+ *
+ * 用法: bench/bench_control [--reps N] [--ops N] [--warmup N] [--filter 子串] [--json 文件]
+ */
+#include "utils.h"
+#include "file.h"
+#include "pool.h"
+#include "scoreboard.h"
+#include "main.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static _Atomic uint64_t alloc_count = 0; // 启动以来的分配次数（所有线程）
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+static inline uint64_t cycles_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t nanos_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+typedef struct
+{
+    const char *name;                   // 被测函数
+    const char *input;                  // 输入类型：realistic / adversarial 等
+    void (*setup)(void *ctx);           // 可为NULL
+    void (*run)(void *ctx, size_t ops); // 执行 ops 次操作
+    void (*teardown)(void *ctx);        // 可为NULL
+    void *ctx;
+} bench_case;
+
+typedef struct
+{
+    double ns_median;
+    double ns_min;
+    double cycles_median;
+    double allocs;
+} bench_result;
+
+static volatile int sink; // 防止编译器把被测调用优化掉
+
+/* ---------- read_line ---------- */
+
+typedef struct
+{
+    const char *line; // 一行命令（含 CRLF）
+    int sv[2];
+    char *batch;      // 预先拼好的一批行
+    size_t batch_lines;
+    size_t batch_len;
+} read_line_ctx;
+
+static void read_line_setup(void *arg)
+{
+    read_line_ctx *c = arg;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, c->sv);
+    size_t len = strlen(c->line);
+    c->batch_lines = 32768 / len > 0 ? 32768 / len : 1; // 一批不超过套接字缓冲区
+    c->batch_len = c->batch_lines * len;
+    c->batch = __libc_malloc(c->batch_len);
+    for (size_t i = 0; i < c->batch_lines; i++)
+        memcpy(c->batch + i * len, c->line, len);
+}
+
+static void read_line_run(void *arg, size_t ops)
+{
+    read_line_ctx *c = arg;
+    char buffer[LINE_MAX_SIZE];
+    while (ops > 0)
+    {
+        size_t n = ops < c->batch_lines ? ops : c->batch_lines;
+        send_all(c->sv[0], c->batch, n * strlen(c->line));
+        for (size_t i = 0; i < n; i++)
+            sink = read_line(c->sv[1], buffer, sizeof(buffer));
+        ops -= n;
+    }
+}
+
+static void read_line_teardown(void *arg)
+{
+    read_line_ctx *c = arg;
+    close(c->sv[0]);
+    close(c->sv[1]);
+    free(c->batch);
+}
+
+/* ---------- parse_cmd_param ---------- */
+
+static void parse_run(void *arg, size_t ops)
+{
+    const char *line = arg;
+    char cmd[128], param[LINE_MAX_SIZE];
+    for (size_t i = 0; i < ops; i++)
+    {
+        parse_cmd_param(line, cmd, sizeof(cmd), param);
+        sink = cmd[0];
+    }
+}
+
+/* ---------- send_response ---------- */
+
+typedef struct
+{
+    const char *message;
+    int sv[2];
+} send_ctx;
+
+static void send_setup(void *arg)
+{
+    send_ctx *c = arg;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, c->sv);
+}
+
+static void send_run(void *arg, size_t ops)
+{
+    send_ctx *c = arg;
+    size_t reply_len = strlen(c->message) + 6; // "NNN " + message + CRLF
+    size_t per_batch = 64; // 每次 send 占一个 skb，批量过大会写满 AF_UNIX 的发送缓冲区
+    char drain[65536];
+    while (ops > 0)
+    {
+        size_t n = ops < per_batch ? ops : per_batch;
+        for (size_t i = 0; i < n; i++)
+            send_response(c->sv[0], 226, c->message);
+        // 读走本批回复，避免对端缓冲区写满后阻塞
+        size_t pending = n * reply_len;
+        while (pending > 0)
+        {
+            ssize_t r = read(c->sv[1], drain, pending < sizeof(drain) ? pending : sizeof(drain));
+            if (r <= 0)
+                break;
+            pending -= r;
+        }
+        ops -= n;
+    }
+}
+
+static void send_teardown(void *arg)
+{
+    send_ctx *c = arg;
+    close(c->sv[0]);
+    close(c->sv[1]);
+}
+
+/* ---------- is_path_safe ---------- */
+
+typedef struct
+{
+    const char *root;
+    char path[PATH_MAX]; // resolve_path 产生的路径最长 PATH_MAX - 1 字节，is_path_safe 按同样大小规范化
+} path_ctx;
+
+static void path_run(void *arg, size_t ops)
+{
+    path_ctx *c = arg;
+    for (size_t i = 0; i < ops; i++)
+        sink = is_path_safe(c->root, c->path);
+}
+
+/* ---------- handle_connection 命令分发 ---------- */
+
+typedef struct
+{
+    const char *command; // 每次操作发送的命令（单行回复）
+    int sv[2];
+    pthread_t thread;
+    char *batch;
+    size_t batch_cmds;
+} dispatch_ctx;
+
+static void *dispatch_server(void *arg)
+{
+    dispatch_ctx *c = arg;
+    handle_connection(c->sv[1], "/tmp");
+    return NULL;
+}
+
+/**
+ * 从会话读取回复，直到收到 lines 个以换行结尾的行
+ */
+static void read_replies(int fd, size_t lines)
+{
+    char buffer[65536];
+    while (lines > 0)
+    {
+        ssize_t r = read(fd, buffer, sizeof(buffer));
+        if (r <= 0)
+            return;
+        for (ssize_t i = 0; i < r; i++)
+            if (buffer[i] == '\n')
+                lines--;
+    }
+}
+
+static void dispatch_setup(void *arg)
+{
+    dispatch_ctx *c = arg;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, c->sv);
+    pthread_create(&c->thread, NULL, dispatch_server, c);
+    // 欢迎语 + 331 + 两行 230
+    const char *login = "USER anonymous\r\nPASS bench@example.com\r\n";
+    send_all(c->sv[0], login, strlen(login));
+    read_replies(c->sv[0], 4);
+
+    char line[LINE_MAX_SIZE];
+    size_t len = snprintf(line, sizeof(line), "%s\r\n", c->command);
+    c->batch_cmds = 64;
+    c->batch = __libc_malloc(c->batch_cmds * len);
+    for (size_t i = 0; i < c->batch_cmds; i++)
+        memcpy(c->batch + i * len, line, len);
+}
+
+static void dispatch_run(void *arg, size_t ops)
+{
+    dispatch_ctx *c = arg;
+    size_t len = strlen(c->command) + 2;
+    while (ops > 0)
+    {
+        size_t n = ops < c->batch_cmds ? ops : c->batch_cmds;
+        send_all(c->sv[0], c->batch, n * len);
+        read_replies(c->sv[0], n);
+        ops -= n;
+    }
+}
+
+static void dispatch_teardown(void *arg)
+{
+    dispatch_ctx *c = arg;
+    send_all(c->sv[0], "QUIT\r\n", 6);
+    read_replies(c->sv[0], 2);
+    pthread_join(c->thread, NULL);
+    close(c->sv[0]);
+    close(c->sv[1]);
+    free(c->batch);
+}
+
+/* ---------- 计时框架 ---------- */
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static bench_result measure(const bench_case *bc, size_t warmup, size_t reps, size_t ops)
+{
+    double ns[reps], cycles[reps];
+    if (bc->setup)
+        bc->setup(bc->ctx);
+    bc->run(bc->ctx, warmup);
+
+    uint64_t allocs_before = atomic_load(&alloc_count);
+    for (size_t r = 0; r < reps; r++)
+    {
+        uint64_t t0 = nanos_now(), c0 = cycles_now();
+        bc->run(bc->ctx, ops);
+        uint64_t c1 = cycles_now(), t1 = nanos_now();
+        ns[r] = (double)(t1 - t0) / ops;
+        cycles[r] = (double)(c1 - c0) / ops;
+    }
+    uint64_t allocs = atomic_load(&alloc_count) - allocs_before;
+    if (bc->teardown)
+        bc->teardown(bc->ctx);
+
+    qsort(ns, reps, sizeof(double), compare_double);
+    qsort(cycles, reps, sizeof(double), compare_double);
+    bench_result res = {
+        .ns_median = ns[reps / 2],
+        .ns_min = ns[0],
+        .cycles_median = cycles[reps / 2],
+        .allocs = (double)allocs / (double)(reps * ops)};
+    return res;
+}
+
+int main(int argc, char **argv)
+{
+    size_t reps = 11, ops = 2000, warmup = 200;
+    const char *json_path = NULL;
+    const char *filter = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+            reps = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc)
+            ops = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            warmup = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else
+        {
+            fprintf(stderr, "usage: %s [--reps N] [--ops N] [--warmup N] [--filter SUBSTR] [--json FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (reps == 0 || ops == 0)
+        return 2;
+
+    // 与服务器子进程相同的环境：slab 池与一个已绑定的计分板槽位
+    signal(SIGPIPE, SIG_IGN);
+    pool_init(0);
+    scoreboard_init(1);
+    struct sockaddr_in peer = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    scoreboard_attach(scoreboard_claim(&peer));
+
+    // 输入数据
+    static char long_arg_line[LINE_MAX_SIZE];
+    snprintf(long_arg_line, sizeof(long_arg_line), "STOR ");
+    memset(long_arg_line + 5, 'a', sizeof(long_arg_line) - 5 - 3);
+    static char long_line[LINE_MAX_SIZE + 2];
+    snprintf(long_line, sizeof(long_line), "%s\r\n", long_arg_line);
+    static char long_message[LINE_MAX_SIZE - 8];
+    memset(long_message, 'x', sizeof(long_message) - 1);
+
+    read_line_ctx rl_short = {.line = "RETR pub/releases/ftpserver-1.4.tar.gz\r\n"};
+    read_line_ctx rl_long = {.line = long_line};
+    send_ctx sr_short = {.message = "Transfer complete."};
+    send_ctx sr_long = {.message = long_message};
+    path_ctx ps_short = {.root = "/srv/ftp", .path = "/srv/ftp/pub/releases/ftpserver-1.4.tar.gz"};
+    path_ctx ps_dots = {.root = "/srv/ftp"};
+    {
+        // 大量 "." 与 ".." 组件，最终仍停留在根目录内
+        size_t len = snprintf(ps_dots.path, sizeof(ps_dots.path), "/srv/ftp");
+        while (len + 10 < sizeof(ps_dots.path))
+            len += snprintf(ps_dots.path + len, sizeof(ps_dots.path) - len, "/a/./b/..");
+    }
+    dispatch_ctx dp_syst = {.command = "SYST"};
+    dispatch_ctx dp_type = {.command = "TYPE I"};
+    dispatch_ctx dp_unknown = {.command = "XYZZY"}; // 走完整个分发链后返回 500
+
+    bench_case cases[] = {
+        {"read_line", "realistic", read_line_setup, read_line_run, read_line_teardown, &rl_short},
+        {"read_line", "max_length", read_line_setup, read_line_run, read_line_teardown, &rl_long},
+        {"parse_cmd_param", "realistic", NULL, parse_run, NULL, "RETR pub/releases/ftpserver-1.4.tar.gz"},
+        {"parse_cmd_param", "leading_spaces", NULL, parse_run, NULL, "        USER          anonymous"},
+        {"parse_cmd_param", "max_length", NULL, parse_run, NULL, long_arg_line},
+        {"send_response", "realistic", send_setup, send_run, send_teardown, &sr_short},
+        {"send_response", "max_length", send_setup, send_run, send_teardown, &sr_long},
+        {"is_path_safe", "realistic", NULL, path_run, NULL, &ps_short},
+        {"is_path_safe", "dot_segments", NULL, path_run, NULL, &ps_dots},
+        {"dispatch", "SYST", dispatch_setup, dispatch_run, dispatch_teardown, &dp_syst},
+        {"dispatch", "TYPE_I", dispatch_setup, dispatch_run, dispatch_teardown, &dp_type},
+        {"dispatch", "unknown", dispatch_setup, dispatch_run, dispatch_teardown, &dp_unknown},
+    };
+    size_t ncases = sizeof(cases) / sizeof(cases[0]);
+
+    FILE *json = NULL;
+    if (json_path != NULL && (json = fopen(json_path, "w")) == NULL)
+    {
+        perror("open json output failed");
+        return 1;
+    }
+    if (json)
+        fprintf(json, "{\"reps\":%zu,\"ops\":%zu,\"warmup\":%zu,\"results\":[", reps, ops, warmup);
+
+    printf("%-16s %-15s %12s %12s %12s %10s\n", "function", "input", "ns/op(med)", "ns/op(min)", "cycles/op",
+           "allocs/op");
+    int first = 1;
+    for (size_t i = 0; i < ncases; i++)
+    {
+        const bench_case *bc = &cases[i];
+        char full_name[64];
+        snprintf(full_name, sizeof(full_name), "%s/%s", bc->name, bc->input);
+        if (filter != NULL && strstr(full_name, filter) == NULL)
+            continue;
+
+        bench_result r = measure(bc, warmup, reps, ops);
+        printf("%-16s %-15s %12.1f %12.1f %12.0f %10.2f\n", bc->name, bc->input, r.ns_median, r.ns_min,
+               r.cycles_median, r.allocs);
+        fflush(stdout);
+        if (json)
+        {
+            fprintf(json, "%s\n{\"name\":\"%s\",\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f,"
+                          "\"cycles_per_op\":%.1f,\"allocs_per_op\":%.3f}",
+                    first ? "" : ",", full_name, r.ns_median, r.ns_min, r.cycles_median, r.allocs);
+            first = 0;
+        }
+    }
+    if (json)
+    {
+        fprintf(json, "\n]}\n");
+        fclose(json);
+    }
+    return 0;
+}
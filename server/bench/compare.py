@@ -0,0 +1,46 @@
+#! /usr/bin/python3
+"""
+对比两次 bench_control 的 JSON 结果，列出每个用例耗时与分配次数的变化。
+
+用法: python3 bench/compare.py base.json new.json [--threshold 百分比]
+
+耗时使用各轮的中位数；变慢超过阈值（默认 10%）或每次操作的分配次数增加时返回非零，
+便于在提交之间比较回归。
+"""
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return {r['name']: r for r in json.load(f)['results']}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('base')
+    parser.add_argument('new')
+    parser.add_argument('--threshold', type=float, default=10.0, help='regression threshold in percent')
+    args = parser.parse_args()
+
+    base, new = load(args.base), load(args.new)
+    regressions = 0
+    print(f"{'case':<32} {'base ns':>10} {'new ns':>10} {'delta':>8} {'allocs':>14}")
+    for name in sorted(set(base) | set(new)):
+        if name not in base or name not in new:
+            print(f"{name:<32} {'only in ' + ('base' if name in base else 'new'):>30}")
+            continue
+        b, n = base[name], new[name]
+        delta = (n['ns_per_op'] - b['ns_per_op']) / b['ns_per_op'] * 100 if b['ns_per_op'] > 0 else 0.0
+        allocs = f"{b['allocs_per_op']:.2f}->{n['allocs_per_op']:.2f}"
+        flag = ''
+        if delta > args.threshold or n['allocs_per_op'] > b['allocs_per_op'] + 0.005:
+            flag = '  REGRESSION'
+            regressions += 1
+        print(f"{name:<32} {b['ns_per_op']:>10.1f} {n['ns_per_op']:>10.1f} {delta:>+7.1f}% {allocs:>14}{flag}")
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,954 @@
+/*
+ * 会话回放工具：读取 ftpserver -capture-dir 捕获的会话文件（格式见 capture.h），
+ * 按原来的时间节奏（或按 -speed 加速）向目标服务器重放每条控制命令，用于在不同版本之间
+ * 对比延迟与吞吐量。
+ *
+ *  - 每个捕获文件一个会话（-scale N 时每个文件同时回放 N 份），各会话按捕获时的开始时间
+ *    错开；会话内每条命令在 原始偏移/speed 时发出，前一条命令尚未完成时顺延
+ *  - 文件内容是合成的：STOR/APPE 发送捕获中记录的字节数，RETR/LIST 等读取到 EOF；
+ *    -prepare 在回放前按捕获中 RETR 的路径与大小上传合成文件，使下载能够成功
+ *  - 登录时 PASS 的参数未被捕获，统一发送 "PASS replay@"；命令参数中捕获时的根目录前缀
+ *    替换为登录后 PWD 得到的目标根目录
+ *  - PORT/EPRT/EPSV 一律改为 PASV，数据连接由回放工具主动连接
+ *  - 无法回放的命令被跳过并计数：AUTH/PBSZ/PROT/CCC（回放只用明文）、MODE（保持流模式）、
+ *    SITE SIGS/DELTA（需要客户端计算的签名与增量数据）
+ * 输出每个命令的次数、响应码类别与捕获不一致的次数、延迟分位数，以及总吞吐量与落后于
+ * 时间表的程度；-json 以 bench/compare.py 的格式写出，便于对比两次回放。
+ *
+ * 用法: bench/replay -server 主机:端口 [-speed 倍数] [-scale N] [-prepare] [-json 文件]
+ *                    [-v] 捕获文件...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "capture.h"
+
+#define REPLAY_LINE_MAX 2048        // 响应行与改写后命令行的长度上限
+#define REPLAY_PATTERN_SIZE 65536   // 合成文件内容的循环块大小
+#define REPLAY_IO_TIMEOUT_S 60      // 每次读写的超时
+#define REPLAY_VERB_MAX 16
+#define REPLAY_MAX_VERBS 64         // 统计中不同命令的种类上限，超出的归入 "OTHER"
+
+typedef struct
+{
+    uint64_t offset_us;  // 距会话开始的时间
+    uint64_t service_us; // 捕获时的处理时间
+    uint64_t bytes;
+    int reply;
+    char *line;
+} record;
+
+typedef struct
+{
+    const char *file;
+    capture_header header;
+    char *root;
+    record *records;
+    size_t count;
+} trace;
+
+typedef struct
+{
+    char verb[REPLAY_VERB_MAX];
+    uint32_t latency_us;
+    uint32_t recorded_us;
+    int mismatch;  // 响应码类别与捕获时不同
+} sample;
+
+typedef struct
+{
+    const trace *trace;
+    int clone;
+    sample *samples;
+    size_t nsamples, cap;
+    uint64_t bytes;
+    uint64_t skipped;
+    uint64_t max_lag_us; // 命令实际发出时间落后于时间表的最大值
+    int failed;          // 连接中断等，会话提前结束
+} session;
+
+static struct
+{
+    struct sockaddr_in server;
+    double speed;
+    int scale;
+    int prepare;
+    int verbose;
+    const char *json;
+} cfg = {.speed = 1.0, .scale = 1};
+
+static trace *traces = NULL;
+static int ntraces = 0;
+static uint64_t replay_start_us = 0; // 回放开始的单调时钟时间
+static uint64_t first_start_us = 0;  // 所有捕获中最早的会话开始时间
+static char pattern[REPLAY_PATTERN_SIZE];
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t due_us)
+{
+    struct timespec ts = {(time_t)(due_us / 1000000), (long)(due_us % 1000000) * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/**
+ * 读取一个捕获文件，忽略末尾不完整的记录
+ * @return 0 成功，-1 失败
+ */
+static int load_trace(const char *file, trace *t)
+{
+    FILE *fp = fopen(file, "rb");
+    if (fp == NULL)
+    {
+        perror(file);
+        return -1;
+    }
+    size_t cap = 1 << 16, len = 0;
+    uint8_t *data = malloc(cap);
+    size_t n;
+    while (data != NULL && (n = fread(data + len, 1, cap - len, fp)) > 0)
+    {
+        len += n;
+        if (len == cap)
+        {
+            uint8_t *grown = realloc(data, cap * 2);
+            if (grown == NULL)
+            {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+            cap *= 2;
+        }
+    }
+    fclose(fp);
+    if (data == NULL)
+        return -1;
+
+    memset(t, 0, sizeof(*t));
+    t->file = file;
+    if (len < sizeof(capture_header))
+        goto bad;
+    memcpy(&t->header, data, sizeof(capture_header));
+    if (t->header.magic != CAPTURE_MAGIC || t->header.version != CAPTURE_VERSION ||
+        sizeof(capture_header) + t->header.root_len > len)
+        goto bad;
+    t->root = strndup((const char *)data + sizeof(capture_header), t->header.root_len);
+
+    const uint8_t *p = data + sizeof(capture_header) + t->header.root_len, *end = data + len;
+    size_t rcap = 0;
+    uint64_t offset = 0;
+    while (p < end)
+    {
+        uint64_t delta, service, reply, bytes, line_len;
+        if (capture_get_varint(&p, end, &delta) != 0 || capture_get_varint(&p, end, &service) != 0 ||
+            capture_get_varint(&p, end, &reply) != 0 || capture_get_varint(&p, end, &bytes) != 0 ||
+            capture_get_varint(&p, end, &line_len) != 0 || line_len > (uint64_t)(end - p))
+            break;
+        if (t->count == rcap)
+        {
+            rcap = rcap ? rcap * 2 : 64;
+            record *grown = realloc(t->records, rcap * sizeof(record));
+            if (grown == NULL)
+                break;
+            t->records = grown;
+        }
+        offset += delta;
+        record *r = &t->records[t->count++];
+        r->offset_us = offset;
+        r->service_us = service;
+        r->reply = (int)reply;
+        r->bytes = bytes;
+        r->line = strndup((const char *)p, (size_t)line_len);
+        p += line_len;
+    }
+    free(data);
+    return 0;
+
+bad:
+    fprintf(stderr, "replay: %s is not a capture file\n", file);
+    free(data);
+    return -1;
+}
+
+static int connect_to(const struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    struct timeval tv = {REPLAY_IO_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* 控制连接：按行读取，保留多读到的数据 */
+typedef struct
+{
+    int fd;
+    char buf[4096];
+    size_t start, end;
+} control;
+
+static int read_line(control *c, char *line, size_t size)
+{
+    size_t len = 0;
+    for (;;)
+    {
+        while (c->start < c->end)
+        {
+            char ch = c->buf[c->start++];
+            if (ch == '\n')
+            {
+                if (len > 0 && line[len - 1] == '\r')
+                    len--;
+                line[len] = '\0';
+                return 0;
+            }
+            if (len + 1 < size)
+                line[len++] = ch;
+        }
+        ssize_t n = recv(c->fd, c->buf, sizeof(c->buf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        c->start = 0;
+        c->end = (size_t)n;
+    }
+}
+
+/**
+ * 读取一个完整响应（多行响应读到 "xyz " 结束行）
+ * @param text 可为 NULL，否则保存最后一行
+ * @return 响应码，-1 连接中断
+ */
+static int read_reply(control *c, char *text, size_t size)
+{
+    char line[REPLAY_LINE_MAX];
+    if (read_line(c, line, sizeof(line)) != 0 || strlen(line) < 3 || !isdigit((unsigned char)line[0]))
+        return -1;
+    int code = atoi(line);
+    if (line[3] == '-')
+    {
+        char end[5];
+        snprintf(end, sizeof(end), "%.3s ", line);
+        do
+        {
+            if (read_line(c, line, sizeof(line)) != 0)
+                return -1;
+        } while (strncmp(line, end, 4) != 0);
+    }
+    if (text != NULL)
+        snprintf(text, size, "%s", line);
+    return code;
+}
+
+static int command(control *c, const char *line, char *text, size_t size)
+{
+    char buf[REPLAY_LINE_MAX + 2];
+    int len = snprintf(buf, sizeof(buf), "%s\r\n", line);
+    if (len >= (int)sizeof(buf) || write_all(c->fd, buf, (size_t)len) != 0)
+        return -1;
+    return read_reply(c, text, size);
+}
+
+/**
+ * 发送 PASV 并连接其给出的数据端口；主机取控制连接的地址（服务器可能位于 NAT 之后）
+ * @return 数据连接，-1 失败
+ */
+static int open_passive(control *c)
+{
+    char text[REPLAY_LINE_MAX];
+    if (command(c, "PASV", text, sizeof(text)) != 227)
+        return -1;
+    const char *p = strchr(text, '(');
+    unsigned h[6];
+    if (p == NULL || sscanf(p + 1, "%u,%u,%u,%u,%u,%u", &h[0], &h[1], &h[2], &h[3], &h[4], &h[5]) != 6)
+        return -1;
+    struct sockaddr_in addr = cfg.server;
+    addr.sin_port = htons((uint16_t)(h[4] << 8 | h[5]));
+    return connect_to(&addr);
+}
+
+static int send_synthetic(int fd, uint64_t bytes)
+{
+    while (bytes > 0)
+    {
+        size_t chunk = bytes < sizeof(pattern) ? (size_t)bytes : sizeof(pattern);
+        if (write_all(fd, pattern, chunk) != 0)
+            return -1;
+        bytes -= chunk;
+    }
+    return 0;
+}
+
+static uint64_t drain(int fd)
+{
+    static __thread char buf[REPLAY_PATTERN_SIZE];
+    uint64_t total = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0 || (n < 0 && errno == EINTR))
+        if (n > 0)
+            total += (uint64_t)n;
+    return total;
+}
+
+/**
+ * 用 PWD 取得当前目录
+ * @return 0 成功，-1 失败
+ */
+static int query_root(control *c, char *root, size_t size)
+{
+    char text[REPLAY_LINE_MAX];
+    if (command(c, "PWD", text, sizeof(text)) != 257)
+        return -1;
+    char *q1 = strchr(text, '"'), *q2 = q1 ? strchr(q1 + 1, '"') : NULL;
+    if (q2 == NULL)
+        return -1;
+    snprintf(root, size, "%.*s", (int)(q2 - q1 - 1), q1 + 1);
+    return 0;
+}
+
+/**
+ * 登录并取得目标服务器上的根目录（登录后的当前目录）
+ * @return 0 成功，-1 失败
+ */
+static int login(control *c, char *root, size_t size)
+{
+    if (read_reply(c, NULL, 0) != 220)
+        return -1;
+    int code = command(c, "USER anonymous", NULL, 0);
+    if (code == 331)
+        code = command(c, "PASS replay@", NULL, 0);
+    if (code != 230)
+        return -1;
+    return query_root(c, root, size);
+}
+
+/**
+ * 把命令参数中以捕获时根目录开头的路径改写到目标根目录
+ * @param out 改写后的命令行
+ */
+static void rewrite_root(const char *line, const char *from, const char *to, char *out, size_t size)
+{
+    size_t from_len = strlen(from), used = 0;
+    const char *p = line;
+    out[0] = '\0';
+    while (*p != '\0' && used + 1 < size)
+    {
+        // 只替换位于词首、且之后是路径分隔或结尾的前缀
+        int at_word = (p == line || p[-1] == ' ');
+        if (from_len > 1 && at_word && strncmp(p, from, from_len) == 0 &&
+            (p[from_len] == '/' || p[from_len] == ' ' || p[from_len] == '\0'))
+        {
+            used += (size_t)snprintf(out + used, size - used, "%s", strcmp(to, "/") == 0 && p[from_len] == '/' ? "" : to);
+            if (used >= size)
+                used = size - 1;
+            p += from_len;
+            continue;
+        }
+        out[used++] = *p++;
+        out[used] = '\0';
+    }
+}
+
+static void split_verb(const char *line, char *verb, const char **arg)
+{
+    size_t n = 0;
+    while (line[n] != '\0' && line[n] != ' ' && n + 1 < REPLAY_VERB_MAX)
+    {
+        verb[n] = (char)toupper((unsigned char)line[n]);
+        n++;
+    }
+    verb[n] = '\0';
+    const char *sp = strchr(line, ' ');
+    *arg = sp ? sp + 1 : "";
+}
+
+static int is_transfer(const char *verb, const char *arg)
+{
+    static const char *const verbs[] = {"RETR", "STOR", "APPE", "STOU", "LIST", "NLST", "MLSD", NULL};
+    for (int i = 0; verbs[i]; i++)
+        if (strcmp(verb, verbs[i]) == 0)
+            return 1;
+    return strcmp(verb, "SITE") == 0 && (strncasecmp(arg, "FIND", 4) == 0 || strncasecmp(arg, "RETRTREE", 8) == 0);
+}
+
+static int is_upload(const char *verb)
+{
+    return strcmp(verb, "STOR") == 0 || strcmp(verb, "APPE") == 0 || strcmp(verb, "STOU") == 0;
+}
+
+static int is_skipped(const char *verb, const char *arg)
+{
+    static const char *const verbs[] = {"AUTH", "PBSZ", "PROT", "CCC", "MODE", NULL};
+    for (int i = 0; verbs[i]; i++)
+        if (strcmp(verb, verbs[i]) == 0)
+            return 1;
+    return strcmp(verb, "SITE") == 0 && (strncasecmp(arg, "SIGS", 4) == 0 || strncasecmp(arg, "DELTA", 5) == 0);
+}
+
+static void add_sample(session *s, const char *verb, uint64_t latency_us, const record *r, int code)
+{
+    if (s->nsamples == s->cap)
+    {
+        size_t cap = s->cap ? s->cap * 2 : 256;
+        sample *grown = realloc(s->samples, cap * sizeof(sample));
+        if (grown == NULL)
+            return;
+        s->samples = grown;
+        s->cap = cap;
+    }
+    sample *x = &s->samples[s->nsamples++];
+    snprintf(x->verb, sizeof(x->verb), "%s", verb);
+    x->latency_us = latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t)latency_us;
+    x->recorded_us = r->service_us > UINT32_MAX ? UINT32_MAX : (uint32_t)r->service_us;
+    x->mismatch = code / 100 != r->reply / 100;
+}
+
+/**
+ * 执行一条命令；传输命令在 1xx 之后收发数据连接并读取最终响应
+ * @param data 之前 PASV 打开的数据连接，传输命令结束后关闭
+ * @return 最终响应码，-1 控制连接中断
+ */
+static int run_command(session *s, control *c, const char *line, const char *verb, const char *arg,
+                       const record *r, int *data)
+{
+    int transfer = is_transfer(verb, arg);
+    int code = command(c, line, NULL, 0);
+    if (transfer && code >= 100 && code < 200)
+    {
+        if (*data >= 0)
+        {
+            if (is_upload(verb))
+            {
+                if (send_synthetic(*data, r->bytes) == 0)
+                    s->bytes += r->bytes;
+            }
+            else
+                s->bytes += drain(*data);
+            close(*data);
+            *data = -1;
+        }
+        code = read_reply(c, NULL, 0);
+    }
+    if (transfer && *data >= 0)
+    {
+        close(*data);
+        *data = -1;
+    }
+    return code;
+}
+
+static void *session_main(void *arg)
+{
+    session *s = arg;
+    const trace *t = s->trace;
+    uint64_t start = replay_start_us + (uint64_t)((double)(t->header.start_us - first_start_us) / cfg.speed);
+    sleep_until(start);
+
+    control c = {.fd = connect_to(&cfg.server)};
+    if (c.fd < 0 || read_reply(&c, NULL, 0) != 220)
+    {
+        s->failed = 1;
+        if (c.fd >= 0)
+            close(c.fd);
+        return NULL;
+    }
+
+    char root[REPLAY_LINE_MAX] = "";
+    int data = -1;
+    for (size_t i = 0; i < t->count; i++)
+    {
+        const record *r = &t->records[i];
+        char verb[REPLAY_VERB_MAX];
+        const char *cmd_arg;
+        split_verb(r->line, verb, &cmd_arg);
+        if (is_skipped(verb, cmd_arg))
+        {
+            s->skipped++;
+            continue;
+        }
+
+        uint64_t due = start + (uint64_t)((double)r->offset_us / cfg.speed), now = now_us();
+        if (now < due)
+            sleep_until(due);
+        else if (now - due > s->max_lag_us)
+            s->max_lag_us = now - due;
+
+        char line[REPLAY_LINE_MAX];
+        if (strcmp(verb, "PASS") == 0)
+            snprintf(line, sizeof(line), "PASS replay@");
+        else if (root[0] != '\0')
+            rewrite_root(r->line, t->root, root, line, sizeof(line));
+        else
+            snprintf(line, sizeof(line), "%s", r->line);
+
+        uint64_t t0 = now_us();
+        int code;
+        if (strcmp(verb, "PASV") == 0 || strcmp(verb, "EPSV") == 0 || strcmp(verb, "PORT") == 0 ||
+            strcmp(verb, "EPRT") == 0)
+        {
+            if (data >= 0)
+                close(data);
+            data = open_passive(&c);
+            code = data >= 0 ? 227 : 425;
+            // 捕获中的 PORT/EPRT 响应为 200，只比较是否成功
+            if (r->reply / 100 == 2 && data >= 0)
+                code = r->reply;
+        }
+        else
+            code = run_command(s, &c, line, verb, cmd_arg, r, &data);
+        if (code < 0)
+        {
+            s->failed = 1;
+            break;
+        }
+        add_sample(s, verb, now_us() - t0, r, code);
+        if (cfg.verbose)
+            fprintf(stderr, "[%s#%d] %s -> %d (captured %d)\n", t->file, s->clone, line, code, r->reply);
+
+        if (strcmp(verb, "PASS") == 0 && code == 230 && root[0] == '\0' &&
+            query_root(&c, root, sizeof(root)) != 0)
+            root[0] = '\0';
+        if (strcmp(verb, "QUIT") == 0)
+            break;
+    }
+    if (data >= 0)
+        close(data);
+    close(c.fd);
+    return NULL;
+}
+
+/* -prepare：收集 RETR 的目标路径，上传同样大小的合成文件 */
+typedef struct
+{
+    char *path; // 捕获时的绝对路径
+    uint64_t size;
+} prepared;
+
+static void join_path(const char *cwd, const char *arg, char *out, size_t size)
+{
+    char tmp[REPLAY_LINE_MAX * 2];
+    if (arg[0] == '/')
+        snprintf(tmp, sizeof(tmp), "%s", arg);
+    else
+        snprintf(tmp, sizeof(tmp), "%s/%s", cwd, arg);
+    // 规范化：去掉空组件与 "."，处理 ".."
+    size_t used = 0;
+    out[0] = '\0';
+    for (char *save = NULL, *comp = strtok_r(tmp, "/", &save); comp; comp = strtok_r(NULL, "/", &save))
+    {
+        if (strcmp(comp, ".") == 0)
+            continue;
+        if (strcmp(comp, "..") == 0)
+        {
+            char *slash = strrchr(out, '/');
+            used = slash ? (size_t)(slash - out) : 0;
+            out[used] = '\0';
+            continue;
+        }
+        int n = snprintf(out + used, size - used, "/%s", comp);
+        if (n < 0 || (size_t)n >= size - used)
+            break;
+        used += (size_t)n;
+    }
+    if (used == 0)
+        snprintf(out, size, "/");
+}
+
+static int compare_prepared(const void *a, const void *b)
+{
+    return strcmp(((const prepared *)a)->path, ((const prepared *)b)->path);
+}
+
+static int prepare_files(void)
+{
+    prepared *files = NULL;
+    size_t n = 0, cap = 0;
+    for (int i = 0; i < ntraces; i++)
+    {
+        const trace *t = &traces[i];
+        char cwd[REPLAY_LINE_MAX];
+        snprintf(cwd, sizeof(cwd), "%s", t->root);
+        for (size_t j = 0; j < t->count; j++)
+        {
+            const record *r = &t->records[j];
+            char verb[REPLAY_VERB_MAX], path[REPLAY_LINE_MAX];
+            const char *arg;
+            split_verb(r->line, verb, &arg);
+            if ((strcmp(verb, "CWD") == 0 || strcmp(verb, "XCWD") == 0) && r->reply / 100 == 2)
+                join_path(cwd, arg, cwd, sizeof(cwd));
+            else if ((strcmp(verb, "CDUP") == 0 || strcmp(verb, "XCUP") == 0) && r->reply / 100 == 2)
+                join_path(cwd, "..", cwd, sizeof(cwd));
+            else if (strcmp(verb, "RETR") == 0 && r->reply / 100 == 2 && arg[0] != '\0')
+            {
+                if (n == cap)
+                {
+                    cap = cap ? cap * 2 : 64;
+                    prepared *grown = realloc(files, cap * sizeof(prepared));
+                    if (grown == NULL)
+                        break;
+                    files = grown;
+                }
+                join_path(cwd, arg, path, sizeof(path));
+                // 只准备根目录之内的文件
+                size_t root_len = strlen(t->root);
+                if (strncmp(path, t->root, root_len) != 0 || path[root_len] != '/')
+                    continue;
+                files[n].path = strdup(path + root_len);
+                files[n].size = r->bytes;
+                n++;
+            }
+        }
+    }
+    qsort(files, n, sizeof(prepared), compare_prepared);
+
+    control c = {.fd = connect_to(&cfg.server)};
+    char root[REPLAY_LINE_MAX];
+    if (c.fd < 0 || login(&c, root, sizeof(root)) != 0)
+    {
+        fprintf(stderr, "replay: cannot log in to prepare files\n");
+        if (c.fd >= 0)
+            close(c.fd);
+        return -1;
+    }
+    size_t uploaded = 0, failed = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        // 同一路径取最大的大小，只上传一次
+        if (i + 1 < n && strcmp(files[i].path, files[i + 1].path) == 0)
+        {
+            if (files[i].size > files[i + 1].size)
+                files[i + 1].size = files[i].size;
+            continue;
+        }
+        char target[REPLAY_LINE_MAX * 2], line[REPLAY_LINE_MAX * 2 + 8];
+        snprintf(target, sizeof(target), "%s%s", strcmp(root, "/") == 0 ? "" : root, files[i].path);
+        // 依次创建沿途的目录，已存在时的 550 忽略
+        for (char *slash = strchr(target + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+        {
+            *slash = '\0';
+            snprintf(line, sizeof(line), "MKD %s", target);
+            *slash = '/';
+            if (command(&c, line, NULL, 0) < 0)
+                break;
+        }
+        int data = open_passive(&c), code = -1;
+        snprintf(line, sizeof(line), "STOR %s", target);
+        if (data >= 0 && (code = command(&c, line, NULL, 0)) >= 100 && code < 200)
+        {
+            send_synthetic(data, files[i].size);
+            close(data);
+            data = -1;
+            code = read_reply(&c, NULL, 0);
+        }
+        if (data >= 0)
+            close(data);
+        if (code / 100 == 2)
+            uploaded++;
+        else
+            failed++;
+    }
+    command(&c, "QUIT", NULL, 0);
+    close(c.fd);
+    for (size_t i = 0; i < n; i++)
+        free(files[i].path);
+    free(files);
+    printf("prepared %zu files (%zu failed)\n", uploaded, failed);
+    return 0;
+}
+
+/* 汇总 */
+typedef struct
+{
+    char verb[REPLAY_VERB_MAX];
+    uint32_t *latency;
+    uint32_t *recorded;
+    size_t count, cap;
+    uint64_t mismatches;
+} verb_stats;
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t n, double p)
+{
+    if (n == 0)
+        return 0;
+    size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+    return sorted[i];
+}
+
+static verb_stats *find_verb(verb_stats *stats, int *nverbs, const char *verb)
+{
+    for (int i = 0; i < *nverbs; i++)
+        if (strcmp(stats[i].verb, verb) == 0)
+            return &stats[i];
+    if (*nverbs == REPLAY_MAX_VERBS)
+        return find_verb(stats, nverbs, "OTHER");
+    verb_stats *v = &stats[(*nverbs)++];
+    memset(v, 0, sizeof(*v));
+    snprintf(v->verb, sizeof(v->verb), "%s", *nverbs == REPLAY_MAX_VERBS ? "OTHER" : verb);
+    return v;
+}
+
+static void report(session *sessions, int nsessions, uint64_t wall_us)
+{
+    static verb_stats stats[REPLAY_MAX_VERBS];
+    int nverbs = 0;
+    uint64_t bytes = 0, skipped = 0, commands = 0, mismatches = 0, max_lag = 0;
+    int failed = 0;
+    for (int i = 0; i < nsessions; i++)
+    {
+        session *s = &sessions[i];
+        bytes += s->bytes;
+        skipped += s->skipped;
+        failed += s->failed;
+        if (s->max_lag_us > max_lag)
+            max_lag = s->max_lag_us;
+        for (size_t j = 0; j < s->nsamples; j++)
+        {
+            verb_stats *v = find_verb(stats, &nverbs, s->samples[j].verb);
+            if (v->count == v->cap)
+            {
+                v->cap = v->cap ? v->cap * 2 : 64;
+                v->latency = realloc(v->latency, v->cap * sizeof(uint32_t));
+                v->recorded = realloc(v->recorded, v->cap * sizeof(uint32_t));
+                if (v->latency == NULL || v->recorded == NULL)
+                {
+                    fprintf(stderr, "replay: out of memory\n");
+                    exit(1);
+                }
+            }
+            v->latency[v->count] = s->samples[j].latency_us;
+            v->recorded[v->count++] = s->samples[j].recorded_us;
+            v->mismatches += (uint64_t)s->samples[j].mismatch;
+            mismatches += (uint64_t)s->samples[j].mismatch;
+            commands++;
+        }
+    }
+
+    printf("%-8s %8s %8s %10s %10s %10s %10s %12s\n", "verb", "count", "mismatch", "p50 ms", "p90 ms", "p99 ms",
+           "max ms", "captured p50");
+    for (int i = 0; i < nverbs; i++)
+    {
+        verb_stats *v = &stats[i];
+        qsort(v->latency, v->count, sizeof(uint32_t), compare_u32);
+        qsort(v->recorded, v->count, sizeof(uint32_t), compare_u32);
+        printf("%-8s %8zu %8llu %10.3f %10.3f %10.3f %10.3f %12.3f\n", v->verb, v->count,
+               (unsigned long long)v->mismatches, percentile(v->latency, v->count, 0.5) / 1000.0,
+               percentile(v->latency, v->count, 0.9) / 1000.0, percentile(v->latency, v->count, 0.99) / 1000.0,
+               v->count ? v->latency[v->count - 1] / 1000.0 : 0.0, percentile(v->recorded, v->count, 0.5) / 1000.0);
+    }
+    double seconds = (double)wall_us / 1e6;
+    printf("sessions %d (%d failed), commands %llu (%llu skipped, %llu reply mismatches)\n", nsessions, failed,
+           (unsigned long long)commands, (unsigned long long)skipped, (unsigned long long)mismatches);
+    printf("wall %.3f s, data %.1f MB, %.1f MB/s, max schedule lag %.3f ms\n", seconds, (double)bytes / 1e6,
+           seconds > 0 ? (double)bytes / 1e6 / seconds : 0.0, (double)max_lag / 1000.0);
+
+    if (cfg.json != NULL)
+    {
+        FILE *fp = fopen(cfg.json, "w");
+        if (fp == NULL)
+        {
+            perror(cfg.json);
+            return;
+        }
+        // 与 bench/compare.py 的输入格式一致：每项一个 ns_per_op
+        fprintf(fp, "{\n  \"results\": [\n");
+        for (int i = 0; i < nverbs; i++)
+        {
+            verb_stats *v = &stats[i];
+            fprintf(fp, "    {\"name\": \"replay %s p50\", \"ns_per_op\": %llu, \"allocs_per_op\": 0},\n", v->verb,
+                    (unsigned long long)percentile(v->latency, v->count, 0.5) * 1000);
+            fprintf(fp, "    {\"name\": \"replay %s p99\", \"ns_per_op\": %llu, \"allocs_per_op\": 0},\n", v->verb,
+                    (unsigned long long)percentile(v->latency, v->count, 0.99) * 1000);
+        }
+        fprintf(fp, "    {\"name\": \"replay wall time\", \"ns_per_op\": %llu, \"allocs_per_op\": 0},\n",
+                (unsigned long long)wall_us * 1000);
+        fprintf(fp, "    {\"name\": \"replay ns per byte\", \"ns_per_op\": %.3f, \"allocs_per_op\": 0}\n",
+                bytes ? (double)wall_us * 1000 / (double)bytes : 0.0);
+        fprintf(fp, "  ]\n}\n");
+        fclose(fp);
+    }
+    for (int i = 0; i < nverbs; i++)
+    {
+        free(stats[i].latency);
+        free(stats[i].recorded);
+    }
+}
+
+static int resolve_server(const char *spec)
+{
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || (size_t)(colon - spec) >= sizeof(host))
+        return -1;
+    memcpy(host, spec, (size_t)(colon - spec));
+    host[colon - spec] = '\0';
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM}, *res;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0)
+        return -1;
+    memcpy(&cfg.server, res->ai_addr, sizeof(cfg.server));
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s -server HOST:PORT [-speed X] [-scale N] [-prepare] [-json FILE] [-v] CAPTURE...\n"
+            "  -speed    replay X times faster than captured (default 1)\n"
+            "  -scale    replay every capture N times concurrently (default 1)\n"
+            "  -prepare  upload synthetic files for every captured RETR before replaying\n"
+            "  -json     write per-command latency in bench/compare.py format\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *server_spec = NULL;
+    int first_file = argc;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-server") == 0 && i + 1 < argc)
+            server_spec = argv[++i];
+        else if (strcmp(argv[i], "-speed") == 0 && i + 1 < argc)
+            cfg.speed = atof(argv[++i]);
+        else if (strcmp(argv[i], "-scale") == 0 && i + 1 < argc)
+            cfg.scale = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-prepare") == 0)
+            cfg.prepare = 1;
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+            cfg.json = argv[++i];
+        else if (strcmp(argv[i], "-v") == 0)
+            cfg.verbose = 1;
+        else if (argv[i][0] != '-')
+        {
+            first_file = i;
+            break;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (server_spec == NULL || first_file == argc || cfg.speed <= 0 || cfg.scale <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (resolve_server(server_spec) != 0)
+    {
+        fprintf(stderr, "replay: cannot resolve %s\n", server_spec);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    traces = calloc((size_t)(argc - first_file), sizeof(trace));
+    if (traces == NULL)
+        return 1;
+    for (int i = first_file; i < argc; i++)
+        if (load_trace(argv[i], &traces[ntraces]) == 0)
+        {
+            if (ntraces == 0 || traces[ntraces].header.start_us < first_start_us)
+                first_start_us = traces[ntraces].header.start_us;
+            ntraces++;
+        }
+    if (ntraces == 0)
+        return 1;
+
+    // 合成内容：xorshift 生成，不可压缩
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < sizeof(pattern); i += sizeof(x))
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(pattern + i, &x, sizeof(x));
+    }
+
+    if (cfg.prepare && prepare_files() != 0)
+        return 1;
+
+    int nsessions = ntraces * cfg.scale;
+    session *sessions = calloc((size_t)nsessions, sizeof(session));
+    pthread_t *threads = calloc((size_t)nsessions, sizeof(pthread_t));
+    if (sessions == NULL || threads == NULL)
+        return 1;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    replay_start_us = now_us() + 100000; // 留出创建线程的时间
+    int started = 0;
+    for (int i = 0; i < nsessions; i++)
+    {
+        sessions[i].trace = &traces[i % ntraces];
+        sessions[i].clone = i / ntraces;
+        if (pthread_create(&threads[i], &attr, session_main, &sessions[i]) != 0)
+        {
+            fprintf(stderr, "replay: cannot start session %d\n", i);
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    uint64_t wall = now_us() - replay_start_us;
+
+    report(sessions, started, wall);
+    int failed = 0;
+    for (int i = 0; i < started; i++)
+    {
+        failed |= sessions[i].failed;
+        free(sessions[i].samples);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+#! /usr/bin/python3
+"""
+比较明文、用户态 TLS 与 kTLS 三种数据通道的 RETR/STOR 吞吐量。
+
+用法: python3 bench/tls_throughput.py [--size MB] [--rounds N] [--json out.json]
+
+脚本会生成临时自签名证书（需要 openssl 命令行工具）和临时根目录，
+分别以三种配置启动 ./ftpserver，并从传输日志中读取实际使用的传输路径，
+因此在内核不支持 TLS ULP（kTLS 不可用）时能看出回退到了用户态加密。
+"""
+import argparse
+import ftplib
+import io
+import json
+import os
+import shutil
+import socket
+import ssl
+import subprocess
+import tempfile
+import time
+
+SERVER_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(('127.0.0.1', 0))
+        return s.getsockname()[1]
+
+
+def make_cert(workdir):
+    cert = os.path.join(workdir, 'cert.pem')
+    key = os.path.join(workdir, 'key.pem')
+    subprocess.run(['openssl', 'req', '-x509', '-newkey', 'rsa:2048', '-nodes', '-keyout', key,
+                    '-out', cert, '-days', '1', '-subj', '/CN=localhost'],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+
+def start_server(root, port, xferlog, extra):
+    args = [os.path.join(SERVER_DIR, 'ftpserver'), '-port', str(port), '-root', root,
+            '-xferlog', xferlog, '-xferlog-format', 'jsonl'] + extra
+    proc = subprocess.Popen(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    for _ in range(50):
+        try:
+            socket.create_connection(('127.0.0.1', port), timeout=0.1).close()
+            return proc
+        except OSError:
+            time.sleep(0.05)
+    proc.kill()
+    raise RuntimeError('server did not start')
+
+
+def connect(port, tls):
+    if tls:
+        ctx = ssl.create_default_context()
+        ctx.check_hostname = False
+        ctx.verify_mode = ssl.CERT_NONE
+        ftp = ftplib.FTP_TLS(context=ctx)
+        ftp.connect('127.0.0.1', port)
+        ftp.auth()
+        ftp.login()
+        ftp.prot_p()
+    else:
+        ftp = ftplib.FTP()
+        ftp.connect('127.0.0.1', port)
+        ftp.login()
+    return ftp
+
+
+class Sink:
+    def __init__(self):
+        self.n = 0
+
+    def __call__(self, data):
+        self.n += len(data)
+
+
+def run_case(name, port, tls, payload, rounds):
+    ftp = connect(port, tls)
+    ftp.storbinary('STOR bench.bin', io.BytesIO(payload), blocksize=1 << 20)
+    results = {}
+    for op in ('RETR', 'STOR'):
+        best = None
+        for _ in range(rounds):
+            start = time.perf_counter()
+            if op == 'RETR':
+                sink = Sink()
+                ftp.retrbinary('RETR bench.bin', sink, blocksize=1 << 20)
+                assert sink.n == len(payload)
+            else:
+                ftp.storbinary('STOR bench.bin', io.BytesIO(payload), blocksize=1 << 20)
+            elapsed = time.perf_counter() - start
+            best = elapsed if best is None else min(best, elapsed)
+        results[op] = len(payload) / best / 1e6
+    ftp.quit()
+    return results
+
+
+def transfer_paths(xferlog):
+    paths = set()
+    with open(xferlog) as f:
+        for line in f:
+            rec = json.loads(line)
+            paths.add(f"{rec['direction']}:{rec['xfer_path']}")
+    return sorted(paths)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--size', type=int, default=256, help='test file size in MB')
+    parser.add_argument('--rounds', type=int, default=3, help='repetitions per case (best is reported)')
+    parser.add_argument('--json', help='write results to this file')
+    opts = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix='ftpbench-')
+    root = os.path.join(workdir, 'root')
+    os.mkdir(root)
+    payload = os.urandom(opts.size << 20)
+    cert, key = make_cert(workdir)
+    cases = [
+        ('cleartext', False, []),
+        ('userspace-tls', True, ['-tls-cert', cert, '-tls-key', key, '-tls-ktls', 'off']),
+        ('ktls', True, ['-tls-cert', cert, '-tls-key', key, '-tls-ktls', 'on']),
+    ]
+
+    report = []
+    try:
+        for name, tls, extra in cases:
+            port = free_port()
+            xferlog = os.path.join(workdir, f'{name}.jsonl')
+            server = start_server(root, port, xferlog, extra)
+            try:
+                res = run_case(name, port, tls, payload, opts.rounds)
+            finally:
+                time.sleep(0.5)  # 等待传输日志刷写
+                server.terminate()
+                server.wait()
+            res['case'] = name
+            res['paths'] = transfer_paths(xferlog)
+            report.append(res)
+            print(f"{name:14s} RETR {res['RETR']:9.1f} MB/s   STOR {res['STOR']:9.1f} MB/s   {' '.join(res['paths'])}")
+    finally:
+        shutil.rmtree(workdir)
+
+    if opts.json:
+        with open(opts.json, 'w') as f:
+            json.dump({'size_mb': opts.size, 'rounds': opts.rounds, 'results': report}, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,717 @@
+/*
+ * 用户态广域网模拟代理：位于客户端与 ftpserver 之间，对控制连接与数据连接施加
+ * 往返时延、带宽上限、抖动与丢包，用于在一台机器上测量流水线、持久数据连接、
+ * 缓冲区调优等在真实网络中的效果（不依赖 tc/netem）。
+ *
+ * 模型（每个方向独立：上行为客户端到服务器，下行为服务器到客户端）：
+ *  - 带宽：同一方向的所有连接共享一条链路，数据段按到达顺序排队串行发送
+ *  - 时延：每段在发送完成后再经过 RTT/2 ± 抖动到达对端；同一连接内保持字节顺序
+ *  - 窗口：每个连接每个方向上尚未送达的字节数不超过 -window，达到后暂停读取，
+ *    单流吞吐量因此受 窗口/RTT 限制，与真实 TCP 一致
+ *  - 丢包：代理两侧都是 TCP，字节不能真正丢弃；按每 1460 字节一个报文的丢包率，
+ *    被“丢弃”的段额外延迟一个重传超时（max(200ms, 2×RTT)），后续数据随之排队
+ * 控制连接按行转发，其中的 227 (PASV) 响应与 PORT 命令被改写为代理自己的监听地址，
+ * 数据连接因此同样经过代理。控制连接启用 TLS 后无法改写，只能使用明文 FTP。
+ *
+ * 用法: bench/wanproxy -listen 端口 -server 主机:端口 [-rtt 毫秒] [-bw Mbit/s] [-jitter 毫秒]
+ *                      [-loss 百分比] [-window KB] [-seed n] [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#define PROXY_READ_SIZE 16384    // 每次从源端读取的最大字节数（一个数据段）
+#define PROXY_LINE_MAX 2048      // 控制连接单行上限，超长的行原样转发
+#define PROXY_MAX_EVENTS 64
+#define PROXY_PACKET_SIZE 1460   // 丢包按报文计算时的报文大小
+#define PROXY_MIN_RTO_US 200000  // 模拟重传超时的下限
+
+enum
+{
+    DIR_UP = 0,  // 客户端 -> 服务器
+    DIR_DOWN = 1 // 服务器 -> 客户端
+};
+
+typedef enum
+{
+    EP_MAIN_LISTENER, // 客户端连接代理的监听socket
+    EP_DATA_LISTENER, // 为 PASV/PORT 临时创建的监听socket
+    EP_CLIENT,        // 连接的客户端一侧
+    EP_SERVER         // 连接的服务器一侧
+} endpoint_type;
+
+struct conn;
+struct data_listener;
+
+typedef struct
+{
+    endpoint_type type;
+    struct conn *conn;
+    struct data_listener *listener;
+} endpoint;
+
+typedef struct chunk
+{
+    struct chunk *next;
+    uint64_t due_us; // 送达对端的时间
+    size_t len;
+    size_t off;      // 已写出的字节数
+    int eof;         // 源端已关闭，送达时对目的端 shutdown(SHUT_WR)
+    char data[];
+} chunk;
+
+typedef struct
+{
+    chunk *head, *tail;
+    size_t queued;        // 尚未送达的字节数（在途）
+    uint64_t last_due;    // 上一段的送达时间，保证同一方向内按序送达
+    int read_eof;         // 源端已读到 EOF
+    int write_blocked;    // 目的端写缓冲区已满，等待 EPOLLOUT
+    int done;             // 已向目的端发送 FIN
+    char line[PROXY_LINE_MAX]; // 控制连接中尚未凑成一行的数据
+    size_t line_len;
+} direction;
+
+typedef struct conn
+{
+    struct conn *next;
+    int control;              // 控制连接（按行改写 PASV/PORT）
+    int dead;                 // 出错，等本轮事件处理完后关闭
+    int fd[2];                // [DIR_UP] 为客户端一侧，[DIR_DOWN] 为服务器一侧
+    endpoint ep[2];
+    direction dir[2];         // 按数据流动方向
+    struct data_listener *listeners; // 本控制连接创建的数据监听socket
+    uint64_t bytes[2];
+} conn;
+
+typedef struct data_listener
+{
+    struct data_listener *next;
+    int fd;
+    endpoint ep;
+    conn *owner;              // 所属控制连接
+    int accept_side;          // 接受的连接属于哪一侧（DIR_UP 客户端，DIR_DOWN 服务器）
+    struct sockaddr_in target;// 接受后再去连接的真实地址
+} data_listener;
+
+static struct
+{
+    uint64_t rtt_us;
+    uint64_t jitter_us;
+    double bw_bytes_per_us;   // 0 表示不限速
+    double loss;              // 每个报文的丢包概率
+    size_t window;            // 每个连接每个方向的在途字节上限
+    int verbose;
+    struct sockaddr_in server;
+} cfg = {0, 0, 0, 0, 4 << 20, 0};
+
+static int epfd = -1;
+static conn *conns = NULL;
+static uint64_t link_free_us[2]; // 每个方向共享链路空闲的时间
+static uint64_t lost_segments = 0;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static double random_unit(void)
+{
+    return (double)random() / ((double)RAND_MAX + 1.0);
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // 延迟由代理模拟，不再叠加 Nagle
+}
+
+static void update_events(conn *c)
+{
+    for (int side = 0; side < 2; side++)
+    {
+        if (c->fd[side] < 0)
+            continue;
+        // 本侧作为源：窗口未满且未到 EOF 时读取；作为目的：写阻塞时等待可写
+        direction *in = &c->dir[side];
+        direction *out = &c->dir[!side];
+        struct epoll_event ev = {0};
+        if (!in->read_eof && in->queued < cfg.window)
+            ev.events |= EPOLLIN;
+        if (out->write_blocked)
+            ev.events |= EPOLLOUT;
+        ev.data.ptr = &c->ep[side];
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd[side], &ev);
+    }
+}
+
+/**
+ * 计算一段数据的送达时间：先在共享链路上排队发送，再经过单向时延与抖动，
+ * 按丢包率可能额外延迟一个重传超时
+ */
+static uint64_t schedule(direction *d, int dir, size_t len)
+{
+    uint64_t now = now_us();
+    uint64_t start = link_free_us[dir] > now ? link_free_us[dir] : now;
+    uint64_t tx = cfg.bw_bytes_per_us > 0 ? (uint64_t)(len / cfg.bw_bytes_per_us) : 0;
+    link_free_us[dir] = start + tx;
+
+    int64_t delay = (int64_t)(cfg.rtt_us / 2);
+    if (cfg.jitter_us > 0)
+        delay += (int64_t)((random_unit() * 2 - 1) * (double)cfg.jitter_us);
+    if (delay < 0)
+        delay = 0;
+    uint64_t due = start + tx + (uint64_t)delay;
+    if (cfg.loss > 0)
+    {
+        size_t packets = (len + PROXY_PACKET_SIZE - 1) / PROXY_PACKET_SIZE;
+        double keep = 1.0;
+        for (size_t i = 0; i < packets; i++)
+            keep *= 1.0 - cfg.loss;
+        if (random_unit() >= keep)
+        {
+            uint64_t rto = 2 * cfg.rtt_us > PROXY_MIN_RTO_US ? 2 * cfg.rtt_us : PROXY_MIN_RTO_US;
+            due += rto;
+            lost_segments++;
+        }
+    }
+    if (due < d->last_due)
+        due = d->last_due; // TCP 按序交付：后发的段不会先到
+    d->last_due = due;
+    return due;
+}
+
+static int enqueue(direction *d, int dir, const char *data, size_t len, int eof)
+{
+    chunk *ch = malloc(sizeof(chunk) + len);
+    if (ch == NULL)
+        return -1;
+    ch->next = NULL;
+    ch->len = len;
+    ch->off = 0;
+    ch->eof = eof;
+    memcpy(ch->data, data, len);
+    ch->due_us = schedule(d, dir, len);
+    if (d->tail != NULL)
+        d->tail->next = ch;
+    else
+        d->head = ch;
+    d->tail = ch;
+    d->queued += len;
+    return 0;
+}
+
+static void close_listener(data_listener *l)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, l->fd, NULL);
+    close(l->fd);
+    free(l);
+}
+
+static void close_conn(conn *c)
+{
+    for (conn **pp = &conns; *pp != NULL; pp = &(*pp)->next)
+    {
+        if (*pp == c)
+        {
+            *pp = c->next;
+            break;
+        }
+    }
+    for (int side = 0; side < 2; side++)
+    {
+        if (c->fd[side] >= 0)
+        {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd[side], NULL);
+            close(c->fd[side]);
+        }
+        chunk *ch = c->dir[side].head;
+        while (ch != NULL)
+        {
+            chunk *next = ch->next;
+            free(ch);
+            ch = next;
+        }
+    }
+    while (c->listeners != NULL)
+    {
+        data_listener *next = c->listeners->next;
+        close_listener(c->listeners);
+        c->listeners = next;
+    }
+    if (cfg.verbose)
+        fprintf(stderr, "wanproxy: %s connection closed, up %llu bytes, down %llu bytes\n",
+                c->control ? "control" : "data", (unsigned long long)c->bytes[DIR_UP],
+                (unsigned long long)c->bytes[DIR_DOWN]);
+    free(c);
+}
+
+static conn *new_conn(int client_fd, int server_fd, int control)
+{
+    conn *c = calloc(1, sizeof(conn));
+    if (c == NULL)
+        return NULL;
+    c->control = control;
+    c->fd[DIR_UP] = client_fd;
+    c->fd[DIR_DOWN] = server_fd;
+    c->ep[DIR_UP] = (endpoint){EP_CLIENT, c, NULL};
+    c->ep[DIR_DOWN] = (endpoint){EP_SERVER, c, NULL};
+    for (int side = 0; side < 2; side++)
+    {
+        set_nonblocking(c->fd[side]);
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &c->ep[side]};
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd[side], &ev);
+    }
+    c->next = conns;
+    conns = c;
+    return c;
+}
+
+static int connect_to(const struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * 为一次 PASV/PORT 创建临时监听socket，绑定在给定本地地址的随机端口上
+ * @param local 监听地址（取自相应控制连接的本地地址）
+ * @return 监听socket，端口写回 local；失败返回 NULL
+ */
+static data_listener *open_listener(conn *owner, struct sockaddr_in *local, int accept_side,
+                                    const struct sockaddr_in *target)
+{
+    data_listener *l = calloc(1, sizeof(data_listener));
+    if (l == NULL)
+        return NULL;
+    l->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    local->sin_port = 0;
+    socklen_t len = sizeof(*local);
+    if (l->fd < 0 || bind(l->fd, (struct sockaddr *)local, sizeof(*local)) != 0 || listen(l->fd, 1) != 0 ||
+        getsockname(l->fd, (struct sockaddr *)local, &len) != 0)
+    {
+        if (l->fd >= 0)
+            close(l->fd);
+        free(l);
+        return NULL;
+    }
+    l->ep = (endpoint){EP_DATA_LISTENER, NULL, l};
+    l->owner = owner;
+    l->accept_side = accept_side;
+    l->target = *target;
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &l->ep};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, l->fd, &ev);
+    l->next = owner->listeners;
+    owner->listeners = l;
+    return l;
+}
+
+static void format_hostport(char *out, size_t outsz, const struct sockaddr_in *addr)
+{
+    uint32_t ip = ntohl(addr->sin_addr.s_addr);
+    unsigned port = ntohs(addr->sin_port);
+    snprintf(out, outsz, "%u,%u,%u,%u,%u,%u", (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF,
+             (port >> 8) & 0xFF, port & 0xFF);
+}
+
+static int parse_hostport(const char *text, struct sockaddr_in *addr)
+{
+    unsigned h[4], p[2];
+    if (sscanf(text, "%u,%u,%u,%u,%u,%u", &h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) != 6)
+        return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl((h[0] << 24) | (h[1] << 16) | (h[2] << 8) | h[3]);
+    addr->sin_port = htons((uint16_t)((p[0] << 8) | p[1]));
+    return 0;
+}
+
+/**
+ * 改写控制连接中的一行：下行的 227 响应与上行的 PORT 命令换成代理的监听地址
+ * @param line 一行（含行尾），改写结果写回
+ * @return 改写后的长度
+ */
+static size_t rewrite_line(conn *c, int dir, char *line, size_t len)
+{
+    struct sockaddr_in target, local;
+    socklen_t local_len = sizeof(local);
+    char hostport[32];
+    if (dir == DIR_DOWN && len > 4 && strncmp(line, "227", 3) == 0)
+    {
+        const char *open_paren = strchr(line, '(');
+        if (open_paren == NULL || parse_hostport(open_paren + 1, &target) != 0)
+            return len;
+        if (target.sin_addr.s_addr == htonl(INADDR_ANY))
+            target.sin_addr = cfg.server.sin_addr;
+        // 客户端连接代理时使用的地址，客户端的数据连接也发往这里
+        if (getsockname(c->fd[DIR_UP], (struct sockaddr *)&local, &local_len) != 0 ||
+            open_listener(c, &local, DIR_UP, &target) == NULL)
+            return len;
+        format_hostport(hostport, sizeof(hostport), &local);
+        return (size_t)snprintf(line, PROXY_LINE_MAX, "227 Entering Passive Mode (%s).\r\n", hostport);
+    }
+    if (dir == DIR_UP && len > 5 && strncasecmp(line, "PORT ", 5) == 0)
+    {
+        if (parse_hostport(line + 5, &target) != 0)
+            return len;
+        // 服务器连接代理时使用的地址
+        if (getsockname(c->fd[DIR_DOWN], (struct sockaddr *)&local, &local_len) != 0 ||
+            open_listener(c, &local, DIR_DOWN, &target) == NULL)
+            return len;
+        format_hostport(hostport, sizeof(hostport), &local);
+        return (size_t)snprintf(line, PROXY_LINE_MAX, "PORT %s\r\n", hostport);
+    }
+    return len;
+}
+
+/**
+ * 控制连接的数据按行处理，完整的行改写后入队，不完整的部分留到下次
+ */
+static int enqueue_control(conn *c, int dir, const char *data, size_t len)
+{
+    direction *d = &c->dir[dir];
+    for (size_t i = 0; i < len; i++)
+    {
+        d->line[d->line_len++] = data[i];
+        if (data[i] != '\n' && d->line_len < PROXY_LINE_MAX - 1)
+            continue;
+        size_t out = data[i] == '\n' ? rewrite_line(c, dir, d->line, d->line_len) : d->line_len;
+        if (enqueue(d, dir, d->line, out, 0) != 0)
+            return -1;
+        d->line_len = 0;
+    }
+    return 0;
+}
+
+/**
+ * 从一侧读取数据，加上模拟的时延后排入对应方向的队列
+ * @return 0 成功，-1 连接应当关闭
+ */
+static int handle_readable(conn *c, int side)
+{
+    direction *d = &c->dir[side];
+    char buf[PROXY_READ_SIZE];
+    while (!d->read_eof && d->queued < cfg.window)
+    {
+        ssize_t n = recv(c->fd[side], buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+        {
+            // 连接关闭（或出错）：先把未凑成行的控制数据送出，再在最后送达 FIN
+            d->read_eof = 1;
+            if (d->line_len > 0 && enqueue(d, side, d->line, d->line_len, 0) != 0)
+                return -1;
+            d->line_len = 0;
+            if (enqueue(d, side, "", 0, 1) != 0)
+                return -1;
+            break;
+        }
+        c->bytes[side] += (uint64_t)n;
+        int rc = c->control ? enqueue_control(c, side, buf, (size_t)n) : enqueue(d, side, buf, (size_t)n, 0);
+        if (rc != 0)
+            return -1;
+    }
+    update_events(c);
+    return 0;
+}
+
+/**
+ * 把已到送达时间的数据段写到目的端
+ * @return 0 成功，-1 连接应当关闭
+ */
+static int deliver(conn *c, int dir, uint64_t now)
+{
+    direction *d = &c->dir[dir];
+    int dst = c->fd[!dir];
+    int progress = 0;
+    while (d->head != NULL && d->head->due_us <= now && !d->done)
+    {
+        chunk *ch = d->head;
+        if (ch->eof)
+        {
+            shutdown(dst, SHUT_WR);
+            d->done = 1;
+        }
+        while (ch->off < ch->len)
+        {
+            ssize_t n = send(dst, ch->data + ch->off, ch->len - ch->off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                d->write_blocked = 1;
+                update_events(c);
+                return 0;
+            }
+            if (n < 0)
+                return -1;
+            ch->off += (size_t)n;
+        }
+        d->head = ch->next;
+        if (d->head == NULL)
+            d->tail = NULL;
+        d->queued -= ch->len;
+        free(ch);
+        progress = 1;
+    }
+    if (progress)
+        update_events(c); // 窗口腾出了空间，恢复读取
+    return 0;
+}
+
+static void accept_client(int listen_fd)
+{
+    int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client_fd < 0)
+        return;
+    int server_fd = connect_to(&cfg.server);
+    if (server_fd < 0)
+    {
+        fprintf(stderr, "wanproxy: cannot connect to server: %s\n", strerror(errno));
+        close(client_fd);
+        return;
+    }
+    if (new_conn(client_fd, server_fd, 1) == NULL)
+    {
+        close(client_fd);
+        close(server_fd);
+    }
+    else if (cfg.verbose)
+    {
+        fprintf(stderr, "wanproxy: control connection opened\n");
+    }
+}
+
+/**
+ * 数据监听socket上有连接到达：连接真实的另一端，之后与控制连接一样施加时延
+ */
+static void accept_data(data_listener *l)
+{
+    int fd = accept4(l->fd, NULL, NULL, SOCK_CLOEXEC);
+    conn *owner = l->owner;
+    for (data_listener **pp = &owner->listeners; *pp != NULL; pp = &(*pp)->next)
+    {
+        if (*pp == l)
+        {
+            *pp = l->next;
+            break;
+        }
+    }
+    struct sockaddr_in target = l->target;
+    int side = l->accept_side;
+    close_listener(l); // 每个监听socket只接受一条数据连接
+    if (fd < 0)
+        return;
+    int other = connect_to(&target);
+    if (other < 0)
+    {
+        close(fd);
+        return;
+    }
+    conn *c = side == DIR_UP ? new_conn(fd, other, 0) : new_conn(other, fd, 0);
+    if (c == NULL)
+    {
+        close(fd);
+        close(other);
+    }
+    else if (cfg.verbose)
+    {
+        fprintf(stderr, "wanproxy: data connection opened (%s)\n", side == DIR_UP ? "PASV" : "PORT");
+    }
+}
+
+static uint64_t next_due(void)
+{
+    uint64_t due = UINT64_MAX;
+    for (conn *c = conns; c != NULL; c = c->next)
+        for (int dir = 0; dir < 2; dir++)
+            if (c->dir[dir].head != NULL && !c->dir[dir].write_blocked && c->dir[dir].head->due_us < due)
+                due = c->dir[dir].head->due_us;
+    return due;
+}
+
+static void deliver_all(void)
+{
+    uint64_t now = now_us();
+    conn *c = conns;
+    while (c != NULL)
+    {
+        conn *next = c->next;
+        int failed = c->dead;
+        for (int dir = 0; dir < 2 && !failed; dir++)
+            if (!c->dir[dir].write_blocked)
+                failed = deliver(c, dir, now) != 0;
+        // 两个方向都已送达 FIN，连接结束
+        if (failed || (c->dir[DIR_UP].done && c->dir[DIR_DOWN].done))
+            close_conn(c);
+        c = next;
+    }
+}
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int resolve_server(const char *spec)
+{
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || (size_t)(colon - spec) >= sizeof(host))
+        return -1;
+    memcpy(host, spec, (size_t)(colon - spec));
+    host[colon - spec] = '\0';
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM}, *res;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0)
+        return -1;
+    memcpy(&cfg.server, res->ai_addr, sizeof(cfg.server));
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s -listen PORT -server HOST:PORT [-rtt MS] [-bw MBIT] [-jitter MS] [-loss PCT]\n"
+            "          [-window KB] [-seed N] [-v]\n"
+            "  -rtt     round-trip time added to every connection (default 0)\n"
+            "  -bw      bandwidth per direction shared by all connections, Mbit/s (default unlimited)\n"
+            "  -jitter  uniform +/- jitter on the one-way delay (default 0)\n"
+            "  -loss    per-packet loss rate; a lost segment is delayed by one RTO (default 0)\n"
+            "  -window  in-flight bytes per connection and direction (default 4096)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    int listen_port = 0;
+    const char *server_spec = NULL;
+    unsigned seed = (unsigned)time(NULL);
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-listen") == 0 && i + 1 < argc)
+            listen_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-server") == 0 && i + 1 < argc)
+            server_spec = argv[++i];
+        else if (strcmp(argv[i], "-rtt") == 0 && i + 1 < argc)
+            cfg.rtt_us = (uint64_t)(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "-bw") == 0 && i + 1 < argc)
+            cfg.bw_bytes_per_us = atof(argv[++i]) / 8; // Mbit/s = 比特/微秒
+        else if (strcmp(argv[i], "-jitter") == 0 && i + 1 < argc)
+            cfg.jitter_us = (uint64_t)(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "-loss") == 0 && i + 1 < argc)
+            cfg.loss = atof(argv[++i]) / 100;
+        else if (strcmp(argv[i], "-window") == 0 && i + 1 < argc)
+            cfg.window = (size_t)atol(argv[++i]) << 10;
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = (unsigned)atol(argv[++i]);
+        else if (strcmp(argv[i], "-v") == 0)
+            cfg.verbose = 1;
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (listen_port <= 0 || server_spec == NULL || cfg.window == 0 || cfg.loss < 0 || cfg.loss >= 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (resolve_server(server_spec) != 0)
+    {
+        fprintf(stderr, "wanproxy: cannot resolve %s\n", server_spec);
+        return 1;
+    }
+    srandom(seed);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons((uint16_t)listen_port)};
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0)
+    {
+        fprintf(stderr, "wanproxy: cannot listen on port %d: %s\n", listen_port, strerror(errno));
+        return 1;
+    }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    endpoint main_ep = {EP_MAIN_LISTENER, NULL, NULL};
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &main_ep};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    fprintf(stderr, "wanproxy: :%d -> %s, rtt %.1f ms, jitter %.1f ms, bw %.1f Mbit/s (0 = unlimited), loss %.2f%%, "
+            "window %zu KB\n",
+            listen_port, server_spec, cfg.rtt_us / 1000.0, cfg.jitter_us / 1000.0, cfg.bw_bytes_per_us * 8,
+            cfg.loss * 100, cfg.window >> 10);
+
+    struct epoll_event events[PROXY_MAX_EVENTS];
+    while (!stop)
+    {
+        // 等到下一个数据段的送达时间（向上取整到毫秒）或有新的事件
+        uint64_t due = next_due(), now = now_us();
+        int timeout = due == UINT64_MAX ? -1 : due <= now ? 0 : (int)((due - now + 999) / 1000);
+        int n = epoll_wait(epfd, events, PROXY_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR)
+            break;
+        for (int i = 0; i < n; i++)
+        {
+            endpoint *ep = events[i].data.ptr;
+            if (ep->type == EP_MAIN_LISTENER)
+            {
+                accept_client(listen_fd);
+                continue;
+            }
+            if (ep->type == EP_DATA_LISTENER)
+            {
+                accept_data(ep->listener);
+                continue;
+            }
+            conn *c = ep->conn;
+            int side = ep->type == EP_CLIENT ? DIR_UP : DIR_DOWN;
+            if (c->dead)
+                continue;
+            if ((events[i].events & EPOLLOUT) && c->dir[!side].write_blocked)
+                c->dir[!side].write_blocked = 0; // 下面的 deliver_all 继续写
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && handle_readable(c, side) != 0)
+                c->dead = 1; // 同一批事件中可能还有该连接的另一侧，统一在 deliver_all 中关闭
+        }
+        deliver_all();
+    }
+    while (conns != NULL)
+        close_conn(conns);
+    fprintf(stderr, "wanproxy: exiting, %llu segments delayed by simulated loss\n", (unsigned long long)lost_segments);
+    close(listen_fd);
+    close(epfd);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "capture.h"
+#include "utils.h"
+#include "scoreboard.h"
+#include <fcntl.h>
+#include <strings.h>
+
+static char capture_dir[PATH_MAX] = ""; // 在 fork 之前设置
+
+// 以下是会话（子进程）自己的状态
+static int capture_fd = -1;
+static uint8_t *buffer = NULL; // CAPTURE_BUF_SIZE，组装文件头与记录
+static size_t used = 0;
+static uint64_t last_start_us = 0; // 上一条命令（或会话）开始的单调时钟时间
+static int pending = 0;            // capture_begin 之后尚未 capture_end
+static uint64_t pending_start_us = 0;
+static uint64_t pending_bytes = 0; // 命令开始时会话已传输的字节数
+static char pending_line[CAPTURE_LINE_MAX];
+
+/**
+ * 配置捕获输出目录，必须在 fork() 之前、chdir 之前调用
+ * @param dir 目录，NULL 表示不捕获
+ */
+void capture_configure(const char *dir)
+{
+    if (dir == NULL)
+    {
+        capture_dir[0] = '\0';
+        return;
+    }
+    // 子进程的工作目录是根目录，这里记录绝对路径
+    if (realpath(dir, capture_dir) == NULL)
+    {
+        perror("capture directory");
+        capture_dir[0] = '\0';
+    }
+}
+
+static void capture_flush(void)
+{
+    if (used > 0 && write(capture_fd, buffer, used) != (ssize_t)used)
+    {
+        // 磁盘写满等情况下放弃本会话剩余的捕获
+        close(capture_fd);
+        capture_fd = -1;
+    }
+    used = 0;
+}
+
+/**
+ * 会话开始时调用（子进程中），创建本会话的捕获文件并写入文件头
+ * @param root 根目录
+ * @param client_ip 客户端地址（网络字节序）
+ * @param client_port 客户端端口（主机字节序）
+ */
+void capture_session_start(const char *root, uint32_t client_ip, uint16_t client_port)
+{
+    if (capture_dir[0] == '\0')
+        return;
+    capture_header header = {CAPTURE_MAGIC, CAPTURE_VERSION, 0, realtime_us(), client_ip, client_port, 0};
+    size_t root_len = strlen(root);
+    if (root_len > UINT16_MAX || sizeof(header) + root_len > CAPTURE_BUF_SIZE)
+        return;
+    header.root_len = (uint16_t)root_len;
+
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/session-%llu-%d.fcap", capture_dir, (unsigned long long)header.start_us,
+             (int)getpid());
+    buffer = malloc(CAPTURE_BUF_SIZE);
+    if (buffer != NULL)
+        capture_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (capture_fd < 0)
+    {
+        free(buffer);
+        buffer = NULL;
+        return;
+    }
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), root, root_len);
+    used = sizeof(header) + root_len;
+    capture_flush();
+    last_start_us = monotonic_us();
+}
+
+/**
+ * 读到并解析一条命令、开始处理之前调用
+ * @param cmd 解析出的命令
+ * @param line 命令行（不含 CRLF）
+ */
+void capture_begin(const char *cmd, const char *line)
+{
+    if (capture_fd < 0)
+        return;
+    pending = 1;
+    pending_start_us = monotonic_us();
+    pending_bytes = scoreboard_session_bytes();
+    // 不记录密码；按解析出的命令判断，与计分板相同，前导空白或制表符分隔的 PASS 也不会漏掉
+    if (strcasecmp(cmd, "PASS") == 0)
+        line = "PASS";
+    snprintf(pending_line, sizeof(pending_line), "%s", line);
+}
+
+/**
+ * 命令处理完成后调用，以最后一个响应码与期间传输的字节数写出一条记录，立即写入文件
+ */
+void capture_end(void)
+{
+    if (capture_fd < 0 || !pending)
+        return;
+    pending = 0;
+    uint64_t now = monotonic_us();
+    size_t len = strlen(pending_line);
+    uint8_t *p = buffer + used;
+    p += capture_put_varint(p, pending_start_us - last_start_us);
+    p += capture_put_varint(p, now - pending_start_us);
+    p += capture_put_varint(p, (uint64_t)last_response_code());
+    p += capture_put_varint(p, scoreboard_session_bytes() - pending_bytes);
+    p += capture_put_varint(p, len);
+    memcpy(p, pending_line, len);
+    used = (size_t)(p + len - buffer);
+    capture_flush();
+    last_start_us = pending_start_us;
+}
+
+/**
+ * 会话结束时调用：写出尚未结束的命令（如 QUIT），关闭文件
+ */
+void capture_session_end(void)
+{
+    if (capture_fd < 0)
+        return;
+    capture_end();
+    if (capture_fd >= 0)
+        close(capture_fd);
+    capture_fd = -1;
+    free(buffer);
+    buffer = NULL;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 会话捕获（-capture-dir 开启）：每个会话一个文件，按顺序记录客户端发来的每条控制命令，
+ * 供 bench/replay 按原来的节奏回放。服务器与回放工具共用本文件中的格式定义。
+ *
+ * 文件以 capture_header 开头，随后是会话开始时的根目录（root_len 字节，不含 '\0'，
+ * 回放时把命令参数中的这个前缀换成目标服务器的根目录）。之后每条命令一条记录，
+ * 各字段均为无符号 LEB128 变长整数，最后是命令行本身：
+ *   offset_us   命令开始时间距上一条命令开始（第一条距会话开始）的微秒数
+ *   service_us  从读到命令到处理完成的微秒数，包括其中的数据传输
+ *   reply       最后一个响应码（传输命令为 226/426 等最终响应）
+ *   bytes       命令期间数据连接上传输的字节数
+ *   len         命令行长度，随后是 len 字节的命令行（不含 CRLF；PASS 的参数不记录）
+ * 文件头在会话开始时写入，每条记录在命令处理完成时立即写入文件，不在进程中缓冲；
+ * 会话进程被杀死时只丢失正在处理的那条命令，写入中途被杀死时最后一条记录可能不完整，回放工具忽略不完整的记录。
+ */
+
+#define CAPTURE_MAGIC 0x31504346u  // "FCP1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BUF_SIZE (8 * 1024) // 组装文件头（含根目录）或一条记录的缓冲区
+#define CAPTURE_LINE_MAX 1024        // 记录的命令行长度上限，超出部分截断
+#define CAPTURE_RECORD_MAX (5 * 10 + CAPTURE_LINE_MAX) // 一条记录的最大长度
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;       // CAPTURE_MAGIC
+    uint16_t version;     // CAPTURE_VERSION
+    uint16_t root_len;    // 之后的根目录长度
+    uint64_t start_us;    // 会话开始时间（Unix 时间，微秒）
+    uint32_t client_ip;   // 客户端地址（网络字节序）
+    uint16_t client_port; // 客户端端口（主机字节序）
+    uint16_t reserved;
+} capture_header;
+
+/**
+ * 写入一个 LEB128 变长整数
+ * @return 写入的字节数（最多10）
+ */
+static inline size_t capture_put_varint(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/**
+ * 读取一个 LEB128 变长整数，*p 移到其后
+ * @return 0 成功，-1 数据不完整或超过64位
+ */
+static inline int capture_get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7)
+    {
+        uint8_t b = *(*p)++;
+        value |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            *v = value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void capture_configure(const char *dir);
+void capture_session_start(const char *root, uint32_t client_ip, uint16_t client_port);
+void capture_begin(const char *cmd, const char *line);
+void capture_end(void);
+void capture_session_end(void);
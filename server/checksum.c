@@ -0,0 +1,390 @@
+#include "checksum.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#ifdef WITH_TLS
+#include <openssl/evp.h>
+#endif
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u // Castagnoli 多项式（反射形式）
+
+static const char *const names[] = {"NONE", "CRC32C", "XXH64", "SHA-256"};
+static const char *const xattr_names[] = {NULL, "user.ftp.crc32c", "user.ftp.xxh64", "user.ftp.sha256"};
+
+/**
+ * 解析算法名（不区分大小写），"SHA256" 与 "SHA-256" 等价
+ * @return 0 成功，-1 未知或本次编译不支持的算法
+ */
+int checksum_parse(const char *name, checksum_alg *alg)
+{
+    if (strcasecmp(name, "NONE") == 0)
+        *alg = CHECKSUM_NONE;
+    else if (strcasecmp(name, "CRC32C") == 0)
+        *alg = CHECKSUM_CRC32C;
+    else if (strcasecmp(name, "XXH64") == 0)
+        *alg = CHECKSUM_XXH64;
+    else if (strcasecmp(name, "SHA-256") == 0 || strcasecmp(name, "SHA256") == 0)
+    {
+#ifdef WITH_TLS
+        *alg = CHECKSUM_SHA256;
+#else
+        return -1;
+#endif
+    }
+    else
+        return -1;
+    return 0;
+}
+
+const char *checksum_name(checksum_alg alg)
+{
+    return names[alg];
+}
+
+/* ---------- CRC32C ---------- */
+
+static uint32_t crc_table[256];
+static int crc_hw = -1; // -1 未检测，0 查表，1 SSE4.2
+
+static void crc32c_setup(void)
+{
+    if (crc_hw >= 0)
+        return;
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_table[i] = c;
+    }
+#if defined(__x86_64__)
+    crc_hw = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#else
+    crc_hw = 0;
+#endif
+}
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len-- > 0)
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * SSE4.2 crc32 指令每次处理8字节，只在运行时检测到该指令时调用
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc;
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    uint32_t c32 = (uint32_t)c;
+    while (len-- > 0)
+        c32 = _mm_crc32_u8(c32, *p++);
+    return c32;
+}
+#endif
+
+/* ---------- XXH64 ---------- */
+
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v)); // xxHash 规定按小端读取，本服务器只运行在小端的 Linux 上
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_stripes(checksum_state *s, const uint8_t *p, size_t stripes)
+{
+    uint64_t v1 = s->xxh_v[0], v2 = s->xxh_v[1], v3 = s->xxh_v[2], v4 = s->xxh_v[3];
+    while (stripes-- > 0)
+    {
+        v1 = xxh_round(v1, read64(p));
+        v2 = xxh_round(v2, read64(p + 8));
+        v3 = xxh_round(v3, read64(p + 16));
+        v4 = xxh_round(v4, read64(p + 24));
+        p += 32;
+    }
+    s->xxh_v[0] = v1;
+    s->xxh_v[1] = v2;
+    s->xxh_v[2] = v3;
+    s->xxh_v[3] = v4;
+}
+
+static void xxh64_update(checksum_state *s, const uint8_t *p, size_t len)
+{
+    s->xxh_total += len;
+    if (s->xxh_len > 0)
+    {
+        size_t fill = 32 - s->xxh_len < len ? 32 - s->xxh_len : len;
+        memcpy(s->xxh_buf + s->xxh_len, p, fill);
+        s->xxh_len += fill;
+        p += fill;
+        len -= fill;
+        if (s->xxh_len < 32)
+            return;
+        xxh64_stripes(s, s->xxh_buf, 1);
+        s->xxh_len = 0;
+    }
+    xxh64_stripes(s, p, len / 32);
+    p += len / 32 * 32;
+    len %= 32;
+    memcpy(s->xxh_buf, p, len);
+    s->xxh_len = len;
+}
+
+static uint64_t xxh64_digest(const checksum_state *s)
+{
+    uint64_t h;
+    if (s->xxh_total >= 32)
+    {
+        const uint64_t *v = s->xxh_v;
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = xxh_merge(h, v[i]);
+    }
+    else
+    {
+        h = XXH_P5; // 种子为0
+    }
+    h += s->xxh_total;
+
+    const uint8_t *p = s->xxh_buf;
+    size_t len = s->xxh_len;
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (len >= 4)
+    {
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--)
+    {
+        h ^= *p * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+    }
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* ---------- 公共接口 ---------- */
+
+/**
+ * 当前进程实际使用的实现，用于诊断输出
+ */
+const char *checksum_impl(checksum_alg alg)
+{
+    switch (alg)
+    {
+    case CHECKSUM_CRC32C:
+        crc32c_setup();
+        return crc_hw ? "sse4.2" : "table";
+    case CHECKSUM_XXH64:
+        return "scalar";
+    case CHECKSUM_SHA256:
+        return "libcrypto";
+    default:
+        return "none";
+    }
+}
+
+/**
+ * 开始计算一个摘要
+ * @return 0 成功，-1 算法不可用或内存不足
+ */
+int checksum_init(checksum_state *s, checksum_alg alg)
+{
+    memset(s, 0, sizeof(*s));
+    s->alg = alg;
+    switch (alg)
+    {
+    case CHECKSUM_CRC32C:
+        crc32c_setup();
+        s->crc = 0xFFFFFFFFu;
+        return 0;
+    case CHECKSUM_XXH64:
+        s->xxh_v[0] = XXH_P1 + XXH_P2;
+        s->xxh_v[1] = XXH_P2;
+        s->xxh_v[2] = 0;
+        s->xxh_v[3] = -XXH_P1;
+        return 0;
+    case CHECKSUM_SHA256:
+#ifdef WITH_TLS
+        s->sha = EVP_MD_CTX_new();
+        if (s->sha != NULL && EVP_DigestInit_ex(s->sha, EVP_sha256(), NULL) == 1)
+            return 0;
+        EVP_MD_CTX_free(s->sha);
+        s->sha = NULL;
+#endif
+        s->alg = CHECKSUM_NONE;
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+void checksum_update(checksum_state *s, const void *data, size_t len)
+{
+    switch (s->alg)
+    {
+    case CHECKSUM_CRC32C:
+#if defined(__x86_64__)
+        if (crc_hw)
+        {
+            s->crc = crc32c_sse42(s->crc, data, len);
+            break;
+        }
+#endif
+        s->crc = crc32c_table(s->crc, data, len);
+        break;
+    case CHECKSUM_XXH64:
+        xxh64_update(s, data, len);
+        break;
+    case CHECKSUM_SHA256:
+#ifdef WITH_TLS
+        EVP_DigestUpdate(s->sha, data, len);
+#endif
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * 一次性计算一段数据的 XXH64（种子为0），供增量上传的块签名使用
+ */
+uint64_t checksum_xxh64(const void *data, size_t len)
+{
+    checksum_state s;
+    checksum_init(&s, CHECKSUM_XXH64);
+    xxh64_update(&s, data, len);
+    return xxh64_digest(&s);
+}
+
+/**
+ * 结束计算并输出十六进制摘要，同时释放状态占用的资源
+ */
+void checksum_final(checksum_state *s, char *hex, size_t hexsz)
+{
+    hex[0] = '\0';
+    switch (s->alg)
+    {
+    case CHECKSUM_CRC32C:
+        snprintf(hex, hexsz, "%08x", s->crc ^ 0xFFFFFFFFu);
+        break;
+    case CHECKSUM_XXH64:
+        snprintf(hex, hexsz, "%016llx", (unsigned long long)xxh64_digest(s));
+        break;
+    case CHECKSUM_SHA256:
+    {
+#ifdef WITH_TLS
+        unsigned char md[EVP_MAX_MD_SIZE];
+        unsigned int md_len = 0;
+        EVP_DigestFinal_ex(s->sha, md, &md_len);
+        EVP_MD_CTX_free(s->sha);
+        s->sha = NULL;
+        for (unsigned int i = 0; i < md_len && 2 * i + 2 < hexsz; i++)
+            snprintf(hex + 2 * i, hexsz - 2 * i, "%02x", md[i]);
+#endif
+        break;
+    }
+    default:
+        break;
+    }
+    s->alg = CHECKSUM_NONE;
+}
+
+/**
+ * 把完整文件的摘要保存到扩展属性，值为 "<摘要> <大小> <修改时间秒>.<纳秒>"，
+ * 读取时据此判断文件在保存之后是否被修改过
+ * @param fd 文件（写入已完成）
+ * @return 0 成功，-1 文件系统不支持扩展属性或无权限
+ */
+int checksum_store_xattr(int fd, checksum_alg alg, const char *hex)
+{
+    struct stat st;
+    if (alg == CHECKSUM_NONE || fstat(fd, &st) != 0)
+        return -1;
+    char value[CHECKSUM_HEX_MAX + 64];
+    int len = snprintf(value, sizeof(value), "%s %lld %lld.%09ld", hex, (long long)st.st_size,
+                       (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    return fsetxattr(fd, xattr_names[alg], value, (size_t)len, 0);
+}
+
+/**
+ * 读取扩展属性中保存的摘要，文件大小或修改时间与保存时不同则视为无效
+ * @return 0 成功，-1 没有有效的摘要
+ */
+int checksum_load_xattr(int fd, checksum_alg alg, char *hex, size_t hexsz)
+{
+    struct stat st;
+    char value[CHECKSUM_HEX_MAX + 64];
+    if (alg == CHECKSUM_NONE || fstat(fd, &st) != 0)
+        return -1;
+    ssize_t len = fgetxattr(fd, xattr_names[alg], value, sizeof(value) - 1);
+    if (len <= 0)
+        return -1;
+    value[len] = '\0';
+    char digest[CHECKSUM_HEX_MAX];
+    long long size, sec;
+    long nsec;
+    if (sscanf(value, "%64s %lld %lld.%ld", digest, &size, &sec, &nsec) != 4 || size != (long long)st.st_size ||
+        sec != (long long)st.st_mtim.tv_sec || nsec != st.st_mtim.tv_nsec)
+        return -1;
+    snprintf(hex, hexsz, "%s", digest);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 传输中的校验和：RETR/STOR 的数据经过用户态缓冲区时顺带计算摘要，不需要事后重读文件。
+ *  - CRC32C：x86-64 上使用 SSE4.2 的 crc32 指令（运行时检测），否则查表
+ *  - XXH64：64位 xxHash
+ *  - SHA-256：由 libcrypto 计算（CPU 支持时自动使用 SHA 扩展指令），只在 TLS=1 编译时可用
+ * 完整上传或下载的摘要保存在文件的扩展属性 user.ftp.<算法> 中，连同文件大小与修改时间，
+ * 之后的 HASH 查询在文件未改变时直接读取扩展属性。
+ */
+
+typedef enum
+{
+    CHECKSUM_NONE = 0,
+    CHECKSUM_CRC32C,
+    CHECKSUM_XXH64,
+    CHECKSUM_SHA256
+} checksum_alg;
+
+#define CHECKSUM_HEX_MAX 65 // 最长摘要（SHA-256）的十六进制长度 + '\0'
+
+typedef struct checksum_state
+{
+    checksum_alg alg;
+    uint32_t crc;       // CRC32C
+    uint64_t xxh_v[4];  // XXH64 的四路累加器
+    uint64_t xxh_total; // XXH64 已输入的字节数
+    uint8_t xxh_buf[32]; // XXH64 未满一组（32字节）的输入
+    size_t xxh_len;
+    void *sha;          // SHA-256 的 EVP_MD_CTX
+} checksum_state;
+
+int checksum_parse(const char *name, checksum_alg *alg);
+const char *checksum_name(checksum_alg alg);
+const char *checksum_impl(checksum_alg alg);
+int checksum_init(checksum_state *s, checksum_alg alg);
+void checksum_update(checksum_state *s, const void *data, size_t len);
+void checksum_final(checksum_state *s, char *hex, size_t hexsz);
+uint64_t checksum_xxh64(const void *data, size_t len);
+int checksum_store_xattr(int fd, checksum_alg alg, const char *hex);
+int checksum_load_xattr(int fd, checksum_alg alg, char *hex, size_t hexsz);
@@ -1,4 +1,7 @@
 #include "connect.h"
+#include "tls.h"
+#include "trace.h"
+#include <strings.h>
 
 /**
  * 处理PORT命令，设置数据连接的地址和端口
@@ -23,7 +26,8 @@ int handle_port_command(int client_socket, const char *arg, connection *session)
     session->data_addr.sin_addr.s_addr = htonl((h1 << 24) | (h2 << 16) | (h3 << 8) | h4);
     session->data_addr.sin_port = htons(port);
 
-    // 更新会话状态为PORT模式
+    // 更新会话状态为PORT模式（丢弃之前保持的数据连接）
+    close_data_connection(session);
     session->mode = DATA_CONN_MODE_PORT;
     return 0; // 成功
 }
@@ -36,10 +40,14 @@ int handle_port_command(int client_socket, const char *arg, connection *session)
  */
 int handle_pasv_command(int client_socket, connection *session)
 {
+    // 丢弃之前的监听socket或保持的数据连接
+    close_data_connection(session);
+
     // 创建一个新的socket用于监听数据连接
     int pasv_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (pasv_socket < 0)
         return -1; // 创建socket失败
+    tcptune_data_socket(pasv_socket); // 接受的数据连接继承拥塞控制算法
 
     // 绑定一个随机端口
     struct sockaddr_in pasv_addr;
@@ -63,6 +71,7 @@ int handle_pasv_command(int client_socket, connection *session)
     }
 
     // 开始监听
+    tcptune_listener(pasv_socket);
     if (listen(pasv_socket, 1) < 0)
     {
         close(pasv_socket);
@@ -97,14 +106,22 @@ int handle_pasv_command(int client_socket, connection *session)
  * @param session 会话状态结构体，包含客户端套接字识别码，IP地址和端口以及连接模式
  * @return 数据连接的socket，成功返回socket，失败返回-1，未设置有效的连接模式返回-2
  */
-int establish_data_connection(connection *session)
+static int establish_raw_data_connection(connection *session)
 {
+    session->block_remaining = 0;
+    session->block_desc = 0;
+    if (session->mode == DATA_CONN_MODE_PERSISTENT)
+    {
+        // MODE B：复用上一次传输保持打开的数据连接
+        return session->client_data_socket;
+    }
     if (session->mode == DATA_CONN_MODE_PORT)
     {
         // 主动模式，连接客户端指定的地址和端口
         int data_socket = socket(AF_INET, SOCK_STREAM, 0);
         if (data_socket < 0)
             return -1; // 创建socket失败
+        tcptune_data_socket(data_socket);
 
         if (connect(data_socket, (struct sockaddr *)&session->data_addr, sizeof(session->data_addr)) < 0)
         {
@@ -129,4 +146,282 @@ int establish_data_connection(connection *session)
         return data_socket; // 返回数据连接socket
     }
     return -2; // 未设置有效的连接模式
+}
+
+/**
+ * 建立数据连接；PROT P 下在连接建立后执行 TLS 握手
+ * @param session 会话状态结构体，包含客户端套接字识别码，IP地址和端口以及连接模式
+ * @param sender 服务器是否为本次传输的发送方（RETR/LIST 为是，STOR 为否），决定调整哪个方向的缓冲区
+ * @return 数据连接的socket，成功返回socket，失败返回-1，未设置有效的连接模式返回-2
+ */
+int establish_data_connection(connection *session, int sender)
+{
+    int persistent = session->mode == DATA_CONN_MODE_PERSISTENT;
+    uint64_t span = trace_begin();
+    int data_socket = establish_raw_data_connection(session);
+    trace_end(persistent ? "data_connection_reuse" : "establish_data_connection", span, 0);
+    if (data_socket >= 0 && !persistent && session->prot_private)
+    {
+        span = trace_begin();
+        int rc = tls_accept(data_socket);
+        trace_end("tls_handshake", span, 0);
+        if (rc != 0)
+        {
+            close(data_socket);
+            session->mode = DATA_CONN_MODE_NONE;
+            return -1; // TLS 握手失败
+        }
+    }
+    if (data_socket >= 0)
+        tcptune_start(&session->tcp, data_socket, !persistent, sender);
+    return data_socket;
+}
+
+/**
+ * 关闭会话持有的 PASV 监听socket或持久数据连接，并清除连接模式
+ * @param session 会话状态结构体
+ */
+void close_data_connection(connection *session)
+{
+    if ((session->mode == DATA_CONN_MODE_PASV || session->mode == DATA_CONN_MODE_PERSISTENT) &&
+        session->client_data_socket >= 0)
+    {
+        tls_close(session->client_data_socket);
+        close(session->client_data_socket);
+    }
+    session->client_data_socket = -1;
+    session->mode = DATA_CONN_MODE_NONE;
+}
+
+/**
+ * 一次传输结束后处理数据连接
+ *  - MODE S：关闭连接，由连接关闭表示文件结束
+ *  - MODE B：由发送方发送 EOF 块并保持连接，供下一次传输复用；传输失败时仍然关闭
+ * @param session 会话状态结构体
+ * @param data_socket 本次传输使用的数据连接
+ * @param keep 传输是否成功完成，成功时 MODE B 才保持连接
+ * @param sender 服务器是否为本次传输的发送方（RETR/LIST 为是，STOR 为否）
+ */
+void release_data_connection(connection *session, int data_socket, int keep, int sender)
+{
+    tcptune_finish(&session->tcp, data_socket); // 关闭前采样本次传输的 RTT 与吞吐
+    if (session->transfer_mode == TRANSFER_MODE_BLOCK && keep &&
+        (!sender || data_write_block_header(data_socket, BLOCK_DESC_EOF, 0) == 0))
+    {
+        session->client_data_socket = data_socket;
+        session->mode = DATA_CONN_MODE_PERSISTENT;
+        return;
+    }
+    tls_close(data_socket);
+    close(data_socket);
+    if (session->mode == DATA_CONN_MODE_PERSISTENT)
+        session->client_data_socket = -1;
+    session->mode = DATA_CONN_MODE_NONE; // 重置数据连接模式
+}
+
+/**
+ * 发送一个 MODE B 块头：1字节描述符 + 2字节长度（网络字节序）
+ * @return 0 成功，-1 发送失败
+ */
+int data_write_block_header(int data_socket, unsigned char desc, size_t len)
+{
+    unsigned char header[3] = {desc, (unsigned char)(len >> 8), (unsigned char)(len & 0xFF)};
+    while (1)
+    {
+        ssize_t n = net_send(data_socket, header, sizeof(header), MSG_MORE);
+        if (n == (ssize_t)sizeof(header))
+            return 0;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        // 极少出现的部分发送，剩余部分按普通方式补齐
+        return send_all(data_socket, header + n, sizeof(header) - n);
+    }
+}
+
+/**
+ * 向数据连接写入数据，MODE B 下自动按块封装
+ * @param session 会话状态结构体
+ * @param data_socket 数据连接
+ * @param buffer 数据
+ * @param len 数据长度
+ * @return 0 成功，-1 发送失败
+ */
+int data_write(connection *session, int data_socket, const void *buffer, size_t len)
+{
+    if (session->transfer_mode != TRANSFER_MODE_BLOCK)
+        return send_all(data_socket, buffer, len);
+
+    const char *p = buffer;
+    while (len > 0)
+    {
+        size_t chunk = len < BLOCK_MAX_SIZE ? len : BLOCK_MAX_SIZE;
+        if (data_write_block_header(data_socket, 0, chunk) != 0 || send_all(data_socket, p, chunk) != 0)
+            return -1;
+        p += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/**
+ * MODE B 下发送一个重启标记块，内容为十进制的文件偏移，客户端可用 REST 从该处续传
+ * @return 0 成功（非 MODE B 时不发送），-1 发送失败
+ */
+int data_write_marker(connection *session, int data_socket, uint64_t offset)
+{
+    if (session->transfer_mode != TRANSFER_MODE_BLOCK)
+        return 0;
+    char marker[32];
+    int len = snprintf(marker, sizeof(marker), "%llu", (unsigned long long)offset);
+    if (data_write_block_header(data_socket, BLOCK_DESC_RESTART, len) != 0)
+        return -1;
+    return send_all(data_socket, marker, len);
+}
+
+/**
+ * 从 socket 读取恰好 len 个字节
+ * @return 0 成功，-1 出错或连接提前关闭
+ */
+static int read_exact(int data_socket, void *buffer, size_t len)
+{
+    char *p = buffer;
+    while (len > 0)
+    {
+        ssize_t n = net_recv(data_socket, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * 从数据连接读取文件数据，MODE B 下解析块头并跳过重启标记
+ * @param session 会话状态结构体
+ * @param data_socket 数据连接
+ * @param buffer 输出缓冲区
+ * @param len 缓冲区大小
+ * @return 读取的字节数，0 表示文件结束（MODE S 为连接关闭，MODE B 为 EOF 块），-1 出错
+ */
+ssize_t data_read(connection *session, int data_socket, void *buffer, size_t len)
+{
+    if (session->transfer_mode != TRANSFER_MODE_BLOCK)
+        return net_recv(data_socket, buffer, len);
+
+    while (session->block_remaining == 0)
+    {
+        if (session->block_desc & BLOCK_DESC_EOF)
+        {
+            session->block_desc = 0; // 为下一次传输复位
+            return 0;
+        }
+        unsigned char header[3];
+        if (read_exact(data_socket, header, sizeof(header)) != 0)
+            return -1; // MODE B 下连接在 EOF 块之前关闭视为出错
+        session->block_desc = header[0];
+        session->block_remaining = ((uint32_t)header[1] << 8) | header[2];
+        if (session->block_desc & BLOCK_DESC_RESTART)
+        {
+            // 重启标记只对发送方有意义，接收方分小段读出并丢弃其内容
+            char marker[32];
+            while (session->block_remaining > 0)
+            {
+                size_t chunk = session->block_remaining < sizeof(marker) ? session->block_remaining : sizeof(marker);
+                if (read_exact(data_socket, marker, chunk) != 0)
+                    return -1;
+                session->block_remaining -= chunk;
+            }
+            session->block_desc &= BLOCK_DESC_EOF;
+        }
+    }
+
+    size_t want = len < session->block_remaining ? len : session->block_remaining;
+    ssize_t n = net_recv(data_socket, buffer, want);
+    if (n <= 0)
+        return -1;
+    session->block_remaining -= n;
+    return n;
+}
+
+/**
+ * 处理 AUTH 命令（RFC 4217），在控制连接上开始 TLS 握手
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态结构体
+ * @param arg 安全机制，支持 TLS 与 SSL（均协商为 TLS）
+ * @return 0 成功，-1 参数错误或未配置证书，-2 握手失败（连接已不可用）
+ */
+int handle_auth_command(int client_socket, connection *session, const char *arg)
+{
+    if (strcasecmp(arg, "TLS") != 0 && strcasecmp(arg, "TLS-C") != 0 && strcasecmp(arg, "SSL") != 0)
+    {
+        send_response(client_socket, 504, "Security mechanism not understood.");
+        return -1;
+    }
+    if (!tls_available())
+    {
+        send_response(client_socket, 431, "TLS is not configured on this server.");
+        return -1;
+    }
+    if (tls_active(client_socket))
+    {
+        send_response(client_socket, 503, "TLS is already active.");
+        return -1;
+    }
+    send_response(client_socket, 234, "Proceed with negotiation.");
+    if (tls_accept(client_socket) != 0)
+        return -2;
+    session->pbsz_set = 0;
+    session->prot_private = 0;
+    return 0;
+}
+
+/**
+ * 处理 PBSZ 命令，TLS 下保护缓冲区大小只能为 0
+ */
+int handle_pbsz_command(int client_socket, connection *session, const char *arg)
+{
+    if (!tls_active(client_socket))
+    {
+        send_response(client_socket, 503, "PBSZ requires AUTH first.");
+        return -1;
+    }
+    session->pbsz_set = 1;
+    send_response(client_socket, 200, "PBSZ=0");
+    return 0;
+}
+
+/**
+ * 处理 PROT 命令，设置数据连接的保护级别：C 明文，P 加密
+ */
+int handle_prot_command(int client_socket, connection *session, const char *arg)
+{
+    if (!session->pbsz_set)
+    {
+        send_response(client_socket, 503, "PROT requires PBSZ first.");
+        return -1;
+    }
+    if (strcasecmp(arg, "P") == 0)
+    {
+        session->prot_private = 1;
+        send_response(client_socket, 200, "Protection level set to Private.");
+    }
+    else if (strcasecmp(arg, "C") == 0)
+    {
+        session->prot_private = 0;
+        send_response(client_socket, 200, "Protection level set to Clear.");
+    }
+    else
+    {
+        send_response(client_socket, 536, "Only C and P protection levels are supported.");
+        return -1;
+    }
+    // 已保持的 MODE B 连接的保护级别可能不再匹配，丢弃它
+    if (session->mode == DATA_CONN_MODE_PERSISTENT)
+        close_data_connection(session);
+    return 0;
 }
\ No newline at end of file
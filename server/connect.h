@@ -1,23 +1,69 @@
 #pragma once
 
 #include "utils.h"
+#include "checksum.h"
+#include "tcptune.h"
 
 typedef enum
 {
     DATA_CONN_MODE_NONE,
     DATA_CONN_MODE_PORT,
-    DATA_CONN_MODE_PASV
+    DATA_CONN_MODE_PASV,
+    DATA_CONN_MODE_PERSISTENT // MODE B 下保持打开的已建立数据连接，保存在 client_data_socket
 } data_conn_mode_t;
 
+typedef enum
+{
+    TRANSFER_MODE_STREAM, // MODE S：以关闭数据连接表示文件结束
+    TRANSFER_MODE_BLOCK   // MODE B：分块传输，以 EOF 描述符表示文件结束，连接可复用
+} transfer_mode_t;
+
+// MODE B 块头描述符（RFC 959）
+#define BLOCK_DESC_EOR 0x80     // 记录结束
+#define BLOCK_DESC_EOF 0x40     // 文件结束
+#define BLOCK_DESC_ERRORS 0x20  // 数据可能有误
+#define BLOCK_DESC_RESTART 0x10 // 块内容为重启标记
+#define BLOCK_MAX_SIZE 65535    // 单个块的最大数据长度
+#define RESTART_MARKER_INTERVAL (16 << 20) // 发送重启标记的间隔（字节）
+
+typedef enum
+{
+    PENDING_NONE,   // 没有等待第二步的命令
+    PENDING_RENAME, // 已收到 RNFR，等待 RNTO
+    PENDING_COPY    // 已收到 SITE CPFR，等待 SITE CPTO
+} pending_op_t;
+
 typedef struct
 {
-    int client_data_socket;       // 客户端数据连接socket
+    int client_data_socket;       // 客户端数据连接socket（PASV 监听socket或 MODE B 的持久连接）
     struct sockaddr_in data_addr; // 客户端数据连接地址
     data_conn_mode_t mode;        // 数据连接模式
-    char root_dir[PATH_MAX];      // FTP服务器根目录
-    int bytes_transferred;        // 传输的字节数
+    const char *root_dir;         // FTP服务器根目录，指向父进程中的只读配置，不在会话间复制
+    uint64_t bytes_transferred;   // 传输的字节数
+    transfer_mode_t transfer_mode; // 传输模式（MODE S/B）
+    uint32_t block_remaining;     // MODE B 接收时当前块剩余的字节数
+    unsigned char block_desc;     // MODE B 接收时当前块的描述符
+    uint64_t restart_offset;      // REST 设置的重启偏移，只对下一次传输有效
+    int pbsz_set;                 // 已收到 PBSZ
+    int prot_private;             // PROT P：数据连接使用 TLS
+    struct sockaddr_in peer_addr; // 客户端控制连接的地址
+    pending_op_t pending_op;      // 两步命令（重命名/复制）的状态
+    char *pending_from;           // 两步命令的源路径（绝对路径），首次使用时从路径缓存分配
+    char *cwd;                    // 会话的当前目录（规范化的绝对路径），从路径缓存分配
+    checksum_alg hash_alg;        // OPTS HASH 选择的算法，非 NONE 时 RETR/STOR 在传输中计算摘要
+    checksum_state *xfer_hash;    // 当前传输正在计算的摘要，send_file_data 据此改走 read/send
+    tcp_tuning tcp;               // 数据连接的 TCP 调优状态与最近一次传输的采样
 } connection;
 
 int handle_port_command(int client_socket, const char *arg, connection *session);
 int handle_pasv_command(int client_socket, connection *session);
-int establish_data_connection(connection *session);
\ No newline at end of file
+int establish_data_connection(connection *session, int sender);
+void release_data_connection(connection *session, int data_socket, int keep, int sender);
+void close_data_connection(connection *session);
+int data_write(connection *session, int data_socket, const void *buffer, size_t len);
+int data_write_block_header(int data_socket, unsigned char desc, size_t len);
+int data_write_marker(connection *session, int data_socket, uint64_t offset);
+ssize_t data_read(connection *session, int data_socket, void *buffer, size_t len);
+int handle_auth_command(int client_socket, connection *session, const char *arg);
+int handle_pbsz_command(int client_socket, connection *session, const char *arg);
+int handle_prot_command(int client_socket, connection *session, const char *arg);
\ No newline at end of file
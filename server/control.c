@@ -0,0 +1,335 @@
+#include "control.h"
+#include "utils.h"
+#include "tls.h"
+#include "scoreboard.h"
+#include "upgrade.h"
+#include <pthread.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+
+// Telnet 命令（RFC 854），控制连接上只需要识别并丢弃
+#define TELNET_IAC 255
+#define TELNET_WILL 251
+#define TELNET_DONT 254
+
+typedef enum
+{
+    TELNET_DATA,     // 普通字符
+    TELNET_IAC_SEEN, // 刚读到 IAC
+    TELNET_OPTION    // 刚读到 IAC WILL/WONT/DO/DONT，下一字节是选项号
+} telnet_state_t;
+
+// 已从控制连接读入、尚未作为命令处理的字节；主循环从 queue_head 开始消费，监视线程向末尾追加
+static unsigned char queue[CONTROL_QUEUE_SIZE];
+static size_t queue_head = 0;
+static size_t queue_len = 0;
+static telnet_state_t read_state = TELNET_DATA;
+
+static struct
+{
+    int running;        // 监视线程是否在运行
+    pthread_t thread;
+    int stop_fd;        // eventfd，写入后线程退出
+    int client_socket;
+    int data_socket;    // ABOR 时 shutdown 的数据连接
+    const char *verb;   // RETR / STOR
+    char path[256];     // 客户端给出的文件名，用于 STAT 输出
+    int64_t size;       // 预计传输的字节数，-1 表示未知
+    uint64_t start_mono;
+    uint64_t start_bytes; // 开始时计分板上的会话累计字节数
+    size_t scanned;     // 队列中已检查过、留给主循环处理的完整命令行的末尾
+    int aborted;        // 收到了 ABOR，等待传输结束后回复
+} watch;
+
+/**
+ * 去掉 Telnet 命令序列（IAC IP、IAC DM、选项协商等），IAC IAC 还原为一个 0xFF 字节
+ * @param state 解码状态，跨调用保存
+ * @param ch 读到的字节
+ * @return 1 表示 ch 是命令文本，0 表示 ch 属于 Telnet 命令序列
+ */
+static int telnet_filter(telnet_state_t *state, unsigned char ch)
+{
+    switch (*state)
+    {
+    case TELNET_DATA:
+        if (ch != TELNET_IAC)
+            return 1;
+        *state = TELNET_IAC_SEEN;
+        return 0;
+    case TELNET_IAC_SEEN:
+        if (ch == TELNET_IAC)
+        {
+            *state = TELNET_DATA;
+            return 1;
+        }
+        *state = ch >= TELNET_WILL && ch <= TELNET_DONT ? TELNET_OPTION : TELNET_DATA;
+        return 0;
+    default:
+        *state = TELNET_DATA;
+        return 0;
+    }
+}
+
+/**
+ * 控制连接建立后调用：紧急数据留在普通字节流中，ABOR 前的 Telnet 同步序列不会打乱命令
+ */
+void control_init(int client_socket)
+{
+    int on = 1;
+    setsockopt(client_socket, SOL_SOCKET, SO_OOBINLINE, &on, sizeof(on));
+    queue_head = queue_len = 0;
+    read_state = TELNET_DATA;
+}
+
+/**
+ * 读取一条命令，先消费传输期间排队的输入，再从控制连接读取；去掉 Telnet 命令序列
+ * @param client_socket 控制连接
+ * @param buffer 存储读取数据的缓冲区
+ * @param max_len 缓冲区的最大长度
+ * @return 读取的字节数，失败或连接关闭时返回-1，等待命令时收到排空通知返回 CONTROL_READ_DRAIN
+ */
+int control_read_line(int client_socket, char *buffer, size_t max_len)
+{
+    size_t total_read = 0;
+    while (total_read < max_len - 1)
+    {
+        unsigned char ch;
+        if (queue_head < queue_len)
+        {
+            ch = queue[queue_head++];
+        }
+        else
+        {
+            queue_head = queue_len = 0;
+            // 阻塞等待客户端时接收排空通知；TLS 库中已解密的数据不会使 socket 可读，先读完
+            if (net_pending(client_socket) == 0 && upgrade_wait_command(client_socket) != 0)
+                return CONTROL_READ_DRAIN;
+            ssize_t bytes_read = net_recv(client_socket, &ch, 1);
+            if (bytes_read < 0)
+            {
+                perror("recv failed");
+                return -1;
+            }
+            if (bytes_read == 0)
+                return -1; // 对端正常关闭
+        }
+        if (!telnet_filter(&read_state, ch))
+            continue;
+        if (ch == '\n')
+            break;
+        if (ch != '\r')
+            buffer[total_read++] = (char)ch;
+    }
+    buffer[total_read] = '\0';
+    return (int)total_read;
+}
+
+/**
+ * 回复 STAT：当前传输的文件、已传输字节数、耗时与速率
+ */
+static void reply_progress(void)
+{
+    uint64_t done = scoreboard_session_bytes() - watch.start_bytes;
+    double secs = (double)(monotonic_us() - watch.start_mono) / 1e6;
+    double rate = secs > 0 ? (double)done / secs / (1024.0 * 1024.0) : 0.0;
+    char message[LINE_MAX_SIZE - 16];
+    if (watch.size > 0)
+        snprintf(message, sizeof(message), "%s %s: %llu of %lld bytes (%d%%), %.1f s, %.2f MB/s", watch.verb,
+                 watch.path, (unsigned long long)done, (long long)watch.size,
+                 (int)(done * 100 / (uint64_t)watch.size), secs, rate);
+    else
+        snprintf(message, sizeof(message), "%s %s: %llu bytes, %.1f s, %.2f MB/s", watch.verb, watch.path,
+                 (unsigned long long)done, secs, rate);
+    send_response(watch.client_socket, 213, message);
+}
+
+/**
+ * 处理传输期间可以立即回答的命令
+ * @param line 去掉 Telnet 序列与行尾的命令行
+ * @return 1 已处理，0 留给主循环在传输结束后处理
+ */
+static int handle_watched_command(const char *line)
+{
+    while (isspace((unsigned char)*line))
+        line++;
+    size_t len = strcspn(line, " \t");
+    const char *arg = line + len;
+    while (isspace((unsigned char)*arg))
+        arg++;
+    if (len != 4)
+        return 0;
+
+    if (strncasecmp(line, "ABOR", 4) == 0)
+    {
+        // 唤醒阻塞在 sendfile/recv 中的传输；数据连接由传输线程照常关闭
+        if (!watch.aborted)
+            shutdown(watch.data_socket, SHUT_RDWR);
+        watch.aborted = 1;
+        return 1;
+    }
+    if (strncasecmp(line, "NOOP", 4) == 0)
+    {
+        send_response(watch.client_socket, 200, "NOOP ok.");
+        return 1;
+    }
+    if (strncasecmp(line, "STAT", 4) == 0 && *arg == '\0')
+    {
+        reply_progress();
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 检查队列中新读入的完整命令行，处理掉可以立即回答的，其余保持原样和顺序
+ */
+static void process_queue(void)
+{
+    size_t start = watch.scanned;
+    while (start < queue_len)
+    {
+        unsigned char *nl = memchr(queue + start, '\n', queue_len - start);
+        if (nl == NULL)
+            break; // 命令行还不完整
+        size_t end = (size_t)(nl - queue) + 1;
+
+        char line[LINE_MAX_SIZE];
+        size_t used = 0;
+        telnet_state_t state = TELNET_DATA;
+        for (size_t i = start; i < end - 1 && used < sizeof(line) - 1; i++)
+        {
+            if (telnet_filter(&state, queue[i]) && queue[i] != '\r')
+                line[used++] = (char)queue[i];
+        }
+        line[used] = '\0';
+
+        if (handle_watched_command(line))
+        {
+            memmove(queue + start, queue + end, queue_len - end);
+            queue_len -= end - start;
+        }
+        else
+        {
+            start = end;
+        }
+    }
+    watch.scanned = start;
+}
+
+static void *watch_main(void *arg)
+{
+    (void)arg;
+    int closed = 0; // 控制连接已关闭或出错，留给主循环发现
+    while (1)
+    {
+        // 队列满时暂停读取，剩下的命令在传输结束后由主循环直接从 socket 读取
+        int reading = !closed && queue_len < sizeof(queue);
+        // TLS 库中已解密的数据不会使 socket 可读，先读完再 poll
+        if (!reading || net_pending(watch.client_socket) == 0)
+        {
+            struct pollfd fds[2];
+            fds[0].fd = watch.stop_fd;
+            fds[0].events = POLLIN;
+            fds[1].fd = reading ? watch.client_socket : -1;
+            fds[1].events = POLLIN | POLLPRI;
+            if (poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            if (fds[0].revents != 0)
+                break;
+            if (fds[1].revents == 0)
+                continue;
+        }
+        // 不能阻塞：只到达了 TLS 记录的一部分时 SSL_read 会一直等待，control_watch_stop 随之卡住
+        ssize_t n = net_recv_nowait(watch.client_socket, queue + queue_len, sizeof(queue) - queue_len);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            continue;
+        if (n <= 0)
+        {
+            closed = 1;
+            continue;
+        }
+        queue_len += (size_t)n;
+        process_queue();
+    }
+    return NULL;
+}
+
+/**
+ * 数据连接建立后启动监视线程，此后直到 control_watch_stop 之前主线程不得使用控制连接
+ * @param client_socket 控制连接
+ * @param data_socket 本次传输的数据连接
+ * @param verb 传输命令名，用于 STAT 输出
+ * @param path 客户端给出的文件名
+ * @param size 预计传输的字节数，-1 表示未知
+ * @return 0 成功，-1 无法创建线程（传输照常进行，只是不响应控制连接）
+ */
+int control_watch_start(int client_socket, int data_socket, const char *verb, const char *path, int64_t size)
+{
+    if (watch.running)
+        return -1;
+    // 上次传输留下的命令移到队列开头，它们先于本次传输期间的命令，全部留给主循环
+    memmove(queue, queue + queue_head, queue_len - queue_head);
+    queue_len -= queue_head;
+    queue_head = 0;
+    watch.scanned = 0;
+    for (size_t i = queue_len; i > 0; i--)
+    {
+        if (queue[i - 1] == '\n')
+        {
+            watch.scanned = i;
+            break;
+        }
+    }
+
+    watch.client_socket = client_socket;
+    watch.data_socket = data_socket;
+    watch.verb = verb;
+    snprintf(watch.path, sizeof(watch.path), "%s", path);
+    watch.size = size;
+    watch.start_mono = monotonic_us();
+    watch.start_bytes = scoreboard_session_bytes();
+    watch.aborted = 0;
+    watch.stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (watch.stop_fd < 0)
+        return -1;
+    if (pthread_create(&watch.thread, NULL, watch_main, NULL) != 0)
+    {
+        close(watch.stop_fd);
+        return -1;
+    }
+    watch.running = 1;
+    return 0;
+}
+
+/**
+ * 停止监视线程，必须在关闭数据连接和发送传输的最终响应之前调用
+ * @return 1 传输期间收到了 ABOR，0 没有
+ */
+int control_watch_stop(void)
+{
+    if (!watch.running)
+        return 0;
+    uint64_t one = 1;
+    if (write(watch.stop_fd, &one, sizeof(one)) != sizeof(one))
+        perror("eventfd write failed");
+    pthread_join(watch.thread, NULL);
+    close(watch.stop_fd);
+    watch.running = 0;
+    return watch.aborted;
+}
+
+/**
+ * 传输的最终响应发送之后调用：传输期间收到过 ABOR 时回复它
+ */
+void control_abort_reply(int client_socket)
+{
+    if (!watch.aborted)
+        return;
+    watch.aborted = 0;
+    send_response(client_socket, 226, "ABOR command successful.");
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONTROL_QUEUE_SIZE 8192 // 传输期间从控制连接读入、尚未处理的命令字节数上限
+#define CONTROL_READ_DRAIN (-2) // control_read_line：服务器正在升级或关闭，会话应回复 421 后退出
+
+/*
+ * 传输期间的控制连接处理（RFC 959 4.1.3）：
+ *  - RETR/STOR 建立数据连接后启动一个监视线程，传输期间由它独占控制连接，主线程只管搬运数据
+ *  - ABOR 立即 shutdown 数据连接，阻塞在 sendfile/recv 中的传输随之失败，
+ *    传输以 426 结束后再回复 ABOR 的 226；STAT（无参数）回复传输进度；NOOP 回复 200
+ *  - 其它命令留在队列中，传输结束后由主循环按顺序处理（流水线）
+ *  - 控制连接开启 SO_OOBINLINE，客户端以紧急数据发送的 Telnet IP/DM 留在字节流中，
+ *    读取命令行时连同其它 Telnet 命令序列一起去掉
+ * 监视线程只使用静态和栈上的缓冲区（slab 池不是线程安全的），
+ * 传输的最终响应在线程结束后才发送，控制连接（包括其 TLS 状态）任何时刻只有一个线程在用。
+ */
+
+void control_init(int client_socket);
+int control_read_line(int client_socket, char *buffer, size_t max_len);
+int control_watch_start(int client_socket, int data_socket, const char *verb, const char *path, int64_t size);
+int control_watch_stop(void);
+void control_abort_reply(int client_socket);
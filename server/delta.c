@@ -0,0 +1,433 @@
+#include "delta.h"
+#include "file.h"
+#include "checksum.h"
+#include "scoreboard.h"
+#include "statcache.h"
+#include "storage.h"
+#include "pool.h"
+#include "trace.h"
+#include "replica.h"
+#include <fcntl.h>
+
+/*
+ * SITE SIGS / SITE DELTA：rsync 式增量上传的服务器端，协议见 delta.h。
+ * 新版本先写入同一目录下的临时文件，结束指令中的长度与 XXH64 校验通过后才 rename 覆盖原文件，
+ * 传输中断或校验失败时原文件保持不变。
+ */
+
+typedef struct
+{
+    connection *session;
+    int data_socket;
+    char *buf;      // 接收缓冲区（BUFFER_SIZE，来自传输缓冲区池）
+    size_t pos;     // 下一个未处理的字节
+    size_t len;     // 缓冲区中的字节数
+    uint64_t bytes; // 从数据连接收到的总字节数
+} delta_reader;
+
+/**
+ * 取出接收缓冲区中至多 max 个字节，缓冲区空时从数据连接读取
+ * @return 取出的字节数，0 表示数据流已结束，-1 出错
+ */
+static ssize_t delta_take(delta_reader *r, const char **data, size_t max)
+{
+    if (r->pos == r->len)
+    {
+        ssize_t n = data_read(r->session, r->data_socket, r->buf, BUFFER_SIZE);
+        if (n <= 0)
+            return n;
+        r->pos = 0;
+        r->len = (size_t)n;
+        r->bytes += (uint64_t)n;
+        scoreboard_add_bytes(n);
+    }
+    size_t n = r->len - r->pos < max ? r->len - r->pos : max;
+    *data = r->buf + r->pos;
+    r->pos += n;
+    return (ssize_t)n;
+}
+
+/**
+ * 读取恰好 len 个字节，数据流提前结束视为出错
+ * @return 0 成功，-1 失败
+ */
+static int delta_read_exact(delta_reader *r, void *out, size_t len)
+{
+    char *p = out;
+    while (len > 0)
+    {
+        const char *data;
+        ssize_t n = delta_take(r, &data, len);
+        if (n <= 0)
+            return -1;
+        memcpy(p, data, (size_t)n);
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = storage->write(fd, data, len);
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * 从原文件读取一段数据，读不满（文件结束）时返回实际长度
+ * @return 读取的字节数，-1 出错
+ */
+static ssize_t read_full(int fd, char *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = storage->read(fd, buf + got, len - got);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+/**
+ * 处理 SITE SIGS 命令：计算已有文件每个块的弱校验和与 XXH64，通过数据连接发送
+ * @param arg "<块大小> <文件>"
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_sigs_command(int client_socket, connection *session, const char *arg)
+{
+    char *end;
+    unsigned long block_size = strtoul(arg, &end, 10);
+    while (*end == ' ')
+        end++;
+    if (end == arg || *end == '\0' || block_size < DELTA_MIN_BLOCK || block_size > DELTA_MAX_BLOCK)
+    {
+        send_response(client_socket, 501, "Usage: SITE SIGS <block size 512-1048576> <file>");
+        return -1;
+    }
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, end, full_path, sizeof(full_path)) != 0)
+        return -1;
+    struct stat st;
+    int file_fd = storage->open(full_path, O_RDONLY, 0);
+    if (file_fd < 0 || storage->fstat(file_fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (file_fd >= 0)
+            storage->close(file_fd);
+        send_response(client_socket, 550, "File not found or not a regular file.");
+        return -1;
+    }
+    char *block = malloc(block_size);
+    char *out = xfer_buffer_alloc();
+    if (block == NULL || out == NULL)
+    {
+        free(block);
+        xfer_buffer_free(out);
+        storage->close(file_fd);
+        send_response(client_socket, 451, "Insufficient memory.");
+        return -1;
+    }
+
+    send_response(client_socket, 150, "Sending block signatures.");
+    scoreboard_set_state(SB_STATE_TRANSFER);
+    uint64_t start_us = realtime_us();
+    uint64_t start_mono = monotonic_us();
+    int data_socket = establish_data_connection(session, 1);
+    int transfer_ok = data_socket >= 0;
+    uint64_t sent = 0, blocks = 0;
+
+    // 头部与签名先拼接到传输缓冲区中，满了再成块发送
+    delta_sig_header header = {DELTA_SIG_MAGIC, (uint32_t)block_size, (uint64_t)st.st_size};
+    memcpy(out, &header, sizeof(header));
+    size_t used = sizeof(header);
+    while (transfer_ok)
+    {
+        uint64_t span = trace_begin();
+        ssize_t n = read_full(file_fd, block, block_size);
+        trace_end("disk_read", span, n > 0 ? n : 0);
+        if (n < 0)
+            transfer_ok = 0;
+        if (n <= 0)
+            break;
+        delta_sig sig = {delta_weak((const uint8_t *)block, (size_t)n), checksum_xxh64(block, (size_t)n)};
+        if (used + sizeof(sig) > BUFFER_SIZE)
+        {
+            transfer_ok = data_write(session, data_socket, out, used) == 0;
+            sent += used;
+            used = 0;
+        }
+        memcpy(out + used, &sig, sizeof(sig));
+        used += sizeof(sig);
+        blocks++;
+    }
+    if (transfer_ok && used > 0)
+    {
+        transfer_ok = data_write(session, data_socket, out, used) == 0;
+        sent += used;
+    }
+    free(block);
+    xfer_buffer_free(out);
+    storage->close(file_fd);
+
+    if (data_socket < 0)
+    {
+        send_response(client_socket, 425, "Failed to establish data connection.");
+        log_transfer(session, 'o', full_path, start_us, start_mono, 0, 425, XFER_PATH_DELTA);
+        scoreboard_set_state(SB_STATE_IDLE);
+        return -1;
+    }
+    release_data_connection(session, data_socket, transfer_ok, 1);
+    if (transfer_ok)
+    {
+        char message[96];
+        snprintf(message, sizeof(message), "Signatures sent, %llu blocks.", (unsigned long long)blocks);
+        session->bytes_transferred += sent;
+        send_response(client_socket, 226, message);
+        log_transfer(session, 'o', full_path, start_us, start_mono, sent, 226, XFER_PATH_DELTA);
+    }
+    else
+    {
+        send_response(client_socket, 426, "Connection closed; transfer aborted.");
+        log_transfer(session, 'o', full_path, start_us, start_mono, sent, 426, XFER_PATH_DELTA);
+    }
+    scoreboard_set_state(SB_STATE_IDLE);
+    return transfer_ok ? 0 : -1;
+}
+
+typedef struct
+{
+    int basis_fd;         // 原文件
+    uint64_t basis_size;
+    uint32_t block_size;  // 取自增量流头部
+    int out_fd;           // 新版本的临时文件
+    uint64_t out_size;    // 已写入新版本的字节数
+    uint64_t literal;     // 字面数据字节数
+    uint64_t reused;      // 从原文件复制的字节数
+    checksum_state hash;  // 新版本的 XXH64
+    char *copy_buf;       // 复制原文件块用的缓冲区
+} delta_apply;
+
+/**
+ * 把一段字面数据从数据连接写入新版本
+ * @return 0 成功，-1 失败
+ */
+static int apply_literal(delta_reader *r, delta_apply *a, uint32_t len)
+{
+    while (len > 0)
+    {
+        const char *data;
+        ssize_t n = delta_take(r, &data, len);
+        if (n <= 0 || write_all(a->out_fd, data, (size_t)n) != 0)
+            return -1;
+        checksum_update(&a->hash, data, (size_t)n);
+        a->out_size += (uint64_t)n;
+        a->literal += (uint64_t)n;
+        len -= (uint32_t)n;
+    }
+    return 0;
+}
+
+/**
+ * 把原文件中的连续块复制到新版本；最后一块可能不足一个块大小
+ * @return 0 成功，-1 块号越界或读写失败
+ */
+static int apply_blocks(delta_apply *a, uint64_t first, uint32_t count)
+{
+    uint64_t nblocks = (a->basis_size + a->block_size - 1) / a->block_size;
+    if (count == 0 || first >= nblocks || count > nblocks - first)
+        return -1;
+    uint64_t offset = first * a->block_size;
+    uint64_t len = (uint64_t)count * a->block_size;
+    if (len > a->basis_size - offset)
+        len = a->basis_size - offset;
+    if (storage->lseek(a->basis_fd, (off_t)offset, SEEK_SET) < 0)
+        return -1;
+    while (len > 0)
+    {
+        size_t want = len < BUFFER_SIZE ? (size_t)len : BUFFER_SIZE;
+        ssize_t n = read_full(a->basis_fd, a->copy_buf, want);
+        if (n != (ssize_t)want || write_all(a->out_fd, a->copy_buf, want) != 0)
+            return -1;
+        checksum_update(&a->hash, a->copy_buf, want);
+        a->out_size += want;
+        a->reused += want;
+        len -= want;
+    }
+    return 0;
+}
+
+/**
+ * 执行增量指令流直到结束指令
+ * @return 0 成功，-1 数据连接出错，-2 指令流无效或校验失败
+ */
+static int run_delta(delta_reader *r, delta_apply *a)
+{
+    delta_header header;
+    if (delta_read_exact(r, &header, sizeof(header)) != 0)
+        return -1;
+    if (header.magic != DELTA_MAGIC || header.block_size < DELTA_MIN_BLOCK || header.block_size > DELTA_MAX_BLOCK)
+        return -2;
+    a->block_size = header.block_size;
+    for (;;)
+    {
+        unsigned char op;
+        if (delta_read_exact(r, &op, 1) != 0)
+            return -1;
+        if (op == DELTA_OP_LITERAL)
+        {
+            uint32_t len;
+            if (delta_read_exact(r, &len, sizeof(len)) != 0)
+                return -1;
+            if (len > DELTA_MAX_LITERAL)
+                return -2;
+            if (apply_literal(r, a, len) != 0)
+                return -1;
+        }
+        else if (op == DELTA_OP_BLOCKS)
+        {
+            uint64_t first;
+            uint32_t count;
+            if (delta_read_exact(r, &first, sizeof(first)) != 0 || delta_read_exact(r, &count, sizeof(count)) != 0)
+                return -1;
+            if (apply_blocks(a, first, count) != 0)
+                return -2;
+        }
+        else if (op == DELTA_OP_END)
+        {
+            uint64_t size, digest;
+            if (delta_read_exact(r, &size, sizeof(size)) != 0 || delta_read_exact(r, &digest, sizeof(digest)) != 0)
+                return -1;
+            char expect[CHECKSUM_HEX_MAX], actual[CHECKSUM_HEX_MAX];
+            snprintf(expect, sizeof(expect), "%016llx", (unsigned long long)digest);
+            checksum_final(&a->hash, actual, sizeof(actual));
+            if (size != a->out_size || strcmp(expect, actual) != 0)
+                return -2;
+            // 校验通过后把摘要保存到扩展属性，之后的 HASH 查询无需重读文件
+            if (storage->native_fds)
+                checksum_store_xattr(a->out_fd, CHECKSUM_XXH64, actual);
+            return 0;
+        }
+        else
+        {
+            return -2;
+        }
+    }
+}
+
+/**
+ * 处理 SITE DELTA 命令：以已有文件为基础，按数据连接上的增量指令生成新版本并替换原文件
+ * 块大小由增量流的头部给出，应与客户端请求签名时使用的块大小相同
+ * @param arg 目标文件（必须已存在）
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_delta_command(int client_socket, connection *session, const char *arg)
+{
+    char full_path[PATH_MAX], tmp_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, arg, full_path, sizeof(full_path)) != 0)
+        return -1;
+    // 临时文件与目标在同一目录，保证 rename 是原子的
+    const char *slash = strrchr(full_path, '/');
+    if (slash == NULL || snprintf(tmp_path, sizeof(tmp_path), "%.*s/.%s.delta.%d", (int)(slash - full_path),
+                                  full_path, slash + 1, (int)getpid()) >= (int)sizeof(tmp_path))
+    {
+        send_response(client_socket, 550, "Resulting path is too long.");
+        return -1;
+    }
+
+    delta_apply a;
+    memset(&a, 0, sizeof(a));
+    struct stat st;
+    a.basis_fd = storage->open(full_path, O_RDONLY, 0);
+    if (a.basis_fd < 0 || storage->fstat(a.basis_fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (a.basis_fd >= 0)
+            storage->close(a.basis_fd);
+        send_response(client_socket, 550, "File not found or not a regular file.");
+        return -1;
+    }
+    a.basis_size = (uint64_t)st.st_size;
+    // 重建的文件替换原文件，保留原文件的权限；open 的 mode 受 umask 影响，本地文件再 fchmod 一次
+    mode_t mode = st.st_mode & 07777;
+    a.out_fd = storage->open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (a.out_fd >= 0 && storage->native_fds)
+        fchmod(a.out_fd, mode);
+    if (a.out_fd < 0)
+    {
+        storage->close(a.basis_fd);
+        send_response(client_socket, 550, "Cannot create temporary file.");
+        return -1;
+    }
+    delta_reader r = {session, -1, xfer_buffer_alloc(), 0, 0, 0};
+    a.copy_buf = xfer_buffer_alloc();
+    checksum_init(&a.hash, CHECKSUM_XXH64);
+
+    send_response(client_socket, 150, "Ready to receive delta.");
+    scoreboard_set_state(SB_STATE_TRANSFER);
+    uint64_t start_us = realtime_us();
+    uint64_t start_mono = monotonic_us();
+    r.data_socket = establish_data_connection(session, 0);
+
+    int rc = -1;
+    if (r.data_socket >= 0 && r.buf != NULL && a.copy_buf != NULL)
+    {
+        uint64_t span = trace_begin();
+        rc = run_delta(&r, &a);
+        trace_end("delta_apply", span, a.out_size);
+    }
+    if (a.hash.alg != CHECKSUM_NONE)
+    {
+        char discard[CHECKSUM_HEX_MAX];
+        checksum_final(&a.hash, discard, sizeof(discard));
+    }
+    xfer_buffer_free(r.buf);
+    xfer_buffer_free(a.copy_buf);
+    storage->close(a.basis_fd);
+    storage->close(a.out_fd);
+
+    if (rc == 0 && storage->rename(tmp_path, full_path) != 0)
+        rc = -2;
+    if (rc != 0)
+        storage->unlink(tmp_path);
+    statcache_invalidate(full_path);
+
+    if (r.data_socket < 0)
+    {
+        send_response(client_socket, 425, "Failed to establish data connection.");
+        log_transfer(session, 'i', full_path, start_us, start_mono, 0, 425, XFER_PATH_DELTA);
+        scoreboard_set_state(SB_STATE_IDLE);
+        return -1;
+    }
+    release_data_connection(session, r.data_socket, rc == 0, 0);
+    session->bytes_transferred += r.bytes;
+    if (rc == 0)
+    {
+        char message[128];
+        snprintf(message, sizeof(message), "Delta applied, %llu literal bytes, %llu bytes reused.",
+                 (unsigned long long)a.literal, (unsigned long long)a.reused);
+        send_response(client_socket, 226, message);
+        log_transfer(session, 'i', full_path, start_us, start_mono, r.bytes, 226, XFER_PATH_DELTA);
+        replica_submit(full_path);
+    }
+    else if (rc == -2)
+    {
+        send_response(client_socket, 451, "Invalid delta or verification failed; file unchanged.");
+        log_transfer(session, 'i', full_path, start_us, start_mono, r.bytes, 451, XFER_PATH_DELTA);
+    }
+    else
+    {
+        send_response(client_socket, 426, "Connection closed; transfer aborted.");
+        log_transfer(session, 'i', full_path, start_us, start_mono, r.bytes, 426, XFER_PATH_DELTA);
+    }
+    scoreboard_set_state(SB_STATE_IDLE);
+    return rc == 0 ? 0 : -1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 增量上传（rsync 算法），服务器与 C 客户端共用本文件中的协议定义：
+ *  SITE SIGS <块大小> <文件>  服务器通过数据连接发送已有文件的块签名
+ *  SITE DELTA <文件>          客户端通过数据连接发送增量指令，服务器以已有文件为基础生成新版本，
+ *                             校验通过后原子替换原文件
+ * 客户端用滚动校验和在本地文件的每个字节偏移上查找与服务器块签名相同的块，
+ * 只有找不到匹配的部分才作为字面数据发送。
+ *
+ * 数据流中的整数均为小端序：
+ *  签名流：delta_sig_header，之后每块一个 delta_sig（最后一块可能不足一个块大小）
+ *  增量流：delta_header，之后是若干条指令，每条以一个字节的操作码开头：
+ *    'L' u32 长度，随后是该长度的字面数据
+ *    'B' u64 起始块号，u32 块数：复制原文件中的连续块
+ *    'E' u64 新文件长度，u64 新文件的 XXH64：结束，服务器据此校验结果
+ */
+
+#define DELTA_SIG_MAGIC 0x31475346u   // "FSG1"
+#define DELTA_MAGIC 0x314C4446u       // "FDL1"
+#define DELTA_MIN_BLOCK 512           // 块大小下限
+#define DELTA_MAX_BLOCK (1 << 20)     // 块大小上限
+#define DELTA_MAX_LITERAL (1 << 20)   // 单条字面指令的最大长度
+
+#define DELTA_OP_LITERAL 'L'
+#define DELTA_OP_BLOCKS 'B'
+#define DELTA_OP_END 'E'
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;      // DELTA_SIG_MAGIC
+    uint32_t block_size;
+    uint64_t file_size;  // 原文件大小，决定块数
+} delta_sig_header;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t weak;   // 滚动校验和
+    uint64_t strong; // 块内容的 XXH64
+} delta_sig;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;      // DELTA_MAGIC
+    uint32_t block_size; // 必须与 SITE SIGS 使用的块大小相同
+} delta_header;
+
+/**
+ * rsync 的弱校验和：低16位为字节和，高16位为按位置加权的字节和
+ */
+static inline uint32_t delta_weak(const uint8_t *p, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        a += p[i];
+        b += (uint32_t)(len - i) * p[i];
+    }
+    return (a & 0xFFFF) | (b << 16);
+}
+
+/**
+ * 窗口向后滑动一个字节：移出 out，移入 in，窗口长度为 len
+ */
+static inline uint32_t delta_roll(uint32_t sum, uint8_t out, uint8_t in, size_t len)
+{
+    uint32_t a = (sum & 0xFFFF) - out + in;
+    uint32_t b = (sum >> 16) - (uint32_t)len * out + a;
+    return (a & 0xFFFF) | (b << 16);
+}
@@ -1,8 +1,21 @@
 #include "file.h"
+#include "xferlog.h"
+#include "scoreboard.h"
+#include "tls.h"
+#include "pool.h"
+#include "trace.h"
+#include "storage.h"
+#include "statcache.h"
+#include "control.h"
+#include "replica.h"
 #include <regex.h>
 #include <stdlib.h>
 #include <fcntl.h>
-#include <dirent.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <sys/sendfile.h>
 
 /**
  * 检查给定的相对路径相对于给定的根目录是否安全，防止目录遍历攻击
@@ -39,13 +52,14 @@ int is_path_safe(const char *root, const char *path)
     }
 
     // 将路径分解为组件，处理 "." 和 ".."
-    char normalized[1024] = {0};
-    char *components[256];
+    // path 可以是会话当前目录与客户端参数拼接而成的 PATH_MAX 长路径，重建时按缓冲区大小截止
+    char normalized[PATH_MAX];
+    char *components[PATH_MAX / 2];
     int count = 0;
 
-    // 分解路径
+    // 分解路径（"/a" 至少两个字节，组件数不会超过 PATH_MAX / 2）
     char *token = strtok(path_copy, "/\\");
-    while (token != NULL && count < 256)
+    while (token != NULL && count < (int)(sizeof(components) / sizeof(components[0])))
     {
         if (strcmp(token, ".") == 0)
         {
@@ -67,12 +81,19 @@ int is_path_safe(const char *root, const char *path)
         token = strtok(NULL, "/\\");
     }
 
+    // 组件过多（未处理完）或重建后超出缓冲区的路径一律视为不安全
+    int overflow = token != NULL;
+
     // 重建规范化路径
+    size_t used = 0;
     normalized[0] = '\0';
-    for (int i = 0; i < count; i++)
+    for (int i = 0; i < count && !overflow; i++)
     {
-        strcat(normalized, "/");
-        strcat(normalized, components[i]);
+        int n = snprintf(normalized + used, sizeof(normalized) - used, "/%s", components[i]);
+        if (n < 0 || (size_t)n >= sizeof(normalized) - used)
+            overflow = 1;
+        else
+            used += (size_t)n;
     }
 
     // 如果路径为空，设置为根目录
@@ -82,7 +103,7 @@ int is_path_safe(const char *root, const char *path)
     }
 
     // 检查规范化后的路径是否以 root 开头
-    int is_safe = (strncmp(normalized, root_copy, root_len) == 0) &&
+    int is_safe = !overflow && (strncmp(normalized, root_copy, root_len) == 0) &&
                   (normalized[root_len] == '\0' ||
                    normalized[root_len] == '/' ||
                    normalized[root_len] == '\\');
@@ -93,6 +114,278 @@ int is_path_safe(const char *root, const char *path)
     return is_safe;
 }
 
+/**
+ * 原地规范化绝对路径：合并重复的斜杠，去掉 "." 组件，".." 回退一级（不会越过 "/"）
+ * 内存后端按组件逐级查找，不能把 ".." 交给内核解析
+ * @param path 以 '/' 开头的绝对路径
+ */
+static void normalize_path(char *path)
+{
+    char *w = path; // 写指针始终不超过读指针
+    const char *r = path;
+    while (*r != '\0')
+    {
+        while (*r == '/')
+            r++;
+        if (*r == '\0')
+            break;
+        const char *end = r;
+        while (*end != '\0' && *end != '/')
+            end++;
+        size_t n = (size_t)(end - r);
+        if (n == 1 && r[0] == '.')
+        {
+            // 跳过当前目录
+        }
+        else if (n == 2 && r[0] == '.' && r[1] == '.')
+        {
+            while (w > path && *--w != '/')
+                ; // 回到上一个组件之前
+        }
+        else
+        {
+            *w++ = '/';
+            memmove(w, r, n);
+            w += n;
+        }
+        r = end;
+    }
+    if (w == path)
+        *w++ = '/';
+    *w = '\0';
+}
+
+/**
+ * 将客户端给出的路径解析为规范化的绝对路径并做安全检查
+ * 相对路径相对于会话的当前目录，而不是进程的工作目录
+ * @param session 会话状态
+ * @param arg 客户端给出的路径，可以是相对路径或绝对路径
+ * @param out 输出的绝对路径
+ * @param outsz 输出缓冲区大小
+ * @return 0 成功，-1 路径过长，-2 路径不安全
+ */
+int resolve_path(connection *session, const char *arg, char *out, size_t outsz)
+{
+    int len;
+    if (arg[0] == '/')
+        len = snprintf(out, outsz, "%s", arg);
+    else
+        len = snprintf(out, outsz, "%s/%s", session->cwd, arg);
+    if (len < 0 || len >= (int)outsz)
+        return -1;
+    normalize_path(out);
+    uint64_t span = trace_begin();
+    int safe = is_path_safe(session->root_dir, out);
+    trace_end("path_check", span, 0);
+    return safe ? 0 : -2;
+}
+
+/**
+ * 解析路径，失败时直接向客户端发送 550 响应
+ * @return 0 成功，-1 失败（已响应）
+ */
+int resolve_path_or_reply(int client_socket, connection *session, const char *arg, char *out, size_t outsz)
+{
+    if (arg[0] == '\0')
+    {
+        send_response(client_socket, 501, "Syntax error in parameters or arguments.");
+        return -1;
+    }
+    switch (resolve_path(session, arg, out, outsz))
+    {
+    case 0:
+        return 0;
+    case -1:
+        send_response(client_socket, 550, "Resulting path is too long.");
+        return -1;
+    default:
+        send_response(client_socket, 550, "Permission denied or invalid path.");
+        return -1;
+    }
+}
+
+/**
+ * 向传输日志提交一条记录（未启用传输日志时不做任何事）
+ * @param session 会话状态
+ * @param direction 'o' 表示下载，'i' 表示上传
+ * @param path 文件的绝对路径
+ * @param start_us 传输开始的 Unix 时间（微秒）
+ * @param start_mono 传输开始的单调时钟时间（微秒）
+ * @param bytes 实际传输的字节数
+ * @param result_code 最终响应码
+ * @param xfer_path 使用的传输路径
+ */
+void log_transfer(connection *session, char direction, const char *path, uint64_t start_us,
+                  uint64_t start_mono, uint64_t bytes, int result_code, xfer_path_t xfer_path)
+{
+    if (!xferlog_enabled())
+        return;
+
+    xfer_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.start_us = start_us;
+    rec.duration_us = monotonic_us() - start_mono;
+    rec.bytes = bytes;
+    rec.client_ip = session->peer_addr.sin_addr;
+    rec.client_port = ntohs(session->peer_addr.sin_port);
+    rec.result_code = (uint16_t)result_code;
+    rec.direction = direction;
+    rec.xfer_path = (uint8_t)xfer_path;
+    snprintf(rec.path, sizeof(rec.path), "%s", path);
+    if (session->tcp.valid)
+    {
+        // 数据连接关闭前采样的 TCP 参数与结果
+        snprintf(rec.tcp_cc, sizeof(rec.tcp_cc), "%s", session->tcp.cc);
+        rec.tcp_rtt_us = session->tcp.rtt_us;
+        rec.tcp_buf = session->tcp.buf;
+        rec.tcp_retrans = session->tcp.retrans;
+        rec.tcp_delivery_rate = session->tcp.delivery_rate;
+        session->tcp.valid = 0;
+    }
+    xferlog_submit(&rec);
+}
+
+/**
+ * 将文件内容从当前偏移开始发送到数据连接，优先使用 sendfile(2) 零拷贝，
+ * 文件不支持 sendfile 时回退到 read/send。MODE B 下每块先发送块头，再用 sendfile 发送块内容。
+ * TLS 数据连接只有在发送方向已交给 kTLS 时才能使用 sendfile，否则走用户态加密；
+ * 存储后端的句柄不是内核文件描述符时（内存后端）只能通过后端的 read 读取；
+ * 会话要求计算摘要（session->xfer_hash）时同样走 read/send，数据经过缓冲区时顺带计算
+ * @param session 会话状态
+ * @param data_socket 数据连接socket
+ * @param file_fd 已打开的文件
+ * @param length 要发送的字节数，-1 表示一直发送到文件末尾
+ * @param restart_markers MODE B 下是否定期插入重启标记（内容为文件偏移）
+ * @param sent 输出已发送的字节数（出错时为出错前已发送的部分）
+ * @param path_used 输出实际使用的传输路径
+ * @return 0 成功（文件提前结束时 sent 小于 length），-1 读取或发送失败
+ */
+int send_file_data(connection *session, int data_socket, int file_fd, int64_t length, int restart_markers,
+                   uint64_t *sent, xfer_path_t *path_used)
+{
+    int tls = tls_active(data_socket);
+    int zero_copy = storage->native_fds && session->xfer_hash == NULL && (!tls || tls_ktls_send(data_socket));
+    int block = session->transfer_mode == TRANSFER_MODE_BLOCK && zero_copy;
+    uint64_t next_marker = RESTART_MARKER_INTERVAL;
+    *sent = 0;
+    *path_used = tls ? XFER_PATH_KTLS_SENDFILE : XFER_PATH_SENDFILE;
+
+    if (block)
+    {
+        // MODE B 的块头必须声明准确长度，因此按文件大小确定要发送的字节数
+        struct stat st;
+        if (fstat(file_fd, &st) != 0)
+            return -1;
+        off_t pos = lseek(file_fd, 0, SEEK_CUR);
+        if (!S_ISREG(st.st_mode) || pos < 0)
+            block = 0; // 非普通文件，交给下面的 read/send 路径逐块发送
+        else if (length < 0 || length > st.st_size - pos)
+            length = st.st_size > pos ? st.st_size - pos : 0;
+    }
+
+    while (block && (int64_t)*sent < length)
+    {
+        size_t chunk = (size_t)(length - *sent) < BLOCK_MAX_SIZE ? (size_t)(length - *sent) : BLOCK_MAX_SIZE;
+        if (data_write_block_header(data_socket, 0, chunk) != 0)
+            return -1;
+        size_t done = 0;
+        uint64_t span = trace_begin();
+        while (done < chunk)
+        {
+            ssize_t n = sendfile(data_socket, file_fd, NULL, chunk - done);
+            if (n <= 0)
+                return -1; // 文件在发送过程中变短，块已无法补齐
+            done += n;
+        }
+        trace_end("sendfile", span, chunk);
+        *sent += chunk;
+        scoreboard_add_bytes(chunk);
+        tcptune_adapt(&session->tcp, data_socket, *sent);
+        if (restart_markers && *sent >= next_marker)
+        {
+            if (data_write_marker(session, data_socket, lseek(file_fd, 0, SEEK_CUR)) != 0)
+                return -1;
+            next_marker += RESTART_MARKER_INTERVAL;
+        }
+    }
+    if (block)
+        return 0;
+
+    while (zero_copy && (length < 0 || (int64_t)*sent < length))
+    {
+        size_t chunk = SENDFILE_CHUNK_SIZE;
+        if (length >= 0 && (uint64_t)(length - *sent) < chunk)
+            chunk = (size_t)(length - *sent);
+        uint64_t span = trace_begin();
+        ssize_t n = sendfile(data_socket, file_fd, NULL, chunk);
+        trace_end("sendfile", span, n > 0 ? n : 0);
+        if (n < 0)
+        {
+            if (*sent == 0 && (errno == EINVAL || errno == ENOSYS))
+                break; // 该文件不支持 sendfile，改用 read/send
+            return -1;
+        }
+        if (n == 0)
+            return 0; // 文件结束
+        *sent += n;
+        scoreboard_add_bytes(n);
+        tcptune_adapt(&session->tcp, data_socket, *sent);
+    }
+    if (length >= 0 && (int64_t)*sent >= length)
+        return 0;
+
+    *path_used = tls ? XFER_PATH_TLS_READ_SEND : XFER_PATH_READ_SEND;
+    char *buffer = xfer_buffer_alloc();
+    if (buffer == NULL)
+        return -1;
+    int rc = 0;
+    while (length < 0 || (int64_t)*sent < length)
+    {
+        size_t want = BUFFER_SIZE;
+        if (length >= 0 && (uint64_t)(length - *sent) < want)
+            want = (size_t)(length - *sent);
+        uint64_t span = trace_begin();
+        ssize_t bytes_read = storage->read(file_fd, buffer, want);
+        trace_end("disk_read", span, bytes_read > 0 ? bytes_read : 0);
+        if (bytes_read <= 0)
+        {
+            rc = bytes_read < 0 ? -1 : 0; // 读取失败或文件结束
+            break;
+        }
+        if (session->xfer_hash != NULL)
+            checksum_update(session->xfer_hash, buffer, bytes_read);
+        span = trace_begin();
+        int send_rc = data_write(session, data_socket, buffer, bytes_read);
+        trace_end("send", span, bytes_read);
+        if (send_rc != 0)
+        {
+            rc = -1; // 发送失败
+            break;
+        }
+        *sent += bytes_read;
+        scoreboard_add_bytes(bytes_read);
+        tcptune_adapt(&session->tcp, data_socket, *sent);
+    }
+    xfer_buffer_free(buffer);
+    return rc;
+}
+
+/**
+ * 发送传输完成的 226 响应，计算了摘要时附在响应中
+ * @param digest 十六进制摘要，空字符串表示未计算
+ */
+static void send_transfer_complete(int client_socket, connection *session, const char *digest)
+{
+    if (digest[0] == '\0')
+    {
+        send_response(client_socket, 226, "Transfer complete.");
+        return;
+    }
+    char message[CHECKSUM_HEX_MAX + 64];
+    snprintf(message, sizeof(message), "Transfer complete. %s %s", checksum_name(session->hash_alg), digest);
+    send_response(client_socket, 226, message);
+}
+
 /**
  * 处理RETR命令，发送文件给客户端，也即下载
  * @param client_socket 控制连接socket
@@ -103,81 +396,86 @@ int is_path_safe(const char *root, const char *path)
 int handle_retr_command(int client_socket, connection *session, const char *filename)
 {
     char full_path[PATH_MAX];
-    char *current_dir = getcwd(NULL, 0);
-    int len = snprintf(full_path, sizeof(full_path), "%s/%s", current_dir, filename);
-    if (len < 0 || len >= (int)sizeof(full_path))
-    {
-        send_response(client_socket, 550, "Filename is too long.");
+    if (resolve_path_or_reply(client_socket, session, filename, full_path, sizeof(full_path)) != 0)
         return -1;
-    }
-    if (!is_path_safe(session->root_dir, full_path))
+    uint64_t span = trace_begin();
+    int file_fd = storage->open(full_path, O_RDONLY, 0);
+    trace_end("open", span, 0);
+    if (file_fd < 0)
     {
-        send_response(client_socket, 550, "Permission denied or invalid path.");
+        send_response(client_socket, 550, "Failed to open file.");
         return -1;
     }
-    int file_fd = open(full_path, O_RDONLY);
-    if (file_fd < 0)
+
+    // REST 设置了重启偏移时从该处继续发送
+    uint64_t offset = session->restart_offset;
+    session->restart_offset = 0;
+    if (offset > 0 && storage->lseek(file_fd, (off_t)offset, SEEK_SET) < 0)
     {
-        send_response(client_socket, 550, "Failed to open file.");
+        storage->close(file_fd);
+        send_response(client_socket, 554, "Invalid restart offset.");
         return -1;
     }
 
     // 发送代码150的初始响应，准备传输
     send_response(client_socket, 150, "Opening data connection for file transfer.");
+    uint64_t start_us = realtime_us();
+    uint64_t start_mono = monotonic_us();
 
     // 建立数据连接
-    int data_socket = establish_data_connection(session);
+    int data_socket = establish_data_connection(session, 1);
     if (data_socket < 0)
     {
-        close(file_fd);
+        storage->close(file_fd);
         send_response(client_socket, 425, "Data connection failed.");
+        log_transfer(session, 'o', full_path, start_us, start_mono, 0, 425, XFER_PATH_READ_SEND);
         return -1;
     }
 
-    // 传输文件内容
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
-    int transfer_ok = 1; // 传输状态标志
-    ssize_t total_sent = 0;
-    while ((bytes_read = read(file_fd, buffer, sizeof(buffer))) > 0)
-    {
-        ssize_t sent_bytes = 0;
-        while (sent_bytes < bytes_read)
-        {
-            ssize_t n = send(data_socket, buffer + sent_bytes, bytes_read - sent_bytes, 0);
-            if (n < 0)
-            {
-                transfer_ok = 0; // 发送失败
-                break;
-            }
-            sent_bytes += n;
-        }
-        if (!transfer_ok) // 发送失败
-            break;        // 退出外层循环
+    // 传输期间由监视线程响应控制连接上的 ABOR/STAT/NOOP
+    struct stat file_st;
+    int64_t expected = -1; // 要发送的字节数，STAT 据此给出百分比
+    if (storage->fstat(file_fd, &file_st) == 0 && S_ISREG(file_st.st_mode) && file_st.st_size > (off_t)offset)
+        expected = (int64_t)(file_st.st_size - (off_t)offset);
+    control_watch_start(client_socket, data_socket, "RETR", filename, expected);
 
-        total_sent += bytes_read;
-    }
-
-    if (bytes_read < 0)
+    // 传输文件内容，需要时同时计算摘要
+    uint64_t total_sent = 0;
+    xfer_path_t xfer_path = XFER_PATH_SENDFILE;
+    checksum_state hash;
+    if (session->hash_alg != CHECKSUM_NONE && checksum_init(&hash, session->hash_alg) == 0)
+        session->xfer_hash = &hash;
+    int transfer_ok = send_file_data(session, data_socket, file_fd, -1, 1, &total_sent, &xfer_path) == 0; // 传输状态标志
+    if (control_watch_stop())
+        transfer_ok = 0; // 被 ABOR 中断
+    char digest[CHECKSUM_HEX_MAX] = "";
+    if (session->xfer_hash != NULL)
     {
-        transfer_ok = 0; // 读取失败
+        session->xfer_hash = NULL;
+        checksum_final(&hash, digest, sizeof(digest));
+        // 完整读出了整个文件时顺便保存摘要，之后的 HASH 查询不必重读
+        struct stat st;
+        if (transfer_ok && offset == 0 && storage->native_fds && fstat(file_fd, &st) == 0 &&
+            (uint64_t)st.st_size == total_sent)
+            checksum_store_xattr(file_fd, session->hash_alg, digest);
     }
 
-    // 关闭数据连接和文件
-    close(data_socket);
-    close(file_fd);
-    session->mode = DATA_CONN_MODE_NONE; // 重置数据连接模式
+    // 关闭（MODE B 下保持）数据连接，关闭文件
+    release_data_connection(session, data_socket, transfer_ok, 1);
+    storage->close(file_fd);
 
     // 最终响应
     if (transfer_ok)
     {
-        session->bytes_transferred += (int)total_sent; // 统计已传输字节数
-        send_response(client_socket, 226, "Transfer complete.");
+        session->bytes_transferred += total_sent; // 统计已传输字节数
+        send_transfer_complete(client_socket, session, digest);
+        log_transfer(session, 'o', full_path, start_us, start_mono, total_sent, 226, xfer_path);
         return 0;
     }
     else
     {
         send_response(client_socket, 426, "Connection closed; transfer aborted.");
+        log_transfer(session, 'o', full_path, start_us, start_mono, total_sent, 426, xfer_path);
         return -1;
     }
 }
@@ -191,54 +489,83 @@ int handle_retr_command(int client_socket, connection *session, const char *file
  */
 int handle_stor_command(int client_socket, connection *session, const char *filename)
 {
-    // 拼接文件的完整路径（绝对路径）
-    char *current_dir = getcwd(NULL, 0);
+    // 1. 拼接文件的完整路径（绝对路径）并做安全检查
     char full_path[PATH_MAX];
-    snprintf(full_path, sizeof(full_path), "%s/%s", current_dir, filename);
-    // 1. 安全检查：路径是否合法
-    if (!is_path_safe(session->root_dir, full_path))
-    {
-        send_response(client_socket, 550, "Permission denied or invalid path.");
+    if (resolve_path_or_reply(client_socket, session, filename, full_path, sizeof(full_path)) != 0)
         return -1;
-    }
 
     // 2. 文件检查：尝试以只写、创建、清空的方式打开文件
     // 0644 是文件权限：所有者可读写，组用户和其他用户只读
-    int file_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    // REST 设置了重启偏移时不清空，从该偏移处继续写入
+    uint64_t offset = session->restart_offset;
+    session->restart_offset = 0;
+    uint64_t span = trace_begin();
+    int file_fd = storage->open(full_path, O_WRONLY | O_CREAT | (offset > 0 ? 0 : O_TRUNC), 0644);
+    trace_end("open", span, 0);
     if (file_fd < 0)
     {
         // 无法创建或写入文件
         send_response(client_socket, 550, "Cannot create or write to file.");
         return -1;
     }
+    statcache_invalidate(full_path); // 文件可能是新建或被清空的
+    if (offset > 0 && storage->lseek(file_fd, (off_t)offset, SEEK_SET) < 0)
+    {
+        storage->close(file_fd);
+        send_response(client_socket, 554, "Invalid restart offset.");
+        return -1;
+    }
 
     // 3. 发送初始响应 (Mark): 告诉客户端准备就绪
     send_response(client_socket, 150, "Ready to receive data.");
+    uint64_t start_us = realtime_us();
+    uint64_t start_mono = monotonic_us();
 
     // 4. 建立数据连接
-    int data_socket = establish_data_connection(session);
+    int data_socket = establish_data_connection(session, 0);
     if (data_socket < 0)
     {
         // 数据连接建立失败
         send_response(client_socket, 425, "Failed to establish data connection.");
-        close(file_fd);
-        remove(filename); // 清理掉创建的空文件
+        storage->close(file_fd);
+        if (offset == 0)
+            storage->unlink(full_path); // 清理掉创建的空文件
+        statcache_invalidate(full_path);
+        log_transfer(session, 'i', full_path, start_us, start_mono, 0, 425, XFER_PATH_RECV_WRITE);
         return -1;
     }
 
-    // 5. 接收文件内容
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
-    int transfer_ok = 1; // 传输状态标志
+    // 5. 接收文件内容，期间由监视线程响应控制连接上的 ABOR/STAT/NOOP
+    control_watch_start(client_socket, data_socket, "STOR", filename, -1);
+    char *buffer = xfer_buffer_alloc();
+    ssize_t bytes_read = -1;
+    int transfer_ok = 1;    // 传输状态标志
+    ssize_t total_recv = 0; // 已接收字节数
+    xfer_path_t xfer_path = tls_active(data_socket) ? XFER_PATH_TLS_RECV_WRITE : XFER_PATH_RECV_WRITE;
+    checksum_state hash;
+    int hashing = session->hash_alg != CHECKSUM_NONE && checksum_init(&hash, session->hash_alg) == 0;
 
-    while ((bytes_read = read(data_socket, buffer, sizeof(buffer))) > 0)
+    while (buffer != NULL)
     {
-        if (write(file_fd, buffer, bytes_read) != bytes_read)
+        span = trace_begin();
+        bytes_read = data_read(session, data_socket, buffer, BUFFER_SIZE);
+        trace_end("recv", span, bytes_read > 0 ? bytes_read : 0);
+        if (bytes_read <= 0)
+            break;
+        span = trace_begin();
+        ssize_t written = storage->write(file_fd, buffer, bytes_read);
+        trace_end("disk_write", span, bytes_read);
+        if (written != bytes_read)
         {
             // 写入本地文件失败
             transfer_ok = 0;
             break;
         }
+        if (hashing)
+            checksum_update(&hash, buffer, bytes_read);
+        total_recv += bytes_read;
+        scoreboard_add_bytes(bytes_read);
+        tcptune_adapt(&session->tcp, data_socket, total_recv);
     }
 
     // 检查是否是从数据连接读取时出错
@@ -246,22 +573,43 @@ int handle_stor_command(int client_socket, connection *session, const char *file
     {
         transfer_ok = 0;
     }
+    // ABOR 关闭数据连接后 recv 返回 0，与正常结束无法区分，以监视线程的结果为准
+    if (control_watch_stop())
+        transfer_ok = 0;
+    xfer_buffer_free(buffer);
 
-    // 6. 关闭数据连接和文件
-    close(data_socket);
-    close(file_fd);
-    session->mode = DATA_CONN_MODE_NONE; // 重置数据连接模式
+    // 6. 关闭（MODE B 下保持）数据连接，保存摘要（只有从头上传的完整文件才保存），关闭文件
+    release_data_connection(session, data_socket, transfer_ok, 0);
+    char digest[CHECKSUM_HEX_MAX] = "";
+    if (hashing)
+    {
+        checksum_final(&hash, digest, sizeof(digest));
+        // 与 RETR 相同，文件大小与收到的字节数一致才保存，防止另一个会话同时写入同一文件
+        struct stat st;
+        if (transfer_ok && offset == 0 && storage->native_fds && fstat(file_fd, &st) == 0 &&
+            st.st_size == total_recv)
+            checksum_store_xattr(file_fd, session->hash_alg, digest);
+    }
+    storage->close(file_fd);
+    statcache_invalidate(full_path);
 
     // 7. 发送最终响应
     if (transfer_ok)
     {
-        session->bytes_transferred += bytes_read; // 统计已传输字节数
-        send_response(client_socket, 226, "Transfer complete.");
+        session->bytes_transferred += total_recv; // 统计已传输字节数
+        send_transfer_complete(client_socket, session, digest);
+        log_transfer(session, 'i', full_path, start_us, start_mono, total_recv, 226, xfer_path);
+        replica_submit(full_path);
     }
     else
     {
         send_response(client_socket, 426, "Connection closed; transfer aborted.");
-        remove(filename); // 清理掉传输不完整的文件
+        if (offset == 0)
+        {
+            storage->unlink(full_path); // 清理掉传输不完整的文件；续传时保留已有部分
+            statcache_invalidate(full_path);
+        }
+        log_transfer(session, 'i', full_path, start_us, start_mono, total_recv, 426, xfer_path);
     }
 
     return 0;
@@ -269,6 +617,7 @@ int handle_stor_command(int client_socket, connection *session, const char *file
 
 /**
  * 处理 CWD (Change Working Directory) 命令
+ * 当前目录保存在会话中，进程始终停留在根目录，因此同样适用于非本地的存储后端
  * @param client_socket 客户端控制连接
  * @param path 客户端请求切换到的目录路径，可以是相对路径或绝对路径
  * @return 0 表示成功处理, -1 表示处理失败
@@ -276,41 +625,18 @@ int handle_stor_command(int client_socket, connection *session, const char *file
 int handle_cwd_command(int client_socket, connection *session, const char *path)
 {
     char new_dir[PATH_MAX];
-    // 分别处理绝对路径和相对路径
-    if (path[0] == '/')
-    {
-        // 绝对路径
-        if (is_path_safe(session->root_dir, path))
-        {
-            chdir(path);
-            send_response(client_socket, 250, "Directory successfully changed.");
-            return 0;
-        }
-        else
-        {
-            send_response(client_socket, 550, "Permission denied or invalid path.");
-            return -1;
-        }
-    }
-    else
-    {
-        // 相对路径
-        char *current_dir = getcwd(NULL, 0);
-        snprintf(new_dir, sizeof(new_dir), "%s/%s", current_dir, path);
-        free(current_dir);
+    if (resolve_path_or_reply(client_socket, session, path, new_dir, sizeof(new_dir)) != 0)
+        return -1;
 
-        if (is_path_safe(session->root_dir, new_dir))
-        {
-            chdir(new_dir);
-            send_response(client_socket, 250, "Directory successfully changed.");
-            return 0;
-        }
-        else
-        {
-            send_response(client_socket, 550, "Permission denied or invalid path.");
-            return -1;
-        }
+    struct stat st;
+    if (statcache_stat(new_dir, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        send_response(client_socket, 550, "Failed to change directory.");
+        return -1;
     }
+    snprintf(session->cwd, PATH_MAX, "%s", new_dir);
+    send_response(client_socket, 250, "Directory successfully changed.");
+    return 0;
 }
 
 /**
@@ -321,20 +647,10 @@ int handle_cwd_command(int client_socket, connection *session, const char *path)
  */
 int handle_pwd_command(int client_socket, connection *session)
 {
-    char cwd[PATH_MAX];
-    if (getcwd(cwd, sizeof(cwd)) != NULL)
-    {
-        char *return_cwd = (char *)malloc(strlen(cwd) + 3);
-        sprintf(return_cwd, "\"%s\"", cwd);
-        send_response(client_socket, 257, return_cwd);
-        free(return_cwd);
-        return 0;
-    }
-    else
-    {
-        send_response(client_socket, 550, "Failed to get current directory.");
-        return -1;
-    }
+    char return_cwd[PATH_MAX + 3];
+    snprintf(return_cwd, sizeof(return_cwd), "\"%s\"", session->cwd);
+    send_response(client_socket, 257, return_cwd);
+    return 0;
 }
 
 /**
@@ -347,19 +663,14 @@ int handle_pwd_command(int client_socket, connection *session)
 int handle_mkd_command(int client_socket, connection *session, const char *dirname)
 {
     char full_path[PATH_MAX];
-    char *current_dir = getcwd(NULL, 0);
-    snprintf(full_path, sizeof(full_path), "%s/%s", current_dir, dirname);
-    if (!is_path_safe(session->root_dir, full_path))
-    {
-        send_response(client_socket, 550, "Permission denied or invalid path.");
+    if (resolve_path_or_reply(client_socket, session, dirname, full_path, sizeof(full_path)) != 0)
         return -1;
-    }
-    if (mkdir(full_path, 0755) == 0)
+    if (storage->mkdir(full_path, 0755) == 0)
     {
-        char *return_path = (char *)malloc(strlen(full_path) + 3);
-        sprintf(return_path, "\"%s\"", full_path);
+        statcache_invalidate(full_path);
+        char return_path[PATH_MAX + 3];
+        snprintf(return_path, sizeof(return_path), "\"%s\"", full_path);
         send_response(client_socket, 257, return_path);
-        free(return_path);
         return 0;
     }
     else
@@ -379,15 +690,11 @@ int handle_mkd_command(int client_socket, connection *session, const char *dirna
 int handle_rmd_command(int client_socket, connection *session, const char *dirname)
 {
     char full_path[PATH_MAX];
-    char *current_dir = getcwd(NULL, 0);
-    snprintf(full_path, sizeof(full_path), "%s/%s", current_dir, dirname);
-    if (!is_path_safe(session->root_dir, full_path))
-    {
-        send_response(client_socket, 550, "Permission denied or invalid path.");
+    if (resolve_path_or_reply(client_socket, session, dirname, full_path, sizeof(full_path)) != 0)
         return -1;
-    }
-    if (rmdir(full_path) == 0)
+    if (storage->rmdir(full_path) == 0)
     {
+        statcache_invalidate_tree(full_path);
         send_response(client_socket, 250, "Directory removed successfully.");
         return 0;
     }
@@ -398,107 +705,768 @@ int handle_rmd_command(int client_socket, connection *session, const char *dirna
     }
 }
 
+#define LIST_BATCH_LINES 4096         // 每批最多缓存的目录项数
+#define LIST_BATCH_BYTES (512 * 1024) // 每批格式化文本的上限
+
+typedef struct
+{
+    uint32_t off;      // 行在批次文本中的偏移
+    uint32_t len;      // 行长度，含结尾的 CRLF
+    uint32_t name_off; // 文件名在行中的偏移，用于排序
+} list_line;
+
+typedef struct
+{
+    connection *session;
+    int data_socket;
+    int unsorted;     // LIST -U 或目录项超过一批：按目录中的原始顺序直接发送
+    int send_failed;  // 数据连接写入失败，停止遍历
+    time_t now;
+    char *text;       // 本批已格式化的行
+    size_t used;
+    list_line *lines;
+    size_t count;
+    char *out;        // 排序后拼接发送用的传输缓冲区
+} list_ctx;
+
+/**
+ * 按 ls -l 的格式生成一行目录项：半年内的文件显示时分，否则显示年份
+ * @return 写入的长度（不含结尾的 '\0'），文件名在行中的偏移由 name_off 输出
+ */
+static int format_list_line(char *out, size_t outsz, const char *name, const struct stat *st, time_t now,
+                            uint32_t *name_off)
+{
+    static const char rwx[] = "rwxrwxrwx";
+    char perms[11];
+    perms[0] = S_ISDIR(st->st_mode) ? 'd' : S_ISLNK(st->st_mode) ? 'l' : '-';
+    for (int i = 0; i < 9; i++)
+        perms[i + 1] = (st->st_mode & (0400 >> i)) ? rwx[i] : '-';
+    perms[10] = '\0';
+
+    char date[16];
+    struct tm tm;
+    localtime_r(&st->st_mtime, &tm);
+    int recent = st->st_mtime > now - 15778476 && st->st_mtime < now + 3600;
+    strftime(date, sizeof(date), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+
+    int prefix = snprintf(out, outsz, "%s %3lu ftp      ftp      %8lld %s ", perms, (unsigned long)st->st_nlink,
+                          (long long)st->st_size, date);
+    *name_off = (uint32_t)prefix;
+    return prefix + snprintf(out + prefix, outsz - prefix, "%s\r\n", name);
+}
+
+static int compare_list_line(const void *a, const void *b, void *arg)
+{
+    const list_line *x = a, *y = b;
+    const char *text = arg;
+    return strcmp(text + x->off + x->name_off, text + y->off + y->name_off);
+}
+
+/**
+ * 把当前批次写到数据连接：不排序时文本本身就是发送顺序，一次写出；
+ * 否则先按文件名排序，再拼接到传输缓冲区中成块发送
+ * @return 0 成功，-1 数据连接写入失败
+ */
+static int flush_list_batch(list_ctx *ctx)
+{
+    int rc = 0;
+    if (ctx->count == 0)
+        return 0;
+    if (ctx->unsorted)
+    {
+        rc = data_write(ctx->session, ctx->data_socket, ctx->text, ctx->used);
+    }
+    else
+    {
+        qsort_r(ctx->lines, ctx->count, sizeof(list_line), compare_list_line, ctx->text);
+        size_t used = 0;
+        for (size_t i = 0; rc == 0 && i < ctx->count; i++)
+        {
+            const list_line *line = &ctx->lines[i];
+            if (used + line->len > BUFFER_SIZE)
+            {
+                rc = data_write(ctx->session, ctx->data_socket, ctx->out, used);
+                used = 0;
+            }
+            memcpy(ctx->out + used, ctx->text + line->off, line->len);
+            used += line->len;
+        }
+        if (rc == 0 && used > 0)
+            rc = data_write(ctx->session, ctx->data_socket, ctx->out, used);
+    }
+    ctx->used = 0;
+    ctx->count = 0;
+    if (rc != 0)
+    {
+        ctx->send_failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 存储后端遍历目录时的回调：格式化到当前批次，批次满了就立即发送，
+ * 因此内存占用固定，第一批目录项在扫描完整个目录之前就已经到达客户端。
+ * 批次满时说明整个目录放不进一批，无法完整排序，从这一批起整个列表都按目录顺序发送，
+ * 而不是发出若干各自有序、彼此交错的片段
+ */
+static int stream_list_line(void *arg, const char *name, const struct stat *st)
+{
+    list_ctx *ctx = arg;
+    char line[NAME_MAX + 128];
+    uint32_t name_off;
+    int len = format_list_line(line, sizeof(line), name, st, ctx->now, &name_off);
+    if (len <= 0 || (size_t)len >= sizeof(line))
+        return 0; // 不可能出现的超长文件名，跳过
+    if (ctx->count == LIST_BATCH_LINES || ctx->used + len > LIST_BATCH_BYTES)
+    {
+        ctx->unsorted = 1;
+        if (flush_list_batch(ctx) != 0)
+            return -1;
+    }
+    list_line *entry = &ctx->lines[ctx->count++];
+    entry->off = (uint32_t)ctx->used;
+    entry->len = (uint32_t)len;
+    entry->name_off = name_off;
+    memcpy(ctx->text + ctx->used, line, len);
+    ctx->used += len;
+    return 0;
+}
+
+/**
+ * 跳过 LIST 参数前面的 ls 选项（如 -la），只识别 -U（不排序）
+ * @return 选项之后的路径部分
+ */
+static const char *parse_list_options(const char *arg, int *unsorted)
+{
+    *unsorted = 0;
+    while (arg != NULL && arg[0] == '-')
+    {
+        size_t len = strcspn(arg, " ");
+        if (memchr(arg, 'U', len) != NULL)
+            *unsorted = 1;
+        arg += len;
+        while (*arg == ' ')
+            arg++;
+    }
+    return arg;
+}
+
 /**
  * 处理 LIST 命令，将目录内容以 ls -l 格式发送给客户端
+ * 先建立数据连接再遍历目录，目录项按批（最多 LIST_BATCH_LINES 项、LIST_BATCH_BYTES 字节）格式化后立即发送，
+ * 内存占用与目录大小无关。目录项放得进一批时按文件名排序后发送；超过一批的大目录整个按目录中的
+ * 原始顺序发送，不排序（与 "LIST -U" 相同）
  * @param client_socket 客户端控制连接
  * @param session 会话状态
- * @param arg 客户端请求列出的目录路径 (可选)
+ * @param arg 客户端请求列出的目录路径，可带 ls 选项 (可选)
  * @return 0 表示成功处理, -1 表示处理失败
  */
 int handle_list_command(int client_socket, connection *session, const char *arg)
 {
-    char command[PATH_MAX + 16]; // "ls -l " + path + null terminator
     char target_path[PATH_MAX];
+    int unsorted;
+    arg = parse_list_options(arg, &unsorted);
 
-    // 1. 确定要列出的目标路径
-    // 如果客户端没有提供路径参数，则列出当前工作目录
-    if (arg == NULL || strlen(arg) == 0)
+    // 1. 确定要列出的目标路径并做安全检查，没有参数时列出当前目录
+    switch (resolve_path(session, arg != NULL ? arg : "", target_path, sizeof(target_path)))
     {
-        // getcwd 已经返回了绝对路径
-        if (getcwd(target_path, sizeof(target_path)) == NULL)
-        {
-            send_response(client_socket, 550, "Failed to get current directory.");
-            return -1;
-        }
+    case 0:
+        break;
+    case -1:
+        send_response(client_socket, 550, "Resulting path is too long.");
+        return -1;
+    default:
+        send_response(client_socket, 550, "Permission denied or invalid path.");
+        return -1;
     }
-    else
+
+    struct stat st;
+    if (statcache_stat(target_path, &st) != 0)
+    {
+        send_response(client_socket, 550, "Failed to list directory.");
+        return -1;
+    }
+
+    // 2. 分配固定大小的批次缓冲区
+    list_ctx ctx = {session, -1, unsorted, 0, time(NULL), NULL, 0, NULL, 0, NULL};
+    ctx.text = malloc(LIST_BATCH_BYTES);
+    ctx.lines = malloc(LIST_BATCH_LINES * sizeof(list_line));
+    ctx.out = xfer_buffer_alloc();
+    if (ctx.text == NULL || ctx.lines == NULL || ctx.out == NULL)
     {
-        // 如果客户端提供了路径，需要解析
-        if (arg[0] == '/')
+        free(ctx.text);
+        free(ctx.lines);
+        xfer_buffer_free(ctx.out);
+        send_response(client_socket, 451, "Insufficient memory.");
+        return -1;
+    }
+
+    // 3. 发送初始响应并建立数据连接
+    send_response(client_socket, 150, "Here comes the directory listing.");
+    ctx.data_socket = establish_data_connection(session, 1);
+
+    // 4. 边遍历边发送；目标是文件时只列出它自己
+    int rc = -1;
+    if (ctx.data_socket >= 0)
+    {
+        if (S_ISDIR(st.st_mode))
         {
-            // 绝对路径
-            strncpy(target_path, arg, sizeof(target_path) - 1);
+            rc = storage->list(target_path, stream_list_line, &ctx);
         }
         else
         {
-            // 相对路径，需要拼接
-            char cwd[PATH_MAX];
-            if (getcwd(cwd, sizeof(cwd)) == NULL)
-            {
-                send_response(client_socket, 550, "Failed to get current directory.");
-                return -1;
-            }
-
-            // --- 核心修复：检查 snprintf 的返回值 ---
-            int required_len = snprintf(target_path, sizeof(target_path), "%s/%s", cwd, arg);
-            if (required_len < 0 || required_len >= (int)sizeof(target_path))
-            {
-                // 如果 snprintf 发生错误或输出被截断，则路径太长
-                send_response(client_socket, 550, "Resulting path is too long.");
-                return -1;
-            }
-            // --- 修复结束 ---
+            const char *base = strrchr(target_path, '/');
+            rc = stream_list_line(&ctx, base != NULL ? base + 1 : target_path, &st);
         }
+        if (rc == 0)
+            rc = flush_list_batch(&ctx);
     }
-    target_path[PATH_MAX - 1] = '\0'; // 确保字符串以 null 结尾
+    free(ctx.text);
+    free(ctx.lines);
+    xfer_buffer_free(ctx.out);
 
-    // 2. 安全检查
-    if (!is_path_safe(session->root_dir, target_path))
+    // 5. 关闭（MODE B 下保持）数据连接并发送最终响应
+    if (ctx.data_socket < 0)
     {
-        send_response(client_socket, 550, "Permission denied or invalid path.");
+        send_response(client_socket, 425, "Failed to establish data connection.");
+        return -1;
+    }
+    release_data_connection(session, ctx.data_socket, rc == 0, 1);
+    if (ctx.send_failed)
+    {
+        send_response(client_socket, 426, "Connection closed; transfer aborted.");
+        return -1;
+    }
+    if (rc != 0)
+    {
+        send_response(client_socket, 451, "Failed to read directory.");
+        return -1;
+    }
+    send_response(client_socket, 226, "Directory send OK.");
+    return 0;
+}
+
+
+/**
+ * 处理 DELE 命令，删除一个文件
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param filename 要删除的文件
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_dele_command(int client_socket, connection *session, const char *filename)
+{
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, filename, full_path, sizeof(full_path)) != 0)
         return -1;
+
+    if (storage->unlink(full_path) == 0)
+    {
+        statcache_invalidate(full_path);
+        send_response(client_socket, 250, "File deleted.");
+        return 0;
     }
+    send_response(client_socket, 550, "Failed to delete file.");
+    return -1;
+}
 
-    // 3. 发送初始响应
-    send_response(client_socket, 150, "Here comes the directory listing.");
+/**
+ * 记录两步命令的源路径，路径缓冲区在第一次使用时才分配，多数会话从不需要它
+ * @return 0 成功，-1 内存不足（已回复客户端）
+ */
+static int set_pending_from(int client_socket, connection *session, const char *full_path)
+{
+    if (session->pending_from == NULL && (session->pending_from = slab_alloc(path_cache())) == NULL)
+    {
+        send_response(client_socket, 451, "Insufficient memory.");
+        return -1;
+    }
+    snprintf(session->pending_from, PATH_MAX, "%s", full_path);
+    return 0;
+}
 
-    // 4. 建立数据连接
-    int data_socket = establish_data_connection(session);
-    if (data_socket < 0)
+/**
+ * 处理 RNFR 命令，记录重命名的源路径，等待随后的 RNTO
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param path 源路径
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_rnfr_command(int client_socket, connection *session, const char *path)
+{
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, path, full_path, sizeof(full_path)) != 0)
+        return -1;
+
+    struct stat st;
+    if (statcache_stat(full_path, &st) != 0)
     {
-        send_response(client_socket, 425, "Failed to establish data connection.");
+        send_response(client_socket, 550, "File not found.");
         return -1;
     }
+    if (set_pending_from(client_socket, session, full_path) != 0)
+        return -1;
+    session->pending_op = PENDING_RENAME;
+    send_response(client_socket, 350, "File exists, ready for destination name.");
+    return 0;
+}
+
+/**
+ * 处理 RNTO 命令，将 RNFR 记录的源路径重命名为目标路径
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param path 目标路径
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_rnto_command(int client_socket, connection *session, const char *path)
+{
+    if (session->pending_op != PENDING_RENAME)
+    {
+        send_response(client_socket, 503, "Bad sequence of commands, send RNFR first.");
+        return -1;
+    }
+    session->pending_op = PENDING_NONE;
+
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, path, full_path, sizeof(full_path)) != 0)
+        return -1;
+
+    if (storage->rename(session->pending_from, full_path) == 0)
+    {
+        statcache_invalidate_tree(session->pending_from);
+        statcache_invalidate_tree(full_path);
+        send_response(client_socket, 250, "Rename successful.");
+        return 0;
+    }
+    send_response(client_socket, 550, "Rename failed.");
+    return -1;
+}
+
+/**
+ * 处理 SITE CPFR 命令，记录服务器端复制的源文件，等待随后的 SITE CPTO
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param path 源文件路径
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_cpfr_command(int client_socket, connection *session, const char *path)
+{
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, path, full_path, sizeof(full_path)) != 0)
+        return -1;
 
-    // 5. 构造并执行 ls -l 命令
-    // 使用 -a 显示隐藏文件，-l 显示详细信息
-    snprintf(command, sizeof(command), "ls -al \"%s\"", target_path);
-    FILE *pipe = popen(command, "r");
-    if (!pipe)
+    struct stat st;
+    if (statcache_stat(full_path, &st) != 0 || !S_ISREG(st.st_mode))
     {
-        close(data_socket);
-        send_response(client_socket, 550, "Failed to execute list command.");
+        send_response(client_socket, 550, "Source is not a regular file.");
         return -1;
     }
+    if (set_pending_from(client_socket, session, full_path) != 0)
+        return -1;
+    session->pending_op = PENDING_COPY;
+    send_response(client_socket, 350, "File exists, ready for destination name.");
+    return 0;
+}
+
+/**
+ * 在内核中复制文件内容，依次尝试：
+ *  1. FICLONE 引用链接（btrfs/xfs 等支持时瞬间完成，共享数据块）
+ *  2. copy_file_range(2)（数据不经过用户态，部分文件系统可在服务端完成）
+ *  3. read/write 回退，存储后端的句柄不是内核文件描述符时直接使用
+ * @param src_fd 源文件
+ * @param dst_fd 目标文件（已截断为空）
+ * @param size 源文件大小
+ * @param method 输出实际使用的复制方式
+ * @return 复制的字节数，失败返回-1
+ */
+static off_t copy_file_data(int src_fd, int dst_fd, off_t size, const char **method)
+{
+    if (storage->native_fds && ioctl(dst_fd, FICLONE, src_fd) == 0)
+    {
+        *method = "reflink";
+        return size;
+    }
 
-    // 6. 将命令输出通过数据连接发送
-    char buffer[BUFFER_SIZE];
-    size_t bytes_read;
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+    off_t copied = 0;
+    *method = "copy_file_range";
+    while (storage->native_fds && copied < size)
     {
-        if (send(data_socket, buffer, bytes_read, 0) < 0)
+        ssize_t n = copy_file_range(src_fd, NULL, dst_fd, NULL, size - copied, 0);
+        if (n < 0)
         {
-            // 发送失败，跳出循环
+            if (copied == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+                break; // 内核或文件系统不支持，改用 read/write
+            return -1;
+        }
+        if (n == 0)
+            break; // 源文件在复制过程中被截断
+        copied += n;
+    }
+    if (copied > 0 || size == 0)
+        return copied;
+
+    *method = "read/write";
+    char *buffer = xfer_buffer_alloc();
+    if (buffer == NULL)
+        return -1;
+    ssize_t bytes_read;
+    while ((bytes_read = storage->read(src_fd, buffer, BUFFER_SIZE)) > 0)
+    {
+        if (storage->write(dst_fd, buffer, bytes_read) != bytes_read)
+        {
+            bytes_read = -1;
             break;
         }
+        copied += bytes_read;
+    }
+    xfer_buffer_free(buffer);
+    return bytes_read < 0 ? -1 : copied;
+}
+
+/**
+ * 处理 SITE CPTO 命令，将 SITE CPFR 记录的源文件复制到目标路径，数据不经过网络
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param path 目标路径
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_cpto_command(int client_socket, connection *session, const char *path)
+{
+    if (session->pending_op != PENDING_COPY)
+    {
+        send_response(client_socket, 503, "Bad sequence of commands, send SITE CPFR first.");
+        return -1;
     }
+    session->pending_op = PENDING_NONE;
 
-    // 7. 清理和收尾
-    pclose(pipe);
-    close(data_socket);
-    session->mode = DATA_CONN_MODE_NONE; // 重置数据连接模式
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, path, full_path, sizeof(full_path)) != 0)
+        return -1;
+    if (strcmp(full_path, session->pending_from) == 0)
+    {
+        send_response(client_socket, 553, "Source and destination are the same file.");
+        return -1;
+    }
 
-    // 8. 发送最终响应
-    send_response(client_socket, 226, "Directory send OK.");
+    int src_fd = storage->open(session->pending_from, O_RDONLY, 0);
+    if (src_fd < 0)
+    {
+        send_response(client_socket, 550, "Failed to open source file.");
+        return -1;
+    }
+    struct stat st;
+    if (storage->fstat(src_fd, &st) != 0)
+    {
+        storage->close(src_fd);
+        send_response(client_socket, 550, "Failed to stat source file.");
+        return -1;
+    }
+    // 先不截断地打开目标，确认它与源文件不是同一个 inode（符号链接、硬链接）后再截断，
+    // 否则 O_TRUNC 会在复制开始前清空源文件
+    int dst_fd = storage->open(full_path, O_WRONLY | O_CREAT, st.st_mode & 0777);
+    if (dst_fd < 0)
+    {
+        storage->close(src_fd);
+        send_response(client_socket, 550, "Cannot create destination file.");
+        return -1;
+    }
+    struct stat dst_st;
+    if (storage->fstat(dst_fd, &dst_st) != 0)
+    {
+        storage->close(src_fd);
+        storage->close(dst_fd);
+        send_response(client_socket, 550, "Cannot create destination file.");
+        return -1;
+    }
+    if (dst_st.st_dev == st.st_dev && dst_st.st_ino == st.st_ino)
+    {
+        storage->close(src_fd);
+        storage->close(dst_fd);
+        send_response(client_socket, 553, "Source and destination are the same file.");
+        return -1;
+    }
+    int truncated;
+    if (storage->native_fds)
+        truncated = ftruncate(dst_fd, 0) == 0;
+    else
+    {
+        // 存储层没有 ftruncate，已确认不是同一文件后重新以 O_TRUNC 打开
+        storage->close(dst_fd);
+        dst_fd = storage->open(full_path, O_WRONLY | O_TRUNC, 0);
+        truncated = dst_fd >= 0;
+    }
+    if (!truncated)
+    {
+        storage->close(src_fd);
+        if (dst_fd >= 0)
+            storage->close(dst_fd);
+        send_response(client_socket, 550, "Cannot create destination file.");
+        return -1;
+    }
+
+    const char *method = NULL;
+    off_t copied = copy_file_data(src_fd, dst_fd, st.st_size, &method);
+    storage->close(src_fd);
+    if (storage->close(dst_fd) != 0)
+        copied = -1;
+    statcache_invalidate(full_path);
+
+    if (copied < 0)
+    {
+        storage->unlink(full_path); // 清理掉复制不完整的文件
+        send_response(client_socket, 550, "Copy failed.");
+        return -1;
+    }
+    char message[128];
+    snprintf(message, sizeof(message), "Copy complete, %lld bytes (%s).", (long long)copied, method);
+    send_response(client_socket, 250, message);
+    return 0;
+}
+
+/**
+ * 处理 SIZE 命令（RFC 3659），返回文件的字节数，只对普通文件有效
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param path 文件路径
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_size_command(int client_socket, connection *session, const char *path)
+{
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, path, full_path, sizeof(full_path)) != 0)
+        return -1;
+
+    struct stat st;
+    if (statcache_stat(full_path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        send_response(client_socket, 550, "Could not get file size.");
+        return -1;
+    }
+    char message[32];
+    snprintf(message, sizeof(message), "%lld", (long long)st.st_size);
+    send_response(client_socket, 213, message);
+    return 0;
+}
+
+/**
+ * 处理 MDTM 命令（RFC 3659），返回文件的修改时间（UTC，YYYYMMDDHHMMSS）
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param path 文件路径
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_mdtm_command(int client_socket, connection *session, const char *path)
+{
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, path, full_path, sizeof(full_path)) != 0)
+        return -1;
+
+    struct stat st;
+    struct tm tm;
+    if (statcache_stat(full_path, &st) != 0 || gmtime_r(&st.st_mtime, &tm) == NULL)
+    {
+        send_response(client_socket, 550, "Could not get file modification time.");
+        return -1;
+    }
+    char message[32];
+    strftime(message, sizeof(message), "%Y%m%d%H%M%S", &tm);
+    send_response(client_socket, 213, message);
+    return 0;
+}
+
+/**
+ * 生成 MLST/MLSD 的事实部分，以 ';' 结尾，如 "type=file;size=3;modify=20240101000000;perm=adfrw;unix.mode=0644;"
+ * @return 0 成功，-1 时间无法转换
+ */
+int format_mlst_facts(char *out, size_t outsz, const struct stat *st)
+{
+    struct tm tm;
+    if (gmtime_r(&st->st_mtime, &tm) == NULL)
+        return -1;
+    char modify[16];
+    strftime(modify, sizeof(modify), "%Y%m%d%H%M%S", &tm);
+    if (S_ISDIR(st->st_mode))
+        snprintf(out, outsz, "type=dir;modify=%s;perm=cdeflmp;unix.mode=%04o;", modify,
+                 (unsigned)(st->st_mode & 07777));
+    else
+        snprintf(out, outsz, "type=file;size=%lld;modify=%s;perm=adfrw;unix.mode=%04o;", (long long)st->st_size,
+                 modify, (unsigned)(st->st_mode & 07777));
     return 0;
 }
+
+/**
+ * 处理 MLST 命令（RFC 3659），在控制连接上返回一个路径的机器可读事实
+ * 事实行以空格开头，不带响应码，因此不使用 send_multiline_response
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param path 路径，为空时表示当前目录
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_mlst_command(int client_socket, connection *session, const char *path)
+{
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, path[0] != '\0' ? path : ".", full_path, sizeof(full_path)) != 0)
+        return -1;
+
+    struct stat st;
+    char facts[MLST_FACTS_MAX];
+    if (statcache_stat(full_path, &st) != 0 || format_mlst_facts(facts, sizeof(facts), &st) != 0)
+    {
+        send_response(client_socket, 550, "No such file or directory.");
+        return -1;
+    }
+
+    char response[PATH_MAX * 2 + 256];
+    int len = snprintf(response, sizeof(response), "250-Listing %s\r\n %s %s\r\n250 End\r\n", full_path, facts,
+                       full_path);
+    if (net_send(client_socket, response, (size_t)len, 0) == -1)
+        return -1;
+    return 0;
+}
+
+/**
+ * 处理 OPTS 命令，目前只支持 OPTS HASH [算法]：不带算法时返回当前算法，
+ * 选择 CRC32C/XXH64/SHA-256 后 RETR/STOR 在传输中计算摘要并附在 226 响应中，NONE 关闭
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg 选项及其参数
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_opts_command(int client_socket, connection *session, const char *arg)
+{
+    char option[LINE_MAX_SIZE], value[LINE_MAX_SIZE];
+    parse_cmd_param(arg, option, sizeof(option), value);
+    if (strcasecmp(option, "HASH") != 0)
+    {
+        send_response(client_socket, 501, "Option not understood.");
+        return -1;
+    }
+    if (value[0] != '\0')
+    {
+        checksum_alg alg;
+        if (checksum_parse(value, &alg) != 0)
+        {
+            send_response(client_socket, 504, "Unknown or unsupported hash algorithm.");
+            return -1;
+        }
+        session->hash_alg = alg;
+    }
+    char message[64];
+    snprintf(message, sizeof(message), "%s (%s)", checksum_name(session->hash_alg),
+             checksum_impl(session->hash_alg));
+    send_response(client_socket, 200, message);
+    return 0;
+}
+
+/**
+ * 处理 HASH 命令，返回整个文件的摘要：213 <算法> 0-<大小> <摘要> <路径>
+ * 使用 OPTS HASH 选择的算法（未选择时为 CRC32C）；本地文件的扩展属性中有未过期的摘要时直接返回，
+ * 否则读取文件计算并保存
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param path 文件路径
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_hash_command(int client_socket, connection *session, const char *path)
+{
+    char full_path[PATH_MAX];
+    if (resolve_path_or_reply(client_socket, session, path, full_path, sizeof(full_path)) != 0)
+        return -1;
+    checksum_alg alg = session->hash_alg != CHECKSUM_NONE ? session->hash_alg : CHECKSUM_CRC32C;
+
+    int fd = storage->open(full_path, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || storage->fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (fd >= 0)
+            storage->close(fd);
+        send_response(client_socket, 550, "Not a regular file.");
+        return -1;
+    }
+
+    char digest[CHECKSUM_HEX_MAX];
+    if (!storage->native_fds || checksum_load_xattr(fd, alg, digest, sizeof(digest)) != 0)
+    {
+        checksum_state hash;
+        char *buffer = xfer_buffer_alloc();
+        if (buffer == NULL || checksum_init(&hash, alg) != 0)
+        {
+            xfer_buffer_free(buffer);
+            storage->close(fd);
+            send_response(client_socket, 451, "Cannot compute hash.");
+            return -1;
+        }
+        ssize_t n;
+        while ((n = storage->read(fd, buffer, BUFFER_SIZE)) > 0)
+            checksum_update(&hash, buffer, n);
+        xfer_buffer_free(buffer);
+        checksum_final(&hash, digest, sizeof(digest));
+        if (n < 0)
+        {
+            storage->close(fd);
+            send_response(client_socket, 451, "Read error while computing hash.");
+            return -1;
+        }
+        if (storage->native_fds)
+            checksum_store_xattr(fd, alg, digest);
+    }
+    storage->close(fd);
+
+    char message[LINE_MAX_SIZE - 8]; // 过长的路径被截断，保证响应行以 CRLF 结尾
+    snprintf(message, sizeof(message), "%s 0-%lld %s %s", checksum_name(alg), (long long)st.st_size, digest, path);
+    send_response(client_socket, 213, message);
+    return 0;
+}
+
+/**
+ * 处理 REST 命令，设置下一次 RETR/STOR 的起始偏移
+ * MODE B 下偏移即发送方插入的重启标记内容
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg 十进制的字节偏移
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_rest_command(int client_socket, connection *session, const char *arg)
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long long offset = strtoull(arg, &end, 10);
+    if (arg[0] == '\0' || arg[0] == '-' || *end != '\0' || errno != 0)
+    {
+        send_response(client_socket, 501, "Syntax error in parameters or arguments.");
+        return -1;
+    }
+    session->restart_offset = offset;
+    char message[96];
+    snprintf(message, sizeof(message), "Restarting at %llu. Send STORE or RETRIEVE to initiate transfer.", offset);
+    send_response(client_socket, 350, message);
+    return 0;
+}
+
+/**
+ * 处理 MODE 命令，在流模式 (S) 与块模式 (B) 之间切换
+ * 块模式下数据连接在传输之间保持打开，切换模式会关闭已保持的连接
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg 模式代码
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_mode_command(int client_socket, connection *session, const char *arg)
+{
+    transfer_mode_t mode;
+    if (strcasecmp(arg, "S") == 0)
+        mode = TRANSFER_MODE_STREAM;
+    else if (strcasecmp(arg, "B") == 0)
+        mode = TRANSFER_MODE_BLOCK;
+    else
+    {
+        send_response(client_socket, 504, "Command not implemented for that parameter.");
+        return -1;
+    }
+    if (mode != session->transfer_mode && session->mode == DATA_CONN_MODE_PERSISTENT)
+        close_data_connection(session);
+    session->transfer_mode = mode;
+    send_response(client_socket, 200, mode == TRANSFER_MODE_BLOCK ? "Mode set to B." : "Mode set to S.");
+    return 0;
+}
\ No newline at end of file
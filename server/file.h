@@ -2,17 +2,41 @@
 
 #include "utils.h"
 #include "connect.h"
+#include "xferlog.h"
 
-#define BUFFER_SIZE 8192 // 文件传输缓冲区大小
+#define BUFFER_SIZE 8192               // 文件传输缓冲区大小
+#define SENDFILE_CHUNK_SIZE (1 << 20) // 每次 sendfile 的最大字节数
+#define MLST_FACTS_MAX 128             // MLST/MLSD 一个路径的事实部分的长度上限
 // #define FTP_ROOT_DIR "." // FTP服务器根目录
 
 // static void ensure_session_cwd(connection *session);
 // static void normalize_virtual_path(const char *base, const char *input, char *out, size_t outsz);
 int is_path_safe(const char *root, const char *path);
+int resolve_path(connection *session, const char *arg, char *out, size_t outsz);
+int resolve_path_or_reply(int client_socket, connection *session, const char *arg, char *out, size_t outsz);
+int send_file_data(connection *session, int data_socket, int file_fd, int64_t length, int restart_markers,
+                   uint64_t *sent, xfer_path_t *path_used);
+void log_transfer(connection *session, char direction, const char *path, uint64_t start_us,
+                  uint64_t start_mono, uint64_t bytes, int result_code, xfer_path_t xfer_path);
 int handle_retr_command(int client_socket, connection *session, const char *filename);
 int handle_stor_command(int client_socket, connection *session, const char *filename);
 int handle_cwd_command(int client_socket, connection *session, const char *path);
 int handle_pwd_command(int client_socket, connection *session);
 int handle_mkd_command(int client_socket, connection *session, const char *dirname);
 int handle_rmd_command(int client_socket, connection *session, const char *dirname);
-int handle_list_command(int client_socket, connection *session, const char *path);
\ No newline at end of file
+int handle_list_command(int client_socket, connection *session, const char *path);
+int handle_dele_command(int client_socket, connection *session, const char *filename);
+int handle_rnfr_command(int client_socket, connection *session, const char *path);
+int handle_rnto_command(int client_socket, connection *session, const char *path);
+int handle_cpfr_command(int client_socket, connection *session, const char *path);
+int handle_cpto_command(int client_socket, connection *session, const char *path);
+int handle_sigs_command(int client_socket, connection *session, const char *arg);
+int handle_delta_command(int client_socket, connection *session, const char *arg);
+int handle_size_command(int client_socket, connection *session, const char *path);
+int handle_mdtm_command(int client_socket, connection *session, const char *path);
+int format_mlst_facts(char *out, size_t outsz, const struct stat *st);
+int handle_mlst_command(int client_socket, connection *session, const char *path);
+int handle_opts_command(int client_socket, connection *session, const char *arg);
+int handle_hash_command(int client_socket, connection *session, const char *path);
+int handle_rest_command(int client_socket, connection *session, const char *arg);
+int handle_mode_command(int client_socket, connection *session, const char *arg);
\ No newline at end of file
@@ -0,0 +1,493 @@
+#include "find.h"
+#include "file.h"
+#include "index.h"
+#include "pool.h"
+#include "statcache.h"
+#include "storage.h"
+
+// 逐级遍历存储后端作为匹配的数据来源：目录由起点之下的相对路径确定，句柄不使用
+typedef struct
+{
+    char path[PATH_MAX]; // 起点目录的绝对路径，之后用作拼接子路径的缓冲区
+    size_t base_len;
+} walk_source;
+
+typedef struct
+{
+    char *data; // 每项为“类型字节 + 名字 + '\0'”
+    size_t used;
+    size_t cap;
+} walk_names;
+
+/**
+ * 拼出 起点/rel[/name]
+ * @return 0 成功，-1 路径过长
+ */
+static int walk_path(walk_source *w, const char *rel, const char *name)
+{
+    w->path[w->base_len] = '\0';
+    size_t len = w->base_len;
+    const char *parts[2] = {rel, name};
+    for (int i = 0; i < 2; i++)
+    {
+        if (parts[i] == NULL || parts[i][0] == '\0')
+            continue;
+        int n = snprintf(w->path + len, sizeof(w->path) - len, "/%s", parts[i]);
+        if (n < 0 || (size_t)n >= sizeof(w->path) - len)
+            return -1;
+        len += (size_t)n;
+    }
+    return 0;
+}
+
+static int walk_collect(void *ctx, const char *name, const struct stat *st)
+{
+    walk_names *names = ctx;
+    size_t need = strlen(name) + 2;
+    if (names->used + need > names->cap)
+    {
+        size_t cap = names->cap * 2 > names->used + need ? names->cap * 2 : names->used + need;
+        char *grown = realloc(names->data, cap);
+        if (grown == NULL)
+            return -1;
+        names->data = grown;
+        names->cap = cap;
+    }
+    names->data[names->used++] = S_ISDIR(st->st_mode) ? 'd' : 'f';
+    memcpy(names->data + names->used, name, need - 1);
+    names->used += need - 1;
+    return 0;
+}
+
+/**
+ * 先把整个目录的名字收集起来再逐个访问：ram 后端在 list 回调期间持有锁，
+ * 不能在回调中继续列出子目录
+ */
+static int walk_children(void *src, uintptr_t dir, const char *rel, glob_visit visit, void *frame)
+{
+    (void)dir;
+    walk_source *w = src;
+    walk_names names = {NULL, 0, 0};
+    if (walk_path(w, rel, NULL) != 0 || storage->list(w->path, walk_collect, &names) != 0)
+    {
+        free(names.data);
+        return -1;
+    }
+    for (size_t off = 0; off < names.used;)
+    {
+        glob_entry e = {names.data + off + 1, names.data[off] == 'd', 0};
+        off += strlen(e.name) + 2;
+        if (visit(frame, &e) != 0)
+            break;
+    }
+    free(names.data);
+    return 0;
+}
+
+static int walk_lookup(void *src, uintptr_t dir, const char *rel, const char *name, glob_entry *out)
+{
+    (void)dir;
+    walk_source *w = src;
+    struct stat st;
+    if (walk_path(w, rel, name) != 0 || storage->stat(w->path, &st) != 0)
+        return 0;
+    out->name = name;
+    out->is_dir = S_ISDIR(st.st_mode);
+    out->handle = 0;
+    return 1;
+}
+
+static const glob_source walk_source_ops = {walk_children, walk_lookup};
+
+/**
+ * 把参数分成起点目录与模式：起点是第一个含通配符的组件之前的部分；
+ * 没有通配符时是最后一个组件之前的部分，模式就是最后一个组件
+ * @param session 会话状态
+ * @param arg 客户端给出的参数
+ * @param target 输出
+ * @return 0 成功，-1 路径过长，-2 路径不安全
+ */
+int find_split(connection *session, const char *arg, find_target *target)
+{
+    size_t split = 0, last = 0;
+    int found = 0;
+    for (size_t start = 0; arg[start] != '\0';)
+    {
+        size_t len = strcspn(arg + start, "/");
+        if (strcspn(arg + start, "*?[\\") < len)
+        {
+            split = start;
+            found = 1;
+            break;
+        }
+        start += len;
+        if (arg[start] == '/')
+        {
+            start++;
+            last = start;
+        }
+    }
+    if (!found)
+        split = last;
+    if (split >= sizeof(target->prefix))
+        return -1;
+    memcpy(target->prefix, arg, split);
+    target->prefix[split] = '\0';
+    target->pattern = arg + split;
+    return resolve_path(session, split > 0 ? target->prefix : ".", target->base, sizeof(target->base));
+}
+
+/**
+ * 在起点目录下匹配模式，优先查询索引，索引不可用时逐级遍历存储后端
+ * @param base 起点目录（规范化的绝对路径）
+ * @param pattern 相对于起点的模式
+ * @param limit 最多输出的结果数
+ * @param emit 每个结果（相对于起点的路径）调用一次，返回非0时停止
+ * @return 结果数；INDEX_NOT_FOUND 起点不是目录；FIND_INVALID 模式无效；-2 内存不足
+ */
+int64_t find_paths(const char *base, const char *pattern, uint32_t limit, glob_emit emit, void *ctx)
+{
+    glob_pattern *compiled = malloc(sizeof(*compiled));
+    walk_source *src = malloc(sizeof(*src));
+    int64_t count = -2;
+    if (compiled == NULL || src == NULL)
+        goto done;
+    count = FIND_INVALID;
+    if (glob_compile(compiled, pattern) != 0)
+        goto done;
+
+    // 索引不跟随符号链接，起点经过符号链接时索引中找不到，同样改为遍历
+    count = index_query(base, pattern, limit, emit, ctx);
+    if (count >= 0)
+        goto done;
+
+    struct stat st;
+    count = INDEX_NOT_FOUND;
+    if (storage->stat(base, &st) != 0 || !S_ISDIR(st.st_mode))
+        goto done;
+    snprintf(src->path, sizeof(src->path), "%s", base);
+    src->base_len = strlen(src->path);
+    if (src->base_len > 1 && src->path[src->base_len - 1] == '/')
+        src->path[--src->base_len] = '\0';
+    else if (src->base_len == 1)
+        src->base_len = 0; // 起点为 "/"，子路径以 "/名字" 拼接
+    count = glob_run(compiled, &walk_source_ops, src, 0, limit, emit, ctx);
+    if (count < 0)
+        count = -2;
+
+done:
+    free(compiled);
+    free(src);
+    return count;
+}
+
+/*
+ * 向数据连接输出一行一个名字（NLST、SITE FIND）或“事实 名字”（MLSD），
+ * 各行先拼接到传输缓冲区中，满了才写出
+ */
+typedef struct
+{
+    connection *session;
+    int data_socket;
+    char *buf;
+    size_t used;
+    const char *prefix; // 每个名字之前附加的客户端写出的路径部分
+    const char *base;   // MLSD 通配结果需要 stat，相对于这个目录
+    int dir_slash;      // 目录名后加 '/'（SITE FIND）
+    int failed;         // 数据连接写入失败
+    uint64_t count;
+} name_writer;
+
+static int writer_flush(name_writer *w)
+{
+    if (w->used > 0 && !w->failed && data_write(w->session, w->data_socket, w->buf, w->used) != 0)
+        w->failed = 1;
+    w->used = 0;
+    return w->failed ? -1 : 0;
+}
+
+/**
+ * 输出一行
+ * @param facts MLSD 的事实部分，NULL 表示只输出名字
+ * @return 0 成功，-1 数据连接写入失败（遍历应停止）
+ */
+static int writer_put(name_writer *w, const char *facts, const char *name, int is_dir)
+{
+    char line[PATH_MAX * 2 + MLST_FACTS_MAX + 8];
+    int len = snprintf(line, sizeof(line), "%s%s%s%s%s\r\n", facts != NULL ? facts : "", facts != NULL ? " " : "",
+                       w->prefix, name, is_dir && w->dir_slash ? "/" : "");
+    if (len < 0 || (size_t)len >= sizeof(line))
+        return 0; // 超长路径，跳过
+    if (w->used + (size_t)len > BUFFER_SIZE && writer_flush(w) != 0)
+        return -1;
+    memcpy(w->buf + w->used, line, (size_t)len);
+    w->used += (size_t)len;
+    w->count++;
+    return 0;
+}
+
+static int emit_name(void *ctx, const char *rel, int is_dir)
+{
+    return writer_put(ctx, NULL, rel, is_dir);
+}
+
+static int emit_facts(void *ctx, const char *rel, int is_dir)
+{
+    (void)is_dir;
+    name_writer *w = ctx;
+    char path[PATH_MAX], facts[MLST_FACTS_MAX];
+    struct stat st;
+    int n = snprintf(path, sizeof(path), "%s/%s", w->base, rel);
+    if (n < 0 || (size_t)n >= sizeof(path) || statcache_stat(path, &st) != 0 ||
+        format_mlst_facts(facts, sizeof(facts), &st) != 0)
+        return 0; // 匹配之后被删除
+    return writer_put(w, facts, rel, 0);
+}
+
+static int list_name(void *ctx, const char *name, const struct stat *st)
+{
+    return writer_put(ctx, NULL, name, S_ISDIR(st->st_mode));
+}
+
+static int list_facts(void *ctx, const char *name, const struct stat *st)
+{
+    char facts[MLST_FACTS_MAX];
+    if (format_mlst_facts(facts, sizeof(facts), st) != 0)
+        return 0;
+    return writer_put(ctx, facts, name, 0);
+}
+
+/**
+ * 发送 150 并建立数据连接
+ * @return 0 成功，-1 失败（已响应）
+ */
+static int writer_open(int client_socket, connection *session, name_writer *w, const char *message)
+{
+    w->buf = xfer_buffer_alloc();
+    if (w->buf == NULL)
+    {
+        send_response(client_socket, 451, "Insufficient memory.");
+        return -1;
+    }
+    send_response(client_socket, 150, message);
+    w->data_socket = establish_data_connection(session, 1);
+    if (w->data_socket < 0)
+    {
+        xfer_buffer_free(w->buf);
+        send_response(client_socket, 425, "Failed to establish data connection.");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 写出剩余内容，关闭（MODE B 下保持）数据连接并发送最终响应
+ * @param rc 产生结果的过程是否成功（0 成功）
+ * @param done_message 成功时的 226 响应
+ * @return 0 成功，-1 失败
+ */
+static int writer_close(int client_socket, name_writer *w, int rc, const char *done_message)
+{
+    writer_flush(w);
+    xfer_buffer_free(w->buf);
+    release_data_connection(w->session, w->data_socket, !w->failed && rc == 0, 1);
+    if (w->failed)
+    {
+        send_response(client_socket, 426, "Connection closed; transfer aborted.");
+        return -1;
+    }
+    if (rc != 0)
+    {
+        send_response(client_socket, 451, "Failed to read directory.");
+        return -1;
+    }
+    send_response(client_socket, 226, done_message);
+    return 0;
+}
+
+/**
+ * 解析通配参数并确认起点是目录，失败时直接响应
+ * @return 0 成功，-1 失败（已响应）
+ */
+static int find_prepare(int client_socket, connection *session, const char *arg, find_target *target)
+{
+    switch (find_split(session, arg, target))
+    {
+    case 0:
+        break;
+    case -1:
+        send_response(client_socket, 550, "Resulting path is too long.");
+        return -1;
+    default:
+        send_response(client_socket, 550, "Permission denied or invalid path.");
+        return -1;
+    }
+    glob_pattern *check = malloc(sizeof(*check));
+    int valid = check != NULL && glob_compile(check, target->pattern) == 0;
+    free(check);
+    if (!valid)
+    {
+        send_response(client_socket, 501, "Invalid pattern.");
+        return -1;
+    }
+    struct stat st;
+    if (statcache_stat(target->base, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        send_response(client_socket, 550, "No such directory.");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 处理 SITE FIND 命令，通过数据连接返回与模式匹配的所有路径，每行一个，目录以 '/' 结尾
+ * 例如 "SITE FIND *.gz"，"**" 组件可以跨越多级目录；结果不排序，超过 FIND_MAX_RESULTS 时截断
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg 模式
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_find_command(int client_socket, connection *session, const char *arg)
+{
+    if (arg[0] == '\0')
+    {
+        send_response(client_socket, 501, "Usage: SITE FIND <pattern>");
+        return -1;
+    }
+    find_target *target = malloc(sizeof(*target));
+    if (target == NULL)
+    {
+        send_response(client_socket, 451, "Insufficient memory.");
+        return -1;
+    }
+    name_writer w = {session, -1, NULL, 0, NULL, NULL, 1, 0, 0};
+    if (find_prepare(client_socket, session, arg, target) != 0 ||
+        writer_open(client_socket, session, &w, "Here comes the search result.") != 0)
+    {
+        free(target);
+        return -1;
+    }
+    w.prefix = target->prefix;
+    int64_t count = find_paths(target->base, target->pattern, FIND_MAX_RESULTS, emit_name, &w);
+    free(target);
+
+    char message[96];
+    if (count >= FIND_MAX_RESULTS)
+        snprintf(message, sizeof(message), "Search truncated at %d matches.", FIND_MAX_RESULTS);
+    else
+        snprintf(message, sizeof(message), "%llu matches.", (unsigned long long)w.count);
+    return writer_close(client_socket, &w, count < 0, message);
+}
+
+/**
+ * 跳过 NLST/MLSD 参数前面的 ls 选项（如 -a），部分客户端会照搬 LIST 的写法
+ */
+static const char *skip_list_options(const char *arg)
+{
+    while (arg[0] == '-')
+    {
+        arg += strcspn(arg, " ");
+        while (*arg == ' ')
+            arg++;
+    }
+    return arg;
+}
+
+/**
+ * 处理 NLST 和 MLSD 命令：
+ *  - 参数含通配符时列出所有匹配的路径（相对路径保留客户端写出的部分，如 "data/a*.csv" 输出 "data/a1.csv"）
+ *  - 参数是目录（或为空，表示当前目录）时列出其中的名字；NLST 的名字前附加参数中的路径
+ *  - NLST 的参数是文件时只返回它自己；MLSD 的参数必须是目录
+ */
+static int handle_name_listing(int client_socket, connection *session, const char *arg, int mlsd)
+{
+    arg = skip_list_options(arg);
+    name_writer w = {session, -1, NULL, 0, "", NULL, 0, 0, 0};
+    const char *message = mlsd ? "Here comes the machine listing." : "Here comes the name list.";
+    if (glob_has_magic(arg))
+    {
+        find_target *target = malloc(sizeof(*target));
+        if (target == NULL)
+        {
+            send_response(client_socket, 451, "Insufficient memory.");
+            return -1;
+        }
+        if (find_prepare(client_socket, session, arg, target) != 0 ||
+            writer_open(client_socket, session, &w, message) != 0)
+        {
+            free(target);
+            return -1;
+        }
+        w.prefix = target->prefix;
+        w.base = target->base;
+        int64_t count = find_paths(target->base, target->pattern, FIND_MAX_RESULTS, mlsd ? emit_facts : emit_name,
+                                   &w);
+        free(target);
+        return writer_close(client_socket, &w, count < 0, "Transfer complete.");
+    }
+
+    char full_path[PATH_MAX];
+    switch (resolve_path(session, arg[0] != '\0' ? arg : ".", full_path, sizeof(full_path)))
+    {
+    case 0:
+        break;
+    case -1:
+        send_response(client_socket, 550, "Resulting path is too long.");
+        return -1;
+    default:
+        send_response(client_socket, 550, "Permission denied or invalid path.");
+        return -1;
+    }
+    struct stat st;
+    if (statcache_stat(full_path, &st) != 0)
+    {
+        send_response(client_socket, 550, "No such file or directory.");
+        return -1;
+    }
+    if (mlsd && !S_ISDIR(st.st_mode))
+    {
+        send_response(client_socket, 501, "Not a directory.");
+        return -1;
+    }
+
+    // NLST 列出子目录时名字带上目录部分，与通配结果一致，客户端可以直接用于 RETR
+    char prefix[PATH_MAX];
+    size_t arg_len = strlen(arg);
+    if (mlsd || arg_len == 0 || !S_ISDIR(st.st_mode))
+        prefix[0] = '\0';
+    else
+        snprintf(prefix, sizeof(prefix), "%s%s", arg, arg[arg_len - 1] == '/' ? "" : "/");
+    w.prefix = prefix;
+    if (writer_open(client_socket, session, &w, message) != 0)
+        return -1;
+    int rc;
+    if (S_ISDIR(st.st_mode))
+        rc = storage->list(full_path, mlsd ? list_facts : list_name, &w);
+    else
+        rc = writer_put(&w, NULL, arg, 0);
+    return writer_close(client_socket, &w, rc, "Transfer complete.");
+}
+
+/**
+ * 处理 NLST 命令，通过数据连接返回名字列表，每行一个
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg 目录、文件或通配模式 (可选)
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_nlst_command(int client_socket, connection *session, const char *arg)
+{
+    return handle_name_listing(client_socket, session, arg, 0);
+}
+
+/**
+ * 处理 MLSD 命令（RFC 3659），通过数据连接返回每个目录项的机器可读事实
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg 目录或通配模式 (可选)
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_mlsd_command(int client_socket, connection *session, const char *arg)
+{
+    return handle_name_listing(client_socket, session, arg, 1);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "utils.h"
+#include "connect.h"
+#include "pathglob.h"
+
+#define FIND_MAX_RESULTS 1000000 // SITE FIND 与 NLST/MLSD 通配最多输出的路径数
+#define FIND_INVALID (-3)        // find_paths：模式无效（空、过长或含有 ".."）
+
+/*
+ * 通配查询：SITE FIND <模式>，以及 NLST/MLSD（本文件实现）参数中的通配符。
+ * 参数中第一个含通配符的组件之前的部分是起点目录（按会话当前目录解析并做安全检查），
+ * 其余部分是相对于起点的模式；输出的路径保留客户端写出的起点部分。
+ * 开启 -index 时由索引进程回答，否则（或索引暂不可用时）逐级遍历存储后端。
+ */
+
+typedef struct
+{
+    char base[PATH_MAX];   // 起点目录的绝对路径
+    char prefix[PATH_MAX]; // 客户端写出的起点部分，为空或以 '/' 结尾
+    const char *pattern;   // 指向参数中相对于起点的模式
+} find_target;
+
+int find_split(connection *session, const char *arg, find_target *target);
+int64_t find_paths(const char *base, const char *pattern, uint32_t limit, glob_emit emit, void *ctx);
+int handle_find_command(int client_socket, connection *session, const char *arg);
+int handle_nlst_command(int client_socket, connection *session, const char *arg);
+int handle_mlsd_command(int client_socket, connection *session, const char *arg);
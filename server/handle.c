@@ -2,22 +2,51 @@
 #include "utils.h"
 #include "connect.h"
 #include "file.h"
+#include "site.h"
+#include "scoreboard.h"
+#include "pool.h"
+#include "trace.h"
+#include "control.h"
+#include "find.h"
+#include "capture.h"
 #include <regex.h>
+#include <strings.h>
 
 // 处理每一个来自客户端的连接
 void handle_connection(int client_socket, const char *root_dir)
 {
     int logged_in = 0;                                      // 登录状态标志
     int awaiting_password = 0;                              // 等待密码标志
-    char line[LINE_MAX_SIZE], cmd[128], arg[LINE_MAX_SIZE]; // 命令和参数缓冲区
+    char cmd[128];                                          // 命令缓冲区
 
-    // 初始化一个会话状态结构体
-    connection session;
-    memset(&session, 0, sizeof(session));
-    session.client_data_socket = -1;
-    session.mode = DATA_CONN_MODE_NONE;                                   // 初始无数据连接模式
-    snprintf(session.root_dir, sizeof(session.root_dir), "%s", root_dir); // 设置根目录
-    session.bytes_transferred = 0;                                        // 初始化传输字节数为0
+    // 会话状态结构体与行缓冲区都从 slab 池中分配，根目录只保存指针
+    connection *session = slab_alloc(session_cache());
+    char *line = slab_alloc(line_cache());
+    char *arg = slab_alloc(line_cache());
+    char *cwd = slab_alloc(path_cache());
+    if (session == NULL || line == NULL || arg == NULL || cwd == NULL)
+    {
+        send_response(client_socket, 421, "Insufficient memory, closing control connection.");
+        slab_free(path_cache(), cwd);
+        slab_free(line_cache(), arg);
+        slab_free(line_cache(), line);
+        slab_free(session_cache(), session);
+        return;
+    }
+    memset(session, 0, sizeof(*session));
+    session->client_data_socket = -1;
+    session->mode = DATA_CONN_MODE_NONE;           // 初始无数据连接模式
+    session->transfer_mode = TRANSFER_MODE_STREAM; // 默认流模式
+    session->root_dir = root_dir;                  // 设置根目录
+    session->cwd = cwd;                            // 当前目录从根目录开始
+    snprintf(session->cwd, PATH_MAX, "%s", root_dir);
+    session->bytes_transferred = 0;                // 初始化传输字节数为0
+    socklen_t peer_len = sizeof(session->peer_addr);
+    getpeername(client_socket, (struct sockaddr *)&session->peer_addr, &peer_len); // 记录客户端地址
+
+    trace_session_start(); // 按采样率决定是否记录本会话的时间线
+    capture_session_start(root_dir, session->peer_addr.sin_addr.s_addr, ntohs(session->peer_addr.sin_port));
+    control_init(client_socket);
 
     // 发送欢迎消息
     send_response(client_socket, 220, "Anonymous FTP server ready.");
@@ -25,17 +54,57 @@ void handle_connection(int client_socket, const char *root_dir)
     // 主循环，处理客户端命令
     while (1)
     {
-        int bytes_read = read_line(client_socket, line, sizeof(line));
+        scoreboard_set_memory(pool_mapped_bytes()); // 等待命令期间会话映射的内存
+        int bytes_read = control_read_line(client_socket, line, LINE_MAX_SIZE);
+        if (bytes_read == CONTROL_READ_DRAIN)
+        {
+            // 服务器正在升级或关闭，空闲会话不必等到排空时限
+            scoreboard_set_state(SB_STATE_CLOSING);
+            send_response(client_socket, 421, "Service not available, closing control connection.");
+            break;
+        }
         if (bytes_read <= 0)
             break; // 读取失败或连接关闭，退出循环
 
         // 解析命令和参数
-        parse_cmd_param(line, cmd, arg);
+        parse_cmd_param(line, cmd, sizeof(cmd), arg);
+        capture_begin(cmd, line);         // 记录命令供回放（开启 -capture-dir 时）
+        scoreboard_set_command(cmd, arg); // 在计分板上公布当前命令
+        uint64_t span = trace_begin();    // 每条命令一个跨度，其中嵌套各阶段的跨度
+
+        // RNFR 与 SITE CPFR 只对紧随其后的 RNTO / SITE CPTO 有效
+        pending_op_t pending = session->pending_op;
+        session->pending_op = PENDING_NONE;
+        if (pending != PENDING_NONE &&
+            (strcmp(cmd, "RNTO") == 0 || (strcmp(cmd, "SITE") == 0 && strncasecmp(arg, "CPTO", 4) == 0)))
+            session->pending_op = pending;
 
         // 处理命令
 
+        // 控制/数据连接的安全协商（RFC 4217），登录前后均可使用
+        if (strcmp(cmd, "AUTH") == 0)
+        {
+            int rc = handle_auth_command(client_socket, session, arg);
+            if (rc == -2)
+                break; // TLS 握手失败，连接已不可用
+            if (rc == 0)
+            {
+                logged_in = 0; // 重新协商后需要重新登录
+                awaiting_password = 0;
+                scoreboard_set_state(SB_STATE_CONNECTED);
+            }
+        }
+        else if (strcmp(cmd, "PBSZ") == 0)
+        {
+            handle_pbsz_command(client_socket, session, arg);
+        }
+        else if (strcmp(cmd, "PROT") == 0)
+        {
+            handle_prot_command(client_socket, session, arg);
+        }
+
         // 3.1 登录
-        if (logged_in == 0) // 尚未登录，其他命令均不合法
+        else if (logged_in == 0) // 尚未登录，其他命令均不合法
         {
             if (strcmp(cmd, "USER") == 0)
             {
@@ -77,6 +146,7 @@ void handle_connection(int client_socket, const char *root_dir)
                         send_multiline_response(client_socket, 230, lines);
                         logged_in = 1;         // 设置为已登录状态
                         awaiting_password = 0; // 登录完成
+                        scoreboard_set_state(SB_STATE_IDLE);
                     }
                     else
                     {
@@ -99,14 +169,14 @@ void handle_connection(int client_socket, const char *root_dir)
             // 3.2 连接模式
             if (strcmp(cmd, "PORT") == 0) // 处理PORT命令
             {
-                if (handle_port_command(client_socket, arg, &session) == 0)
+                if (handle_port_command(client_socket, arg, session) == 0)
                     send_response(client_socket, 200, "PORT command successful.");
                 else
                     send_response(client_socket, 501, "Syntax error in parameters or arguments.");
             }
             else if (strcmp(cmd, "PASV") == 0) // 处理PASV命令
             {
-                switch (handle_pasv_command(client_socket, &session))
+                switch (handle_pasv_command(client_socket, session))
                 {
                 case -1:
                     send_response(client_socket, 425, "Can't create socket for PASV.");
@@ -130,33 +200,87 @@ void handle_connection(int client_socket, const char *root_dir)
             // 3.3 文件传输命令处理
             else if (strcmp(cmd, "RETR") == 0)
             {
-                handle_retr_command(client_socket, &session, arg);
+                scoreboard_set_state(SB_STATE_TRANSFER);
+                handle_retr_command(client_socket, session, arg);
+                control_abort_reply(client_socket); // 传输被 ABOR 中断时，在 426 之后回复 ABOR
+                scoreboard_set_state(SB_STATE_IDLE);
             }
             else if (strcmp(cmd, "STOR") == 0)
             {
-                handle_stor_command(client_socket, &session, arg);
+                scoreboard_set_state(SB_STATE_TRANSFER);
+                handle_stor_command(client_socket, session, arg);
+                control_abort_reply(client_socket); // 传输被 ABOR 中断时，在 426 之后回复 ABOR
+                scoreboard_set_state(SB_STATE_IDLE);
             }
 
             // 3.4 文件和目录操作命令处理
             else if (strcmp(cmd, "CWD") == 0)
             {
-                handle_cwd_command(client_socket, &session, arg);
+                handle_cwd_command(client_socket, session, arg);
             }
             else if (strcmp(cmd, "PWD") == 0)
             {
-                handle_pwd_command(client_socket, &session);
+                handle_pwd_command(client_socket, session);
             }
             else if (strcmp(cmd, "MKD") == 0)
             {
-                handle_mkd_command(client_socket, &session, arg);
+                handle_mkd_command(client_socket, session, arg);
             }
             else if (strcmp(cmd, "RMD") == 0)
             {
-                handle_rmd_command(client_socket, &session, arg);
+                handle_rmd_command(client_socket, session, arg);
             }
             else if (strcmp(cmd, "LIST") == 0)
             {
-                handle_list_command(client_socket, &session, arg);
+                handle_list_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "NLST") == 0)
+            {
+                handle_nlst_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "MLSD") == 0)
+            {
+                handle_mlsd_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "REST") == 0)
+            {
+                handle_rest_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "MODE") == 0)
+            {
+                handle_mode_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "DELE") == 0)
+            {
+                handle_dele_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "RNFR") == 0)
+            {
+                handle_rnfr_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "RNTO") == 0)
+            {
+                handle_rnto_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "SIZE") == 0)
+            {
+                handle_size_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "MDTM") == 0)
+            {
+                handle_mdtm_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "MLST") == 0)
+            {
+                handle_mlst_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "OPTS") == 0)
+            {
+                handle_opts_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "HASH") == 0)
+            {
+                handle_hash_command(client_socket, session, arg);
             }
 
             // 3.5 其他系统命令处理
@@ -176,11 +300,29 @@ void handle_connection(int client_socket, const char *root_dir)
                     send_response(client_socket, 504, "Command not implemented for that parameter.");
                 }
             }
+            else if (strcmp(cmd, "NOOP") == 0)
+            {
+                send_response(client_socket, 200, "NOOP ok.");
+            }
+            else if (strcmp(cmd, "ABOR") == 0)
+            {
+                // 传输期间的 ABOR 由监视线程处理，到这里说明没有进行中的传输
+                send_response(client_socket, 225, "No transfer to abort.");
+            }
+            else if (strcmp(cmd, "SITE") == 0)
+            {
+                handle_site_command(client_socket, session, arg);
+            }
+            else if (strcmp(cmd, "STAT") == 0)
+            {
+                handle_stat_command(client_socket, session, arg);
+            }
             else if (strcmp(cmd, "QUIT") == 0)
             {
-
+                scoreboard_set_state(SB_STATE_CLOSING);
                 char bytes_msg[64];
-                snprintf(bytes_msg, sizeof(bytes_msg), "Total bytes transferred: %d", session.bytes_transferred);
+                snprintf(bytes_msg, sizeof(bytes_msg), "Total bytes transferred: %llu",
+                         (unsigned long long)session->bytes_transferred);
                 const char *lines[] = {
                     "Goodbye.",
                     bytes_msg,
@@ -194,5 +336,17 @@ void handle_connection(int client_socket, const char *root_dir)
                 send_response(client_socket, 500, "Command not implemented.");
             }
         }
+        trace_end(cmd, span, 0);
+        capture_end();
     }
+
+    trace_set(0);           // 输出本会话记录的时间线
+    capture_session_end(); // 写出退出循环的那条命令（如 QUIT）并关闭捕获文件
+
+    if (session->pending_from != NULL)
+        slab_free(path_cache(), session->pending_from);
+    slab_free(path_cache(), session->cwd);
+    slab_free(line_cache(), arg);
+    slab_free(line_cache(), line);
+    slab_free(session_cache(), session);
 }
@@ -0,0 +1,736 @@
+#include "index.h"
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <sys/inotify.h>
+
+#define NIL UINT32_MAX
+#define INDEX_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | \
+                          IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define INDEX_QUERY_TIMEOUT_S 5 // 读取查询请求的超时
+
+typedef struct
+{
+    char *name;            // NULL 表示空闲节点
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling; // 空闲节点用它串成空闲链表
+    uint32_t prev_sibling;
+    uint32_t hash_next;    // 散列桶中的下一个节点
+    int32_t wd;            // 目录的 inotify 监视，-1 表示没有
+    uint8_t is_dir;
+} index_node;
+
+// 以下在父进程与会话中使用
+static int enabled = 0;
+static struct sockaddr_un server_addr; // 抽象命名空间地址，sun_path[0] 为 '\0'
+static socklen_t server_addr_len = 0;
+
+// 以下只在索引进程中使用；节点 0 是根目录
+static char root_path[PATH_MAX];
+static index_node *nodes = NULL;
+static uint32_t node_count = 0; // 用过的最大节点号 + 1
+static uint32_t node_cap = 0;
+static uint32_t free_nodes = NIL;
+static uint32_t live_nodes = 0;
+static uint32_t *buckets = NULL;
+static uint32_t bucket_mask = 0;
+static uint32_t *wd_nodes = NULL; // inotify 监视号 -> 节点
+static int wd_cap = 0;
+static int inotify_fd = -1;
+static int ready = 0;    // 遍历完成，可以回答查询
+static int degraded = 0; // 有目录没能加上监视，索引可能过时
+static pthread_rwlock_t index_lock;
+
+static uint32_t hash_name(uint32_t parent, const char *name)
+{
+    uint32_t h = 2166136261u ^ parent;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++)
+        h = (h ^ *p) * 16777619u;
+    return h;
+}
+
+static uint32_t node_find(uint32_t parent, const char *name)
+{
+    for (uint32_t id = buckets[hash_name(parent, name) & bucket_mask]; id != NIL; id = nodes[id].hash_next)
+    {
+        if (nodes[id].parent == parent && strcmp(nodes[id].name, name) == 0)
+            return id;
+    }
+    return NIL;
+}
+
+/**
+ * 节点数超过桶数时把散列表扩大一倍
+ * @return 0 成功，-1 内存不足（保留原表，只是链变长）
+ */
+static int grow_buckets(void)
+{
+    uint32_t count = (bucket_mask + 1) * 2;
+    uint32_t *table = malloc(sizeof(uint32_t) * count);
+    if (table == NULL)
+        return -1;
+    for (uint32_t i = 0; i < count; i++)
+        table[i] = NIL;
+    for (uint32_t id = 0; id < node_count; id++)
+    {
+        if (nodes[id].name == NULL)
+            continue;
+        uint32_t b = hash_name(nodes[id].parent, nodes[id].name) & (count - 1);
+        nodes[id].hash_next = table[b];
+        table[b] = id;
+    }
+    free(buckets);
+    buckets = table;
+    bucket_mask = count - 1;
+    return 0;
+}
+
+/**
+ * 在 parent 下新建一个节点
+ * @return 节点号，内存不足时返回 NIL
+ */
+static uint32_t node_add(uint32_t parent, const char *name, int is_dir)
+{
+    uint32_t id = free_nodes;
+    if (id != NIL)
+    {
+        free_nodes = nodes[id].next_sibling;
+    }
+    else
+    {
+        if (node_count == node_cap)
+        {
+            uint32_t cap = node_cap > 0 ? node_cap * 2 : 4096;
+            index_node *grown = realloc(nodes, sizeof(index_node) * cap);
+            if (grown == NULL)
+                return NIL;
+            nodes = grown;
+            node_cap = cap;
+        }
+        id = node_count++;
+    }
+    index_node *n = &nodes[id];
+    n->name = strdup(name);
+    if (n->name == NULL)
+    {
+        n->next_sibling = free_nodes;
+        free_nodes = id;
+        return NIL;
+    }
+    n->parent = parent;
+    n->first_child = NIL;
+    n->prev_sibling = NIL;
+    n->next_sibling = NIL;
+    n->wd = -1;
+    n->is_dir = (uint8_t)is_dir;
+    if (parent != NIL)
+    {
+        n->next_sibling = nodes[parent].first_child;
+        if (n->next_sibling != NIL)
+            nodes[n->next_sibling].prev_sibling = id;
+        nodes[parent].first_child = id;
+    }
+    uint32_t b = hash_name(parent, name) & bucket_mask;
+    n->hash_next = buckets[b];
+    buckets[b] = id;
+    if (++live_nodes > bucket_mask + 1)
+        grow_buckets();
+    return id;
+}
+
+/**
+ * 删除节点及其整棵子树，同时移除目录上的监视
+ */
+static void node_remove(uint32_t id)
+{
+    while (nodes[id].first_child != NIL)
+        node_remove(nodes[id].first_child);
+
+    index_node *n = &nodes[id];
+    if (n->wd >= 0)
+    {
+        inotify_rm_watch(inotify_fd, n->wd); // 已被内核移除时返回 EINVAL，无妨
+        if (n->wd < wd_cap)
+            wd_nodes[n->wd] = NIL;
+    }
+    if (n->prev_sibling != NIL)
+        nodes[n->prev_sibling].next_sibling = n->next_sibling;
+    else if (n->parent != NIL)
+        nodes[n->parent].first_child = n->next_sibling;
+    if (n->next_sibling != NIL)
+        nodes[n->next_sibling].prev_sibling = n->prev_sibling;
+
+    uint32_t *link = &buckets[hash_name(n->parent, n->name) & bucket_mask];
+    while (*link != id)
+        link = &nodes[*link].hash_next;
+    *link = n->hash_next;
+
+    free(n->name);
+    n->name = NULL;
+    n->next_sibling = free_nodes;
+    free_nodes = id;
+    live_nodes--;
+}
+
+/**
+ * 生成节点的绝对路径
+ * @return 0 成功，-1 路径过长
+ */
+static int node_path(uint32_t id, char *out, size_t outsz)
+{
+    uint32_t chain[PATH_MAX / 2];
+    int depth = 0;
+    for (uint32_t n = id; n != 0 && depth < (int)(sizeof(chain) / sizeof(chain[0])); n = nodes[n].parent)
+        chain[depth++] = n;
+    size_t len = (size_t)snprintf(out, outsz, "%s", root_path);
+    while (depth > 0)
+    {
+        int w = snprintf(out + len, outsz - len, "/%s", nodes[chain[--depth]].name);
+        if (w < 0 || (size_t)w >= outsz - len)
+            return -1;
+        len += (size_t)w;
+    }
+    if (len == 0)
+        snprintf(out, outsz, "/"); // 根目录为 "/" 时 root_path 为空
+    return 0;
+}
+
+/**
+ * 为目录加上监视；监视数用尽时把索引标记为不完整
+ */
+static void watch_dir(uint32_t id, const char *path)
+{
+    int wd = inotify_add_watch(inotify_fd, path, INDEX_WATCH_MASK);
+    if (wd < 0)
+    {
+        if ((errno == ENOSPC || errno == ENOMEM) && !degraded)
+        {
+            fprintf(stderr, "index: cannot watch %s (%s), falling back to directory walks; "
+                            "raise fs.inotify.max_user_watches\n", path, strerror(errno));
+            degraded = 1;
+        }
+        return;
+    }
+    if (wd >= wd_cap)
+    {
+        int cap = wd_cap > 0 ? wd_cap : 4096;
+        while (cap <= wd)
+            cap *= 2;
+        uint32_t *grown = realloc(wd_nodes, sizeof(uint32_t) * (size_t)cap);
+        if (grown == NULL)
+        {
+            inotify_rm_watch(inotify_fd, wd);
+            degraded = 1;
+            return;
+        }
+        for (int i = wd_cap; i < cap; i++)
+            grown[i] = NIL;
+        wd_nodes = grown;
+        wd_cap = cap;
+    }
+    wd_nodes[wd] = id;
+    nodes[id].wd = wd;
+}
+
+/**
+ * 遍历目录 id 以下的整棵子树，补上索引中还没有的目录项。
+ * 先加监视再读目录，读取期间发生的变化会在之后的事件中体现
+ */
+static void scan_tree(uint32_t id)
+{
+    uint32_t *stack = malloc(sizeof(uint32_t) * 1024);
+    size_t cap = 1024, top = 0;
+    if (stack == NULL)
+        return;
+    stack[top++] = id;
+    char path[PATH_MAX];
+    while (top > 0)
+    {
+        uint32_t dir_id = stack[--top];
+        if (node_path(dir_id, path, sizeof(path)) != 0)
+            continue;
+        if (nodes[dir_id].wd < 0)
+            watch_dir(dir_id, path);
+        int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        DIR *dir = dfd >= 0 ? fdopendir(dfd) : NULL;
+        if (dir == NULL)
+        {
+            if (dfd >= 0)
+                close(dfd);
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            int is_dir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN)
+            {
+                struct stat st;
+                if (fstatat(dfd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                    continue;
+                is_dir = S_ISDIR(st.st_mode);
+            }
+            uint32_t child = node_find(dir_id, entry->d_name);
+            if (child == NIL)
+                child = node_add(dir_id, entry->d_name, is_dir);
+            if (child == NIL || !is_dir)
+                continue;
+            if (top == cap)
+            {
+                uint32_t *grown = realloc(stack, sizeof(uint32_t) * cap * 2);
+                if (grown == NULL)
+                    continue;
+                stack = grown;
+                cap *= 2;
+            }
+            stack[top++] = child;
+        }
+        closedir(dir);
+    }
+    free(stack);
+}
+
+/**
+ * 清空索引并重新遍历整棵树；遍历期间 ready 为 0，查询由会话自行遍历
+ */
+static void rebuild(void)
+{
+    pthread_rwlock_wrlock(&index_lock);
+    ready = 0;
+    for (uint32_t id = 0; id < node_count; id++)
+        free(nodes[id].name);
+    node_count = 0;
+    free_nodes = NIL;
+    live_nodes = 0;
+    for (uint32_t i = 0; i <= bucket_mask; i++)
+        buckets[i] = NIL;
+    for (int i = 0; i < wd_cap; i++)
+        wd_nodes[i] = NIL;
+    if (inotify_fd >= 0)
+        close(inotify_fd); // 关闭即移除全部监视
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    degraded = inotify_fd < 0;
+    pthread_rwlock_unlock(&index_lock);
+
+    // 遍历不持锁：ready 为 0 时查询不访问节点
+    uint64_t start = monotonic_us();
+    uint32_t root = node_add(NIL, "", 1);
+    if (root != NIL && inotify_fd >= 0)
+        scan_tree(root);
+
+    pthread_rwlock_wrlock(&index_lock);
+    ready = root != NIL;
+    pthread_rwlock_unlock(&index_lock);
+    fprintf(stderr, "index: %u entries under %s in %.1f s%s\n", live_nodes, root_path,
+            (double)(monotonic_us() - start) / 1e6, degraded ? " (incomplete)" : "");
+}
+
+/**
+ * 应用一条 inotify 事件，调用者持有写锁
+ * @return 1 事件队列溢出，需要重建
+ */
+static int apply_event(const struct inotify_event *ev)
+{
+    if (ev->mask & IN_Q_OVERFLOW)
+        return 1;
+    if (ev->wd < 0 || ev->wd >= wd_cap || wd_nodes[ev->wd] == NIL)
+        return 0;
+    uint32_t dir = wd_nodes[ev->wd];
+    if (ev->mask & IN_IGNORED)
+    {
+        wd_nodes[ev->wd] = NIL;
+        if (nodes[dir].wd == ev->wd)
+            nodes[dir].wd = -1;
+        if (dir == 0)
+            degraded = 1; // 根目录本身被删除或卸载
+        return 0;
+    }
+    if (ev->len == 0)
+        return 0; // 目录自身的事件，由父目录上的事件处理
+    uint32_t child = node_find(dir, ev->name);
+    if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        if (child != NIL)
+            node_remove(child);
+    }
+    else if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        int is_dir = (ev->mask & IN_ISDIR) != 0;
+        if (child != NIL && nodes[child].is_dir != is_dir)
+        {
+            node_remove(child);
+            child = NIL;
+        }
+        if (child == NIL)
+            child = node_add(dir, ev->name, is_dir);
+        if (child != NIL && is_dir)
+            scan_tree(child); // 新建或移入的目录：加监视并补上其中已有的内容
+    }
+    return 0;
+}
+
+/**
+ * 读取并应用所有已到达的事件
+ */
+static void process_events(void)
+{
+    static char events[INDEX_EVENT_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int overflow = 0;
+    ssize_t n;
+    while ((n = read(inotify_fd, events, sizeof(events))) > 0)
+    {
+        pthread_rwlock_wrlock(&index_lock);
+        for (char *p = events; p < events + n && !overflow;)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            overflow = apply_event(ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        pthread_rwlock_unlock(&index_lock);
+        if (overflow)
+            break;
+    }
+    if (overflow)
+        rebuild();
+}
+
+// 路径树作为匹配的数据来源：目录句柄就是节点号
+
+static int tree_children(void *src, uintptr_t dir, const char *rel, glob_visit visit, void *frame)
+{
+    (void)src;
+    (void)rel;
+    for (uint32_t id = nodes[dir].first_child; id != NIL; id = nodes[id].next_sibling)
+    {
+        glob_entry e = {nodes[id].name, nodes[id].is_dir, id};
+        if (visit(frame, &e) != 0)
+            break;
+    }
+    return 0;
+}
+
+static int tree_lookup(void *src, uintptr_t dir, const char *rel, const char *name, glob_entry *out)
+{
+    (void)src;
+    (void)rel;
+    uint32_t id = node_find((uint32_t)dir, name);
+    if (id == NIL)
+        return 0;
+    out->name = nodes[id].name;
+    out->is_dir = nodes[id].is_dir;
+    out->handle = id;
+    return 1;
+}
+
+static const glob_source tree_source = {tree_children, tree_lookup};
+
+typedef struct
+{
+    char *data;
+    size_t used;
+    size_t cap;
+} reply_buf;
+
+static int reply_append(void *ctx, const char *rel, int is_dir)
+{
+    reply_buf *r = ctx;
+    size_t need = strlen(rel) + 2;
+    if (r->used + need > r->cap)
+    {
+        size_t cap = r->cap * 2 > r->used + need ? r->cap * 2 : r->used + need;
+        char *grown = realloc(r->data, cap);
+        if (grown == NULL)
+            return -1;
+        r->data = grown;
+        r->cap = cap;
+    }
+    r->data[r->used++] = is_dir ? 'd' : 'f';
+    memcpy(r->data + r->used, rel, need - 1);
+    r->used += need - 1;
+    return 0;
+}
+
+static int read_full(int fd, void *buffer, size_t len)
+{
+    char *p = buffer;
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * 回答一次查询：在读锁下匹配并把结果收集到缓冲区，释放锁之后再发送，
+ * 读得慢的会话不会拖住索引更新
+ */
+static void *query_main(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    index_request req;
+    char base[PATH_MAX], pattern_text[PATH_MAX];
+    if (read_full(fd, &req, sizeof(req)) != 0 || req.magic != INDEX_MAGIC || req.base_len >= sizeof(base) ||
+        req.pattern_len >= sizeof(pattern_text) || read_full(fd, base, req.base_len) != 0 ||
+        read_full(fd, pattern_text, req.pattern_len) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    base[req.base_len] = '\0';
+    pattern_text[req.pattern_len] = '\0';
+
+    glob_pattern *pattern = malloc(sizeof(*pattern));
+    reply_buf reply = {malloc(65536), sizeof(int32_t), 65536};
+    int32_t status = INDEX_NOT_FOUND;
+    size_t root_len = strlen(root_path);
+    if (pattern == NULL || reply.data == NULL || glob_compile(pattern, pattern_text) != 0 ||
+        strncmp(base, root_path, root_len) != 0 || (base[root_len] != '/' && base[root_len] != '\0'))
+        goto done;
+
+    pthread_rwlock_rdlock(&index_lock);
+    if (!ready || degraded)
+    {
+        status = INDEX_UNAVAILABLE;
+    }
+    else
+    {
+        // 从根节点逐级找到起点目录
+        uint32_t dir = 0;
+        char *save = NULL;
+        for (char *s = strtok_r(base + root_len, "/", &save); s != NULL && dir != NIL;
+             s = strtok_r(NULL, "/", &save))
+            dir = node_find(dir, s);
+        if (dir != NIL && nodes[dir].is_dir)
+        {
+            int64_t count = glob_run(pattern, &tree_source, NULL, dir, req.limit, reply_append, &reply);
+            status = count < 0 ? INDEX_UNAVAILABLE : 0;
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+done:
+    if (reply.data != NULL)
+    {
+        memcpy(reply.data, &status, sizeof(status));
+        size_t len = status == 0 ? reply.used : sizeof(status);
+        for (size_t off = 0; off < len;)
+        {
+            ssize_t n = send(fd, reply.data + off, len - off, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            off += (size_t)n;
+        }
+    }
+    free(reply.data);
+    free(pattern);
+    close(fd);
+    return NULL;
+}
+
+/**
+ * 接受查询连接，每个查询一个分离的线程；只接受与本进程同一用户的连接
+ */
+static void *accept_main(void *arg)
+{
+    int listen_fd = (int)(intptr_t)arg;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (1)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        struct timeval timeout = {INDEX_QUERY_TIMEOUT_S, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        pthread_t thread;
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != geteuid() ||
+            pthread_create(&thread, &attr, query_main, (void *)(intptr_t)fd) != 0)
+            close(fd);
+    }
+    pthread_attr_destroy(&attr);
+    return NULL;
+}
+
+/**
+ * 索引进程主体：建立索引，之后只处理 inotify 事件，查询由其它线程回答
+ */
+static void index_main(int listen_fd)
+{
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    // 默认的读者优先会让持续的查询饿死更新
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&index_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    buckets = malloc(sizeof(uint32_t) * 4096);
+    if (buckets == NULL)
+        _exit(EXIT_FAILURE);
+    bucket_mask = 4095;
+    for (uint32_t i = 0; i <= bucket_mask; i++)
+        buckets[i] = NIL;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, accept_main, (void *)(intptr_t)listen_fd) != 0)
+        _exit(EXIT_FAILURE);
+    rebuild();
+    while (1)
+    {
+        struct pollfd pfd = {.fd = inotify_fd, .events = POLLIN};
+        if (inotify_fd < 0)
+        {
+            pause(); // 无法使用 inotify，只回答“不可用”
+            continue;
+        }
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            _exit(EXIT_FAILURE);
+        if (pfd.revents & POLLIN)
+            process_events();
+    }
+}
+
+/**
+ * 启动索引进程，必须在 fork 会话之前由父进程调用
+ * @param root 服务器根目录（绝对路径）
+ * @return 0 成功，-1 失败
+ */
+int index_start(const char *root)
+{
+    snprintf(root_path, sizeof(root_path), "%s", root);
+    size_t len = strlen(root_path);
+    while (len > 1 && root_path[len - 1] == '/')
+        root_path[--len] = '\0';
+    if (strcmp(root_path, "/") == 0)
+        root_path[0] = '\0'; // 节点路径总是以 "/名字" 拼接
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    int name_len = snprintf(server_addr.sun_path + 1, sizeof(server_addr.sun_path) - 1, "ftpserver-index-%d",
+                            (int)getpid());
+    server_addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + name_len);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&server_addr, server_addr_len) != 0 ||
+        listen(listen_fd, 64) != 0)
+    {
+        perror("index socket failed");
+        if (listen_fd >= 0)
+            close(listen_fd);
+        return -1;
+    }
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork index process failed");
+        close(listen_fd);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        // 父进程退出（包括升级后旧进程排空退出）时随之结束
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent)
+            _exit(EXIT_SUCCESS);
+        prctl(PR_SET_NAME, "ftp-index");
+        index_main(listen_fd);
+        _exit(EXIT_SUCCESS);
+    }
+    close(listen_fd);
+    enabled = 1;
+    return 0;
+}
+
+int index_enabled(void)
+{
+    return enabled;
+}
+
+/**
+ * 会话查询索引，对每个结果调用 emit
+ * @param base 起点目录（规范化的绝对路径）
+ * @param pattern 相对于起点的模式
+ * @param limit 最多返回的结果数
+ * @return 结果数；INDEX_NOT_FOUND 起点不存在；INDEX_UNAVAILABLE 应改为遍历文件系统
+ */
+int64_t index_query(const char *base, const char *pattern, uint32_t limit, glob_emit emit, void *ctx)
+{
+    size_t base_len = strlen(base), pattern_len = strlen(pattern);
+    if (!enabled || base_len >= PATH_MAX || pattern_len >= PATH_MAX)
+        return INDEX_UNAVAILABLE;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return INDEX_UNAVAILABLE;
+    if (connect(fd, (struct sockaddr *)&server_addr, server_addr_len) != 0)
+    {
+        close(fd); // 索引进程不在了
+        return INDEX_UNAVAILABLE;
+    }
+    index_request req = {INDEX_MAGIC, limit, (uint16_t)base_len, (uint16_t)pattern_len};
+    int32_t status;
+    if (send_all(fd, &req, sizeof(req)) != 0 || send_all(fd, base, base_len) != 0 ||
+        send_all(fd, pattern, pattern_len) != 0 || read_full(fd, &status, sizeof(status)) != 0)
+    {
+        close(fd);
+        return INDEX_UNAVAILABLE;
+    }
+    if (status != 0)
+    {
+        close(fd);
+        return status;
+    }
+
+    char *buffer = malloc(INDEX_READ_BUF);
+    if (buffer == NULL)
+    {
+        close(fd);
+        return INDEX_UNAVAILABLE;
+    }
+    int64_t count = 0;
+    size_t have = 0;
+    int stop = 0;
+    while (!stop)
+    {
+        ssize_t n = recv(fd, buffer + have, INDEX_READ_BUF - have, 0);
+        if (n <= 0)
+            break; // 结果结束
+        have += (size_t)n;
+        // 逐条处理完整的记录，不完整的尾部移到缓冲区开头
+        size_t off = 0;
+        while (!stop)
+        {
+            char *end = memchr(buffer + off, '\0', have - off);
+            if (end == NULL)
+                break;
+            stop = emit(ctx, buffer + off + 1, buffer[off] == 'd') != 0;
+            count++;
+            off = (size_t)(end - buffer) + 1;
+        }
+        memmove(buffer, buffer + off, have - off);
+        have -= off;
+        if (have == INDEX_READ_BUF)
+            break; // 单条记录超过缓冲区，数据有误
+    }
+    free(buffer);
+    close(fd);
+    return count;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include "pathglob.h"
+
+#define INDEX_MAGIC 0x31584449u        // "IDX1"，查询请求的魔数
+#define INDEX_READ_BUF (64 * 1024)     // 会话读取查询结果的缓冲区
+#define INDEX_EVENT_BUF (64 * 1024)    // 索引进程一次读取的 inotify 事件
+
+// index_query 的返回值（非负时为结果数）
+#define INDEX_NOT_FOUND (-1)   // 查询起点不存在或不是目录
+#define INDEX_UNAVAILABLE (-2) // 没有开启索引、索引尚未建好或不完整，调用者应改为遍历文件系统
+
+/*
+ * 根目录下整棵目录树的内存索引（-index 开启，仅本地存储后端）：
+ *  - 父进程在 fork 会话之前启动一个独立的索引进程，索引不占用父进程的地址空间，
+ *    fork 会话时不必复制它的页表；父进程退出时索引进程随之被内核结束
+ *  - 索引是一棵路径树：每个目录项一个节点，按（父节点，名字）散列，子项用链表串起。
+ *    启动时遍历一次，之后每个目录一个 inotify 监视，按创建/删除/移动事件增量更新；
+ *    事件队列溢出时整体重建，监视数达到 fs.inotify.max_user_watches 时索引标记为不完整
+ *  - 会话通过抽象命名空间的 unix socket 查询：请求中给出起点目录和通配模式，
+ *    索引进程在读锁下匹配，结果以“类型字节 + 相对路径 + '\0'”的记录流返回
+ *  - 索引不可用时调用者改为用同样的匹配逻辑逐级遍历存储后端
+ */
+
+typedef struct
+{
+    uint32_t magic;       // INDEX_MAGIC
+    uint32_t limit;       // 最多返回的结果数
+    uint16_t base_len;    // 起点目录（绝对路径）长度
+    uint16_t pattern_len; // 模式长度
+} index_request;          // 之后紧跟起点目录与模式，均不含 '\0'
+
+int index_start(const char *root);
+int index_enabled(void);
+int64_t index_query(const char *base, const char *pattern, uint32_t limit, glob_emit emit, void *ctx);
@@ -1,15 +1,117 @@
 #include "main.h"
 #include "utils.h"
 #include "file.h"
+#include "xferlog.h"
+#include "scoreboard.h"
+#include "admission.h"
+#include "tls.h"
+#include "pool.h"
+#include "upgrade.h"
+#include "trace.h"
+#include "storage.h"
+#include "statcache.h"
+#include "affinity.h"
+#include "tcptune.h"
+#include "index.h"
+#include "replica.h"
+#include "capture.h"
 #include <signal.h>
 #include <unistd.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+
+static volatile sig_atomic_t dump_requested = 0; // 收到 SIGUSR1 后输出计分板
+
+static volatile sig_atomic_t upgrade_requested = 0;  // 收到 SIGUSR2 后执行零停机升级
+static volatile sig_atomic_t shutdown_requested = 0; // 收到 SIGTERM 后停止 accept 并排空
+
+static void on_sigusr1(int signo)
+{
+    (void)signo;
+    dump_requested = 1;
+}
+
+static void on_sigusr2(int signo)
+{
+    (void)signo;
+    upgrade_requested = 1;
+}
+
+static void on_sigterm(int signo)
+{
+    (void)signo;
+    shutdown_requested = 1;
+}
+
+/**
+ * 以 421 快速拒绝一个连接，不阻塞也不触发 SIGPIPE
+ */
+static void reject_connection(int connected_socket, const char *message)
+{
+    char response[LINE_MAX_SIZE];
+    int len = snprintf(response, sizeof(response), "421 %s\r\n", message);
+    send(connected_socket, response, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(connected_socket);
+}
+
+static void release_admission(int32_t entry)
+{
+    admission_release(entry);
+}
+
+/**
+ * 创建监听socket并开始监听，失败时退出进程
+ * @param port 监听端口
+ * @return 监听socket
+ */
+static int create_listen_socket(int port)
+{
+    int listen_socket;
+    struct sockaddr_in server_addr; // 服务器地址结构体
+
+    // 创建监听socket
+    if ((listen_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    {
+        perror("listen socket creation failed!");
+        exit(EXIT_FAILURE);
+    }
+
+    // 允许端口复用，便于快速重启
+    int opt = 1;
+    if (setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    {
+        perror("setsockopt SO_REUSEADDR failed");
+    }
+
+    // 配置服务器地址结构体
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    server_addr.sin_port = htons(port);
+
+    // 绑定地址和端口到socket
+    if (bind(listen_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1)
+    {
+        perror("bind failed!");
+        close(listen_socket);
+        exit(EXIT_FAILURE);
+    }
+
+    // 开始监听连接请求
+    if (listen(listen_socket, WAITING_QUEUE_SIZE) == -1)
+    {
+        perror("listen failed!");
+        close(listen_socket);
+        exit(EXIT_FAILURE);
+    }
+    return listen_socket;
+}
 
 int main(int argc, char **argv)
 {
     int listen_socket;              // 监听socket
     int connected_socket;           // 连接socket
-    struct sockaddr_in server_addr; // 服务器地址结构体
 
     // 解析命令行参数
     int port = CONTROL_PORT; // 默认控制端口21
@@ -17,6 +119,34 @@ int main(int argc, char **argv)
     // 默认根目录与测试一致：/tmp（首轮不传 -root）
     strncpy(root_dir, "/tmp", sizeof(root_dir) - 1);
     root_dir[sizeof(root_dir) - 1] = '\0';
+    const char *xferlog_path = NULL;                         // 传输日志文件，NULL 表示不记录
+    xferlog_format_t xferlog_format = XFERLOG_FORMAT_XFERLOG; // 传输日志格式
+    int max_sessions = SCOREBOARD_DEFAULT_SLOTS;              // 最大并发会话数
+    const char *tls_cert = NULL;                             // TLS 证书，未设置时不支持 AUTH TLS
+    const char *tls_key = NULL;                              // TLS 私钥，默认与证书同一文件
+    int use_ktls = 1;                                        // 握手后尝试启用内核 TLS
+    int use_hugepages = 0;                                   // 达到 2MB 的 slab 是否使用大页（会话缓存远小于此，不使用）
+    int drain_timeout = UPGRADE_DEFAULT_DRAIN_TIMEOUT;       // 升级或关闭时等待会话结束的时限（秒）
+    const char *trace_dir = NULL;                            // 会话时间线输出目录，NULL 表示不支持追踪
+    double trace_sample = 0.0;                               // 自动追踪的会话比例
+    const char *capture_dir = NULL;                          // 会话捕获输出目录，NULL 表示不捕获
+    const char *storage_spec = NULL;                         // 存储后端：local（默认）或 ram[:MB]
+    int stat_cache_ttl = STATCACHE_DEFAULT_TTL_MS;           // 元数据缓存有效期（毫秒），0 表示关闭
+    const char *cpu_list = NULL;                             // 会话绑定的 CPU 集合，NULL 表示不绑定
+    affinity_pin_t cpu_pin = AFFINITY_PIN_CORE;              // 绑定到单个 CPU 还是其所在的 NUMA 节点
+    const char *tcp_cc = NULL;                               // 数据连接的拥塞控制算法，NULL 表示系统默认
+    int tcp_fastopen = TCPTUNE_DEFAULT_FASTOPEN;             // 监听socket的 TFO 队列长度，0 表示关闭
+    int tcp_max_buf = TCPTUNE_DEFAULT_MAX_BUF_MB;            // 数据连接缓冲区上限（MB），0 表示不调整
+    int use_index = 0;                                       // 是否维护目录树的内存索引（SITE FIND、NLST/MLSD 通配）
+    const char *replica_targets[REPLICA_MAX_TARGETS + 1];   // -replica 可重复指定，多出的一个用于报错
+    int replica_count = 0;
+    int replica_workers = REPLICA_DEFAULT_WORKERS;           // 同时进行的复制数
+    admission_config admission = {
+        .max_per_ip = 64,     // 单个IP最多64个并发会话
+        .rate_per_ip = 50,    // 单个IP每秒最多50个新连接
+        .burst_per_ip = 100,  // 允许100个连接的突发
+        .global_rate = 0,     // 全局连接速率默认不限制
+        .global_burst = 0};
 
     for (int i = 1; i < argc; i++)
     {
@@ -29,6 +159,188 @@ int main(int argc, char **argv)
             strncpy(root_dir, argv[++i], sizeof(root_dir) - 1);
             root_dir[sizeof(root_dir) - 1] = '\0';
         }
+        else if (strcmp(argv[i], "-max-sessions") == 0 && i + 1 < argc)
+        {
+            max_sessions = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-max-per-ip") == 0 && i + 1 < argc)
+        {
+            admission.max_per_ip = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-rate-per-ip") == 0 && i + 1 < argc)
+        {
+            admission.rate_per_ip = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-burst-per-ip") == 0 && i + 1 < argc)
+        {
+            admission.burst_per_ip = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-max-rate") == 0 && i + 1 < argc)
+        {
+            admission.global_rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-max-burst") == 0 && i + 1 < argc)
+        {
+            admission.global_burst = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-tls-cert") == 0 && i + 1 < argc)
+        {
+            tls_cert = argv[++i];
+        }
+        else if (strcmp(argv[i], "-tls-key") == 0 && i + 1 < argc)
+        {
+            tls_key = argv[++i];
+        }
+        else if (strcmp(argv[i], "-tls-ktls") == 0 && i + 1 < argc)
+        {
+            use_ktls = strcmp(argv[++i], "off") != 0;
+        }
+        else if (strcmp(argv[i], "-drain-timeout") == 0 && i + 1 < argc)
+        {
+            drain_timeout = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-trace-dir") == 0 && i + 1 < argc)
+        {
+            trace_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-capture-dir") == 0 && i + 1 < argc)
+        {
+            capture_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-trace-sample") == 0 && i + 1 < argc)
+        {
+            trace_sample = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-storage") == 0 && i + 1 < argc)
+        {
+            storage_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "-stat-cache-ttl") == 0 && i + 1 < argc)
+        {
+            stat_cache_ttl = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-cpus") == 0 && i + 1 < argc)
+        {
+            cpu_list = argv[++i];
+        }
+        else if (strcmp(argv[i], "-cpu-pin") == 0 && i + 1 < argc)
+        {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "core") == 0)
+                cpu_pin = AFFINITY_PIN_CORE;
+            else if (strcmp(mode, "node") == 0)
+                cpu_pin = AFFINITY_PIN_NODE;
+            else
+            {
+                fprintf(stderr, "unknown cpu pin mode: %s\n", mode);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "-tcp-cc") == 0 && i + 1 < argc)
+        {
+            tcp_cc = argv[++i];
+        }
+        else if (strcmp(argv[i], "-tcp-fastopen") == 0 && i + 1 < argc)
+        {
+            tcp_fastopen = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-tcp-max-buf") == 0 && i + 1 < argc)
+        {
+            tcp_max_buf = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-replica") == 0 && i + 1 < argc)
+        {
+            if (replica_count <= REPLICA_MAX_TARGETS)
+                replica_targets[replica_count++] = argv[++i];
+            else
+                i++;
+        }
+        else if (strcmp(argv[i], "-replica-workers") == 0 && i + 1 < argc)
+        {
+            replica_workers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-index") == 0)
+        {
+            use_index = 1;
+        }
+        else if (strcmp(argv[i], "-hugepages") == 0)
+        {
+            use_hugepages = 1;
+        }
+        else if (strcmp(argv[i], "-xferlog") == 0 && i + 1 < argc)
+        {
+            xferlog_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-xferlog-format") == 0 && i + 1 < argc)
+        {
+            const char *format = argv[++i];
+            if (strcmp(format, "jsonl") == 0)
+                xferlog_format = XFERLOG_FORMAT_JSONL;
+            else if (strcmp(format, "xferlog") == 0)
+                xferlog_format = XFERLOG_FORMAT_XFERLOG;
+            else
+            {
+                fprintf(stderr, "unknown xferlog format: %s\n", format);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    // 控制信号只在主循环等待连接时递送，必须在创建任何线程之前屏蔽，否则会被递送到后台线程
+    sigset_t control_signals, orig_mask;
+    sigemptyset(&control_signals);
+    sigaddset(&control_signals, SIGUSR1);
+    sigaddset(&control_signals, SIGUSR2);
+    sigaddset(&control_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &control_signals, &orig_mask);
+
+    // 升级时需要按启动目录重新解析二进制路径与相对参数
+    upgrade_init(argv[0]);
+    // 传输日志路径在 chdir 之前打开，因此相对路径相对于启动目录
+    if (xferlog_path != NULL && xferlog_init(xferlog_path, xferlog_format) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // 本地复制目标同样相对于启动目录；队列在共享内存中，复制线程在存储后端初始化之后启动
+    if (replica_count > 0 && replica_init(replica_targets, replica_count, replica_workers) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // 追踪目录同样相对于启动目录；SITE TRACE 可对单个会话开启
+    trace_configure(trace_dir, trace_sample);
+    // 捕获目录同样相对于启动目录；每个会话把控制命令与时间写入自己的文件，供 bench/replay 回放
+    capture_configure(capture_dir);
+    // 证书路径同样相对于启动目录
+    if (tls_cert != NULL && tls_init(tls_cert, tls_key != NULL ? tls_key : tls_cert, use_ktls) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // 会话与传输缓冲区的 slab 池，子进程继承缓存描述，各自按需映射内存
+    pool_init(use_hugepages);
+    // 会话计分板位于共享内存，子进程更新，父进程与 SITE WHO/STAT 无锁读取
+    if (scoreboard_init(max_sessions) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // 每IP与全局准入控制，在 fork 之前执行；槽位释放时归还该IP的并发计数
+    if (admission_init(&admission) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    scoreboard_set_release_hook(release_admission);
+    // 会话的 CPU 绑定：按连接的接收 CPU 与计分板中各 CPU 的会话数分配
+    if (affinity_init(cpu_list, cpu_pin) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // 数据连接的缓冲区、拥塞控制与监听socket的 TCP Fast Open
+    if (tcptune_init(tcp_cc, tcp_fastopen, tcp_max_buf) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // SIZE/MDTM/MLST/CWD 共用的元数据缓存，同样位于共享内存
+    if (statcache_init(stat_cache_ttl) != 0)
+    {
+        exit(EXIT_FAILURE);
     }
     if (chdir(root_dir) != 0)
     {
@@ -44,75 +356,139 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    // 创建监听socket
-    if ((listen_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    // 存储后端；内存后端的共享区必须在 fork 之前创建，所有会话看到同一份内容
+    if (storage_init(storage_spec, abs_root) != 0)
     {
-        perror("listen socket creation failed!");
         exit(EXIT_FAILURE);
     }
 
-    // 允许端口复用，便于快速重启
-    int opt = 1;
-    if (setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-    {
-        perror("setsockopt SO_REUSEADDR failed");
-    }
-
-    // 配置服务器地址结构体
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_addr.sin_port = htons(port);
-
-    // 绑定地址和端口到socket
-    if (bind(listen_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1)
+    // 上传完成后的异步复制
+    if (replica_start(abs_root) != 0)
     {
-        perror("bind failed!");
-        close(listen_socket);
         exit(EXIT_FAILURE);
     }
 
-    // 开始监听连接请求
-    if (listen(listen_socket, WAITING_QUEUE_SIZE) == -1)
+    // 目录树索引位于独立的进程中，按 inotify 事件增量更新；遍历与监视依赖真实的目录，只支持本地存储
+    if (use_index)
     {
-        perror("listen failed!");
-        close(listen_socket);
-        exit(EXIT_FAILURE);
+        if (!storage->native_fds)
+            fprintf(stderr, "-index is only supported with local storage, ignored\n");
+        else if (index_start(abs_root) != 0)
+            exit(EXIT_FAILURE);
     }
 
+    // 由升级启动时直接使用旧进程交来的监听socket，交接期间到达的连接留在监听队列中
+    if ((listen_socket = upgrade_inherited_listener()) < 0)
+        listen_socket = create_listen_socket(port);
+    tcptune_listener(listen_socket); // 升级交来的监听socket同样开启（旧版本可能没有开启）
+
     // 避免子进程成为僵尸
     signal(SIGCHLD, SIG_IGN);
+    // 客户端中途断开时 send/sendfile 返回 EPIPE，而不是终止进程
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGUSR1：输出计分板；SIGUSR2：零停机升级；SIGTERM：停止 accept 并排空后退出
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = on_sigusr1;
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = on_sigusr2;
+    sigaction(SIGUSR2, &sa, NULL);
+    sa.sa_handler = on_sigterm;
+    sigaction(SIGTERM, &sa, NULL);
+
+    // 监听socket设为非阻塞：升级交接期间新旧进程可能同时等待同一个监听队列
+    fcntl(listen_socket, F_SETFL, fcntl(listen_socket, F_GETFL) | O_NONBLOCK);
+    upgrade_notify_ready();
 
     // 监听主循环
-    while (1)
+    while (!shutdown_requested)
     {
-        if ((connected_socket = accept(listen_socket, NULL, NULL)) == -1)
+        if (dump_requested)
+        {
+            dump_requested = 0;
+            scoreboard_dump(stderr);
+        }
+        if (upgrade_requested)
+        {
+            upgrade_requested = 0;
+            if (upgrade_exec(listen_socket, argv) == 0)
+                break; // 新进程已接管监听socket
+        }
+
+        // 只在 ppoll 等待期间解除信号屏蔽，信号不会在检查标志之后、进入等待之前丢失
+        struct pollfd pfd = {.fd = listen_socket, .events = POLLIN};
+        if (ppoll(&pfd, 1, NULL, &orig_mask) < 0)
+        {
+            if (errno != EINTR)
+                perror("poll failed!");
+            continue;
+        }
+
+        struct sockaddr_in peer_addr;
+        socklen_t peer_len = sizeof(peer_addr);
+        connected_socket = accept(listen_socket, (struct sockaddr *)&peer_addr, &peer_len);
+        if (connected_socket == -1)
+        {
+            if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept failed!");
+            continue;
+        }
+
+        // 准入控制：每IP并发数、每IP与全局连接速率
+        int admission_entry;
+        int verdict = admission_admit(&peer_addr, &admission_entry);
+        if (verdict != ADMIT_OK)
+        {
+            reject_connection(connected_socket, admission_reason(verdict));
+            continue;
+        }
+
+        // 在 fork 之前占用计分板槽位，槽位耗尽即达到并发上限
+        int slot = scoreboard_claim(&peer_addr);
+        if (slot < 0)
         {
-            perror("accept failed!");
+            admission_release(admission_entry);
+            reject_connection(connected_socket, "Too many users, please try again later.");
             continue;
         }
+        scoreboard_set_tag(slot, admission_entry);
+        int cpu = affinity_pick(connected_socket);
+        scoreboard_set_cpu(slot, cpu);
 
         pid_t pid = fork();
         if (pid == 0)
         {
-            // 子进程：处理一个连接
+            // 子进程：处理一个连接，恢复默认的信号处理，使排空超时时的 SIGTERM 能终止会话；
+            // SIGUSR2 改为排空通知，只在等待命令时递送
             close(listen_socket);
+            signal(SIGTERM, SIG_DFL);
+            upgrade_session_init(&orig_mask);
+            // 在分配任何会话内存之前绑定 CPU 与内存节点
+            affinity_apply(cpu);
+            scoreboard_attach(slot);
             handle_connection(connected_socket, abs_root);
             close(connected_socket);
+            scoreboard_release(slot);
             _exit(0);
         }
         else if (pid > 0)
         {
             // 父进程：继续 accept
+            scoreboard_set_pid(slot, pid);
             close(connected_socket);
         }
         else
         {
             perror("fork failed!");
+            scoreboard_release(slot);
             close(connected_socket);
         }
     }
 
+    // 停止 accept：升级时监听队列由新进程继续处理，关闭时新连接被拒绝
     close(listen_socket);
+    upgrade_drain(drain_timeout);
     return 0;
 }
\ No newline at end of file
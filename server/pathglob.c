@@ -0,0 +1,309 @@
+#include "pathglob.h"
+
+typedef struct
+{
+    const glob_pattern *pattern;
+    const glob_source *source;
+    void *src;
+    glob_emit emit;
+    void *ctx;
+    uint64_t limit;
+    uint64_t count;
+    int stop;           // 达到数量上限或 emit 要求停止
+    char rel[PATH_MAX]; // 当前目录相对于起点的路径
+} glob_query;
+
+typedef struct
+{
+    glob_query *q;
+    int i;          // 当前目录的子项要匹配的组件
+    size_t rel_len; // 当前目录的相对路径长度
+} glob_frame;
+
+static void glob_dir(glob_query *q, uintptr_t dir, size_t rel_len, int i);
+
+/**
+ * 模式中是否含有通配符（或转义，需要经过匹配器去掉反斜杠）
+ */
+int glob_has_magic(const char *pattern)
+{
+    return strpbrk(pattern, "*?[\\") != NULL;
+}
+
+/**
+ * 匹配字符类，*pp 指向 '[' 之后，成功时移到 ']' 之后
+ * @return 1 匹配，0 不匹配，-1 没有闭合的 ']'（此时 '[' 按普通字符处理）
+ */
+static int match_class(const char **pp, unsigned char c)
+{
+    const char *p = *pp;
+    int negate = 0, matched = 0;
+    if (*p == '!' || *p == '^')
+    {
+        negate = 1;
+        p++;
+    }
+    for (int first = 1; *p != '\0' && (first || *p != ']'); first = 0)
+    {
+        unsigned char lo = (unsigned char)*p++;
+        if (lo == '\\' && *p != '\0')
+            lo = (unsigned char)*p++;
+        unsigned char hi = lo;
+        if (*p == '-' && p[1] != ']' && p[1] != '\0')
+        {
+            p++;
+            hi = (unsigned char)*p++;
+            if (hi == '\\' && *p != '\0')
+                hi = (unsigned char)*p++;
+        }
+        if (lo <= c && c <= hi)
+            matched = 1;
+    }
+    if (*p != ']')
+        return -1;
+    *pp = p + 1;
+    return matched != negate;
+}
+
+/**
+ * 用一个组件的模式匹配一个名字；'*' 失配时回溯到最近一个 '*' 处多吞一个字符
+ * @return 1 匹配，0 不匹配
+ */
+int glob_match(const char *pattern, const char *name)
+{
+    const char *p = pattern, *n = name;
+    const char *star_p = NULL, *star_n = NULL;
+    while (*n != '\0')
+    {
+        if (*p == '*')
+        {
+            while (*p == '*')
+                p++;
+            if (*p == '\0')
+                return 1;
+            star_p = p;
+            star_n = n;
+            continue;
+        }
+        int ok;
+        const char *next = p + 1;
+        if (*p == '?')
+        {
+            ok = 1;
+        }
+        else if (*p == '[')
+        {
+            int r = match_class(&next, (unsigned char)*n);
+            if (r < 0)
+            {
+                next = p + 1;
+                ok = *n == '[';
+            }
+            else
+            {
+                ok = r;
+            }
+        }
+        else if (*p == '\\' && p[1] != '\0')
+        {
+            ok = p[1] == *n;
+            next = p + 2;
+        }
+        else
+        {
+            ok = *p != '\0' && *p == *n;
+        }
+        if (ok)
+        {
+            p = next;
+            n++;
+        }
+        else if (star_p != NULL)
+        {
+            p = star_p;
+            n = ++star_n;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    while (*p == '*')
+        p++;
+    return *p == '\0';
+}
+
+/**
+ * 编译模式：复制后按 '/' 原地切分，去掉空组件与 "."，合并连续的 "**"
+ * @param pattern 输出
+ * @param text 相对于查询起点的模式
+ * @return 0 成功，-1 模式为空、过长、组件过多或含有 ".."
+ */
+int glob_compile(glob_pattern *pattern, const char *text)
+{
+    int len = snprintf(pattern->text, sizeof(pattern->text), "%s", text);
+    if (len < 0 || len >= (int)sizeof(pattern->text))
+        return -1;
+    pattern->ncomps = 0;
+    char *save = NULL;
+    for (char *s = strtok_r(pattern->text, "/", &save); s != NULL; s = strtok_r(NULL, "/", &save))
+    {
+        if (strcmp(s, ".") == 0)
+            continue;
+        if (strcmp(s, "..") == 0)
+            return -1;
+        int globstar = strcmp(s, "**") == 0;
+        if (globstar && pattern->ncomps > 0 && pattern->comps[pattern->ncomps - 1].globstar)
+            continue;
+        if (pattern->ncomps == GLOB_MAX_COMPONENTS)
+            return -1;
+        glob_comp *c = &pattern->comps[pattern->ncomps++];
+        c->s = s;
+        c->magic = glob_has_magic(s);
+        c->globstar = globstar;
+        c->suffix = NULL;
+        c->suffix_len = 0;
+        if (s[0] == '*' && s[1] != '\0' && !glob_has_magic(s + 1))
+        {
+            c->suffix = s + 1;
+            c->suffix_len = strlen(s + 1);
+        }
+    }
+    return pattern->ncomps > 0 ? 0 : -1;
+}
+
+/**
+ * 名字是否与组件匹配；通配的组件不匹配隐藏的名字
+ */
+static int comp_match(const glob_comp *c, const char *name)
+{
+    if (!c->magic)
+        return strcmp(c->s, name) == 0;
+    if (name[0] == '.' && c->s[0] != '.')
+        return 0;
+    if (c->suffix != NULL)
+    {
+        size_t n = strlen(name);
+        return n >= c->suffix_len && memcmp(name + n - c->suffix_len, c->suffix, c->suffix_len) == 0;
+    }
+    return glob_match(c->s, name);
+}
+
+/**
+ * 把名字接到相对路径之后
+ * @return 新的相对路径长度，超出 PATH_MAX 时返回 0
+ */
+static size_t push_name(glob_query *q, size_t rel_len, const char *name)
+{
+    size_t n = strlen(name);
+    size_t need = rel_len + (rel_len > 0) + n;
+    if (need >= sizeof(q->rel))
+        return 0;
+    if (rel_len > 0)
+        q->rel[rel_len++] = '/';
+    memcpy(q->rel + rel_len, name, n + 1);
+    return need;
+}
+
+/**
+ * 子项与第 j-1 个组件匹配：已是最后一个组件时输出，否则进入该目录继续匹配第 j 个组件
+ */
+static void glob_matched(glob_query *q, const glob_entry *e, size_t rel_len, int j)
+{
+    size_t len = push_name(q, rel_len, e->name);
+    if (len == 0)
+        return;
+    if (j == q->pattern->ncomps)
+    {
+        if (q->emit(q->ctx, q->rel, e->is_dir) != 0 || ++q->count >= q->limit)
+            q->stop = 1;
+    }
+    else if (e->is_dir)
+    {
+        glob_dir(q, e->handle, len, j);
+    }
+    q->rel[rel_len] = '\0';
+}
+
+static int glob_visit_entry(void *arg, const glob_entry *e)
+{
+    glob_frame *f = arg;
+    glob_query *q = f->q;
+    const glob_pattern *p = q->pattern;
+    const glob_comp *c = &p->comps[f->i];
+    if (!c->globstar)
+    {
+        if (comp_match(c, e->name))
+            glob_matched(q, e, f->rel_len, f->i + 1);
+        return q->stop;
+    }
+
+    // "**" 匹配零级目录：子项直接与下一个组件比较；位于末尾时匹配所有子项
+    if (f->i + 1 == p->ncomps)
+    {
+        if (e->name[0] != '.')
+            glob_matched(q, e, f->rel_len, f->i + 1);
+    }
+    else if (comp_match(&p->comps[f->i + 1], e->name))
+    {
+        glob_matched(q, e, f->rel_len, f->i + 2);
+    }
+    // 匹配一级或多级：进入子目录，仍然用 "**" 匹配
+    if (!q->stop && e->is_dir && e->name[0] != '.')
+    {
+        size_t len = push_name(q, f->rel_len, e->name);
+        if (len != 0)
+        {
+            glob_dir(q, e->handle, len, f->i);
+            q->rel[f->rel_len] = '\0';
+        }
+    }
+    return q->stop;
+}
+
+/**
+ * 在目录 dir 中匹配第 i 个组件；不含通配符的组件直接查找，不必列出整个目录
+ */
+static void glob_dir(glob_query *q, uintptr_t dir, size_t rel_len, int i)
+{
+    if (q->stop)
+        return;
+    const glob_comp *c = &q->pattern->comps[i];
+    if (!c->magic)
+    {
+        glob_entry e;
+        if (q->source->lookup(q->src, dir, q->rel, c->s, &e) == 1)
+            glob_matched(q, &e, rel_len, i + 1);
+        return;
+    }
+    glob_frame f = {q, i, rel_len};
+    q->source->children(q->src, dir, q->rel, glob_visit_entry, &f);
+}
+
+/**
+ * 从目录 root 开始匹配模式，对每个结果调用 emit（相对于 root 的路径）
+ * @param source 数据来源
+ * @param limit 最多输出的结果数
+ * @param emit 返回非0时停止
+ * @return 输出的结果数，-1 内存不足
+ */
+int64_t glob_run(const glob_pattern *pattern, const glob_source *source, void *src, uintptr_t root, uint64_t limit,
+                 glob_emit emit, void *ctx)
+{
+    glob_query *q = malloc(sizeof(*q));
+    if (q == NULL)
+        return -1;
+    q->pattern = pattern;
+    q->source = source;
+    q->src = src;
+    q->emit = emit;
+    q->ctx = ctx;
+    q->limit = limit > 0 ? limit : UINT64_MAX;
+    q->count = 0;
+    q->stop = 0;
+    q->rel[0] = '\0';
+    glob_dir(q, root, 0, 0);
+    int64_t count = (int64_t)q->count;
+    free(q);
+    return count;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "utils.h"
+
+#define GLOB_MAX_COMPONENTS 128 // 模式中路径组件数的上限
+
+/*
+ * 路径通配：模式按 '/' 分成组件，每个组件匹配一级目录项
+ *  *  ?  [abc]  [a-z]  [!x]  与 shell 相同，不跨越 '/'；反斜杠转义下一个字符
+ *  ** 单独作为一个组件时匹配零级或多级目录
+ * 与 shell 一样，以 '.' 开头的名字只能被以 '.' 开头的组件匹配，** 也不进入隐藏目录。
+ *
+ * 匹配过程与数据来源无关：glob_source 提供“列出子项”和“按名字查找子项”两个操作，
+ * 会话进程中的实现是逐级遍历存储后端，索引进程中的实现是内存中的路径树。
+ */
+
+typedef struct
+{
+    const char *name;
+    int is_dir;
+    uintptr_t handle; // 数据来源内部使用的标识（如路径树的节点号）
+} glob_entry;
+
+typedef int (*glob_visit)(void *frame, const glob_entry *entry);
+typedef int (*glob_emit)(void *ctx, const char *rel, int is_dir);
+
+typedef struct
+{
+    // 对目录 dir（相对路径为 rel）的每个子项调用 visit，visit 返回非0时停止；目录无法读取返回 -1
+    int (*children)(void *src, uintptr_t dir, const char *rel, glob_visit visit, void *frame);
+    // 查找目录 dir 下名为 name 的子项，找到返回 1 并填写 out（out->name 可以指向 name）
+    int (*lookup)(void *src, uintptr_t dir, const char *rel, const char *name, glob_entry *out);
+} glob_source;
+
+typedef struct
+{
+    const char *s; // 以 '\0' 结尾的组件文本
+    int magic;     // 含通配符，需要逐个匹配子项
+    int globstar;  // 组件为 "**"
+    const char *suffix; // 形如 "*.ext" 的组件只需比较后缀，指向 ".ext"；其它组件为 NULL
+    size_t suffix_len;
+} glob_comp;
+
+typedef struct
+{
+    char text[PATH_MAX];                 // 模式的副本，组件在原位以 '\0' 分隔
+    glob_comp comps[GLOB_MAX_COMPONENTS];
+    int ncomps;
+} glob_pattern;
+
+int glob_has_magic(const char *pattern);
+int glob_match(const char *pattern, const char *name);
+int glob_compile(glob_pattern *pattern, const char *text);
+int64_t glob_run(const glob_pattern *pattern, const glob_source *source, void *src, uintptr_t root, uint64_t limit,
+                 glob_emit emit, void *ctx);
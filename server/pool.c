@@ -0,0 +1,275 @@
+#include "pool.h"
+#include "utils.h"
+#include "file.h"
+#include <sys/mman.h>
+
+typedef struct slab
+{
+    slab_cache *cache;  // 所属缓存
+    struct slab *prev;  // 部分空闲 slab 链表
+    struct slab *next;
+    void *free_list;    // 空闲对象链表（对象首部存放下一个空闲对象的指针）
+    size_t in_use;      // 已分配的对象数
+    size_t capacity;    // 对象总数
+    int huge;           // 是否为大页映射
+} slab;
+
+struct slab_cache
+{
+    const char *name;
+    size_t object_size;   // 对象大小（已按8字节对齐）
+    size_t slab_bytes;    // 每个 slab 的大小
+    slab *partial;        // 还有空闲对象的 slab
+    slab *empty;          // 缓存的一个完全空闲的 slab
+    uint64_t in_use;      // 已分配对象数
+    uint64_t slabs;       // 已映射的 slab 数
+    int huge;             // 是否尝试使用大页
+};
+
+static int hugepages = 0;
+static slab_cache *sessions = NULL;
+static slab_cache *lines = NULL;
+static slab_cache *paths = NULL;
+static slab_cache *buffers = NULL;
+
+/**
+ * 设置分配器参数并创建会话相关的缓存，应在 fork() 之前调用；此时不分配任何对象内存
+ * 每个会话进程只有一个会话结构、两个行缓冲区（命令行与参数）、一个当前目录，
+ * 传输时通常只有一个传输缓冲区（偶尔两个时再映射一个 slab），slab 按此大小确定
+ * @param use_hugepages 是否尝试使用 2MB 大页
+ */
+void pool_init(int use_hugepages)
+{
+    hugepages = use_hugepages;
+    sessions = slab_create("session", sizeof(connection), 1);
+    lines = slab_create("line", LINE_MAX_SIZE, 2);
+    paths = slab_create("path", PATH_MAX, 1);
+    buffers = slab_create("xfer-buffer", BUFFER_SIZE, 1);
+}
+
+/**
+ * 创建一个对象缓存
+ * @param name 缓存名称，仅用于诊断
+ * @param object_size 对象大小
+ * @param objects 每个进程通常同时使用的对象数，决定 slab 的大小
+ * @return 缓存，失败返回NULL
+ */
+slab_cache *slab_create(const char *name, size_t object_size, size_t objects)
+{
+    slab_cache *cache = calloc(1, sizeof(slab_cache));
+    if (cache == NULL)
+        return NULL;
+    cache->name = name;
+    cache->object_size = (object_size + 7) & ~(size_t)7;
+    if (objects < 1)
+        objects = 1;
+    // 头部之后至少放得下 objects 个对象
+    size_t need = ((sizeof(slab) + 7) & ~(size_t)7) + objects * cache->object_size;
+    cache->slab_bytes = SLAB_MIN_SIZE;
+    while (cache->slab_bytes < need)
+        cache->slab_bytes <<= 1;
+    // 只有工作集本身达到 2MB 的缓存才使用大页，小缓存用大页只会浪费内存
+    cache->huge = hugepages && cache->slab_bytes >= SLAB_HUGE_SIZE;
+    return cache;
+}
+
+/**
+ * 映射一块按 size 对齐的内存
+ */
+static void *map_aligned(size_t size, int *huge)
+{
+    if (*huge)
+    {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED && ((uintptr_t)p & (size - 1)) == 0)
+            return p;
+        if (p != MAP_FAILED)
+            munmap(p, size);
+        *huge = 0; // 没有可用的大页，回退到普通页
+    }
+    // 多映射一个 slab 大小，再裁掉首尾使起始地址对齐
+    size_t span = size * 2;
+    char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+    char *aligned = (char *)(((uintptr_t)raw + size - 1) & ~(uintptr_t)(size - 1));
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    if (raw + span > aligned + size)
+        munmap(aligned + size, raw + span - (aligned + size));
+    return aligned;
+}
+
+static void list_remove(slab **head, slab *s)
+{
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        *head = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+    s->prev = s->next = NULL;
+}
+
+static void list_push(slab **head, slab *s)
+{
+    s->prev = NULL;
+    s->next = *head;
+    if (*head)
+        (*head)->prev = s;
+    *head = s;
+}
+
+static slab *slab_grow(slab_cache *cache)
+{
+    int huge = cache->huge;
+    slab *s = map_aligned(cache->slab_bytes, &huge);
+    if (s == NULL)
+        return NULL;
+    s->cache = cache;
+    s->prev = s->next = NULL;
+    s->in_use = 0;
+    s->huge = huge;
+    // 对象紧跟在头部之后，头部大小按8字节对齐
+    char *first = (char *)s + ((sizeof(slab) + 7) & ~(size_t)7);
+    s->capacity = (size_t)((char *)s + cache->slab_bytes - first) / cache->object_size;
+    s->free_list = NULL;
+    for (size_t i = s->capacity; i > 0; i--)
+    {
+        void **obj = (void **)(first + (i - 1) * cache->object_size);
+        *obj = s->free_list;
+        s->free_list = obj;
+    }
+    cache->slabs++;
+    return s;
+}
+
+/**
+ * 从缓存中分配一个对象（内容未初始化）
+ * @return 对象指针，内存不足时返回NULL
+ */
+void *slab_alloc(slab_cache *cache)
+{
+    if (cache == NULL)
+        return NULL;
+    slab *s = cache->partial;
+    if (s == NULL)
+    {
+        if (cache->empty != NULL)
+        {
+            s = cache->empty;
+            cache->empty = NULL;
+        }
+        else if ((s = slab_grow(cache)) == NULL)
+        {
+            return NULL;
+        }
+        list_push(&cache->partial, s);
+    }
+
+    void **obj = s->free_list;
+    s->free_list = *obj;
+    s->in_use++;
+    cache->in_use++;
+    if (s->free_list == NULL)
+        list_remove(&cache->partial, s); // slab 已满
+    return obj;
+}
+
+/**
+ * 释放对象；slab 完全空闲时保留一个作为缓存，多余的归还内核
+ */
+void slab_free(slab_cache *cache, void *object)
+{
+    if (cache == NULL || object == NULL)
+        return;
+    slab *s = (slab *)((uintptr_t)object & ~(uintptr_t)(cache->slab_bytes - 1));
+    if (s->free_list == NULL)
+        list_push(&cache->partial, s); // 之前是满的，重新加入部分空闲链表
+    *(void **)object = s->free_list;
+    s->free_list = object;
+    s->in_use--;
+    cache->in_use--;
+
+    if (s->in_use == 0)
+    {
+        list_remove(&cache->partial, s);
+        if (cache->empty == NULL)
+        {
+            cache->empty = s;
+        }
+        else
+        {
+            munmap(s, cache->slab_bytes);
+            cache->slabs--;
+        }
+    }
+}
+
+size_t slab_object_size(const slab_cache *cache)
+{
+    return cache != NULL ? cache->object_size : 0;
+}
+
+/**
+ * 缓存中已分配对象占用的字节数
+ */
+uint64_t slab_in_use_bytes(const slab_cache *cache)
+{
+    return cache != NULL ? cache->in_use * cache->object_size : 0;
+}
+
+/**
+ * 缓存映射的总字节数（包括空闲对象）
+ */
+uint64_t slab_mapped_bytes(const slab_cache *cache)
+{
+    return cache != NULL ? cache->slabs * cache->slab_bytes : 0;
+}
+
+slab_cache *session_cache(void)
+{
+    return sessions;
+}
+
+slab_cache *line_cache(void)
+{
+    return lines;
+}
+
+slab_cache *path_cache(void)
+{
+    return paths;
+}
+
+/**
+ * 分配一个 BUFFER_SIZE 大小的传输缓冲区，替代各传输循环中的栈上缓冲区
+ */
+void *xfer_buffer_alloc(void)
+{
+    return slab_alloc(buffers);
+}
+
+void xfer_buffer_free(void *buffer)
+{
+    slab_free(buffers, buffer);
+}
+
+/**
+ * 本进程从各会话缓存中分配的对象字节数
+ */
+uint64_t pool_in_use_bytes(void)
+{
+    return slab_in_use_bytes(sessions) + slab_in_use_bytes(lines) + slab_in_use_bytes(paths) +
+           slab_in_use_bytes(buffers);
+}
+
+/**
+ * 本进程为各会话缓存映射的字节数（包括 slab 中的空闲对象与保留的空闲 slab），
+ * 即当前会话实际占用的内存
+ */
+uint64_t pool_mapped_bytes(void)
+{
+    return slab_mapped_bytes(sessions) + slab_mapped_bytes(lines) + slab_mapped_bytes(paths) +
+           slab_mapped_bytes(buffers);
+}
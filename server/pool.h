@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 固定大小对象的 slab 分配器。
+ * 每个 slab 是一块按自身大小对齐的 mmap 内存，对象指针按位与即可找到所属 slab；
+ * 完全空闲的 slab 只保留一个作为缓存，其余立即归还内核，使占用量跟随活动工作集。
+ * slab 大小按创建缓存时给出的每进程工作集（对象数）确定，取能容纳这些对象的最小的2的幂，
+ * 至少一页：会话子进程各自映射自己的 slab，过大的 slab 会直接放大每个会话的内存占用。
+ * 开启大页时，只有 slab 本身达到 2MB 的缓存才使用 MAP_HUGETLB（失败时自动回退到普通页）。
+ */
+
+#define SLAB_MIN_SIZE 4096               // slab 的最小大小（一页）
+#define SLAB_HUGE_SIZE (2 * 1024 * 1024) // 可以使用大页的 slab 大小
+
+typedef struct slab_cache slab_cache;
+
+void pool_init(int use_hugepages);
+slab_cache *slab_create(const char *name, size_t object_size, size_t objects);
+void *slab_alloc(slab_cache *cache);
+void slab_free(slab_cache *cache, void *object);
+size_t slab_object_size(const slab_cache *cache);
+uint64_t slab_in_use_bytes(const slab_cache *cache);
+uint64_t slab_mapped_bytes(const slab_cache *cache);
+
+// 会话相关的共享缓存
+slab_cache *session_cache(void);
+slab_cache *line_cache(void);
+slab_cache *path_cache(void);
+void *xfer_buffer_alloc(void);
+void xfer_buffer_free(void *buffer);
+uint64_t pool_in_use_bytes(void);
+uint64_t pool_mapped_bytes(void);
@@ -0,0 +1,774 @@
+#include "replica.h"
+#include "ring.h"
+#include "storage.h"
+#include "utils.h"
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+
+#define REPLICA_COPY_CHUNK (1 << 20) // copy_file_range/sendfile 每次的最大字节数
+#define REPLICA_REPLY_MAX 1024       // FTP 目标一行响应的长度上限
+
+typedef struct
+{
+    int ftp;             // 0 本地目录，1 FTP 服务器
+    char path[PATH_MAX]; // 本地目录的绝对路径，或 FTP 目标上的目录（可为空）
+    char host[256];
+    char port[8];
+    char user[64];
+    char pass[64];
+    char label[PATH_MAX + 384]; // FTP 目标在日志中显示的地址（不含密码）
+} replica_target;
+
+typedef struct
+{
+    uint64_t enqueue_us; // 入队时间（单调时钟）
+    char path[PATH_MAX]; // 上传完成的文件的绝对路径
+} replica_msg;
+
+typedef struct
+{
+    _Atomic uint64_t queued;
+    _Atomic uint64_t completed;
+    _Atomic uint64_t failed;
+    _Atomic uint64_t skipped;
+    _Atomic uint64_t retries;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t in_flight;
+    _Atomic uint64_t lag_last_us;
+    _Atomic uint64_t lag_max_us;
+    _Atomic uint64_t lag_sum_us;
+} replica_counters;
+
+// 等待重试的任务，只在父进程的复制线程之间共享
+typedef struct replica_job
+{
+    struct replica_job *next;         // 等待列表中的下一个任务
+    struct replica_job *running_next; // 正在复制的任务列表中的下一个任务
+    uint64_t enqueue_us;
+    uint64_t due_us;   // 下一次尝试的时间（单调时钟）
+    uint32_t pending;  // 尚未成功的目标（位图）
+    int attempts;
+    char path[PATH_MAX];
+} replica_job;
+
+// 以下在 fork 之前设置，会话只读
+static replica_target targets[REPLICA_MAX_TARGETS];
+static int target_count = 0;
+static int worker_count = 0;
+static ring_t *replica_ring = NULL;
+static replica_counters *counters = NULL; // 共享内存
+static int wake_fd = -1;                  // EFD_SEMAPHORE：每入队一个任务加一
+
+// 以下只在父进程中使用
+static char root_path[PATH_MAX];
+static size_t root_len = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER; // 保护以下两个列表
+static replica_job *retry_list = NULL;   // 按 due_us 升序
+static replica_job *running_list = NULL; // 正在复制的任务，同一路径同一时间只有一个
+
+/**
+ * 解析 ftp://[用户[:密码]@]主机[:端口][/目录]
+ * @return 0 成功，-1 格式错误
+ */
+static int parse_ftp_target(const char *spec, replica_target *t)
+{
+    const char *p = spec + strlen("ftp://");
+    const char *slash = strchr(p, '/');
+    size_t auth_len = slash != NULL ? (size_t)(slash - p) : strlen(p);
+    const char *at = memchr(p, '@', auth_len);
+    snprintf(t->user, sizeof(t->user), "anonymous");
+    snprintf(t->pass, sizeof(t->pass), "replica@");
+    if (at != NULL)
+    {
+        const char *colon = memchr(p, ':', (size_t)(at - p));
+        size_t user_len = colon != NULL ? (size_t)(colon - p) : (size_t)(at - p);
+        if (user_len == 0 || user_len >= sizeof(t->user))
+            return -1;
+        memcpy(t->user, p, user_len);
+        t->user[user_len] = '\0';
+        if (colon != NULL)
+        {
+            size_t pass_len = (size_t)(at - colon - 1);
+            if (pass_len >= sizeof(t->pass))
+                return -1;
+            memcpy(t->pass, colon + 1, pass_len);
+            t->pass[pass_len] = '\0';
+        }
+        auth_len -= (size_t)(at + 1 - p);
+        p = at + 1;
+    }
+    const char *colon = memchr(p, ':', auth_len);
+    size_t host_len = colon != NULL ? (size_t)(colon - p) : auth_len;
+    if (host_len == 0 || host_len >= sizeof(t->host))
+        return -1;
+    memcpy(t->host, p, host_len);
+    t->host[host_len] = '\0';
+    snprintf(t->port, sizeof(t->port), "21");
+    if (colon != NULL)
+    {
+        size_t port_len = auth_len - host_len - 1;
+        if (port_len == 0 || port_len >= sizeof(t->port))
+            return -1;
+        memcpy(t->port, colon + 1, port_len);
+        t->port[port_len] = '\0';
+    }
+    // RFC 1738：主机之后的 '/' 只是分隔符，目录相对于登录后的当前目录
+    snprintf(t->path, sizeof(t->path), "%s", slash != NULL ? slash + 1 : "");
+    size_t len = strlen(t->path);
+    while (len > 0 && t->path[len - 1] == '/')
+        t->path[--len] = '\0';
+    snprintf(t->label, sizeof(t->label), "ftp://%s@%s:%s/%s", t->user, t->host, t->port, t->path);
+    return 0;
+}
+
+/**
+ * 配置复制目标并创建共享队列，必须在 fork() 之前、chdir 到根目录之前调用（本地目标相对于启动目录）
+ * @param specs 目标列表：本地目录，或 ftp:// 地址
+ * @param ntargets 目标数
+ * @param workers 复制线程数
+ * @return 0 成功，-1 失败
+ */
+int replica_init(const char *const *specs, int ntargets, int workers)
+{
+    if (ntargets > REPLICA_MAX_TARGETS)
+    {
+        fprintf(stderr, "at most %d replica targets are supported\n", REPLICA_MAX_TARGETS);
+        return -1;
+    }
+    for (int i = 0; i < ntargets; i++)
+    {
+        replica_target *t = &targets[i];
+        memset(t, 0, sizeof(*t));
+        if (strncmp(specs[i], "ftp://", 6) == 0)
+        {
+            t->ftp = 1;
+            if (parse_ftp_target(specs[i], t) != 0)
+            {
+                fprintf(stderr, "invalid replica target: %s\n", specs[i]);
+                return -1;
+            }
+            continue;
+        }
+        struct stat st;
+        if (realpath(specs[i], t->path) == NULL || stat(t->path, &st) != 0 || !S_ISDIR(st.st_mode))
+        {
+            fprintf(stderr, "replica target %s is not a directory\n", specs[i]);
+            return -1;
+        }
+    }
+    target_count = ntargets;
+    worker_count = workers > 0 ? workers : REPLICA_DEFAULT_WORKERS;
+
+    replica_ring = ring_create(sizeof(replica_msg), REPLICA_RING_SLOTS);
+    void *mem = mmap(NULL, sizeof(replica_counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    wake_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+    if (replica_ring == NULL || mem == MAP_FAILED || wake_fd < 0)
+    {
+        perror("create replica queue failed");
+        replica_ring = NULL;
+        return -1;
+    }
+    counters = mem;
+    return 0;
+}
+
+int replica_enabled(void)
+{
+    return replica_ring != NULL;
+}
+
+/**
+ * 会话在上传成功后调用，把文件交给复制线程；不会阻塞，队列满时丢弃并计数
+ * @param path 文件的绝对路径
+ */
+void replica_submit(const char *path)
+{
+    if (replica_ring == NULL)
+        return;
+    replica_msg msg;
+    msg.enqueue_us = monotonic_us();
+    int len = snprintf(msg.path, sizeof(msg.path), "%s", path);
+    if (len < 0 || len >= (int)sizeof(msg.path))
+        return;
+    if (ring_push(replica_ring, &msg) != 0)
+        return; // 丢弃数由队列计数
+    atomic_fetch_add_explicit(&counters->queued, 1, memory_order_relaxed);
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        // 计数器不可能溢出；即使写入失败，任务仍会在下一次唤醒时被取走
+    }
+}
+
+/**
+ * 读取复制的计数与延迟（会话中调用，用于 SITE STAT）
+ */
+void replica_get_metrics(replica_metrics *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (replica_ring == NULL)
+        return;
+    out->queued = atomic_load_explicit(&counters->queued, memory_order_relaxed);
+    out->dropped = ring_dropped(replica_ring);
+    out->completed = atomic_load_explicit(&counters->completed, memory_order_relaxed);
+    out->failed = atomic_load_explicit(&counters->failed, memory_order_relaxed);
+    out->skipped = atomic_load_explicit(&counters->skipped, memory_order_relaxed);
+    out->retries = atomic_load_explicit(&counters->retries, memory_order_relaxed);
+    out->bytes = atomic_load_explicit(&counters->bytes, memory_order_relaxed);
+    out->in_flight = atomic_load_explicit(&counters->in_flight, memory_order_relaxed);
+    out->lag_last_us = atomic_load_explicit(&counters->lag_last_us, memory_order_relaxed);
+    out->lag_max_us = atomic_load_explicit(&counters->lag_max_us, memory_order_relaxed);
+    out->lag_sum_us = atomic_load_explicit(&counters->lag_sum_us, memory_order_relaxed);
+}
+
+/**
+ * 逐级创建 path 的上级目录（已存在的忽略）
+ */
+static void make_parents(char *path)
+{
+    for (char *p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+}
+
+/**
+ * 在内核中复制文件内容，依次尝试 FICLONE、copy_file_range、pread/write。
+ * 与 file.c 中 CPTO 的做法相同，但在复制线程中运行，不能使用非线程安全的传输缓冲区池
+ * @return 复制的字节数，失败返回-1
+ */
+static int64_t copy_local(int src_fd, int dst_fd, uint64_t size)
+{
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+        return (int64_t)size;
+
+    uint64_t copied = 0;
+    loff_t in_off = 0;
+    while (copied < size)
+    {
+        ssize_t n = copy_file_range(src_fd, &in_off, dst_fd, NULL, size - copied < REPLICA_COPY_CHUNK
+                                                                          ? size - copied
+                                                                          : REPLICA_COPY_CHUNK, 0);
+        if (n < 0)
+        {
+            if (copied == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+                break; // 不支持时改用 pread/write
+            return -1;
+        }
+        if (n == 0)
+            return (int64_t)copied; // 源文件在复制过程中被截断
+        copied += (uint64_t)n;
+    }
+    if (copied > 0 || size == 0)
+        return (int64_t)copied;
+
+    char *buffer = malloc(REPLICA_COPY_CHUNK);
+    if (buffer == NULL)
+        return -1;
+    ssize_t n;
+    while ((n = pread(src_fd, buffer, REPLICA_COPY_CHUNK, (off_t)copied)) > 0)
+    {
+        if (write(dst_fd, buffer, (size_t)n) != n)
+        {
+            n = -1;
+            break;
+        }
+        copied += (uint64_t)n;
+    }
+    free(buffer);
+    return n < 0 ? -1 : (int64_t)copied;
+}
+
+/**
+ * 复制到本地目录：先写临时文件，保留权限与修改时间后原子地替换目标
+ * @return 复制的字节数，失败返回-1
+ */
+static int64_t replicate_local(const replica_target *t, const char *rel, int src_fd, const struct stat *st)
+{
+    char dest[PATH_MAX], tmp[PATH_MAX + 32];
+    int n = snprintf(dest, sizeof(dest), "%s/%s", t->path, rel);
+    if (n < 0 || n >= (int)sizeof(dest))
+        return -1;
+    snprintf(tmp, sizeof(tmp), "%s.replica-%lx", dest, (unsigned long)pthread_self());
+    make_parents(dest);
+    int dst_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st->st_mode & 07777);
+    if (dst_fd < 0)
+        return -1;
+    int64_t copied = copy_local(src_fd, dst_fd, (uint64_t)st->st_size);
+    struct timespec times[2] = {st->st_atim, st->st_mtim};
+    if (copied < 0 || futimens(dst_fd, times) != 0 || close(dst_fd) != 0 || rename(tmp, dest) != 0)
+    {
+        if (copied < 0)
+            close(dst_fd);
+        unlink(tmp);
+        return -1;
+    }
+    return copied;
+}
+
+// 以下是复制到 FTP 服务器所需的最小客户端
+
+typedef struct
+{
+    int fd;
+    char buf[REPLICA_REPLY_MAX];
+    size_t len; // buf 中已读入、尚未处理的字节数
+} ftp_conn;
+
+static int write_all(int fd, const void *buffer, size_t len)
+{
+    const char *p = buffer;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * 读取一行（不含 CRLF）
+ * @return 0 成功，-1 连接关闭、超时或行过长
+ */
+static int ftp_read_line(ftp_conn *c, char *line, size_t linesz)
+{
+    while (1)
+    {
+        char *nl = memchr(c->buf, '\n', c->len);
+        if (nl != NULL)
+        {
+            size_t n = (size_t)(nl - c->buf);
+            size_t copy = n > 0 && c->buf[n - 1] == '\r' ? n - 1 : n;
+            if (copy >= linesz)
+                copy = linesz - 1;
+            memcpy(line, c->buf, copy);
+            line[copy] = '\0';
+            memmove(c->buf, nl + 1, c->len - n - 1);
+            c->len -= n + 1;
+            return 0;
+        }
+        if (c->len == sizeof(c->buf))
+            return -1;
+        ssize_t got = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        c->len += (size_t)got;
+    }
+}
+
+/**
+ * 读取一条完整的响应（多行响应读到 "xyz " 开头的最后一行）
+ * @param text 输出最后一行，可为 NULL
+ * @return 响应码，-1 连接出错
+ */
+static int ftp_reply(ftp_conn *c, char *text, size_t textsz)
+{
+    char line[REPLICA_REPLY_MAX];
+    if (ftp_read_line(c, line, sizeof(line)) != 0 || strlen(line) < 3)
+        return -1;
+    int code = atoi(line);
+    if (line[3] == '-')
+    {
+        char end[5];
+        snprintf(end, sizeof(end), "%.3s ", line);
+        do
+        {
+            if (ftp_read_line(c, line, sizeof(line)) != 0)
+                return -1;
+        } while (strncmp(line, end, 4) != 0);
+    }
+    if (text != NULL)
+        snprintf(text, textsz, "%s", line);
+    return code;
+}
+
+/**
+ * 发送一条命令并读取响应
+ * @return 响应码，-1 连接出错
+ */
+static int ftp_cmd(ftp_conn *c, char *text, size_t textsz, const char *fmt, ...)
+{
+    char line[PATH_MAX + 16];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line) - 2, fmt, ap);
+    va_end(ap);
+    if (n < 0 || n >= (int)sizeof(line) - 2)
+        return -1;
+    memcpy(line + n, "\r\n", 2);
+    if (write_all(c->fd, line, (size_t)n + 2) != 0)
+        return -1;
+    return ftp_reply(c, text, textsz);
+}
+
+/**
+ * 连接到目标主机的指定端口，读写都设置超时
+ * @return socket，失败返回-1
+ */
+static int ftp_connect(const char *host, const char *port)
+{
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        struct timeval timeout = {REPLICA_FTP_TIMEOUT_S, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/**
+ * 通过被动模式打开数据连接；只使用 227 响应中的端口，主机沿用控制连接的目标，
+ * 对端在 NAT 之后时 227 中的地址往往不可达
+ * @return 数据socket，失败返回-1
+ */
+static int ftp_pasv(ftp_conn *c, const replica_target *t)
+{
+    char text[REPLICA_REPLY_MAX];
+    if (ftp_cmd(c, text, sizeof(text), "PASV") != 227)
+        return -1;
+    const char *p = strchr(text, '(');
+    unsigned h1, h2, h3, h4, p1, p2;
+    if (p == NULL || sscanf(p + 1, "%u,%u,%u,%u,%u,%u", &h1, &h2, &h3, &h4, &p1, &p2) != 6 || p1 > 255 || p2 > 255)
+        return -1;
+    char port[8];
+    snprintf(port, sizeof(port), "%u", p1 * 256 + p2);
+    return ftp_connect(t->host, port);
+}
+
+/**
+ * 上传到 FTP 服务器：登录、创建沿途目录、PASV + STOR，用 sendfile 发送文件内容
+ * @return 发送的字节数，失败返回-1
+ */
+static int64_t replicate_ftp(const replica_target *t, const char *rel, int src_fd, const struct stat *st)
+{
+    char remote[PATH_MAX];
+    int n = snprintf(remote, sizeof(remote), "%s%s%s", t->path, t->path[0] != '\0' ? "/" : "", rel);
+    if (n < 0 || n >= (int)sizeof(remote))
+        return -1;
+    ftp_conn *c = malloc(sizeof(*c));
+    if (c == NULL)
+        return -1;
+    c->len = 0;
+    c->fd = ftp_connect(t->host, t->port);
+    int64_t sent = -1;
+    int data_fd = -1;
+    if (c->fd < 0 || ftp_reply(c, NULL, 0) != 220)
+        goto done;
+    int code = ftp_cmd(c, NULL, 0, "USER %s", t->user);
+    if (code == 331)
+        code = ftp_cmd(c, NULL, 0, "PASS %s", t->pass);
+    if (code != 230 || ftp_cmd(c, NULL, 0, "TYPE I") != 200)
+        goto done;
+    // 沿途的目录可能已经存在，MKD 的结果不影响之后的 STOR
+    for (char *p = strchr(remote, '/'); p != NULL; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        if (remote[0] != '\0' && ftp_cmd(c, NULL, 0, "MKD %s", remote) < 0)
+            goto done;
+        *p = '/';
+    }
+    data_fd = ftp_pasv(c, t);
+    if (data_fd < 0)
+        goto done;
+    code = ftp_cmd(c, NULL, 0, "STOR %s", remote);
+    if (code != 150 && code != 125)
+        goto done;
+    off_t offset = 0;
+    while (offset < st->st_size)
+    {
+        size_t chunk = st->st_size - offset < REPLICA_COPY_CHUNK ? (size_t)(st->st_size - offset) : REPLICA_COPY_CHUNK;
+        ssize_t w = sendfile(data_fd, src_fd, &offset, chunk);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            break; // 出错，或源文件在复制过程中被截断
+    }
+    int complete = offset == st->st_size;
+    close(data_fd);
+    data_fd = -1;
+    if (ftp_reply(c, NULL, 0) == 226 && complete)
+        sent = offset;
+    ftp_cmd(c, NULL, 0, "QUIT");
+
+done:
+    if (data_fd >= 0)
+        close(data_fd);
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c);
+    return sent;
+}
+
+/**
+ * 把任务按到期时间插入等待列表
+ * @param delay_ms 距离下一次尝试的时间
+ */
+static void schedule_job(replica_job *job, uint64_t delay_ms)
+{
+    job->due_us = monotonic_us() + delay_ms * 1000;
+    pthread_mutex_lock(&job_lock);
+    replica_job **link = &retry_list;
+    while (*link != NULL && (*link)->due_us <= job->due_us)
+        link = &(*link)->next;
+    job->next = *link;
+    *link = job;
+    pthread_mutex_unlock(&job_lock);
+}
+
+/**
+ * 按指数退避安排重试
+ */
+static void schedule_retry(replica_job *job)
+{
+    int shift = job->attempts - 1 < 16 ? job->attempts - 1 : 16;
+    uint64_t delay_ms = (uint64_t)REPLICA_RETRY_BASE_MS << shift;
+    if (delay_ms > REPLICA_RETRY_MAX_MS)
+        delay_ms = REPLICA_RETRY_MAX_MS;
+    schedule_job(job, delay_ms);
+}
+
+/**
+ * 登记任务正在复制。同一文件在复制期间再次上传时会有两个任务，若同时复制，
+ * 先开始、读到旧内容的任务可能最后 rename，目标停留在旧版本
+ * @return 1 登记成功，0 同一路径已有任务正在复制
+ */
+static int claim_path(replica_job *job)
+{
+    pthread_mutex_lock(&job_lock);
+    for (replica_job *r = running_list; r != NULL; r = r->running_next)
+    {
+        if (strcmp(r->path, job->path) == 0)
+        {
+            pthread_mutex_unlock(&job_lock);
+            return 0;
+        }
+    }
+    job->running_next = running_list;
+    running_list = job;
+    pthread_mutex_unlock(&job_lock);
+    return 1;
+}
+
+static void release_path(replica_job *job)
+{
+    pthread_mutex_lock(&job_lock);
+    replica_job **link = &running_list;
+    while (*link != job)
+        link = &(*link)->running_next;
+    *link = job->running_next;
+    pthread_mutex_unlock(&job_lock);
+}
+
+/**
+ * 对任务的每个未完成目标尝试一次复制，之后结束任务或安排重试。
+ * 同一路径已有任务在复制时不占用尝试次数，放回等待列表，等那个任务结束后再复制最新的内容
+ */
+static void run_job(replica_job *job)
+{
+    if (!claim_path(job))
+    {
+        schedule_job(job, REPLICA_RETRY_BASE_MS);
+        return;
+    }
+    atomic_fetch_add_explicit(&counters->in_flight, 1, memory_order_relaxed);
+    job->attempts++;
+    const char *rel = job->path + root_len;
+    while (*rel == '/')
+        rel++;
+
+    int src_fd = open(job->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (src_fd < 0 || fstat(src_fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (src_fd >= 0)
+            close(src_fd);
+        release_path(job);
+        // 上传之后又被删除或改名；改名后的文件不再复制
+        atomic_fetch_sub_explicit(&counters->in_flight, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->skipped, 1, memory_order_relaxed);
+        free(job);
+        return;
+    }
+    for (int i = 0; i < target_count; i++)
+    {
+        if (!(job->pending & (1u << i)))
+            continue;
+        const replica_target *t = &targets[i];
+        int64_t copied = t->ftp ? replicate_ftp(t, rel, src_fd, &st) : replicate_local(t, rel, src_fd, &st);
+        if (copied >= 0)
+        {
+            job->pending &= ~(1u << i);
+            atomic_fetch_add_explicit(&counters->bytes, (uint64_t)copied, memory_order_relaxed);
+        }
+        else if (job->attempts == REPLICA_MAX_ATTEMPTS)
+        {
+            fprintf(stderr, "replica: giving up on %s -> %s after %d attempts: %s\n", job->path, t->ftp ? t->label : t->path,
+                    job->attempts, strerror(errno));
+        }
+    }
+    close(src_fd);
+    release_path(job);
+    atomic_fetch_sub_explicit(&counters->in_flight, 1, memory_order_relaxed);
+
+    if (job->pending == 0)
+    {
+        uint64_t lag = monotonic_us() - job->enqueue_us;
+        atomic_store_explicit(&counters->lag_last_us, lag, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->lag_sum_us, lag, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&counters->lag_max_us, memory_order_relaxed);
+        while (lag > max &&
+               !atomic_compare_exchange_weak_explicit(&counters->lag_max_us, &max, lag, memory_order_relaxed,
+                                                      memory_order_relaxed))
+            ;
+        atomic_fetch_add_explicit(&counters->completed, 1, memory_order_relaxed);
+        free(job);
+    }
+    else if (job->attempts >= REPLICA_MAX_ATTEMPTS)
+    {
+        atomic_fetch_add_explicit(&counters->failed, 1, memory_order_relaxed);
+        free(job);
+    }
+    else
+    {
+        atomic_fetch_add_explicit(&counters->retries, 1, memory_order_relaxed);
+        schedule_retry(job);
+    }
+}
+
+/**
+ * 取出下一个任务：先取到期的重试，再取新入队的任务
+ * @param timeout_ms 没有任务时输出需要等待的时间（-1 表示直到有新任务）
+ * @return 任务，没有时返回 NULL
+ */
+static replica_job *next_job(int *timeout_ms)
+{
+    uint64_t now = monotonic_us();
+    *timeout_ms = -1;
+    pthread_mutex_lock(&job_lock);
+    replica_job *job = retry_list;
+    if (job != NULL && job->due_us <= now)
+        retry_list = job->next;
+    else if (job != NULL)
+    {
+        *timeout_ms = (int)((job->due_us - now + 999) / 1000);
+        job = NULL;
+    }
+    pthread_mutex_unlock(&job_lock);
+    if (job != NULL)
+        return job;
+
+    uint64_t one;
+    replica_msg *msg = malloc(sizeof(*msg));
+    if (msg == NULL)
+        return NULL;
+    if (read(wake_fd, &one, sizeof(one)) == sizeof(one) && ring_pop(replica_ring, msg) == 0)
+    {
+        job = malloc(sizeof(*job));
+        if (job != NULL)
+        {
+            job->next = NULL;
+            job->enqueue_us = msg->enqueue_us;
+            job->pending = (1u << target_count) - 1;
+            job->attempts = 0;
+            memcpy(job->path, msg->path, sizeof(job->path));
+        }
+    }
+    free(msg);
+    return job;
+}
+
+/**
+ * 复制线程：等待新任务或重试到期，每个线程同一时间只复制一个文件
+ */
+static void *replica_worker(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        int timeout_ms;
+        replica_job *job = next_job(&timeout_ms);
+        if (job != NULL)
+        {
+            run_job(job);
+            continue;
+        }
+        struct pollfd pfd = {.fd = wake_fd, .events = POLLIN};
+        poll(&pfd, 1, timeout_ms);
+    }
+    return NULL;
+}
+
+/**
+ * 启动复制线程，在存储后端初始化之后、fork 会话之前由父进程调用
+ * @param root 服务器根目录（绝对路径），复制到各目标时保留相对于它的路径
+ * @return 0 成功，-1 失败
+ */
+int replica_start(const char *root)
+{
+    if (replica_ring == NULL)
+        return 0;
+    if (!storage->native_fds)
+    {
+        // 复制线程直接读取根目录下的真实文件
+        fprintf(stderr, "-replica is only supported with local storage, ignored\n");
+        replica_ring = NULL;
+        return 0;
+    }
+    snprintf(root_path, sizeof(root_path), "%s", root);
+    root_len = strlen(root_path);
+    while (root_len > 1 && root_path[root_len - 1] == '/')
+        root_path[--root_len] = '\0';
+    for (int i = 0; i < target_count; i++)
+    {
+        if (!targets[i].ftp && strcmp(targets[i].path, root_path) == 0)
+        {
+            fprintf(stderr, "replica target %s is the server root\n", targets[i].path);
+            return -1;
+        }
+    }
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, replica_worker, NULL) != 0)
+        {
+            fprintf(stderr, "replica: failed to start worker thread\n");
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    return 0;
+}
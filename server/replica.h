@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#define REPLICA_MAX_TARGETS 4         // -replica 最多可指定的目标数
+#define REPLICA_RING_SLOTS 1024       // 待复制队列的槽位数，队列满时新的任务被丢弃并计数
+#define REPLICA_DEFAULT_WORKERS 2     // 默认的复制线程数，即同时进行的复制数上限
+#define REPLICA_MAX_ATTEMPTS 8        // 每个任务最多尝试的次数
+#define REPLICA_RETRY_BASE_MS 500     // 第一次重试前的等待，之后每次翻倍
+#define REPLICA_RETRY_MAX_MS 60000    // 重试等待的上限
+#define REPLICA_FTP_TIMEOUT_S 30      // FTP 目标上每次读写的超时
+
+/*
+ * 上传完成后的异步复制：
+ *  - STOR 与 SITE DELTA 成功后，会话把文件路径放入共享内存中的环形队列（fork 之前创建），
+ *    并通过 eventfd 唤醒复制线程；入队从不阻塞，队列满时丢弃并计数
+ *  - 复制线程位于父进程中（-replica-workers 个，限制同时进行的复制数），逐个目标复制：
+ *      本地目录：   FICLONE，不支持时 copy_file_range，再不支持时 pread/write；
+ *                   先写同一目录下的临时文件，保留权限与修改时间后 rename 覆盖
+ *      FTP 服务器： ftp://[用户[:密码]@]主机[:端口][/目录]，被动模式 STOR，用 sendfile 发送；
+ *                   目录按 RFC 1738 相对于登录后的当前目录，沿途的目录用 MKD 创建
+ *  - 失败的目标按指数退避重试，只重试失败的目标；源文件已被删除时放弃
+ *  - 同一文件同一时间只由一个线程复制；复制期间再次上传产生的任务等它结束后再复制最新内容
+ *  - 延迟（入队到所有目标完成）与计数位于共享内存，SITE STAT 中显示
+ * 队列只在内存中，服务器重启或升级时尚未完成的任务会丢失。
+ */
+
+typedef struct
+{
+    uint64_t queued;     // 已入队的任务数
+    uint64_t dropped;    // 队列满而丢弃的任务数
+    uint64_t completed;  // 所有目标都已完成的任务数
+    uint64_t failed;     // 重试次数用尽而放弃的任务数
+    uint64_t skipped;    // 复制前源文件已被删除的任务数
+    uint64_t retries;    // 重试的次数
+    uint64_t bytes;      // 已复制的字节数（每个目标分别计入）
+    uint64_t in_flight;  // 正在复制的任务数
+    uint64_t lag_last_us; // 最近一个完成的任务从入队到完成的时间
+    uint64_t lag_max_us;
+    uint64_t lag_sum_us; // 与 completed 一起计算平均延迟
+} replica_metrics;
+
+int replica_init(const char *const *targets, int ntargets, int workers);
+int replica_start(const char *root);
+int replica_enabled(void);
+void replica_submit(const char *path);
+void replica_get_metrics(replica_metrics *out);
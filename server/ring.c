@@ -0,0 +1,137 @@
+#include "ring.h"
+#include <string.h>
+#include <sys/mman.h>
+
+#define RING_CACHELINE 64
+
+typedef struct
+{
+    _Atomic uint64_t seq; // 槽位序号：等于写位置表示可写，等于写位置+1表示可读
+} ring_slot;
+
+struct ring
+{
+    size_t slot_size;                                      // 记录大小（字节）
+    size_t stride;                                         // 槽位跨度（含序号，按缓存行对齐）
+    uint64_t mask;                                         // nslots - 1
+    _Alignas(RING_CACHELINE) _Atomic uint64_t head;        // 下一个写位置
+    _Alignas(RING_CACHELINE) _Atomic uint64_t tail;        // 下一个读位置
+    _Alignas(RING_CACHELINE) _Atomic uint64_t dropped;     // 队列满而丢弃的记录数
+    _Alignas(RING_CACHELINE) unsigned char slots[];
+};
+
+static ring_slot *ring_slot_at(ring_t *ring, uint64_t pos)
+{
+    return (ring_slot *)(ring->slots + (pos & ring->mask) * ring->stride);
+}
+
+/**
+ * 创建一个位于共享内存中的环形队列，应在 fork() 之前调用
+ * @param slot_size 每条记录的大小
+ * @param nslots 槽位数量，必须是2的幂
+ * @return 成功返回队列指针，失败返回NULL
+ */
+ring_t *ring_create(size_t slot_size, size_t nslots)
+{
+    if (slot_size == 0 || nslots == 0 || (nslots & (nslots - 1)) != 0)
+        return NULL;
+
+    size_t stride = (sizeof(ring_slot) + slot_size + RING_CACHELINE - 1) & ~(size_t)(RING_CACHELINE - 1);
+    size_t total = sizeof(struct ring) + stride * nslots;
+    void *mem = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    ring_t *ring = (ring_t *)mem;
+    ring->slot_size = slot_size;
+    ring->stride = stride;
+    ring->mask = nslots - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    for (uint64_t i = 0; i < nslots; i++)
+        atomic_init(&ring_slot_at(ring, i)->seq, i);
+    return ring;
+}
+
+/**
+ * 将一条记录放入队列，队列已满时直接丢弃并计数，从不阻塞
+ * @param ring 队列
+ * @param record 记录内容，长度为 slot_size
+ * @return 0 成功，-1 队列已满
+ */
+int ring_push(ring_t *ring, const void *record)
+{
+    uint64_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;)
+    {
+        ring_slot *slot = ring_slot_at(ring, pos);
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if (diff == 0)
+        {
+            // 槽位空闲，尝试占用
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                memcpy(slot + 1, record, ring->slot_size);
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return 0;
+            }
+            // CAS 失败时 pos 已被更新为最新值，重试
+        }
+        else if (diff < 0)
+        {
+            // 队列已满
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return -1;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * 从队列中取出一条记录
+ * @param ring 队列
+ * @param record 输出缓冲区，长度至少为 slot_size
+ * @return 0 成功，-1 队列为空
+ */
+int ring_pop(ring_t *ring, void *record)
+{
+    uint64_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;)
+    {
+        ring_slot *slot = ring_slot_at(ring, pos);
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                memcpy(record, slot + 1, ring->slot_size);
+                atomic_store_explicit(&slot->seq, pos + ring->mask + 1, memory_order_release);
+                return 0;
+            }
+        }
+        else if (diff < 0)
+        {
+            return -1; // 队列为空
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * 获取因队列已满而丢弃的记录总数
+ */
+uint64_t ring_dropped(const ring_t *ring)
+{
+    return atomic_load_explicit(&((ring_t *)ring)->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * 固定槽位大小的有界无锁环形队列（多生产者/单消费者均可，实现为 MPMC）。
+ * 队列整体位于 MAP_SHARED 匿名映射中，在 fork() 之前创建即可被父子进程共享，
+ * 各进程通过原子操作并发入队，无需任何锁。
+ */
+typedef struct ring ring_t;
+
+ring_t *ring_create(size_t slot_size, size_t nslots);
+int ring_push(ring_t *ring, const void *record);
+int ring_pop(ring_t *ring, void *record);
+uint64_t ring_dropped(const ring_t *ring);
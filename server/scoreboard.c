@@ -0,0 +1,421 @@
+#include "scoreboard.h"
+#include "utils.h"
+#include <signal.h>
+#include <sys/mman.h>
+
+typedef struct
+{
+    int nslots;                      // 槽位数量
+    _Atomic uint32_t active;         // 当前占用的槽位数
+    _Atomic uint64_t total_sessions; // 启动以来的会话总数
+    _Atomic uint64_t total_bytes;    // 已结束会话的累计传输字节数
+    // 槽位按 128 字节对齐，避免不同会话之间的伪共享
+    _Alignas(128) unsigned char slots[];
+} sb_header;
+
+#define SB_SLOT_STRIDE ((sizeof(sb_slot) + 127) & ~(size_t)127)
+
+static sb_header *scoreboard = NULL;
+static int current_slot = -1; // 子进程自己的槽位
+static void (*release_hook)(int32_t tag) = NULL;
+
+static sb_slot *slot_at(int slot)
+{
+    return (sb_slot *)(scoreboard->slots + (size_t)slot * SB_SLOT_STRIDE);
+}
+
+static int slot_valid(int slot)
+{
+    return scoreboard != NULL && slot >= 0 && slot < scoreboard->nslots;
+}
+
+/**
+ * 创建共享内存计分板，必须在 fork() 之前由父进程调用
+ * @param nslots 槽位数量，即允许的最大并发会话数
+ * @return 0 成功，-1 失败
+ */
+int scoreboard_init(int nslots)
+{
+    if (nslots <= 0)
+        return -1;
+
+    size_t total = sizeof(sb_header) + SB_SLOT_STRIDE * (size_t)nslots;
+    void *mem = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("mmap scoreboard failed");
+        return -1;
+    }
+    // 匿名映射已清零，所有槽位初始即为 SB_STATE_FREE
+    scoreboard = (sb_header *)mem;
+    scoreboard->nslots = nslots;
+    return 0;
+}
+
+/**
+ * 获取计分板的槽位数量
+ */
+int scoreboard_capacity(void)
+{
+    return scoreboard != NULL ? scoreboard->nslots : 0;
+}
+
+/**
+ * 回收进程已经不存在的槽位（子进程异常退出时不会自行释放）
+ * @return 回收后仍在使用的槽位数
+ */
+uint32_t scoreboard_sweep(void)
+{
+    if (scoreboard == NULL)
+        return 0;
+    for (int i = 0; i < scoreboard->nslots; i++)
+    {
+        sb_slot *s = slot_at(i);
+        int32_t pid = atomic_load(&s->pid);
+        if (atomic_load(&s->state) != SB_STATE_FREE && pid > 0 && kill(pid, 0) != 0 && errno == ESRCH)
+            scoreboard_release(i);
+    }
+    return atomic_load(&scoreboard->active);
+}
+
+/**
+ * 为新连接占用一个槽位，由父进程在 fork() 之前调用
+ * @param peer 客户端地址
+ * @return 槽位编号，没有空闲槽位时返回-1
+ */
+int scoreboard_claim(const struct sockaddr_in *peer)
+{
+    if (scoreboard == NULL)
+        return -1;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < scoreboard->nslots; i++)
+        {
+            sb_slot *s = slot_at(i);
+            uint32_t expected = SB_STATE_FREE;
+            if (!atomic_compare_exchange_strong(&s->state, &expected, SB_STATE_RESERVED))
+                continue;
+
+            uint64_t now = realtime_us();
+            atomic_store(&s->pid, 0);
+            atomic_store(&s->tag, -1);
+            atomic_store(&s->cpu, -1);
+            atomic_store(&s->peer, ((uint64_t)ntohl(peer->sin_addr.s_addr) << 32) | ntohs(peer->sin_port));
+            atomic_store(&s->start_us, now);
+            atomic_store(&s->last_us, now);
+            atomic_store(&s->bytes, 0);
+            atomic_store(&s->commands, 0);
+            atomic_store(&s->mem_bytes, 0);
+            atomic_fetch_add(&s->cmd_seq, 1);
+            s->cmd[0] = '\0';
+            atomic_fetch_add(&s->cmd_seq, 1);
+            atomic_fetch_add(&scoreboard->active, 1);
+            atomic_fetch_add(&scoreboard->total_sessions, 1);
+            return i;
+        }
+        // 没有空闲槽位，回收异常退出的会话后再试一次
+        scoreboard_sweep();
+    }
+    return -1;
+}
+
+/**
+ * 记录处理该槽位的子进程
+ */
+void scoreboard_set_pid(int slot, pid_t pid)
+{
+    if (slot_valid(slot))
+        atomic_store(&slot_at(slot)->pid, (int32_t)pid);
+}
+
+/**
+ * 设置槽位的附加值，槽位释放时传给释放钩子
+ */
+void scoreboard_set_tag(int slot, int32_t tag)
+{
+    if (slot_valid(slot))
+        atomic_store(&slot_at(slot)->tag, tag);
+}
+
+/**
+ * 记录会话绑定的 CPU（父进程在 fork 之前设置）
+ */
+void scoreboard_set_cpu(int slot, int cpu)
+{
+    if (slot_valid(slot))
+        atomic_store(&slot_at(slot)->cpu, (int32_t)cpu);
+}
+
+/**
+ * 统计每个 CPU 上绑定的活动会话数
+ * @param counts 输出，下标为 CPU 编号
+ * @param ncpus counts 的长度
+ */
+void scoreboard_cpu_load(uint32_t *counts, int ncpus)
+{
+    memset(counts, 0, sizeof(*counts) * (size_t)ncpus);
+    for (int i = 0; i < scoreboard_capacity(); i++)
+    {
+        sb_slot *s = slot_at(i);
+        if (atomic_load(&s->state) == SB_STATE_FREE)
+            continue;
+        int32_t cpu = atomic_load(&s->cpu);
+        if (cpu >= 0 && cpu < ncpus)
+            counts[cpu]++;
+    }
+}
+
+/**
+ * 注册槽位释放钩子；无论是会话正常结束还是回收异常退出的会话，每个槽位只调用一次
+ */
+void scoreboard_set_release_hook(void (*hook)(int32_t tag))
+{
+    release_hook = hook;
+}
+
+/**
+ * 释放槽位，会话累计字节数计入全局统计
+ */
+void scoreboard_release(int slot)
+{
+    if (!slot_valid(slot))
+        return;
+    sb_slot *s = slot_at(slot);
+    // 先转入 RELEASING 取得释放权：子进程与父进程的回收可能同时释放同一槽位，只有一方成功；
+    // 槽位在读取字节数与附加值、调用钩子期间仍不是 FREE，父进程不会把它分配给新连接
+    uint32_t state = atomic_load(&s->state);
+    do
+    {
+        if (state == SB_STATE_FREE || state == SB_STATE_RELEASING)
+            return; // 已经被释放过或正在被释放
+    } while (!atomic_compare_exchange_weak(&s->state, &state, SB_STATE_RELEASING));
+    atomic_fetch_add(&scoreboard->total_bytes, atomic_load(&s->bytes));
+    if (release_hook != NULL)
+        release_hook(atomic_load(&s->tag));
+    atomic_fetch_sub(&scoreboard->active, 1);
+    atomic_store_explicit(&s->state, SB_STATE_FREE, memory_order_release);
+}
+
+/**
+ * 无锁地读取一个槽位的快照
+ * @param slot 槽位编号
+ * @param out 输出的快照
+ * @return 1 槽位正在使用，0 槽位空闲或编号无效
+ */
+int scoreboard_read(int slot, sb_snapshot *out)
+{
+    if (!slot_valid(slot))
+        return 0;
+    sb_slot *s = slot_at(slot);
+    out->state = (sb_state_t)atomic_load(&s->state);
+    if (out->state == SB_STATE_FREE)
+        return 0;
+
+    out->pid = atomic_load(&s->pid);
+    uint64_t peer = atomic_load(&s->peer);
+    out->ip.s_addr = htonl((uint32_t)(peer >> 32));
+    out->port = (uint16_t)(peer & 0xFFFF);
+    out->start_us = atomic_load(&s->start_us);
+    out->last_us = atomic_load(&s->last_us);
+    out->bytes = atomic_load(&s->bytes);
+    out->commands = atomic_load(&s->commands);
+    out->mem_bytes = atomic_load(&s->mem_bytes);
+    out->cpu = atomic_load(&s->cpu);
+
+    // 序号锁读取当前命令，写者正在写入时重试（最多若干次，之后放弃该字段）
+    for (int tries = 0; tries < 16; tries++)
+    {
+        uint32_t seq = atomic_load_explicit(&s->cmd_seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        memcpy(out->cmd, s->cmd, sizeof(out->cmd));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->cmd_seq, memory_order_relaxed) == seq)
+        {
+            out->cmd[sizeof(out->cmd) - 1] = '\0';
+            return 1;
+        }
+    }
+    out->cmd[0] = '\0';
+    return 1;
+}
+
+/**
+ * 当前活动会话数
+ */
+uint32_t scoreboard_active(void)
+{
+    return scoreboard != NULL ? atomic_load(&scoreboard->active) : 0;
+}
+
+/**
+ * 启动以来的会话总数
+ */
+uint64_t scoreboard_total_sessions(void)
+{
+    return scoreboard != NULL ? atomic_load(&scoreboard->total_sessions) : 0;
+}
+
+/**
+ * 启动以来传输的字节总数（含仍在进行中的会话）
+ */
+uint64_t scoreboard_total_bytes(void)
+{
+    if (scoreboard == NULL)
+        return 0;
+    uint64_t total = atomic_load(&scoreboard->total_bytes);
+    for (int i = 0; i < scoreboard->nslots; i++)
+    {
+        sb_slot *s = slot_at(i);
+        if (atomic_load(&s->state) != SB_STATE_FREE)
+            total += atomic_load(&s->bytes);
+    }
+    return total;
+}
+
+/**
+ * 空闲（已登录、等待命令）会话平均映射的 slab 内存
+ * @param idle_sessions 输出空闲会话数，可为NULL
+ * @return 每个空闲会话的平均字节数，没有空闲会话时为0
+ */
+uint64_t scoreboard_idle_memory(uint32_t *idle_sessions)
+{
+    uint64_t total = 0;
+    uint32_t count = 0;
+    for (int i = 0; i < scoreboard_capacity(); i++)
+    {
+        sb_slot *s = slot_at(i);
+        if (atomic_load(&s->state) != SB_STATE_IDLE)
+            continue;
+        total += atomic_load(&s->mem_bytes);
+        count++;
+    }
+    if (idle_sessions != NULL)
+        *idle_sessions = count;
+    return count > 0 ? total / count : 0;
+}
+
+/**
+ * 将所有活动会话输出到指定文件，供父进程在收到 SIGUSR1 时使用
+ */
+void scoreboard_dump(FILE *out)
+{
+    uint64_t now = realtime_us();
+    fprintf(out, "scoreboard: %u active, %llu total sessions, %llu bytes\n",
+            scoreboard_active(), (unsigned long long)scoreboard_total_sessions(),
+            (unsigned long long)scoreboard_total_bytes());
+    for (int i = 0; i < scoreboard_capacity(); i++)
+    {
+        sb_snapshot snap;
+        if (!scoreboard_read(i, &snap))
+            continue;
+        fprintf(out, "  [%d] pid=%d %s:%u %s %llus bytes=%llu mem=%llu cpu=%d cmd=%s\n", i, snap.pid,
+                inet_ntoa(snap.ip), snap.port, scoreboard_state_name(snap.state),
+                (unsigned long long)((now - snap.start_us) / 1000000), (unsigned long long)snap.bytes,
+                (unsigned long long)snap.mem_bytes, snap.cpu, snap.cmd);
+    }
+    fflush(out);
+}
+
+/**
+ * 子进程绑定自己的槽位
+ */
+void scoreboard_attach(int slot)
+{
+    current_slot = slot_valid(slot) ? slot : -1;
+    if (current_slot >= 0)
+    {
+        atomic_store(&slot_at(current_slot)->pid, (int32_t)getpid());
+        atomic_store(&slot_at(current_slot)->state, SB_STATE_CONNECTED);
+    }
+}
+
+/**
+ * 当前进程绑定的槽位，未绑定时为-1
+ */
+int scoreboard_current(void)
+{
+    return current_slot;
+}
+
+/**
+ * 更新当前会话的状态
+ */
+void scoreboard_set_state(sb_state_t state)
+{
+    if (current_slot >= 0)
+        atomic_store_explicit(&slot_at(current_slot)->state, state, memory_order_release);
+}
+
+/**
+ * 更新当前会话正在执行的命令，PASS 的参数不会被记录
+ */
+void scoreboard_set_command(const char *cmd, const char *arg)
+{
+    if (current_slot < 0)
+        return;
+    sb_slot *s = slot_at(current_slot);
+    atomic_fetch_add_explicit(&s->cmd_seq, 1, memory_order_acq_rel);
+    if (arg[0] != '\0' && strcasecmp(cmd, "PASS") != 0)
+        snprintf(s->cmd, sizeof(s->cmd), "%s %s", cmd, arg);
+    else
+        snprintf(s->cmd, sizeof(s->cmd), "%s", cmd);
+    atomic_fetch_add_explicit(&s->cmd_seq, 1, memory_order_release);
+    atomic_store_explicit(&s->last_us, realtime_us(), memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->commands, 1, memory_order_relaxed);
+}
+
+/**
+ * 累加当前会话传输的字节数，供传输循环调用
+ */
+void scoreboard_add_bytes(uint64_t bytes)
+{
+    if (current_slot >= 0)
+        atomic_fetch_add_explicit(&slot_at(current_slot)->bytes, bytes, memory_order_relaxed);
+}
+
+/**
+ * 当前会话累计传输的字节数，可在传输进行中从其它线程读取
+ */
+uint64_t scoreboard_session_bytes(void)
+{
+    if (current_slot < 0)
+        return 0;
+    return atomic_load_explicit(&slot_at(current_slot)->bytes, memory_order_relaxed);
+}
+
+/**
+ * 公布当前会话为 slab 池映射的内存字节数
+ */
+void scoreboard_set_memory(uint64_t bytes)
+{
+    if (current_slot >= 0)
+        atomic_store_explicit(&slot_at(current_slot)->mem_bytes, bytes, memory_order_relaxed);
+}
+
+/**
+ * 状态的可读名称
+ */
+const char *scoreboard_state_name(sb_state_t state)
+{
+    switch (state)
+    {
+    case SB_STATE_FREE:
+        return "free";
+    case SB_STATE_RESERVED:
+        return "starting";
+    case SB_STATE_CONNECTED:
+        return "connected";
+    case SB_STATE_IDLE:
+        return "idle";
+    case SB_STATE_TRANSFER:
+        return "transfer";
+    case SB_STATE_CLOSING:
+        return "closing";
+    case SB_STATE_RELEASING:
+        return "releasing";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#define SCOREBOARD_DEFAULT_SLOTS 256 // 默认会话槽位数，同时也是并发会话上限
+#define SCOREBOARD_CMD_MAX 48        // 槽位中保存的当前命令长度上限
+
+typedef enum
+{
+    SB_STATE_FREE = 0,  // 空闲槽位
+    SB_STATE_RESERVED,  // 父进程已占用，子进程尚未启动
+    SB_STATE_CONNECTED, // 已连接，尚未登录
+    SB_STATE_IDLE,      // 已登录，等待命令
+    SB_STATE_TRANSFER,  // 正在进行数据传输
+    SB_STATE_CLOSING,   // 正在关闭
+    SB_STATE_RELEASING  // 正在释放：释放者仍拥有该槽位，scoreboard_claim 不会占用
+} sb_state_t;
+
+/*
+ * 每个会话一个固定大小的槽位，位于 fork() 之前创建的共享内存中。
+ * 只有会话自身（以及创建/回收槽位的父进程）会写入，其它进程通过原子读取无锁地观察。
+ * 当前命令文本使用序号锁（seqlock）保护，读者读到奇数序号或序号变化时重试。
+ */
+typedef struct
+{
+    _Atomic uint32_t state;        // sb_state_t
+    _Atomic int32_t pid;           // 处理该会话的子进程
+    _Atomic uint64_t peer;         // 客户端地址：高32位为IP，低16位为端口（主机字节序）
+    _Atomic uint64_t start_us;     // 会话开始时间（Unix 时间，微秒）
+    _Atomic uint64_t last_us;      // 最近一次命令的时间
+    _Atomic uint64_t bytes;        // 会话累计传输字节数
+    _Atomic uint64_t commands;     // 会话累计命令数
+    _Atomic uint64_t mem_bytes;    // 会话当前为 slab 池映射的字节数
+    _Atomic int32_t tag;           // 槽位释放时传给释放钩子的附加值（如准入控制表条目）
+    _Atomic int32_t cpu;           // 会话绑定的 CPU，-1 表示未绑定
+    _Atomic uint32_t cmd_seq;      // 当前命令文本的序号锁
+    char cmd[SCOREBOARD_CMD_MAX];  // 当前命令文本
+} sb_slot;
+
+typedef struct
+{
+    int32_t pid;
+    sb_state_t state;
+    struct in_addr ip;
+    uint16_t port;
+    uint64_t start_us;
+    uint64_t last_us;
+    uint64_t bytes;
+    uint64_t commands;
+    uint64_t mem_bytes;
+    int32_t cpu;
+    char cmd[SCOREBOARD_CMD_MAX];
+} sb_snapshot;
+
+int scoreboard_init(int nslots);
+int scoreboard_capacity(void);
+int scoreboard_claim(const struct sockaddr_in *peer);
+void scoreboard_set_pid(int slot, pid_t pid);
+void scoreboard_set_tag(int slot, int32_t tag);
+void scoreboard_set_cpu(int slot, int cpu);
+void scoreboard_cpu_load(uint32_t *counts, int ncpus);
+void scoreboard_set_release_hook(void (*hook)(int32_t tag));
+void scoreboard_release(int slot);
+uint32_t scoreboard_sweep(void);
+int scoreboard_read(int slot, sb_snapshot *out);
+uint32_t scoreboard_active(void);
+uint64_t scoreboard_total_sessions(void);
+uint64_t scoreboard_total_bytes(void);
+uint64_t scoreboard_idle_memory(uint32_t *idle_sessions);
+void scoreboard_dump(FILE *out);
+
+// 以下函数在子进程中使用，作用于 scoreboard_attach 绑定的当前槽位
+void scoreboard_attach(int slot);
+int scoreboard_current(void);
+void scoreboard_set_state(sb_state_t state);
+void scoreboard_set_command(const char *cmd, const char *arg);
+void scoreboard_add_bytes(uint64_t bytes);
+uint64_t scoreboard_session_bytes(void);
+void scoreboard_set_memory(uint64_t bytes);
+
+const char *scoreboard_state_name(sb_state_t state);
@@ -0,0 +1,255 @@
+#include "site.h"
+#include "file.h"
+#include "tree.h"
+#include "find.h"
+#include "scoreboard.h"
+#include "xferlog.h"
+#include "admission.h"
+#include "trace.h"
+#include "storage.h"
+#include "statcache.h"
+#include "affinity.h"
+#include "replica.h"
+#include <strings.h>
+
+/**
+ * 处理 SITE WHO 命令，列出所有活动会话（读取共享计分板，无需加锁）
+ * @param client_socket 客户端控制连接
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+static int handle_site_who(int client_socket)
+{
+    int capacity = scoreboard_capacity();
+    if (capacity == 0)
+    {
+        send_response(client_socket, 502, "Session scoreboard is not available.");
+        return -1;
+    }
+
+    // 第一行为标题，最后一行为总结，中间每个会话一行
+    char(*rows)[160] = malloc(sizeof(*rows) * (capacity + 2));
+    const char **lines = malloc(sizeof(*lines) * (capacity + 3));
+    if (rows == NULL || lines == NULL)
+    {
+        free(rows);
+        free(lines);
+        send_response(client_socket, 451, "Out of memory.");
+        return -1;
+    }
+
+    uint64_t now = realtime_us();
+    int n = 0;
+    snprintf(rows[n], sizeof(rows[n]), "%-7s %-21s %-9s %4s %8s %14s  %s", "PID", "PEER", "STATE", "CPU", "SECS", "BYTES",
+             "COMMAND");
+    lines[n] = rows[n];
+    n++;
+    for (int i = 0; i < capacity; i++)
+    {
+        sb_snapshot snap;
+        if (!scoreboard_read(i, &snap))
+            continue;
+        char peer[32];
+        snprintf(peer, sizeof(peer), "%s:%u", inet_ntoa(snap.ip), snap.port);
+        char cpu[8] = "-";
+        if (snap.cpu >= 0)
+            snprintf(cpu, sizeof(cpu), "%d", snap.cpu);
+        snprintf(rows[n], sizeof(rows[n]), "%-7d %-21s %-9s %4s %8llu %14llu  %s", snap.pid, peer,
+                 scoreboard_state_name(snap.state), cpu, (unsigned long long)((now - snap.start_us) / 1000000),
+                 (unsigned long long)snap.bytes, snap.cmd);
+        lines[n] = rows[n];
+        n++;
+    }
+    snprintf(rows[n], sizeof(rows[n]), "%u of %d session slots in use.", scoreboard_active(), capacity);
+    lines[n] = rows[n];
+    lines[n + 1] = NULL;
+
+    send_multiline_response(client_socket, 200, lines);
+    free(rows);
+    free(lines);
+    return 0;
+}
+
+/**
+ * 处理 SITE TRACE 命令，开启/关闭本会话的时间线追踪
+ *  - SITE TRACE ON：开始记录
+ *  - SITE TRACE OFF：停止记录并输出 Chrome trace JSON
+ *  - SITE TRACE（无参数）：查询当前状态
+ * @param client_socket 客户端控制连接
+ * @param arg ON / OFF / 空
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+static int handle_site_trace(int client_socket, const char *arg)
+{
+    if (!trace_available())
+    {
+        send_response(client_socket, 502, "Tracing is not configured on this server.");
+        return -1;
+    }
+    if (arg[0] == '\0')
+    {
+        send_response(client_socket, 200, trace_enabled ? "Tracing is on." : "Tracing is off.");
+        return 0;
+    }
+    if (strcasecmp(arg, "ON") == 0)
+    {
+        if (trace_set(1) != 0)
+        {
+            send_response(client_socket, 451, "Failed to allocate trace buffer.");
+            return -1;
+        }
+        send_response(client_socket, 200, "Tracing enabled.");
+        return 0;
+    }
+    if (strcasecmp(arg, "OFF") == 0)
+    {
+        int was_on = trace_enabled;
+        if (trace_set(0) != 0)
+        {
+            send_response(client_socket, 451, "Failed to write trace file.");
+            return -1;
+        }
+        char message[PATH_MAX + 32];
+        if (was_on && trace_last_file()[0] != '\0')
+            snprintf(message, sizeof(message), "Tracing disabled, timeline written to %s.", trace_last_file());
+        else
+            snprintf(message, sizeof(message), "Tracing disabled.");
+        send_response(client_socket, 200, message);
+        return 0;
+    }
+    send_response(client_socket, 501, "Usage: SITE TRACE [ON|OFF].");
+    return -1;
+}
+
+/**
+ * 处理 SITE 命令，根据子命令分派
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg 子命令及其参数
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_site_command(int client_socket, connection *session, const char *arg)
+{
+    char subcmd[128], subarg[LINE_MAX_SIZE];
+    parse_cmd_param(arg, subcmd, sizeof(subcmd), subarg);
+
+    if (strcasecmp(subcmd, "WHO") == 0)
+    {
+        return handle_site_who(client_socket);
+    }
+    else if (strcasecmp(subcmd, "CPFR") == 0)
+    {
+        return handle_cpfr_command(client_socket, session, subarg);
+    }
+    else if (strcasecmp(subcmd, "CPTO") == 0)
+    {
+        return handle_cpto_command(client_socket, session, subarg);
+    }
+    else if (strcasecmp(subcmd, "RETRTREE") == 0)
+    {
+        return handle_retrtree_command(client_socket, session, subarg);
+    }
+    else if (strcasecmp(subcmd, "SIGS") == 0)
+    {
+        return handle_sigs_command(client_socket, session, subarg);
+    }
+    else if (strcasecmp(subcmd, "DELTA") == 0)
+    {
+        return handle_delta_command(client_socket, session, subarg);
+    }
+    else if (strcasecmp(subcmd, "FIND") == 0)
+    {
+        return handle_find_command(client_socket, session, subarg);
+    }
+    else if (strcasecmp(subcmd, "TRACE") == 0)
+    {
+        return handle_site_trace(client_socket, subarg);
+    }
+    send_response(client_socket, 504, "SITE command not implemented.");
+    return -1;
+}
+
+/**
+ * 处理不带参数的 STAT 命令，返回当前会话与服务器整体的状态
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg STAT 参数，目前只支持为空
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_stat_command(int client_socket, connection *session, const char *arg)
+{
+    if (arg[0] != '\0')
+    {
+        send_response(client_socket, 504, "STAT with arguments is not implemented.");
+        return -1;
+    }
+
+    char peer_line[64], session_line[64], active_line[64], total_line[96], drops_line[64], rejected_line[96];
+    char memory_line[80], storage_line[96], cache_line[128], cpu_line[96], replica_line[192];
+    snprintf(peer_line, sizeof(peer_line), "Connected to %s:%u", inet_ntoa(session->peer_addr.sin_addr),
+             ntohs(session->peer_addr.sin_port));
+    snprintf(session_line, sizeof(session_line), "Session bytes transferred: %llu",
+             (unsigned long long)session->bytes_transferred);
+    snprintf(active_line, sizeof(active_line), "Active sessions: %u of %d", scoreboard_active(),
+             scoreboard_capacity());
+    snprintf(total_line, sizeof(total_line), "Total sessions: %llu, total bytes: %llu",
+             (unsigned long long)scoreboard_total_sessions(), (unsigned long long)scoreboard_total_bytes());
+    snprintf(rejected_line, sizeof(rejected_line), "Connections rejected: %llu, from your address: %d active",
+             (unsigned long long)admission_rejected(), admission_active(session->peer_addr.sin_addr.s_addr));
+    uint32_t idle = 0;
+    uint64_t idle_bytes = scoreboard_idle_memory(&idle);
+    snprintf(memory_line, sizeof(memory_line), "Bytes per idle session: %llu (%u idle)",
+             (unsigned long long)idle_bytes, idle);
+    if (storage == &storage_ram)
+    {
+        uint64_t used = 0, capacity = 0;
+        ram_storage_usage(&used, &capacity);
+        snprintf(storage_line, sizeof(storage_line), "Storage: ram, %llu of %llu bytes used",
+                 (unsigned long long)used, (unsigned long long)capacity);
+    }
+    else
+    {
+        snprintf(storage_line, sizeof(storage_line), "Storage: %s", storage->name);
+    }
+    statcache_metrics cache;
+    statcache_get_metrics(&cache);
+    snprintf(cache_line, sizeof(cache_line), "Stat cache: %llu hits, %llu misses, %u entries, %llu evictions, %llu invalidations",
+             (unsigned long long)cache.hits, (unsigned long long)cache.misses, cache.entries,
+             (unsigned long long)cache.evictions, (unsigned long long)cache.invalidations);
+    snprintf(drops_line, sizeof(drops_line), "Transfer log records dropped: %llu",
+             (unsigned long long)xferlog_dropped());
+    replica_metrics replica;
+    replica_get_metrics(&replica);
+    uint64_t replica_pending = replica.queued - replica.completed - replica.failed - replica.skipped;
+    snprintf(replica_line, sizeof(replica_line),
+             "Replication: %llu pending, %llu done, %llu failed, %llu dropped, %llu retries, lag %llu ms (avg %llu, max %llu)",
+             (unsigned long long)replica_pending, (unsigned long long)replica.completed,
+             (unsigned long long)replica.failed, (unsigned long long)replica.dropped,
+             (unsigned long long)replica.retries, (unsigned long long)(replica.lag_last_us / 1000),
+             (unsigned long long)(replica.completed > 0 ? replica.lag_sum_us / replica.completed / 1000 : 0),
+             (unsigned long long)(replica.lag_max_us / 1000));
+
+    const char *lines[15];
+    int n = 0;
+    lines[n++] = "FTP server status:";
+    lines[n++] = peer_line;
+    lines[n++] = session->transfer_mode == TRANSFER_MODE_BLOCK ? "Logged in as anonymous, TYPE: BINARY, MODE: BLOCK"
+                                                               : "Logged in as anonymous, TYPE: BINARY, MODE: STREAM";
+    lines[n++] = session_line;
+    lines[n++] = active_line;
+    lines[n++] = total_line;
+    lines[n++] = rejected_line;
+    lines[n++] = memory_line;
+    lines[n++] = storage_line;
+    if (affinity_describe(cpu_line, sizeof(cpu_line)) == 0)
+        lines[n++] = cpu_line;
+    if (statcache_enabled())
+        lines[n++] = cache_line;
+    if (xferlog_enabled())
+        lines[n++] = drops_line;
+    if (replica_enabled())
+        lines[n++] = replica_line;
+    lines[n++] = "End of status";
+    lines[n] = NULL;
+    send_multiline_response(client_socket, 211, lines);
+    return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "utils.h"
+#include "connect.h"
+
+int handle_site_command(int client_socket, connection *session, const char *arg);
+int handle_stat_command(int client_socket, connection *session, const char *arg);
@@ -0,0 +1,328 @@
+#include "statcache.h"
+#include "storage.h"
+#include "utils.h"
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#define STATCACHE_BUCKETS (STATCACHE_ENTRIES / STATCACHE_WAYS)
+
+/*
+ * 每个条目用序号锁保护：读者无锁复制后检查序号，写者用 CAS 把序号从偶数改为奇数来独占条目，
+ * 抢不到时直接放弃本次写入（缓存写入失败只影响命中率）。
+ */
+typedef struct
+{
+    _Atomic uint32_t seq; // 序号锁，奇数表示写者正在更新
+    int32_t err;          // 0 表示路径存在，否则为 stat 失败时的 errno（负缓存）
+    uint64_t hash;        // 路径散列，0 表示空条目
+    uint64_t expires_us;  // 过期时间（单调时钟）
+    uint64_t size;
+    int64_t mtime;
+    uint64_t ino;
+    uint32_t mode;
+    uint32_t nlink;
+    char path[STATCACHE_PATH_MAX];
+} statcache_entry;
+
+typedef struct
+{
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t evictions;
+    _Atomic uint64_t invalidations;
+    _Atomic uint64_t generation; // 每次失效递增；查询存储后端期间发生过失效时不写入缓存
+    statcache_entry entries[STATCACHE_ENTRIES];
+} statcache_table;
+
+static statcache_table *table = NULL;
+static uint64_t ttl_us = 0;
+
+/**
+ * 创建元数据缓存，必须在 fork() 之前调用
+ * @param ttl_ms 条目有效期（毫秒），0 表示不使用缓存
+ * @return 0 成功，-1 失败
+ */
+int statcache_init(int ttl_ms)
+{
+    if (ttl_ms <= 0)
+        return 0;
+    void *mem = mmap(NULL, sizeof(statcache_table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("mmap stat cache failed");
+        return -1;
+    }
+    table = (statcache_table *)mem;
+    ttl_us = (uint64_t)ttl_ms * 1000;
+    return 0;
+}
+
+int statcache_enabled(void)
+{
+    return table != NULL;
+}
+
+static uint64_t hash_path(const char *path, size_t len)
+{
+    // FNV-1a，结果为0时改为1，0 保留给空条目
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)path[i]) * 1099511628211ULL;
+    return h != 0 ? h : 1;
+}
+
+static statcache_entry *bucket_of(uint64_t hash)
+{
+    return &table->entries[(hash & (STATCACHE_BUCKETS - 1)) * STATCACHE_WAYS];
+}
+
+/**
+ * 无锁读取一个条目的副本
+ * @return 1 读到一致的副本，0 写者持续更新（放弃该条目）
+ */
+static int entry_read(statcache_entry *e, statcache_entry *copy)
+{
+    const size_t off = offsetof(statcache_entry, err);
+    for (int tries = 0; tries < 16; tries++)
+    {
+        uint32_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        memcpy((char *)copy + off, (char *)e + off, sizeof(*e) - off);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&e->seq, memory_order_relaxed) == seq)
+            return 1;
+    }
+    return 0;
+}
+
+static int entry_lock(statcache_entry *e)
+{
+    uint32_t seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    return !(seq & 1) && atomic_compare_exchange_strong_explicit(&e->seq, &seq, seq + 1, memory_order_acq_rel,
+                                                                 memory_order_relaxed);
+}
+
+static void entry_unlock(statcache_entry *e)
+{
+    atomic_fetch_add_explicit(&e->seq, 1, memory_order_release);
+}
+
+static void fill_stat(const statcache_entry *e, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_mode = e->mode;
+    st->st_size = (off_t)e->size;
+    st->st_mtime = (time_t)e->mtime;
+    st->st_nlink = e->nlink;
+    st->st_ino = e->ino;
+}
+
+/**
+ * 写入查询结果：优先复用同一路径的条目，其次是空条目或已过期的条目，否则替换最早过期的条目。
+ * 持有条目锁后再核对失效代数：失效者先递增代数再逐个清除条目，
+ * 所以要么这里看到新的代数而放弃写入，要么失效者在写入完成后才清除该条目
+ * @param generation 查询存储后端之前读到的失效代数
+ */
+static void insert(uint64_t hash, const char *path, size_t len, int err, const struct stat *st, uint64_t now,
+                   uint64_t generation)
+{
+    statcache_entry *bucket = bucket_of(hash);
+    statcache_entry copy;
+    int victim = -1, victim_live = 0;
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < STATCACHE_WAYS; i++)
+    {
+        if (!entry_read(&bucket[i], &copy))
+            continue;
+        if (copy.hash == hash && strcmp(copy.path, path) == 0)
+        {
+            victim = i;
+            victim_live = 0;
+            break;
+        }
+        int live = copy.hash != 0 && copy.expires_us > now;
+        if (!live && (victim < 0 || victim_live))
+        {
+            victim = i;
+            victim_live = 0;
+            oldest = 0;
+        }
+        else if (live && copy.expires_us < oldest)
+        {
+            victim = i;
+            victim_live = 1;
+            oldest = copy.expires_us;
+        }
+    }
+    if (victim < 0)
+        return;
+
+    statcache_entry *e = &bucket[victim];
+    if (!entry_lock(e))
+        return;
+    atomic_thread_fence(memory_order_seq_cst); // 与失效者的代数递增配对，防止加锁与读代数被重排
+    if (atomic_load_explicit(&table->generation, memory_order_relaxed) != generation)
+    {
+        entry_unlock(e);
+        return;
+    }
+    e->hash = hash;
+    e->err = err;
+    e->expires_us = now + ttl_us;
+    if (err == 0)
+    {
+        e->mode = st->st_mode;
+        e->size = (uint64_t)st->st_size;
+        e->mtime = st->st_mtime;
+        e->nlink = (uint32_t)st->st_nlink;
+        e->ino = st->st_ino;
+    }
+    memcpy(e->path, path, len + 1);
+    entry_unlock(e);
+    if (victim_live)
+        atomic_fetch_add_explicit(&table->evictions, 1, memory_order_relaxed);
+}
+
+/**
+ * 带缓存的 stat，语义与存储后端的 stat 相同
+ * @param path 规范化的绝对路径
+ * @param st 输出的文件信息（只保证 mode/size/mtime/nlink/ino 有效）
+ * @return 0 成功，-1 失败并设置 errno
+ */
+int statcache_stat(const char *path, struct stat *st)
+{
+    size_t len = strlen(path);
+    if (table == NULL || len >= STATCACHE_PATH_MAX)
+        return storage->stat(path, st);
+
+    uint64_t hash = hash_path(path, len);
+    uint64_t now = monotonic_us();
+    statcache_entry *bucket = bucket_of(hash);
+    statcache_entry copy;
+    for (int i = 0; i < STATCACHE_WAYS; i++)
+    {
+        if (entry_read(&bucket[i], &copy) && copy.hash == hash && copy.expires_us > now &&
+            strcmp(copy.path, path) == 0)
+        {
+            atomic_fetch_add_explicit(&table->hits, 1, memory_order_relaxed);
+            if (copy.err != 0)
+            {
+                errno = copy.err;
+                return -1;
+            }
+            fill_stat(&copy, st);
+            return 0;
+        }
+    }
+
+    atomic_fetch_add_explicit(&table->misses, 1, memory_order_relaxed);
+    uint64_t generation = atomic_load_explicit(&table->generation, memory_order_acquire);
+    int rc = storage->stat(path, st);
+    int err = rc == 0 ? 0 : errno;
+    // 只缓存成功结果与"不存在"，权限等瞬时错误不缓存
+    if (rc == 0 || err == ENOENT || err == ENOTDIR)
+        insert(hash, path, len, err, st, now, generation);
+    errno = err;
+    return rc;
+}
+
+/**
+ * 清除一个条目。抢不到锁说明另一个写者正在更新（可能正写入失效前查到的旧结果），等它完成后再清除；
+ * 持锁的进程异常退出时条目序号停在奇数，读者本来就不会再读到它，放弃即可
+ */
+static void entry_clear(statcache_entry *e)
+{
+    for (int tries = 0; !entry_lock(e); tries++)
+    {
+        if (tries >= 1000)
+            return;
+        sched_yield();
+    }
+    e->hash = 0;
+    entry_unlock(e);
+    atomic_fetch_add_explicit(&table->invalidations, 1, memory_order_relaxed);
+}
+
+/**
+ * 清除一个路径的条目。读不到一致副本的条目正被写者持有，可能正写入本路径，保守地一并清除
+ */
+static void invalidate_one(const char *path, size_t len)
+{
+    if (len >= STATCACHE_PATH_MAX)
+        return;
+    uint64_t hash = hash_path(path, len);
+    statcache_entry *bucket = bucket_of(hash);
+    statcache_entry copy;
+    for (int i = 0; i < STATCACHE_WAYS; i++)
+    {
+        if (entry_read(&bucket[i], &copy) &&
+            (copy.hash != hash || strncmp(copy.path, path, len) != 0 || copy.path[len] != '\0'))
+            continue;
+        entry_clear(&bucket[i]);
+    }
+}
+
+static void invalidate_parent(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL)
+        return;
+    invalidate_one(path, slash == path ? 1 : (size_t)(slash - path));
+}
+
+/**
+ * 本服务器修改了一个文件或空目录：清除它与父目录（大小、修改时间、链接数发生变化）的条目
+ */
+void statcache_invalidate(const char *path)
+{
+    if (table == NULL)
+        return;
+    atomic_fetch_add_explicit(&table->generation, 1, memory_order_acq_rel);
+    atomic_thread_fence(memory_order_seq_cst);
+    invalidate_one(path, strlen(path));
+    invalidate_parent(path);
+}
+
+/**
+ * 本服务器删除或移动了一个目录：清除它、它之下所有路径以及父目录的条目（扫描整个缓存）
+ */
+void statcache_invalidate_tree(const char *path)
+{
+    if (table == NULL)
+        return;
+    atomic_fetch_add_explicit(&table->generation, 1, memory_order_acq_rel);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t len = strlen(path);
+    statcache_entry copy;
+    for (int i = 0; i < STATCACHE_ENTRIES; i++)
+    {
+        statcache_entry *e = &table->entries[i];
+        if (entry_read(e, &copy) && (copy.hash == 0 || strncmp(copy.path, path, len) != 0 ||
+                                     (copy.path[len] != '\0' && copy.path[len] != '/')))
+            continue;
+        entry_clear(e);
+    }
+    invalidate_parent(path);
+}
+
+/**
+ * 读取缓存统计，条目数通过扫描得到
+ */
+void statcache_get_metrics(statcache_metrics *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (table == NULL)
+        return;
+    out->hits = atomic_load(&table->hits);
+    out->misses = atomic_load(&table->misses);
+    out->evictions = atomic_load(&table->evictions);
+    out->invalidations = atomic_load(&table->invalidations);
+    uint64_t now = monotonic_us();
+    statcache_entry copy;
+    for (int i = 0; i < STATCACHE_ENTRIES; i++)
+        if (entry_read(&table->entries[i], &copy) && copy.hash != 0 && copy.expires_us > now)
+            out->entries++;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define STATCACHE_ENTRIES 4096        // 缓存条目总数（2的幂）
+#define STATCACHE_WAYS 4              // 每个桶的条目数（组相联）
+#define STATCACHE_PATH_MAX 240        // 可缓存的路径长度上限，更长的路径直接查询存储后端
+#define STATCACHE_DEFAULT_TTL_MS 1000 // 默认有效期（毫秒）
+
+/*
+ * 共享的元数据缓存：规范化路径 -> stat 结果（包括"不存在"的负缓存），位于 fork() 之前创建的共享内存中，
+ * SIZE/MDTM/MLST/CWD 等元数据命令先查缓存，同步类客户端的大量查询大多不需要系统调用。
+ * 本服务器自己的修改（STOR/DELE/MKD/RMD/RNTO/CPTO）立即使相关条目失效；
+ * 绕过服务器对文件系统的修改最多在有效期之后可见。
+ */
+
+typedef struct
+{
+    uint64_t hits;          // 命中次数
+    uint64_t misses;        // 未命中（包括过期）次数
+    uint64_t evictions;     // 因桶满而替换的有效条目数
+    uint64_t invalidations; // 因修改而失效的条目数
+    uint32_t entries;       // 当前未过期的条目数
+} statcache_metrics;
+
+int statcache_init(int ttl_ms);
+int statcache_enabled(void);
+int statcache_stat(const char *path, struct stat *st);
+void statcache_invalidate(const char *path);
+void statcache_invalidate_tree(const char *path);
+void statcache_get_metrics(statcache_metrics *out);
@@ -0,0 +1,161 @@
+#include "storage.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <strings.h>
+
+const storage_backend *storage = &storage_local;
+
+#define RAM_STORAGE_DEFAULT_MB 256 // -storage ram 未指定大小时的容量
+
+static int local_open(const char *path, int flags, mode_t mode)
+{
+    return open(path, flags | O_CLOEXEC, mode);
+}
+
+static ssize_t local_read(int fd, void *buffer, size_t len)
+{
+    return read(fd, buffer, len);
+}
+
+static ssize_t local_write(int fd, const void *buffer, size_t len)
+{
+    return write(fd, buffer, len);
+}
+
+static off_t local_lseek(int fd, off_t offset, int whence)
+{
+    return lseek(fd, offset, whence);
+}
+
+static int local_fstat(int fd, struct stat *st)
+{
+    return fstat(fd, st);
+}
+
+static int local_close(int fd)
+{
+    return close(fd);
+}
+
+static int local_stat(const char *path, struct stat *st)
+{
+    return stat(path, st);
+}
+
+#define LOCAL_LIST_BATCH (256 * 1024) // 每次 getdents64 读取的目录项缓冲区大小
+
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * 遍历目录，对每个目录项（不含 . 与 ..）调用回调；符号链接本身不被跟随
+ * 直接用 getdents64 一次读取一大批目录项，再在同一个目录 fd 上逐个 fstatat，
+ * 内存占用固定为一个批次缓冲区，与目录大小无关；回调返回非0时立即停止
+ */
+static int local_list(const char *path, storage_list_cb cb, void *ctx)
+{
+    int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0)
+        return -1;
+    char *batch = malloc(LOCAL_LIST_BATCH);
+    if (batch == NULL)
+    {
+        close(dfd);
+        return -1;
+    }
+    int rc = 0;
+    long n = 0;
+    while (rc == 0 && (n = syscall(SYS_getdents64, dfd, batch, LOCAL_LIST_BATCH)) > 0)
+    {
+        for (long off = 0; rc == 0 && off < n;)
+        {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(batch + off);
+            off += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            struct stat st;
+            if (fstatat(dfd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue; // 遍历期间被删除
+            rc = cb(ctx, entry->d_name, &st);
+        }
+    }
+    if (rc == 0 && n < 0)
+        rc = -1;
+    free(batch);
+    close(dfd);
+    return rc;
+}
+
+static int local_mkdir(const char *path, mode_t mode)
+{
+    return mkdir(path, mode);
+}
+
+static int local_rmdir(const char *path)
+{
+    return rmdir(path);
+}
+
+static int local_unlink(const char *path)
+{
+    return unlink(path);
+}
+
+static int local_rename(const char *from, const char *to)
+{
+    return rename(from, to);
+}
+
+const storage_backend storage_local = {
+    .name = "local",
+    .native_fds = 1,
+    .open = local_open,
+    .read = local_read,
+    .write = local_write,
+    .lseek = local_lseek,
+    .fstat = local_fstat,
+    .close = local_close,
+    .stat = local_stat,
+    .list = local_list,
+    .mkdir = local_mkdir,
+    .rmdir = local_rmdir,
+    .unlink = local_unlink,
+    .rename = local_rename,
+};
+
+/**
+ * 根据 -storage 参数选择存储后端，必须在 fork() 之前调用
+ * @param spec "local" 或 "ram[:容量MB]"，NULL 表示默认的 local
+ * @param root 服务器根目录（绝对路径），ram 后端以它作为文件系统的根
+ * @return 0 成功，-1 参数错误或初始化失败
+ */
+int storage_init(const char *spec, const char *root)
+{
+    if (spec == NULL || strcmp(spec, "local") == 0)
+    {
+        storage = &storage_local;
+        return 0;
+    }
+    if (strncmp(spec, "ram", 3) == 0 && (spec[3] == '\0' || spec[3] == ':'))
+    {
+        long mb = spec[3] == ':' ? atol(spec + 4) : RAM_STORAGE_DEFAULT_MB;
+        if (mb <= 0)
+        {
+            fprintf(stderr, "invalid ram storage size: %s\n", spec);
+            return -1;
+        }
+        if (ram_storage_init(root, (uint64_t)mb << 20) != 0)
+            return -1;
+        storage = &storage_ram;
+        return 0;
+    }
+    fprintf(stderr, "unknown storage backend: %s\n", spec);
+    return -1;
+}
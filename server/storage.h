@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * 存储后端：file.c 中的命令处理函数通过这组接口访问文件，而不是直接调用 POSIX 函数。
+ * 所有路径都是经过 resolve_path 规范化、并通过 is_path_safe 检查的绝对路径（以服务器根目录开头）。
+ * 出错时返回 -1 并设置 errno，与对应的 POSIX 函数一致。
+ *  - local：本地文件系统（默认），句柄就是内核文件描述符，可以使用 sendfile/copy_file_range
+ *  - ram：位于 fork 之前创建的共享内存区中的内存文件系统，所有会话看到同一份内容，
+ *         用于排除磁盘影响的纯网络基准测试，或作为类似 tmpfs 的临时区
+ */
+
+typedef int (*storage_list_cb)(void *ctx, const char *name, const struct stat *st);
+
+typedef struct
+{
+    const char *name;
+    int native_fds; // 句柄是否为真实的内核文件描述符
+    int (*open)(const char *path, int flags, mode_t mode);
+    ssize_t (*read)(int fd, void *buffer, size_t len);
+    ssize_t (*write)(int fd, const void *buffer, size_t len);
+    off_t (*lseek)(int fd, off_t offset, int whence);
+    int (*fstat)(int fd, struct stat *st);
+    int (*close)(int fd);
+    int (*stat)(const char *path, struct stat *st);
+    int (*list)(const char *path, storage_list_cb cb, void *ctx); // 不包含 "." 与 ".."
+    int (*mkdir)(const char *path, mode_t mode);
+    int (*rmdir)(const char *path);
+    int (*unlink)(const char *path);
+    int (*rename)(const char *from, const char *to);
+} storage_backend;
+
+extern const storage_backend *storage; // 当前使用的后端
+
+extern const storage_backend storage_local;
+extern const storage_backend storage_ram;
+
+int storage_init(const char *spec, const char *root);
+int ram_storage_init(const char *root, uint64_t capacity);
+void ram_storage_usage(uint64_t *used, uint64_t *capacity);
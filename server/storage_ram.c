@@ -0,0 +1,746 @@
+#include "storage.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/*
+ * 内存文件系统：节点表、块链表和数据块都位于 fork() 之前创建的共享映射中，
+ * 所有会话进程看到同一份内容，由一把进程间共享的健壮互斥锁保护。
+ * 文件数据按固定大小的块存放，块之间用 FAT 式的 next 数组串成链表；
+ * 打开的文件句柄是进程私有的，记录偏移与最近访问的块，顺序读写不需要从头遍历链表。
+ */
+
+#define RAMFS_MAX_NODES 8192        // 文件与目录总数上限
+#define RAMFS_NAME_MAX 255          // 单个路径组件的长度上限
+#define RAMFS_CHUNK_SIZE (64 * 1024) // 数据块大小
+#define RAMFS_MAX_HANDLES 32        // 每个进程同时打开的文件数上限
+#define RAMFS_FD_BASE (1 << 20)     // 句柄编号的起点，误传给系统调用时会得到 EBADF
+
+typedef struct
+{
+    uint8_t used;          // 节点是否已分配
+    uint8_t is_dir;        // 目录
+    uint8_t unlinked;      // 已删除但仍有句柄打开，最后一个句柄关闭时释放
+    uint16_t mode;         // 权限位
+    int32_t parent;        // 父目录节点，根目录为-1
+    int32_t first_chunk;   // 第一个数据块，-1 表示空文件
+    uint32_t open_count;   // 打开的句柄数
+    uint32_t generation;   // 数据块链表被释放时递增，使句柄中缓存的块位置失效
+    uint64_t size;         // 文件大小
+    int64_t mtime;         // 修改时间
+    char name[RAMFS_NAME_MAX + 1];
+} ram_node;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    uint32_t nchunks;     // 数据块总数
+    int32_t free_chunk;   // 空闲块链表头
+    uint64_t used_chunks; // 已使用的数据块数
+    int32_t node_limit;   // 曾经使用过的最大节点编号+1，限制查找时的扫描范围
+    ram_node nodes[RAMFS_MAX_NODES];
+} ram_arena;
+
+typedef struct
+{
+    int used;
+    int32_t node;
+    int flags;
+    uint64_t offset;
+    int32_t chunk;        // 最近访问的块
+    uint64_t chunk_start; // 该块在文件中的起始偏移
+    uint32_t generation;  // 缓存块位置时节点的 generation
+} ram_handle;
+
+static ram_arena *arena = NULL;
+static int32_t *chunk_next = NULL; // chunk_next[i] 为块 i 的下一块，-1 表示链表结束
+static char *chunk_data = NULL;
+static char root_path[PATH_MAX];
+static size_t root_len = 0;
+static ram_handle handles[RAMFS_MAX_HANDLES]; // 进程私有
+
+static void ram_lock(void)
+{
+    if (pthread_mutex_lock(&arena->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&arena->lock); // 持锁的会话进程异常退出
+}
+
+static void ram_unlock(void)
+{
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/**
+ * 创建内存文件系统，必须在 fork() 之前调用
+ * @param root 服务器根目录，作为内存文件系统的根
+ * @param capacity 数据容量（字节），按块向下取整
+ * @return 0 成功，-1 失败
+ */
+int ram_storage_init(const char *root, uint64_t capacity)
+{
+    uint32_t nchunks = (uint32_t)(capacity / RAMFS_CHUNK_SIZE);
+    if (nchunks == 0 || nchunks > INT32_MAX)
+        return -1;
+    size_t meta = sizeof(ram_arena) + (size_t)nchunks * sizeof(int32_t);
+    meta = (meta + 4095) & ~(size_t)4095;
+    size_t total = meta + (size_t)nchunks * RAMFS_CHUNK_SIZE;
+    // MAP_NORESERVE：页面在第一次写入时才真正分配
+    void *mem = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("mmap ram storage failed");
+        return -1;
+    }
+    arena = mem;
+    chunk_next = (int32_t *)((char *)mem + sizeof(ram_arena));
+    chunk_data = (char *)mem + meta;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&arena->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    arena->nchunks = nchunks;
+    for (uint32_t i = 0; i < nchunks; i++)
+        chunk_next[i] = i + 1 < nchunks ? (int32_t)(i + 1) : -1;
+    arena->free_chunk = 0;
+
+    // 节点 0 为根目录
+    ram_node *rootn = &arena->nodes[0];
+    rootn->used = 1;
+    rootn->is_dir = 1;
+    rootn->mode = 0755;
+    rootn->parent = -1;
+    rootn->first_chunk = -1;
+    rootn->mtime = time(NULL);
+    arena->node_limit = 1;
+
+    snprintf(root_path, sizeof(root_path), "%s", root);
+    root_len = strlen(root_path);
+    while (root_len > 1 && root_path[root_len - 1] == '/')
+        root_path[--root_len] = '\0';
+    return 0;
+}
+
+/**
+ * 内存文件系统的使用量
+ */
+void ram_storage_usage(uint64_t *used, uint64_t *capacity)
+{
+    *used = arena != NULL ? arena->used_chunks * RAMFS_CHUNK_SIZE : 0;
+    *capacity = arena != NULL ? (uint64_t)arena->nchunks * RAMFS_CHUNK_SIZE : 0;
+}
+
+/* ---------- 节点与数据块（调用者持有锁） ---------- */
+
+static int32_t node_child(int32_t dir, const char *name, size_t len)
+{
+    for (int32_t i = 1; i < arena->node_limit; i++)
+    {
+        ram_node *n = &arena->nodes[i];
+        if (n->used && n->parent == dir && !n->unlinked && strncmp(n->name, name, len) == 0 && n->name[len] == '\0')
+            return i;
+    }
+    return -1;
+}
+
+static int32_t node_alloc(int32_t parent, const char *name, int is_dir, mode_t mode)
+{
+    for (int32_t i = 1; i < RAMFS_MAX_NODES; i++)
+    {
+        ram_node *n = &arena->nodes[i];
+        if (n->used)
+            continue;
+        memset(n, 0, sizeof(*n));
+        n->used = 1;
+        n->is_dir = (uint8_t)is_dir;
+        n->mode = (uint16_t)(mode & 07777);
+        n->parent = parent;
+        n->first_chunk = -1;
+        n->mtime = time(NULL);
+        snprintf(n->name, sizeof(n->name), "%s", name);
+        if (i >= arena->node_limit)
+            arena->node_limit = i + 1;
+        arena->nodes[parent].mtime = n->mtime;
+        return i;
+    }
+    errno = ENOSPC;
+    return -1;
+}
+
+static void chunks_free(ram_node *n)
+{
+    int32_t c = n->first_chunk;
+    while (c >= 0)
+    {
+        int32_t next = chunk_next[c];
+        chunk_next[c] = arena->free_chunk;
+        arena->free_chunk = c;
+        arena->used_chunks--;
+        c = next;
+    }
+    n->first_chunk = -1;
+    n->size = 0;
+    n->generation++;
+}
+
+static void node_free(int32_t idx)
+{
+    ram_node *n = &arena->nodes[idx];
+    chunks_free(n);
+    n->used = 0;
+}
+
+/**
+ * 删除节点；仍有句柄打开时只从目录中摘除，最后一个句柄关闭时再释放
+ */
+static void node_remove(int32_t idx)
+{
+    ram_node *n = &arena->nodes[idx];
+    if (n->parent >= 0)
+        arena->nodes[n->parent].mtime = time(NULL);
+    if (n->open_count > 0)
+    {
+        n->unlinked = 1;
+        n->parent = -1;
+    }
+    else
+    {
+        node_free(idx);
+    }
+}
+
+static int dir_is_empty(int32_t dir)
+{
+    for (int32_t i = 1; i < arena->node_limit; i++)
+        if (arena->nodes[i].used && arena->nodes[i].parent == dir && !arena->nodes[i].unlinked)
+            return 0;
+    return 1;
+}
+
+/**
+ * 按路径查找节点
+ * @param path 绝对路径，必须以根目录开头
+ * @param parent_only 为1时返回最后一个组件的父目录，并把最后一个组件复制到 base
+ * @param base 输出最后一个组件（parent_only 时使用）
+ * @return 节点编号，失败返回-1并设置 errno
+ */
+static int32_t walk(const char *path, int parent_only, char *base)
+{
+    if (strncmp(path, root_path, root_len) != 0 || (path[root_len] != '\0' && path[root_len] != '/'))
+    {
+        errno = EACCES;
+        return -1;
+    }
+    const char *p = path + root_len;
+    int32_t cur = 0;
+    while (1)
+    {
+        while (*p == '/')
+            p++;
+        if (*p == '\0')
+        {
+            if (parent_only)
+            {
+                errno = EEXIST; // 路径就是根目录
+                return -1;
+            }
+            return cur;
+        }
+        const char *end = strchr(p, '/');
+        size_t len = end != NULL ? (size_t)(end - p) : strlen(p);
+        if (len > RAMFS_NAME_MAX)
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        const char *rest = p + len;
+        while (*rest == '/')
+            rest++;
+        if (!arena->nodes[cur].is_dir)
+        {
+            errno = ENOTDIR;
+            return -1;
+        }
+        if (parent_only && *rest == '\0')
+        {
+            memcpy(base, p, len);
+            base[len] = '\0';
+            return cur;
+        }
+        int32_t next = node_child(cur, p, len);
+        if (next < 0)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+        cur = next;
+        p = rest;
+    }
+}
+
+static void fill_stat(int32_t idx, struct stat *st)
+{
+    ram_node *n = &arena->nodes[idx];
+    memset(st, 0, sizeof(*st));
+    st->st_ino = (ino_t)idx + 1;
+    st->st_mode = (n->is_dir ? S_IFDIR : S_IFREG) | n->mode;
+    st->st_nlink = 1;
+    st->st_size = (off_t)n->size;
+    st->st_blksize = RAMFS_CHUNK_SIZE;
+    st->st_blocks = (blkcnt_t)((n->size + 511) / 512);
+    st->st_mtime = st->st_atime = st->st_ctime = (time_t)n->mtime;
+}
+
+/**
+ * 取得包含文件偏移 offset 的数据块，需要时沿链表追加新块（新块内容为零）
+ * @return 块编号，超出文件末尾且不允许分配时返回-1，空间不足时返回-1并设置 ENOSPC
+ */
+static int32_t chunk_at(ram_handle *h, ram_node *n, uint64_t offset, int allocate)
+{
+    if (h->generation != n->generation || h->chunk < 0 || offset < h->chunk_start)
+    {
+        h->chunk = n->first_chunk;
+        h->chunk_start = 0;
+        h->generation = n->generation;
+        if (h->chunk < 0)
+        {
+            if (!allocate)
+                return -1;
+            if (arena->free_chunk < 0)
+            {
+                errno = ENOSPC;
+                return -1;
+            }
+            int32_t c = arena->free_chunk;
+            arena->free_chunk = chunk_next[c];
+            chunk_next[c] = -1;
+            arena->used_chunks++;
+            memset(chunk_data + (size_t)c * RAMFS_CHUNK_SIZE, 0, RAMFS_CHUNK_SIZE);
+            n->first_chunk = h->chunk = c;
+        }
+    }
+    while (offset >= h->chunk_start + RAMFS_CHUNK_SIZE)
+    {
+        int32_t next = chunk_next[h->chunk];
+        if (next < 0)
+        {
+            if (!allocate)
+                return -1;
+            if (arena->free_chunk < 0)
+            {
+                errno = ENOSPC;
+                return -1;
+            }
+            next = arena->free_chunk;
+            arena->free_chunk = chunk_next[next];
+            chunk_next[next] = -1;
+            arena->used_chunks++;
+            memset(chunk_data + (size_t)next * RAMFS_CHUNK_SIZE, 0, RAMFS_CHUNK_SIZE);
+            chunk_next[h->chunk] = next;
+        }
+        h->chunk = next;
+        h->chunk_start += RAMFS_CHUNK_SIZE;
+    }
+    return h->chunk;
+}
+
+static ram_handle *handle_get(int fd)
+{
+    int i = fd - RAMFS_FD_BASE;
+    if (i < 0 || i >= RAMFS_MAX_HANDLES || !handles[i].used)
+    {
+        errno = EBADF;
+        return NULL;
+    }
+    return &handles[i];
+}
+
+/* ---------- 后端接口 ---------- */
+
+static int ram_open(const char *path, int flags, mode_t mode)
+{
+    int slot = -1;
+    for (int i = 0; i < RAMFS_MAX_HANDLES; i++)
+        if (!handles[i].used)
+        {
+            slot = i;
+            break;
+        }
+    if (slot < 0)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+
+    ram_lock();
+    int32_t idx = walk(path, 0, NULL);
+    if (idx < 0 && errno == ENOENT && (flags & O_CREAT))
+    {
+        char base[RAMFS_NAME_MAX + 1];
+        int32_t parent = walk(path, 1, base);
+        if (parent >= 0 && !arena->nodes[parent].is_dir)
+        {
+            errno = ENOTDIR;
+            parent = -1;
+        }
+        idx = parent >= 0 ? node_alloc(parent, base, 0, mode) : -1;
+    }
+    else if (idx >= 0 && (flags & O_CREAT) && (flags & O_EXCL))
+    {
+        errno = EEXIST;
+        idx = -1;
+    }
+    if (idx >= 0 && arena->nodes[idx].is_dir)
+    {
+        errno = EISDIR;
+        idx = -1;
+    }
+    if (idx < 0)
+    {
+        ram_unlock();
+        return -1;
+    }
+
+    ram_node *n = &arena->nodes[idx];
+    if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY)
+    {
+        chunks_free(n);
+        n->mtime = time(NULL);
+    }
+    n->open_count++;
+    ram_handle *h = &handles[slot];
+    h->used = 1;
+    h->node = idx;
+    h->flags = flags;
+    h->offset = (flags & O_APPEND) ? n->size : 0;
+    h->chunk = -1;
+    h->chunk_start = 0;
+    h->generation = n->generation;
+    ram_unlock();
+    return RAMFS_FD_BASE + slot;
+}
+
+static ssize_t ram_read(int fd, void *buffer, size_t len)
+{
+    ram_handle *h = handle_get(fd);
+    if (h == NULL)
+        return -1;
+    ram_lock();
+    ram_node *n = &arena->nodes[h->node];
+    size_t done = 0;
+    while (done < len && h->offset < n->size)
+    {
+        int32_t c = chunk_at(h, n, h->offset, 0);
+        if (c < 0)
+            break;
+        uint64_t in_chunk = h->offset - h->chunk_start;
+        uint64_t avail = RAMFS_CHUNK_SIZE - in_chunk;
+        if (avail > n->size - h->offset)
+            avail = n->size - h->offset;
+        if (avail > len - done)
+            avail = len - done;
+        memcpy((char *)buffer + done, chunk_data + (size_t)c * RAMFS_CHUNK_SIZE + in_chunk, avail);
+        done += avail;
+        h->offset += avail;
+    }
+    ram_unlock();
+    return (ssize_t)done;
+}
+
+static ssize_t ram_write(int fd, const void *buffer, size_t len)
+{
+    ram_handle *h = handle_get(fd);
+    if (h == NULL)
+        return -1;
+    if ((h->flags & O_ACCMODE) == O_RDONLY)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    ram_lock();
+    ram_node *n = &arena->nodes[h->node];
+    size_t done = 0;
+    while (done < len)
+    {
+        int32_t c = chunk_at(h, n, h->offset, 1);
+        if (c < 0)
+            break; // 空间不足
+        uint64_t in_chunk = h->offset - h->chunk_start;
+        uint64_t avail = RAMFS_CHUNK_SIZE - in_chunk;
+        if (avail > len - done)
+            avail = len - done;
+        memcpy(chunk_data + (size_t)c * RAMFS_CHUNK_SIZE + in_chunk, (const char *)buffer + done, avail);
+        done += avail;
+        h->offset += avail;
+    }
+    if (h->offset > n->size)
+        n->size = h->offset;
+    n->mtime = time(NULL);
+    ram_unlock();
+    if (done == 0 && len > 0)
+        return -1; // errno 为 ENOSPC
+    return (ssize_t)done;
+}
+
+static off_t ram_lseek(int fd, off_t offset, int whence)
+{
+    ram_handle *h = handle_get(fd);
+    if (h == NULL)
+        return -1;
+    int64_t base = 0;
+    if (whence == SEEK_CUR)
+        base = (int64_t)h->offset;
+    else if (whence == SEEK_END)
+    {
+        ram_lock();
+        base = (int64_t)arena->nodes[h->node].size;
+        ram_unlock();
+    }
+    else if (whence != SEEK_SET)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (base + offset < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    h->offset = (uint64_t)(base + offset);
+    return (off_t)h->offset;
+}
+
+static int ram_fstat(int fd, struct stat *st)
+{
+    ram_handle *h = handle_get(fd);
+    if (h == NULL)
+        return -1;
+    ram_lock();
+    fill_stat(h->node, st);
+    ram_unlock();
+    return 0;
+}
+
+static int ram_close(int fd)
+{
+    ram_handle *h = handle_get(fd);
+    if (h == NULL)
+        return -1;
+    ram_lock();
+    ram_node *n = &arena->nodes[h->node];
+    if (n->open_count > 0)
+        n->open_count--;
+    if (n->unlinked && n->open_count == 0)
+        node_free(h->node);
+    ram_unlock();
+    h->used = 0;
+    return 0;
+}
+
+static int ram_stat(const char *path, struct stat *st)
+{
+    ram_lock();
+    int32_t idx = walk(path, 0, NULL);
+    if (idx >= 0)
+        fill_stat(idx, st);
+    ram_unlock();
+    return idx >= 0 ? 0 : -1;
+}
+
+typedef struct
+{
+    char name[RAMFS_NAME_MAX + 1];
+    struct stat st;
+} ram_entry;
+
+/**
+ * 列出目录：持锁复制目录项后再回调，回调中的网络发送不会阻塞其它会话
+ */
+static int ram_list(const char *path, storage_list_cb cb, void *ctx)
+{
+    ram_lock();
+    int32_t dir = walk(path, 0, NULL);
+    if (dir >= 0 && !arena->nodes[dir].is_dir)
+    {
+        errno = ENOTDIR;
+        dir = -1;
+    }
+    if (dir < 0)
+    {
+        ram_unlock();
+        return -1;
+    }
+    size_t count = 0, cap = 0;
+    ram_entry *entries = NULL;
+    for (int32_t i = 1; i < arena->node_limit; i++)
+    {
+        ram_node *n = &arena->nodes[i];
+        if (!n->used || n->parent != dir || n->unlinked)
+            continue;
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 32;
+            ram_entry *grown = realloc(entries, cap * sizeof(ram_entry));
+            if (grown == NULL)
+            {
+                ram_unlock();
+                free(entries);
+                errno = ENOMEM;
+                return -1;
+            }
+            entries = grown;
+        }
+        snprintf(entries[count].name, sizeof(entries[count].name), "%s", n->name);
+        fill_stat(i, &entries[count].st);
+        count++;
+    }
+    ram_unlock();
+
+    int rc = 0;
+    for (size_t i = 0; i < count && rc == 0; i++)
+        rc = cb(ctx, entries[i].name, &entries[i].st);
+    free(entries);
+    return rc;
+}
+
+static int ram_mkdir(const char *path, mode_t mode)
+{
+    char base[RAMFS_NAME_MAX + 1];
+    ram_lock();
+    int32_t parent = walk(path, 1, base);
+    int rc = -1;
+    if (parent >= 0)
+    {
+        if (!arena->nodes[parent].is_dir)
+            errno = ENOTDIR;
+        else if (node_child(parent, base, strlen(base)) >= 0)
+            errno = EEXIST;
+        else
+            rc = node_alloc(parent, base, 1, mode) >= 0 ? 0 : -1;
+    }
+    ram_unlock();
+    return rc;
+}
+
+static int ram_rmdir(const char *path)
+{
+    ram_lock();
+    int32_t idx = walk(path, 0, NULL);
+    int rc = -1;
+    if (idx == 0)
+        errno = EBUSY;
+    else if (idx > 0 && !arena->nodes[idx].is_dir)
+        errno = ENOTDIR;
+    else if (idx > 0 && !dir_is_empty(idx))
+        errno = ENOTEMPTY;
+    else if (idx > 0)
+    {
+        node_remove(idx);
+        rc = 0;
+    }
+    ram_unlock();
+    return rc;
+}
+
+static int ram_unlink(const char *path)
+{
+    ram_lock();
+    int32_t idx = walk(path, 0, NULL);
+    int rc = -1;
+    if (idx >= 0 && arena->nodes[idx].is_dir)
+        errno = EISDIR;
+    else if (idx >= 0)
+    {
+        node_remove(idx);
+        rc = 0;
+    }
+    ram_unlock();
+    return rc;
+}
+
+static int ram_rename(const char *from, const char *to)
+{
+    char base[RAMFS_NAME_MAX + 1];
+    ram_lock();
+    int rc = -1;
+    int32_t src = walk(from, 0, NULL);
+    int32_t parent = src >= 0 ? walk(to, 1, base) : -1;
+    if (src == 0)
+    {
+        errno = EBUSY;
+        goto out;
+    }
+    if (src < 0 || parent < 0)
+        goto out;
+    if (!arena->nodes[parent].is_dir)
+    {
+        errno = ENOTDIR;
+        goto out;
+    }
+    // 目录不能移动到自己的子树中
+    for (int32_t p = parent; p >= 0; p = arena->nodes[p].parent)
+        if (p == src)
+        {
+            errno = EINVAL;
+            goto out;
+        }
+
+    int32_t dst = node_child(parent, base, strlen(base));
+    if (dst == src)
+    {
+        rc = 0;
+        goto out;
+    }
+    if (dst >= 0)
+    {
+        // 与 rename(2) 一致：文件替换文件，目录只能替换空目录
+        ram_node *d = &arena->nodes[dst];
+        if (arena->nodes[src].is_dir && !d->is_dir)
+        {
+            errno = ENOTDIR;
+            goto out;
+        }
+        if (!arena->nodes[src].is_dir && d->is_dir)
+        {
+            errno = EISDIR;
+            goto out;
+        }
+        if (d->is_dir && !dir_is_empty(dst))
+        {
+            errno = ENOTEMPTY;
+            goto out;
+        }
+        node_remove(dst);
+    }
+    ram_node *s = &arena->nodes[src];
+    arena->nodes[s->parent].mtime = time(NULL);
+    s->parent = parent;
+    snprintf(s->name, sizeof(s->name), "%s", base);
+    arena->nodes[parent].mtime = time(NULL);
+    rc = 0;
+out:
+    ram_unlock();
+    return rc;
+}
+
+const storage_backend storage_ram = {
+    .name = "ram",
+    .native_fds = 0,
+    .open = ram_open,
+    .read = ram_read,
+    .write = ram_write,
+    .lseek = ram_lseek,
+    .fstat = ram_fstat,
+    .close = ram_close,
+    .stat = ram_stat,
+    .list = ram_list,
+    .mkdir = ram_mkdir,
+    .rmdir = ram_rmdir,
+    .unlink = ram_unlink,
+    .rename = ram_rename,
+};
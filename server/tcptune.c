@@ -0,0 +1,228 @@
+#include "tcptune.h"
+#include "utils.h"
+#include <linux/tcp.h>
+
+static char cc_name[TCPTUNE_CC_MAX] = ""; // -tcp-cc，空字符串表示使用系统默认
+static int tfo_qlen = TCPTUNE_DEFAULT_FASTOPEN;
+static uint64_t max_buf = (uint64_t)TCPTUNE_DEFAULT_MAX_BUF_MB << 20;
+
+// 以下在 tcptune_init 中从 sysctl 读取
+static uint64_t wmem_max = 0;      // net.core.wmem_max：普通进程 SO_SNDBUF 的上限
+static uint64_t rmem_max = 0;      // net.core.rmem_max
+static uint64_t wmem_auto = 0;     // net.ipv4.tcp_wmem 第三项：自动调整的上限
+static uint64_t rmem_auto = 0;     // net.ipv4.tcp_rmem 第三项
+
+/**
+ * 读取 /proc/sys 下的整数，文件中有多个数时取第 index 个（从 0 开始）
+ * @return 读到的值，失败时返回 0
+ */
+static uint64_t read_sysctl(const char *path, int index)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    unsigned long long value = 0;
+    for (int i = 0; i <= index; i++)
+    {
+        if (fscanf(fp, "%llu", &value) != 1)
+        {
+            value = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+/**
+ * 配置数据连接调优，必须在 fork() 之前调用
+ * @param cc 拥塞控制算法名，NULL 表示不设置
+ * @param fastopen_qlen 监听socket的 TFO 队列长度，0 表示关闭
+ * @param max_buf_mb 缓冲区上限（MB），0 表示不调整缓冲区
+ * @return 0 成功，-1 算法不可用
+ */
+int tcptune_init(const char *cc, int fastopen_qlen, int max_buf_mb)
+{
+    tfo_qlen = fastopen_qlen > 0 ? fastopen_qlen : 0;
+    max_buf = max_buf_mb > 0 ? (uint64_t)max_buf_mb << 20 : 0;
+    wmem_max = read_sysctl("/proc/sys/net/core/wmem_max", 0);
+    rmem_max = read_sysctl("/proc/sys/net/core/rmem_max", 0);
+    wmem_auto = read_sysctl("/proc/sys/net/ipv4/tcp_wmem", 2);
+    rmem_auto = read_sysctl("/proc/sys/net/ipv4/tcp_rmem", 2);
+
+    if (cc == NULL)
+        return 0;
+    // 在临时socket上试设一次：算法未加载或不在 tcp_allowed_congestion_control 中时启动即报错
+    int probe = socket(AF_INET, SOCK_STREAM, 0);
+    if (probe < 0)
+        return -1;
+    int rc = setsockopt(probe, IPPROTO_TCP, TCP_CONGESTION, cc, strlen(cc));
+    close(probe);
+    if (rc != 0)
+    {
+        fprintf(stderr, "congestion control %s is not available: %s\n", cc, strerror(errno));
+        return -1;
+    }
+    snprintf(cc_name, sizeof(cc_name), "%s", cc);
+    return 0;
+}
+
+/**
+ * 监听socket开启 TCP Fast Open（控制连接与 PASV 共用）
+ */
+void tcptune_listener(int listen_socket)
+{
+    if (tfo_qlen > 0)
+        setsockopt(listen_socket, IPPROTO_TCP, TCP_FASTOPEN, &tfo_qlen, sizeof(tfo_qlen));
+}
+
+/**
+ * 新建的数据socket（PORT 的主动连接或 PASV 的监听socket）在 connect/listen 之前调用
+ */
+void tcptune_data_socket(int data_socket)
+{
+    if (cc_name[0] != '\0')
+        setsockopt(data_socket, IPPROTO_TCP, TCP_CONGESTION, cc_name, strlen(cc_name));
+}
+
+static int read_info(int data_socket, struct tcp_info *info)
+{
+    socklen_t len = sizeof(*info);
+    memset(info, 0, sizeof(*info));
+    return getsockopt(data_socket, IPPROTO_TCP, TCP_INFO, info, &len);
+}
+
+/**
+ * 方向对应的字节计数：发送方看对端已确认的字节，接收方看已收到的字节
+ */
+static uint64_t info_bytes(const tcp_tuning *t, const struct tcp_info *info)
+{
+    return t->sender ? info->tcpi_bytes_acked : info->tcpi_bytes_received;
+}
+
+/**
+ * 方向对应的 RTT：接收方几乎不发数据，tcpi_rtt 只有握手时的样本，优先用接收端估计
+ */
+static uint32_t info_rtt(const tcp_tuning *t, const struct tcp_info *info)
+{
+    if (!t->sender && info->tcpi_rcv_rtt != 0)
+        return info->tcpi_rcv_rtt;
+    return info->tcpi_rtt;
+}
+
+/**
+ * 当前能用于在途数据的缓冲区大小：显式设置过时就是设置值，
+ * 否则按自动调整的上限估算（内核记账包含报文开销，约一半可用于数据）
+ */
+static uint64_t usable_buf(const tcp_tuning *t)
+{
+    if (t->buf != 0)
+        return t->buf;
+    return (t->sender ? wmem_auto : rmem_auto) / 2;
+}
+
+/**
+ * 把缓冲区设为 want（不超过 -tcp-max-buf），只有确实大于当前可用大小时才设置。
+ * 有 CAP_NET_ADMIN 时用 *BUFFORCE 越过 wmem_max/rmem_max，否则会被内核截断到该上限
+ * @return 1 已扩大，0 已到上限无法再扩大
+ */
+static int grow_buf(tcp_tuning *t, int data_socket, uint64_t want)
+{
+    uint64_t current = usable_buf(t);
+    if (want > max_buf)
+        want = max_buf;
+    if (want > INT32_MAX / 2)
+        want = INT32_MAX / 2;
+    if (want <= current)
+        return 0;
+    int value = (int)want;
+    int force = t->sender ? SO_SNDBUFFORCE : SO_RCVBUFFORCE;
+    if (setsockopt(data_socket, SOL_SOCKET, force, &value, sizeof(value)) != 0)
+    {
+        uint64_t limit = t->sender ? wmem_max : rmem_max;
+        if (limit < want)
+            want = limit;
+        if (want <= current)
+            return 0; // 截断后反而比自动调整小，保留自动调整
+        value = (int)want;
+        if (setsockopt(data_socket, SOL_SOCKET, t->sender ? SO_SNDBUF : SO_RCVBUF, &value, sizeof(value)) != 0)
+            return 0;
+    }
+    t->buf = (uint32_t)want;
+    return 1;
+}
+
+/**
+ * 数据连接建立后、开始传输前调用
+ * @param t 会话的调优状态，保存上一次传输测得的速率
+ * @param data_socket 数据连接
+ * @param fresh 是否为新建立的连接（MODE B 复用的连接保留已设置的缓冲区）
+ * @param sender 服务器是否为本次传输的发送方
+ */
+void tcptune_start(tcp_tuning *t, int data_socket, int fresh, int sender)
+{
+    if (fresh)
+        t->buf = 0;
+    t->valid = 0;
+    t->sender = sender;
+    t->start_us = monotonic_us();
+    t->next_check = TCPTUNE_ADAPT_INTERVAL;
+    struct tcp_info info;
+    if (read_info(data_socket, &info) != 0)
+    {
+        t->next_check = UINT64_MAX; // 不是 TCP 连接，不做调整
+        return;
+    }
+    t->base_bytes = info_bytes(t, &info);
+    // 已知这个客户端的吞吐时，按 BDP 的两倍预先放大缓冲区，免得每次传输都从头摸索
+    uint32_t rtt = info_rtt(t, &info);
+    if (max_buf != 0 && t->rate != 0 && rtt != 0)
+        grow_buf(t, data_socket, 2 * t->rate * rtt / 1000000);
+}
+
+/**
+ * 传输循环中调用，每 TCPTUNE_ADAPT_INTERVAL 字节检查一次：
+ * 实际吞吐乘以 RTT 已达到可用缓冲区的 3/4，说明在途数据受缓冲区限制，把缓冲区翻倍
+ * @param bytes 本次传输到目前为止的字节数
+ */
+void tcptune_adapt(tcp_tuning *t, int data_socket, uint64_t bytes)
+{
+    if (bytes < t->next_check || max_buf == 0)
+        return;
+    t->next_check = bytes + TCPTUNE_ADAPT_INTERVAL;
+    struct tcp_info info;
+    if (read_info(data_socket, &info) != 0)
+        return;
+    uint32_t rtt = info_rtt(t, &info);
+    uint64_t elapsed = monotonic_us() - t->start_us;
+    if (rtt == 0 || elapsed < 4 * (uint64_t)rtt)
+        return; // 前几个 RTT 处于慢启动，吞吐还不能说明问题
+    uint64_t rate = (info_bytes(t, &info) - t->base_bytes) * 1000000 / elapsed;
+    uint64_t inflight = rate * rtt / 1000000;
+    uint64_t current = usable_buf(t);
+    if (inflight * 4 >= current * 3 && !grow_buf(t, data_socket, current * 2))
+        t->next_check = UINT64_MAX; // 已到上限，本次传输不再检查
+}
+
+/**
+ * 关闭或保留数据连接之前调用，采样本次传输的结果供传输日志使用
+ */
+void tcptune_finish(tcp_tuning *t, int data_socket)
+{
+    struct tcp_info info;
+    if (read_info(data_socket, &info) != 0)
+        return;
+    uint64_t elapsed = monotonic_us() - t->start_us;
+    uint64_t done = info_bytes(t, &info) - t->base_bytes;
+    t->rtt_us = info_rtt(t, &info);
+    t->retrans = info.tcpi_total_retrans;
+    t->delivery_rate = info.tcpi_delivery_rate;
+    // 太短的传输测不出链路能力，不覆盖之前的速率
+    if (done >= TCPTUNE_ADAPT_INTERVAL && elapsed > 0)
+        t->rate = done * 1000000 / elapsed;
+    socklen_t len = sizeof(t->cc);
+    if (getsockopt(data_socket, IPPROTO_TCP, TCP_CONGESTION, t->cc, &len) != 0)
+        t->cc[0] = '\0';
+    t->cc[sizeof(t->cc) - 1] = '\0';
+    t->valid = 1;
+}
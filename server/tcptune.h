@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#define TCPTUNE_DEFAULT_FASTOPEN 64      // 监听socket的 TFO 队列长度，0 表示关闭
+#define TCPTUNE_DEFAULT_MAX_BUF_MB 64    // 数据连接缓冲区上限（MB），0 表示不调整缓冲区
+#define TCPTUNE_ADAPT_INTERVAL (1 << 20) // 传输中每隔这么多字节检查一次是否需要扩大缓冲区
+#define TCPTUNE_CC_MAX 16                // 拥塞控制算法名长度上限（同内核 TCP_CA_NAME_MAX）
+
+/*
+ * 数据连接的 TCP 调优：
+ *  - 缓冲区：内核自动调整最多只能涨到 tcp_wmem/tcp_rmem 的上限，高 BDP 链路上会先于带宽成为瓶颈。
+ *    连接建立时按上一次传输测得的速率与 RTT 估算 BDP；传输过程中每 TCPTUNE_ADAPT_INTERVAL 字节
+ *    读一次 TCP_INFO，实际吞吐已接近“缓冲区/RTT”时说明受缓冲区限制，把缓冲区翻倍（不超过 -tcp-max-buf）。
+ *    只在需要超过自动调整上限时才显式设置，其余情况保留内核的自动调整
+ *  - 拥塞控制：-tcp-cc 指定时（如 bbr）设置到每个数据连接，PASV 监听socket上设置后由接受的连接继承
+ *  - TCP Fast Open：控制连接与 PASV 的监听socket开启，客户端可在 SYN 中携带第一条命令
+ * 每次传输结束时采样 RTT、速率、重传数，随传输日志（jsonl 格式）输出
+ */
+
+typedef struct
+{
+    int valid;                 // 已从本次传输的数据连接采样，可写入传输日志
+    int sender;                // 服务器是否为发送方（决定调整发送还是接收缓冲区）
+    char cc[TCPTUNE_CC_MAX];   // 数据连接使用的拥塞控制算法
+    uint32_t rtt_us;           // 平滑 RTT（微秒）
+    uint32_t buf;              // 显式设置的缓冲区大小（字节），0 表示内核自动调整
+    uint32_t retrans;          // 本连接累计重传的报文段数
+    uint64_t delivery_rate;    // 内核估计的交付速率（字节/秒）
+    uint64_t rate;             // 最近一次传输的实际吞吐（字节/秒），下一次连接据此估算 BDP
+    uint64_t start_us;         // 本次传输开始的单调时钟时间
+    uint64_t base_bytes;       // 本次传输开始时连接上已确认/已接收的字节数（MODE B 连接跨多次传输）
+    uint64_t next_check;       // 下一次检查缓冲区时的已传输字节数
+} tcp_tuning;
+
+int tcptune_init(const char *cc, int fastopen_qlen, int max_buf_mb);
+void tcptune_listener(int listen_socket);
+void tcptune_data_socket(int data_socket);
+void tcptune_start(tcp_tuning *t, int data_socket, int fresh, int sender);
+void tcptune_adapt(tcp_tuning *t, int data_socket, uint64_t bytes);
+void tcptune_finish(tcp_tuning *t, int data_socket);
@@ -0,0 +1,281 @@
+#include "tls.h"
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#ifdef WITH_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+typedef struct
+{
+    int socket;
+    SSL *ssl;
+} tls_binding;
+
+static SSL_CTX *tls_ctx = NULL;
+static tls_binding bindings[TLS_MAX_SOCKETS];
+static int bindings_used = 0;
+
+static SSL *tls_lookup(int socket)
+{
+    for (int i = 0; i < bindings_used; i++)
+    {
+        if (bindings[i].socket == socket)
+            return bindings[i].ssl;
+    }
+    return NULL;
+}
+
+/**
+ * 初始化 TLS 上下文，由父进程在 fork() 之前调用
+ * @param cert_file PEM 格式的证书（链）
+ * @param key_file PEM 格式的私钥
+ * @param use_ktls 是否在握手后尝试启用内核 TLS
+ * @return 0 成功，-1 失败
+ */
+int tls_init(const char *cert_file, const char *key_file, int use_ktls)
+{
+    tls_ctx = SSL_CTX_new(TLS_server_method());
+    if (tls_ctx == NULL)
+    {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+    if (SSL_CTX_use_certificate_chain_file(tls_ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(tls_ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(tls_ctx) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(tls_ctx);
+        tls_ctx = NULL;
+        return -1;
+    }
+    // 数据连接需要复用控制连接的会话（很多客户端强制要求）
+    SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(tls_ctx, (const unsigned char *)"ftpserver", 9);
+    // 客户端不发送 close_notify 直接断开很常见，按正常关闭处理
+    SSL_CTX_set_options(tls_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+    if (use_ktls)
+        SSL_CTX_set_options(tls_ctx, SSL_OP_ENABLE_KTLS);
+    return 0;
+}
+
+/**
+ * 服务器是否配置了证书，可以响应 AUTH TLS
+ */
+int tls_available(void)
+{
+    return tls_ctx != NULL;
+}
+
+/**
+ * 在已连接的 socket 上执行服务器端 TLS 握手，成功后该 socket 的读写自动加密
+ * @return 0 成功，-1 失败
+ */
+int tls_accept(int socket)
+{
+    if (tls_ctx == NULL || bindings_used >= TLS_MAX_SOCKETS)
+        return -1;
+    SSL *ssl = SSL_new(tls_ctx);
+    if (ssl == NULL)
+        return -1;
+    SSL_set_fd(ssl, socket);
+    if (SSL_accept(ssl) != 1)
+    {
+        ERR_clear_error();
+        SSL_free(ssl);
+        return -1;
+    }
+    bindings[bindings_used].socket = socket;
+    bindings[bindings_used].ssl = ssl;
+    bindings_used++;
+    return 0;
+}
+
+/**
+ * 结束 socket 上的 TLS 会话（发送 close_notify），socket 本身由调用者关闭
+ */
+void tls_close(int socket)
+{
+    for (int i = 0; i < bindings_used; i++)
+    {
+        if (bindings[i].socket != socket)
+            continue;
+        SSL_shutdown(bindings[i].ssl);
+        SSL_free(bindings[i].ssl);
+        bindings[i] = bindings[--bindings_used];
+        return;
+    }
+}
+
+/**
+ * socket 是否处于 TLS 保护下
+ */
+int tls_active(int socket)
+{
+    return tls_lookup(socket) != NULL;
+}
+
+/**
+ * 发送方向是否已交给内核 TLS；是则可以直接对该 socket 使用 send/sendfile
+ */
+int tls_ktls_send(int socket)
+{
+    SSL *ssl = tls_lookup(socket);
+    return ssl != NULL && BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+/**
+ * 接收方向是否已交给内核 TLS
+ */
+int tls_ktls_recv(int socket)
+{
+    SSL *ssl = tls_lookup(socket);
+    return ssl != NULL && BIO_get_ktls_recv(SSL_get_rbio(ssl));
+}
+
+/**
+ * 向 socket 发送数据，TLS 连接上经过加密
+ * @return 发送的字节数，失败返回-1
+ */
+ssize_t net_send(int socket, const void *buffer, size_t len, int flags)
+{
+    SSL *ssl = tls_lookup(socket);
+    if (ssl == NULL || BIO_get_ktls_send(SSL_get_wbio(ssl)))
+        return send(socket, buffer, len, flags | MSG_NOSIGNAL);
+    size_t written = 0;
+    if (SSL_write_ex(ssl, buffer, len, &written) != 1)
+    {
+        ERR_clear_error();
+        errno = EIO;
+        return -1;
+    }
+    return (ssize_t)written;
+}
+
+/**
+ * 从 socket 接收数据，TLS 连接上经过解密
+ * @return 接收的字节数，0 表示对端关闭，失败返回-1
+ */
+ssize_t net_recv(int socket, void *buffer, size_t len)
+{
+    SSL *ssl = tls_lookup(socket);
+    if (ssl == NULL)
+        return recv(socket, buffer, len, 0);
+    size_t got = 0;
+    if (SSL_read_ex(ssl, buffer, len, &got) == 1)
+        return (ssize_t)got;
+    int err = SSL_get_error(ssl, 0);
+    ERR_clear_error();
+    if (err == SSL_ERROR_ZERO_RETURN)
+        return 0; // 对端发送了 close_notify
+    errno = EIO;
+    return -1;
+}
+
+/**
+ * 不阻塞地从 socket 接收数据；TLS 连接上只收到记录的一部分时同样不阻塞
+ * 调用期间临时将 socket 设为非阻塞，调用者必须是此刻唯一使用该 socket 的线程
+ * @return 接收的字节数，0 表示对端关闭，失败返回-1（暂无完整数据时 errno 为 EAGAIN）
+ */
+ssize_t net_recv_nowait(int socket, void *buffer, size_t len)
+{
+    SSL *ssl = tls_lookup(socket);
+    if (ssl == NULL)
+        return recv(socket, buffer, len, MSG_DONTWAIT);
+    int flags = fcntl(socket, F_GETFL);
+    if (flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) != 0)
+        return -1;
+    size_t got = 0;
+    int ok = SSL_read_ex(ssl, buffer, len, &got);
+    int err = ok == 1 ? SSL_ERROR_NONE : SSL_get_error(ssl, 0);
+    fcntl(socket, F_SETFL, flags);
+    if (ok == 1)
+        return (ssize_t)got;
+    ERR_clear_error();
+    if (err == SSL_ERROR_ZERO_RETURN)
+        return 0;
+    errno = err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? EAGAIN : EIO;
+    return -1;
+}
+
+/**
+ * TLS 库中已解密、尚未被读取的字节数；这些数据不会使 socket 可读，poll 之前必须先读完
+ * @return 字节数，非 TLS 连接为0
+ */
+size_t net_pending(int socket)
+{
+    SSL *ssl = tls_lookup(socket);
+    return ssl != NULL ? (size_t)SSL_pending(ssl) : 0;
+}
+
+#else // !WITH_TLS
+
+int tls_init(const char *cert_file, const char *key_file, int use_ktls)
+{
+    (void)cert_file;
+    (void)key_file;
+    (void)use_ktls;
+    fprintf(stderr, "TLS support was not compiled in (build with TLS=1)\n");
+    return -1;
+}
+
+int tls_available(void)
+{
+    return 0;
+}
+
+int tls_accept(int socket)
+{
+    (void)socket;
+    return -1;
+}
+
+void tls_close(int socket)
+{
+    (void)socket;
+}
+
+int tls_active(int socket)
+{
+    (void)socket;
+    return 0;
+}
+
+int tls_ktls_send(int socket)
+{
+    (void)socket;
+    return 0;
+}
+
+int tls_ktls_recv(int socket)
+{
+    (void)socket;
+    return 0;
+}
+
+ssize_t net_send(int socket, const void *buffer, size_t len, int flags)
+{
+    return send(socket, buffer, len, flags | MSG_NOSIGNAL);
+}
+
+ssize_t net_recv(int socket, void *buffer, size_t len)
+{
+    return recv(socket, buffer, len, 0);
+}
+
+ssize_t net_recv_nowait(int socket, void *buffer, size_t len)
+{
+    return recv(socket, buffer, len, MSG_DONTWAIT);
+}
+
+size_t net_pending(int socket)
+{
+    (void)socket;
+    return 0;
+}
+
+#endif
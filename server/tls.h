@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * FTPS（AUTH TLS，RFC 4217）支持。
+ * 每个会话进程内维护 socket -> SSL 的映射，send_response/read_line 与数据通道读写
+ * 通过 net_send/net_recv 自动走 TLS，现有函数签名无需改变。
+ * 握手完成后若内核支持，发送方向交给 kTLS，sendfile 仍可在加密的数据连接上零拷贝。
+ * 编译时未定义 WITH_TLS 则所有 TLS 功能不可用，net_send/net_recv 退化为 send/recv。
+ */
+
+#define TLS_MAX_SOCKETS 4 // 每个会话同时使用 TLS 的 socket 数（控制连接 + 数据连接）
+
+int tls_init(const char *cert_file, const char *key_file, int use_ktls);
+int tls_available(void);
+int tls_accept(int socket);
+void tls_close(int socket);
+int tls_active(int socket);
+int tls_ktls_send(int socket);
+int tls_ktls_recv(int socket);
+ssize_t net_send(int socket, const void *buffer, size_t len, int flags);
+ssize_t net_recv(int socket, void *buffer, size_t len);
+ssize_t net_recv_nowait(int socket, void *buffer, size_t len);
+size_t net_pending(int socket);
@@ -0,0 +1,185 @@
+#include "trace.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+typedef struct
+{
+    uint64_t start_us;         // 开始时间（Unix 时间，微秒）
+    uint64_t dur_us;           // 持续时间
+    uint64_t arg;              // 附加数值
+    char name[TRACE_NAME_MAX]; // 跨度名称
+} trace_span;
+
+int trace_enabled = 0;
+
+static char trace_dir[PATH_MAX];  // 输出目录，空表示未配置追踪
+static double trace_sample = 0.0; // 会话开始时自动开启追踪的概率
+static trace_span *spans = NULL;  // 本会话的环形缓冲区
+static uint64_t span_count = 0;   // 记录过的跨度总数（取模得到写入位置）
+static uint64_t dump_seq = 0;     // 本会话已输出的文件数
+static char last_file[PATH_MAX + 64]; // 最近一次输出的文件
+
+/**
+ * 配置追踪输出目录与采样率，在父进程 fork 之前调用
+ * @param dir 输出目录，NULL 表示禁用追踪
+ * @param sample_rate 会话自动开启追踪的概率（0~1）
+ */
+void trace_configure(const char *dir, double sample_rate)
+{
+    if (dir == NULL)
+    {
+        trace_dir[0] = '\0';
+        return;
+    }
+    // 子进程的工作目录会随 CWD 改变，这里记录绝对路径
+    if (realpath(dir, trace_dir) == NULL)
+    {
+        perror("trace directory");
+        trace_dir[0] = '\0';
+        return;
+    }
+    trace_sample = sample_rate < 0 ? 0 : sample_rate > 1 ? 1 : sample_rate;
+}
+
+/**
+ * 是否配置了追踪输出目录（SITE TRACE 需要）
+ */
+int trace_available(void)
+{
+    return trace_dir[0] != '\0';
+}
+
+/**
+ * 会话开始时按采样率决定是否自动开启追踪，在子进程中调用
+ */
+void trace_session_start(void)
+{
+    if (!trace_available() || trace_sample <= 0)
+        return;
+    unsigned int seed = (unsigned int)(getpid() ^ realtime_us());
+    if ((double)rand_r(&seed) / ((double)RAND_MAX + 1.0) < trace_sample)
+        trace_set(1);
+}
+
+/**
+ * 开启或关闭当前会话的追踪，关闭时输出已记录的时间线
+ * @param enabled 1 开启，0 关闭
+ * @return 0 成功，-1 未配置追踪或内存不足
+ */
+int trace_set(int enabled)
+{
+    if (!trace_available())
+        return -1;
+    if (enabled)
+    {
+        if (spans == NULL)
+        {
+            spans = mmap(NULL, TRACE_RING_SPANS * sizeof(trace_span), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (spans == MAP_FAILED)
+            {
+                spans = NULL;
+                return -1;
+            }
+        }
+        trace_enabled = 1;
+        return 0;
+    }
+    int rc = trace_enabled ? trace_dump() : 0;
+    trace_enabled = 0;
+    return rc;
+}
+
+/**
+ * 当前时间（Unix 时间，微秒）；跨度使用真实时间，便于把多个会话的文件合在一起看
+ */
+uint64_t trace_now_us(void)
+{
+    return realtime_us();
+}
+
+/**
+ * 记录一个已结束的跨度
+ */
+void trace_record(const char *name, uint64_t start_us, uint64_t arg)
+{
+    if (spans == NULL || !trace_enabled)
+        return; // 跨度开始后追踪被关闭（如 SITE TRACE OFF 本身）
+    trace_span *s = &spans[span_count % TRACE_RING_SPANS];
+    uint64_t now = trace_now_us();
+    s->start_us = start_us;
+    s->dur_us = now > start_us ? now - start_us : 0;
+    s->arg = arg;
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    span_count++;
+}
+
+/**
+ * 把 JSON 字符串中需要转义的字符替换掉（跨度名可能来自客户端命令）
+ */
+static void json_name(char *out, size_t outsz, const char *in)
+{
+    size_t j = 0;
+    for (size_t i = 0; in[i] != '\0' && j + 1 < outsz; i++)
+    {
+        unsigned char c = (unsigned char)in[i];
+        out[j++] = (c == '"' || c == '\\' || c < 0x20) ? '_' : (char)c;
+    }
+    out[j] = '\0';
+}
+
+/**
+ * 将环形缓冲区中的跨度输出为 Chrome trace JSON 并清空缓冲区
+ * 文件名为 <目录>/ftp-<pid>-<序号>.json
+ * @return 0 成功（没有跨度时不输出），-1 失败
+ */
+int trace_dump(void)
+{
+    if (spans == NULL || span_count == 0 || !trace_available())
+        return 0;
+
+    snprintf(last_file, sizeof(last_file), "%s/ftp-%d-%llu.json", trace_dir, (int)getpid(),
+             (unsigned long long)dump_seq++);
+    int fd = open(last_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    FILE *out = fdopen(fd, "w");
+    if (out == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    int pid = (int)getpid();
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"ftp session %d\"}}",
+            pid, pid, pid);
+    uint64_t first = span_count > TRACE_RING_SPANS ? span_count - TRACE_RING_SPANS : 0;
+    for (uint64_t i = first; i < span_count; i++)
+    {
+        const trace_span *s = &spans[i % TRACE_RING_SPANS];
+        char name[TRACE_NAME_MAX];
+        json_name(name, sizeof(name), s->name);
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"ftp\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,"
+                     "\"args\":{\"value\":%llu}}",
+                name, (unsigned long long)s->start_us, (unsigned long long)s->dur_us, pid, pid,
+                (unsigned long long)s->arg);
+    }
+    if (first > 0)
+        fprintf(out, ",\n{\"name\":\"spans dropped\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%llu,\"pid\":%d,\"tid\":%d,"
+                     "\"args\":{\"count\":%llu}}",
+                (unsigned long long)spans[first % TRACE_RING_SPANS].start_us, pid, pid, (unsigned long long)first);
+    fprintf(out, "\n]}\n");
+    span_count = 0;
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+/**
+ * 最近一次输出的文件路径
+ */
+const char *trace_last_file(void)
+{
+    return last_file;
+}
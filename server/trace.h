@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#define TRACE_RING_SPANS 4096 // 每个会话保留的最近跨度数（约 224KB，开启追踪时才分配）
+#define TRACE_NAME_MAX 32     // 跨度名称长度上限
+
+/*
+ * 会话时间线追踪：在路径检查、open、数据连接建立、磁盘读写、网络收发等阶段记录跨度，
+ * 写入会话自己的环形缓冲区（满时覆盖最旧的跨度），会话结束或 SITE TRACE OFF 时
+ * 输出为 Chrome trace / Perfetto 可直接打开的 JSON 文件。
+ * 未开启追踪的会话中 trace_begin 只是一次全局变量检查。
+ */
+
+extern int trace_enabled; // 当前会话是否在记录，只由 trace_* 函数修改
+
+void trace_configure(const char *dir, double sample_rate);
+int trace_available(void);
+void trace_session_start(void);
+int trace_set(int enabled);
+int trace_dump(void);
+void trace_record(const char *name, uint64_t start_us, uint64_t arg);
+uint64_t trace_now_us(void);
+const char *trace_last_file(void);
+
+/**
+ * 开始一个跨度
+ * @return 开始时间，未开启追踪时为0
+ */
+static inline uint64_t trace_begin(void)
+{
+    return trace_enabled ? trace_now_us() : 0;
+}
+
+/**
+ * 结束一个跨度
+ * @param name 跨度名称（复制到环形缓冲区，可以是临时字符串）
+ * @param start trace_begin 的返回值
+ * @param arg 附加数值（如字节数），记录在 args.value 中
+ */
+static inline void trace_end(const char *name, uint64_t start, uint64_t arg)
+{
+    if (start != 0)
+        trace_record(name, start, arg);
+}
@@ -0,0 +1,398 @@
+#include "tree.h"
+#include "file.h"
+#include "scoreboard.h"
+#include "pool.h"
+#include "storage.h"
+#include <fcntl.h>
+#include <dirent.h>
+#include <strings.h>
+#include <zlib.h>
+
+/*
+ * SITE RETRTREE：把整个目录树以 tar（可选 gzip 压缩）流的形式通过一条数据连接发送。
+ * tar 流在遍历目录时即时生成，每层目录只保持一个打开的 DIR，内存占用与目录大小无关；
+ * 不压缩时文件内容直接走 sendfile 零拷贝路径。
+ */
+
+typedef struct
+{
+    connection *session;              // 会话（决定 MODE S/B 的封装方式）
+    int data_socket;                  // 数据连接
+    z_stream *zs;                     // 压缩流，NULL 表示不压缩
+    unsigned char *zbuf;              // 压缩输出缓冲区（BUFFER_SIZE，来自传输缓冲区池）
+    uint64_t bytes;                   // 已写入数据连接的字节数
+    uint64_t files;                   // 已发送的文件数
+    int error;                        // 发生过发送错误
+} tar_stream;
+
+/**
+ * 向 tar 流写入数据，压缩模式下先经过 deflate
+ * @return 0 成功，-1 失败
+ */
+static int tar_write(tar_stream *ts, const void *data, size_t len, int flush)
+{
+    if (ts->error)
+        return -1;
+    if (ts->zs == NULL)
+    {
+        if (data_write(ts->session, ts->data_socket, data, len) != 0)
+        {
+            ts->error = 1;
+            return -1;
+        }
+        ts->bytes += len;
+        scoreboard_add_bytes(len);
+        return 0;
+    }
+
+    ts->zs->next_in = (Bytef *)data;
+    ts->zs->avail_in = (uInt)len;
+    do
+    {
+        ts->zs->next_out = ts->zbuf;
+        ts->zs->avail_out = BUFFER_SIZE;
+        if (deflate(ts->zs, flush) == Z_STREAM_ERROR)
+        {
+            ts->error = 1;
+            return -1;
+        }
+        size_t have = BUFFER_SIZE - ts->zs->avail_out;
+        if (have > 0)
+        {
+            if (data_write(ts->session, ts->data_socket, ts->zbuf, have) != 0)
+            {
+                ts->error = 1;
+                return -1;
+            }
+            ts->bytes += have;
+            scoreboard_add_bytes(have);
+        }
+    } while (ts->zs->avail_out == 0);
+    return 0;
+}
+
+/**
+ * 写入若干个全零字节，用于块对齐填充
+ */
+static int tar_write_zeros(tar_stream *ts, size_t len)
+{
+    static const char zeros[TAR_BLOCK_SIZE];
+    while (len > 0)
+    {
+        size_t n = len < sizeof(zeros) ? len : sizeof(zeros);
+        if (tar_write(ts, zeros, n, Z_NO_FLUSH) != 0)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * 以八进制填充数字字段；超出八进制表示范围时使用 GNU 的 base-256 编码
+ */
+static void tar_number(char *field, size_t width, uint64_t value)
+{
+    if (width > 1 && value < (1ULL << (3 * (width - 1))))
+    {
+        snprintf(field, width, "%0*llo", (int)(width - 1), (unsigned long long)value);
+        return;
+    }
+    memset(field, 0, width);
+    field[0] = (char)0x80;
+    for (size_t i = width - 1; i > 0 && value > 0; i--)
+    {
+        field[i] = (char)(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+/**
+ * 写入一个 ustar 头部
+ */
+static int tar_header(tar_stream *ts, const char *name, char type, const struct stat *st, uint64_t size,
+                      const char *linkname)
+{
+    size_t name_len = strlen(name);
+    if (name_len > 100)
+    {
+        // 超长文件名使用 GNU 长文件名扩展：先发送一个类型为 'L' 的伪条目
+        struct stat dummy;
+        memset(&dummy, 0, sizeof(dummy));
+        if (tar_header(ts, "././@LongLink", 'L', &dummy, name_len + 1, NULL) != 0 ||
+            tar_write(ts, name, name_len + 1, Z_NO_FLUSH) != 0 ||
+            tar_write_zeros(ts, (TAR_BLOCK_SIZE - (name_len + 1) % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE) != 0)
+            return -1;
+    }
+
+    char h[TAR_BLOCK_SIZE];
+    memset(h, 0, sizeof(h));
+    memcpy(h, name, name_len > 100 ? 100 : name_len);
+    tar_number(h + 100, 8, st->st_mode & 07777);
+    tar_number(h + 108, 8, st->st_uid);
+    tar_number(h + 116, 8, st->st_gid);
+    tar_number(h + 124, 12, size);
+    tar_number(h + 136, 12, (uint64_t)st->st_mtime);
+    h[156] = type;
+    if (linkname != NULL)
+        strncpy(h + 157, linkname, 100);
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+
+    // 校验和：计算时校验和字段视为8个空格
+    memset(h + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (size_t i = 0; i < sizeof(h); i++)
+        sum += (unsigned char)h[i];
+    snprintf(h + 148, 8, "%06o", sum);
+    h[155] = ' ';
+    return tar_write(ts, h, sizeof(h), Z_NO_FLUSH);
+}
+
+/**
+ * 发送一个普通文件：头部 + 内容 + 块对齐填充
+ * 文件在发送过程中变短时用零补齐到头部声明的大小，变长的部分不发送
+ */
+static int tar_file(tar_stream *ts, int dir_fd, const char *entry, const char *name, const struct stat *st)
+{
+    int fd = openat(dir_fd, entry, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+        return 0; // 无法读取的文件直接跳过
+    if (tar_header(ts, name, '0', st, st->st_size, NULL) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    uint64_t sent = 0;
+    if (ts->zs == NULL)
+    {
+        // 不压缩：直接复用 RETR 的零拷贝发送路径
+        xfer_path_t path_used;
+        int rc = send_file_data(ts->session, ts->data_socket, fd, st->st_size, 0, &sent, &path_used);
+        ts->bytes += sent;
+        if (rc != 0)
+        {
+            close(fd);
+            ts->error = 1;
+            return -1;
+        }
+    }
+    else
+    {
+        char *buffer = xfer_buffer_alloc();
+        if (buffer == NULL)
+        {
+            close(fd);
+            ts->error = 1;
+            return -1;
+        }
+        while (sent < (uint64_t)st->st_size)
+        {
+            size_t want = BUFFER_SIZE;
+            if ((uint64_t)st->st_size - sent < want)
+                want = (size_t)(st->st_size - sent);
+            ssize_t n = read(fd, buffer, want);
+            if (n <= 0)
+                break;
+            if (tar_write(ts, buffer, n, Z_NO_FLUSH) != 0)
+            {
+                xfer_buffer_free(buffer);
+                close(fd);
+                return -1;
+            }
+            sent += n;
+        }
+        xfer_buffer_free(buffer);
+    }
+    close(fd);
+
+    size_t pad = (TAR_BLOCK_SIZE - st->st_size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    if (tar_write_zeros(ts, (size_t)(st->st_size - sent) + pad) != 0)
+        return -1;
+    ts->files++;
+    return 0;
+}
+
+/**
+ * 递归发送目录 dir_fd 中的所有条目
+ * @param ts tar 流
+ * @param dir_fd 目录（函数负责关闭）
+ * @param name 归档中的路径前缀缓冲区，长度为 PATH_MAX，返回时恢复原内容
+ * @param depth 当前递归深度
+ * @return 0 成功，-1 发送失败
+ */
+static int tar_directory(tar_stream *ts, int dir_fd, char *name, int depth)
+{
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL)
+    {
+        close(dir_fd);
+        return 0;
+    }
+
+    size_t base_len = strlen(name);
+    struct dirent *entry;
+    int rc = 0;
+    while (rc == 0 && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        int len = snprintf(name + base_len, PATH_MAX - base_len, "%s", entry->d_name);
+        if (len < 0 || base_len + len >= PATH_MAX - 1)
+            continue; // 路径过长，跳过
+
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+
+        if (S_ISREG(st.st_mode))
+        {
+            rc = tar_file(ts, dirfd(dir), entry->d_name, name, &st);
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            // 只发送符号链接本身，不跟随，避免泄露根目录之外的内容
+            char target[PATH_MAX];
+            ssize_t n = readlinkat(dirfd(dir), entry->d_name, target, sizeof(target) - 1);
+            if (n >= 0 && n <= 100)
+            {
+                target[n] = '\0';
+                rc = tar_header(ts, name, '2', &st, 0, target);
+            }
+        }
+        else if (S_ISDIR(st.st_mode) && depth < TREE_MAX_DEPTH)
+        {
+            strcat(name, "/");
+            rc = tar_header(ts, name, '5', &st, 0, NULL);
+            int child_fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (rc == 0 && child_fd >= 0)
+                rc = tar_directory(ts, child_fd, name, depth + 1);
+            else if (child_fd >= 0)
+                close(child_fd);
+        }
+        // 其它类型（设备、FIFO、套接字）不发送
+    }
+    name[base_len] = '\0';
+    closedir(dir);
+    return rc;
+}
+
+/**
+ * 处理 SITE RETRTREE 命令，通过一条数据连接以 tar 流发送整个目录树
+ * @param client_socket 客户端控制连接
+ * @param session 会话状态
+ * @param arg 目录路径，可附加 GZ 选项启用 gzip 压缩，如 "SITE RETRTREE data GZ"
+ * @return 0 表示成功处理, -1 表示处理失败
+ */
+int handle_retrtree_command(int client_socket, connection *session, const char *arg)
+{
+    char dir_arg[LINE_MAX_SIZE], option[LINE_MAX_SIZE];
+    parse_cmd_param(arg, dir_arg, sizeof(dir_arg), option);
+    int compress = 0;
+    if (strcasecmp(option, "GZ") == 0)
+        compress = 1;
+    else if (option[0] != '\0')
+    {
+        send_response(client_socket, 501, "Usage: SITE RETRTREE <dir> [GZ]");
+        return -1;
+    }
+    if (dir_arg[0] == '\0')
+        strcpy(dir_arg, ".");
+    // 打包时直接使用目录与文件描述符（openat/fdopendir/sendfile），只支持本地存储
+    if (!storage->native_fds)
+    {
+        send_response(client_socket, 502, "SITE RETRTREE is not available on this storage backend.");
+        return -1;
+    }
+
+    char full_path[PATH_MAX];
+    int rc = resolve_path(session, dir_arg, full_path, sizeof(full_path));
+    if (rc != 0)
+    {
+        send_response(client_socket, 550, rc == -1 ? "Resulting path is too long." : "Permission denied or invalid path.");
+        return -1;
+    }
+    int dir_fd = open(full_path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0)
+    {
+        send_response(client_socket, 550, "Failed to open directory.");
+        return -1;
+    }
+
+    send_response(client_socket, 150, compress ? "Opening data connection for tree transfer (tar.gz)."
+                                               : "Opening data connection for tree transfer (tar).");
+    scoreboard_set_state(SB_STATE_TRANSFER);
+    uint64_t start_us = realtime_us();
+    uint64_t start_mono = monotonic_us();
+    xfer_path_t xfer_path = compress ? XFER_PATH_DEFLATE : XFER_PATH_SENDFILE;
+
+    int data_socket = establish_data_connection(session, 1);
+    if (data_socket < 0)
+    {
+        close(dir_fd);
+        send_response(client_socket, 425, "Failed to establish data connection.");
+        log_transfer(session, 'o', full_path, start_us, start_mono, 0, 425, xfer_path);
+        scoreboard_set_state(SB_STATE_IDLE);
+        return -1;
+    }
+
+    tar_stream *ts = calloc(1, sizeof(tar_stream));
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    int transfer_ok = ts != NULL;
+    if (transfer_ok)
+    {
+        ts->session = session;
+        ts->data_socket = data_socket;
+        if (compress)
+        {
+            // windowBits 15 + 16 表示输出 gzip 格式
+            ts->zbuf = xfer_buffer_alloc();
+            if (ts->zbuf != NULL &&
+                deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+                ts->zs = &zs;
+            else
+                transfer_ok = 0;
+        }
+    }
+
+    if (transfer_ok)
+    {
+        char name[PATH_MAX] = "";
+        transfer_ok = tar_directory(ts, dir_fd, name, 0) == 0;
+        // tar 以两个全零块结束
+        if (transfer_ok)
+            transfer_ok = tar_write_zeros(ts, 2 * TAR_BLOCK_SIZE) == 0;
+        if (transfer_ok && ts->zs != NULL)
+            transfer_ok = tar_write(ts, NULL, 0, Z_FINISH) == 0;
+    }
+    else
+    {
+        close(dir_fd);
+    }
+    if (ts != NULL && ts->zs != NULL)
+        deflateEnd(ts->zs);
+
+    release_data_connection(session, data_socket, transfer_ok, 1);
+
+    uint64_t bytes = ts != NULL ? ts->bytes : 0;
+    if (transfer_ok)
+    {
+        char message[128];
+        snprintf(message, sizeof(message), "Transfer complete, %llu files, %llu bytes.",
+                 (unsigned long long)ts->files, (unsigned long long)bytes);
+        session->bytes_transferred += bytes;
+        send_response(client_socket, 226, message);
+        log_transfer(session, 'o', full_path, start_us, start_mono, bytes, 226, xfer_path);
+    }
+    else
+    {
+        send_response(client_socket, 426, "Connection closed; transfer aborted.");
+        log_transfer(session, 'o', full_path, start_us, start_mono, bytes, 426, xfer_path);
+    }
+    if (ts != NULL)
+        xfer_buffer_free(ts->zbuf);
+    free(ts);
+    scoreboard_set_state(SB_STATE_IDLE);
+    return transfer_ok ? 0 : -1;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "utils.h"
+#include "connect.h"
+
+#define TAR_BLOCK_SIZE 512  // tar 记录块大小
+#define TREE_MAX_DEPTH 64   // 目录递归的最大深度，限制同时打开的目录数量
+
+int handle_retrtree_command(int client_socket, connection *session, const char *arg);
@@ -0,0 +1,226 @@
+#include "upgrade.h"
+#include "utils.h"
+#include "scoreboard.h"
+#include "xferlog.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+static volatile sig_atomic_t drain_notified = 0; // 会话子进程收到了排空通知（SIGUSR2）
+static sigset_t command_wait_mask;                  // 会话等待命令时的信号屏蔽字，不屏蔽 SIGUSR2
+
+static char exe_path[PATH_MAX];    // 启动时解析出的二进制路径，升级时执行磁盘上的新版本
+static char startup_dir[PATH_MAX]; // 启动目录，相对的 -root 等参数相对于它
+
+/**
+ * 记录可执行文件路径与启动目录，必须在 chdir 到 FTP 根目录之前调用
+ * @param argv0 main 的 argv[0]
+ */
+void upgrade_init(const char *argv0)
+{
+    // 不能使用 /proc/self/exe：部署新版本后它仍指向旧的（已删除的）文件
+    if (strchr(argv0, '/') == NULL || realpath(argv0, exe_path) == NULL)
+        snprintf(exe_path, sizeof(exe_path), "%s", argv0); // 交给 execvp 在 PATH 中查找
+    if (getcwd(startup_dir, sizeof(startup_dir)) == NULL)
+        startup_dir[0] = '\0';
+}
+
+/**
+ * 取得升级前的进程传来的监听socket
+ * @return 监听socket，不是由升级启动或描述符无效时返回-1
+ */
+int upgrade_inherited_listener(void)
+{
+    const char *value = getenv(UPGRADE_LISTEN_FD_ENV);
+    if (value == NULL)
+        return -1;
+    int fd = atoi(value);
+    unsetenv(UPGRADE_LISTEN_FD_ENV); // 不再传给后续的子进程
+
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    if (fd < 0 || getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0 || !listening)
+    {
+        fprintf(stderr, "upgrade: inherited fd %s is not a listening socket\n", value);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+/**
+ * 通知升级前的进程：新进程已经准备好 accept，可以开始排空
+ */
+void upgrade_notify_ready(void)
+{
+    const char *value = getenv(UPGRADE_READY_FD_ENV);
+    if (value == NULL)
+        return;
+    int fd = atoi(value);
+    unsetenv(UPGRADE_READY_FD_ENV);
+    char ready = 1;
+    if (write(fd, &ready, 1) != 1)
+        perror("upgrade: ready notification failed");
+    close(fd);
+}
+
+/**
+ * fork 并执行新的二进制，把监听socket交给它，等待它就绪
+ * @param listen_socket 当前的监听socket
+ * @param argv 启动参数，原样传给新进程
+ * @return 0 新进程已开始 accept，旧进程应停止 accept 并排空；-1 升级失败，继续服务
+ */
+int upgrade_exec(int listen_socket, char **argv)
+{
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) != 0)
+    {
+        perror("upgrade: pipe failed");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("upgrade: fork failed");
+        close(ready[0]);
+        close(ready[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        // 只有监听socket和就绪管道的写端需要跨越 exec
+        char value[16];
+        fcntl(listen_socket, F_SETFD, 0);
+        fcntl(ready[1], F_SETFD, 0);
+        snprintf(value, sizeof(value), "%d", listen_socket);
+        setenv(UPGRADE_LISTEN_FD_ENV, value, 1);
+        snprintf(value, sizeof(value), "%d", ready[1]);
+        setenv(UPGRADE_READY_FD_ENV, value, 1);
+        sigset_t none;
+        sigemptyset(&none);
+        signal(SIGUSR1, SIG_DFL);
+        signal(SIGUSR2, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &none, NULL); // 信号屏蔽字会跨越 exec 保留
+        if (startup_dir[0] != '\0' && chdir(startup_dir) != 0)
+            perror("upgrade: chdir to startup directory failed");
+        execvp(exe_path, argv);
+        perror("upgrade: exec failed");
+        _exit(127);
+    }
+
+    // 等待新进程写入就绪字节；新进程启动失败时管道直接关闭
+    close(ready[1]);
+    struct pollfd pfd = {.fd = ready[0], .events = POLLIN};
+    uint64_t deadline = monotonic_us() + (uint64_t)UPGRADE_READY_TIMEOUT_MS * 1000;
+    char byte = 0;
+    ssize_t n = -1;
+    while (1)
+    {
+        uint64_t now = monotonic_us();
+        if (now >= deadline)
+            break;
+        int rc = poll(&pfd, 1, (int)((deadline - now) / 1000) + 1);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc > 0)
+            n = read(ready[0], &byte, 1);
+        break;
+    }
+    close(ready[0]);
+
+    if (n != 1)
+    {
+        fprintf(stderr, "upgrade: new process %d did not become ready, keep serving\n", (int)pid);
+        kill(pid, SIGTERM); // 避免两个进程同时 accept
+        return -1;
+    }
+    fprintf(stderr, "upgrade: new process %d is accepting, draining\n", (int)pid);
+    return 0;
+}
+
+/**
+ * 在时限内等待所有会话结束，超时后终止剩余会话；由已停止 accept 的父进程调用
+ * @param timeout_sec 排空时限（秒），0 表示立即终止剩余会话
+ */
+void upgrade_drain(int timeout_sec)
+{
+    uint64_t deadline = monotonic_us() + (uint64_t)timeout_sec * 1000000;
+    const struct timespec interval = {0, 100 * 1000000L};
+
+    // 通知所有会话：空闲的立即关闭，传输中的在传输完成后关闭（信号在此之前保持挂起）
+    for (int i = 0; i < scoreboard_capacity(); i++)
+    {
+        sb_snapshot snap;
+        if (scoreboard_read(i, &snap) && snap.pid > 0)
+            kill(snap.pid, SIGUSR2);
+    }
+
+    while (scoreboard_sweep() > 0)
+    {
+        if (monotonic_us() >= deadline)
+        {
+            fprintf(stderr, "upgrade: drain timeout, terminating %u sessions\n", scoreboard_active());
+            for (int i = 0; i < scoreboard_capacity(); i++)
+            {
+                sb_snapshot snap;
+                if (scoreboard_read(i, &snap) && snap.pid > 0)
+                    kill(snap.pid, SIGTERM);
+            }
+            break;
+        }
+        nanosleep(&interval, NULL);
+    }
+
+    // 给传输日志的后台线程留出最后一次刷写的时间
+    if (xferlog_enabled())
+    {
+        const struct timespec flush = {0, 2 * XFERLOG_FLUSH_INTERVAL_MS * 1000000L};
+        nanosleep(&flush, NULL);
+    }
+}
+
+static void on_drain_notice(int signo)
+{
+    (void)signo;
+    drain_notified = 1;
+}
+
+/**
+ * 会话子进程启动时调用：安装排空通知的处理函数，并设置信号屏蔽字，
+ * 使 SIGUSR2 只在 upgrade_wait_command 中递送，不会打断传输中的系统调用
+ * @param base_mask 会话平时使用的信号屏蔽字（父进程启动时的屏蔽字）
+ */
+void upgrade_session_init(const sigset_t *base_mask)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_drain_notice;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+
+    command_wait_mask = *base_mask;
+    sigdelset(&command_wait_mask, SIGUSR2);
+    sigset_t mask = *base_mask;
+    sigaddset(&mask, SIGUSR2);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+/**
+ * 等待控制连接可读，期间接收排空通知
+ * @param fd 控制连接
+ * @return 0 可读（或出错，由随后的读取报告），-1 收到排空通知，会话应回复 421 后关闭
+ */
+int upgrade_wait_command(int fd)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    while (!drain_notified)
+    {
+        int rc = ppoll(&pfd, 1, NULL, &command_wait_mask);
+        if (rc > 0 || (rc < 0 && errno != EINTR))
+            return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <signal.h>
+
+#define UPGRADE_LISTEN_FD_ENV "FTP_LISTEN_FD"       // 新进程继承的监听socket
+#define UPGRADE_READY_FD_ENV "FTP_UPGRADE_READY_FD" // 新进程就绪后写入一个字节的管道
+#define UPGRADE_READY_TIMEOUT_MS 10000              // 等待新进程就绪的时间上限
+#define UPGRADE_DEFAULT_DRAIN_TIMEOUT 60            // 默认排空时限（秒）
+
+/*
+ * 零停机升级：收到 SIGUSR2 后父进程 fork+exec 磁盘上的新二进制，
+ * 监听socket通过环境变量中的描述符编号传给新进程，监听队列在交接期间一直存在，不会拒绝连接。
+ * 新进程开始 accept 后通过管道通知旧进程，旧进程随即停止 accept，
+ * 向所有会话发送 SIGUSR2，在时限内等待已有会话结束（超时后向剩余会话发送 SIGTERM）再退出。
+ * 会话平时屏蔽 SIGUSR2，只在等待下一条命令时（ppoll）接收：空闲会话立即回复 421 并关闭，
+ * 正在传输的会话不受打扰，传输完成、回到等待命令时再关闭。
+ */
+
+void upgrade_init(const char *argv0);
+int upgrade_inherited_listener(void);
+void upgrade_notify_ready(void);
+int upgrade_exec(int listen_socket, char **argv);
+void upgrade_drain(int timeout_sec);
+
+// 以下函数在会话子进程中使用
+void upgrade_session_init(const sigset_t *base_mask);
+int upgrade_wait_command(int fd);
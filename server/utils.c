@@ -1,4 +1,10 @@
 #include "utils.h"
+#include "tls.h"
+#include <time.h>
+#include <stdatomic.h>
+
+// 最近一次发送的响应码（会话捕获使用）；传输期间控制连接的监视线程也会发送响应
+static _Atomic int last_code = 0;
 
 /**
  * 向指定的客户端套接字发送响应消息
@@ -10,7 +16,8 @@ void send_response(int client_socket, int code, const char *message)
 {
     char response[LINE_MAX_SIZE];
     snprintf(response, sizeof(response), "%d %s\r\n", code, message);
-    if (send(client_socket, response, strlen(response), 0) == -1)
+    atomic_store_explicit(&last_code, code, memory_order_relaxed);
+    if (net_send(client_socket, response, strlen(response), 0) == -1)
     {
         perror("send failed");
     }
@@ -26,11 +33,12 @@ void send_multiline_response(int client_socket, int code, const char *messages[]
 {
     char response[LINE_MAX_SIZE];
     int i = 0;
+    atomic_store_explicit(&last_code, code, memory_order_relaxed);
     // 发送除最后一行外的所有行，格式为 "%d-%s\r\n"
     for (i = 0; messages[i] != NULL && messages[i + 1] != NULL; i++)
     {
         snprintf(response, sizeof(response), "%d-%s\r\n", code, messages[i]);
-        if (send(client_socket, response, strlen(response), 0) == -1)
+        if (net_send(client_socket, response, strlen(response), 0) == -1)
         {
             perror("send failed");
             return;
@@ -40,7 +48,7 @@ void send_multiline_response(int client_socket, int code, const char *messages[]
     if (messages[i] != NULL)
     {
         snprintf(response, sizeof(response), "%d %s\r\n", code, messages[i]);
-        if (send(client_socket, response, strlen(response), 0) == -1)
+        if (net_send(client_socket, response, strlen(response), 0) == -1)
         {
             perror("send failed");
             return;
@@ -48,6 +56,39 @@ void send_multiline_response(int client_socket, int code, const char *messages[]
     }
 }
 
+/**
+ * 获取本进程最近一次发送的响应码
+ */
+int last_response_code(void)
+{
+    return atomic_load_explicit(&last_code, memory_order_relaxed);
+}
+
+/**
+ * 将缓冲区中的数据全部发送出去，处理部分发送
+ * @param socket 目标套接字
+ * @param buffer 数据
+ * @param len 数据长度
+ * @return 0 成功，-1 发送失败
+ */
+int send_all(int socket, const void *buffer, size_t len)
+{
+    const char *p = buffer;
+    while (len > 0)
+    {
+        ssize_t n = net_send(socket, p, len, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
 /**
  * 从客户端套接字读取一行数据，并存储到缓冲区
  * @param client_socket 客户端套接字
@@ -61,7 +102,7 @@ int read_line(int client_socket, char *buffer, size_t max_len)
     while (total_read < max_len - 1)
     {
         char ch;
-        ssize_t bytes_read = recv(client_socket, &ch, 1, 0);
+        ssize_t bytes_read = net_recv(client_socket, &ch, 1);
         if (bytes_read < 0)
         {
             perror("recv failed");
@@ -84,10 +125,11 @@ int read_line(int client_socket, char *buffer, size_t max_len)
 /**
  * 解析命令行，提取命令和参数。暂时只支持单个参数的情况。
  * @param line 输入的命令行
- * @param cmd 输出的命令
- * @param arg 输出的参数，可为空字符串
+ * @param cmd 输出的命令，超出 cmd_size 的部分截断（截断后不会与任何命令匹配）
+ * @param cmd_size cmd 缓冲区大小
+ * @param arg 输出的参数，可为空字符串；缓冲区不小于 line
  */
-void parse_cmd_param(const char *line, char *cmd, char *arg)
+void parse_cmd_param(const char *line, char *cmd, size_t cmd_size, char *arg)
 {
     while (*line && isspace((unsigned char)*line))
         line++; // 跳过前导空白字符
@@ -97,11 +139,35 @@ void parse_cmd_param(const char *line, char *cmd, char *arg)
     while (*line && !isspace((unsigned char)*line))
         line++;
     size_t cmd_len = line - cmd_start;
-    strncpy(cmd, cmd_start, cmd_len);
+    if (cmd_len >= cmd_size)
+        cmd_len = cmd_size - 1;
+    memcpy(cmd, cmd_start, cmd_len);
     cmd[cmd_len] = '\0';
 
     // 提取参数
     while (*line && isspace((unsigned char)*line))
         line++; // 跳过空白字符
     strcpy(arg, line);
+}
+
+/**
+ * 获取单调时钟时间，用于计算耗时
+ * @return 单调时钟时间（微秒）
+ */
+uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * 获取当前的 Unix 时间
+ * @return 自 1970-01-01 起的微秒数
+ */
+uint64_t realtime_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <stdint.h>
 
 #define CONTROL_PORT 21      // 控制连接端口
 #define WAITING_QUEUE_SIZE 5 // 监听队列大小
@@ -18,5 +19,9 @@
 
 void send_response(int client_socket, int code, const char *message);
 void send_multiline_response(int client_socket, int code, const char *messages[]);
+int last_response_code(void);
+int send_all(int socket, const void *buffer, size_t len);
 int read_line(int client_socket, char *buffer, size_t max_len);
-void parse_cmd_param(const char *line, char *cmd, char *arg);
\ No newline at end of file
+void parse_cmd_param(const char *line, char *cmd, size_t cmd_size, char *arg);
+uint64_t monotonic_us(void);
+uint64_t realtime_us(void);
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "xferlog.h"
+#include "ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+static ring_t *xferlog_ring = NULL;
+static int xferlog_fd = -1;
+static xferlog_format_t xferlog_format = XFERLOG_FORMAT_XFERLOG;
+
+static const char *xfer_path_name(uint8_t path)
+{
+    switch (path)
+    {
+    case XFER_PATH_READ_SEND:
+        return "read/send";
+    case XFER_PATH_RECV_WRITE:
+        return "recv/write";
+    case XFER_PATH_SENDFILE:
+        return "sendfile";
+    case XFER_PATH_DEFLATE:
+        return "deflate";
+    case XFER_PATH_KTLS_SENDFILE:
+        return "ktls/sendfile";
+    case XFER_PATH_TLS_READ_SEND:
+        return "tls/read/send";
+    case XFER_PATH_TLS_RECV_WRITE:
+        return "tls/recv/write";
+    case XFER_PATH_DELTA:
+        return "delta";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * 以 xferlog 格式输出一条记录，文件名中的空白字符替换为下划线
+ */
+static int format_xferlog(const xfer_record *rec, char *out, size_t outsz)
+{
+    time_t start = (time_t)(rec->start_us / 1000000);
+    struct tm tm;
+    char when[32];
+    localtime_r(&start, &tm);
+    strftime(when, sizeof(when), "%a %b %d %H:%M:%S %Y", &tm);
+
+    char path[XFERLOG_PATH_MAX];
+    size_t i;
+    for (i = 0; i < sizeof(path) - 1 && rec->path[i]; i++)
+        path[i] = (rec->path[i] == ' ' || rec->path[i] == '\t') ? '_' : rec->path[i];
+    path[i] = '\0';
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &rec->client_ip, ip, sizeof(ip));
+
+    // 传输耗时以秒计，向上取整；完成状态 c 为完成，i 为未完成
+    return snprintf(out, outsz, "%s %llu %s %llu %s b _ %c a anonymous ftp 0 * %c\n",
+                    when, (unsigned long long)((rec->duration_us + 999999) / 1000000), ip,
+                    (unsigned long long)rec->bytes, path, rec->direction,
+                    rec->result_code == 226 ? 'c' : 'i');
+}
+
+/**
+ * 以 JSON 行格式输出一条记录
+ */
+static int format_jsonl(const xfer_record *rec, char *out, size_t outsz)
+{
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &rec->client_ip, ip, sizeof(ip));
+
+    // 转义路径中的引号、反斜杠和控制字符
+    char path[XFERLOG_PATH_MAX * 6];
+    size_t n = 0;
+    for (size_t i = 0; rec->path[i] && i < XFERLOG_PATH_MAX; i++)
+    {
+        unsigned char c = (unsigned char)rec->path[i];
+        if (c == '"' || c == '\\')
+        {
+            path[n++] = '\\';
+            path[n++] = (char)c;
+        }
+        else if (c < 0x20)
+        {
+            n += snprintf(path + n, sizeof(path) - n, "\\u%04x", c);
+        }
+        else
+        {
+            path[n++] = (char)c;
+        }
+    }
+    path[n] = '\0';
+
+    // 实际吞吐（字节/秒），以及数据连接上采样到的 TCP 参数
+    unsigned long long throughput = rec->duration_us > 0 ? rec->bytes * 1000000 / rec->duration_us : 0;
+    char tcp[160] = "";
+    if (rec->tcp_cc[0] != '\0')
+        snprintf(tcp, sizeof(tcp),
+                 ",\"tcp\":{\"cc\":\"%s\",\"rtt_us\":%u,\"buf\":%u,\"retrans\":%u,\"delivery_rate\":%llu}",
+                 rec->tcp_cc, rec->tcp_rtt_us, rec->tcp_buf, rec->tcp_retrans,
+                 (unsigned long long)rec->tcp_delivery_rate);
+
+    return snprintf(out, outsz,
+                    "{\"start_us\":%llu,\"duration_us\":%llu,\"client\":\"%s:%u\",\"path\":\"%s\","
+                    "\"direction\":\"%s\",\"bytes\":%llu,\"result\":%u,\"xfer_path\":\"%s\","
+                    "\"throughput\":%llu%s}\n",
+                    (unsigned long long)rec->start_us, (unsigned long long)rec->duration_us,
+                    ip, rec->client_port, path, rec->direction == 'o' ? "retr" : "stor",
+                    (unsigned long long)rec->bytes, rec->result_code, xfer_path_name(rec->xfer_path),
+                    throughput, tcp);
+}
+
+/**
+ * 后台刷写线程：周期性地清空环形缓冲区，批量写入日志文件
+ */
+static void *xferlog_flusher(void *arg)
+{
+    (void)arg;
+    char batch[64 * 1024];
+    uint64_t reported_drops = 0;
+    const struct timespec interval = {0, XFERLOG_FLUSH_INTERVAL_MS * 1000000L};
+
+    while (1)
+    {
+        xfer_record rec;
+        size_t used = 0;
+        while (ring_pop(xferlog_ring, &rec) == 0)
+        {
+            char line[2048];
+            int len = xferlog_format == XFERLOG_FORMAT_JSONL
+                          ? format_jsonl(&rec, line, sizeof(line))
+                          : format_xferlog(&rec, line, sizeof(line));
+            if (len <= 0)
+                continue;
+            if ((size_t)len >= sizeof(line))
+                len = sizeof(line) - 1;
+            if (used + len > sizeof(batch))
+            {
+                if (write(xferlog_fd, batch, used) < 0)
+                    perror("xferlog write failed");
+                used = 0;
+            }
+            memcpy(batch + used, line, len);
+            used += len;
+        }
+        if (used > 0 && write(xferlog_fd, batch, used) < 0)
+            perror("xferlog write failed");
+
+        uint64_t drops = ring_dropped(xferlog_ring);
+        if (drops != reported_drops)
+        {
+            fprintf(stderr, "xferlog: %llu records dropped (ring full)\n", (unsigned long long)drops);
+            reported_drops = drops;
+        }
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * 初始化传输日志：创建共享环形缓冲区并启动后台刷写线程，必须在 fork() 之前调用
+ * @param filename 日志文件路径（追加写入）
+ * @param format 日志格式
+ * @return 0 成功，-1 失败
+ */
+int xferlog_init(const char *filename, xferlog_format_t format)
+{
+    xferlog_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (xferlog_fd < 0)
+    {
+        perror("open xferlog failed");
+        return -1;
+    }
+
+    xferlog_ring = ring_create(sizeof(xfer_record), XFERLOG_RING_SLOTS);
+    if (xferlog_ring == NULL)
+    {
+        perror("create xferlog ring failed");
+        close(xferlog_fd);
+        xferlog_fd = -1;
+        return -1;
+    }
+    xferlog_format = format;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, xferlog_flusher, NULL) != 0)
+    {
+        fprintf(stderr, "xferlog: failed to start flusher thread\n");
+        xferlog_ring = NULL;
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/**
+ * 传输日志是否已启用
+ */
+int xferlog_enabled(void)
+{
+    return xferlog_ring != NULL;
+}
+
+/**
+ * 提交一条传输记录，不会阻塞；缓冲区满时丢弃并计数
+ */
+void xferlog_submit(const xfer_record *record)
+{
+    if (xferlog_ring != NULL)
+        ring_push(xferlog_ring, record);
+}
+
+/**
+ * 获取因缓冲区满而丢弃的记录数
+ */
+uint64_t xferlog_dropped(void)
+{
+    return xferlog_ring != NULL ? ring_dropped(xferlog_ring) : 0;
+}
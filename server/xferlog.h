@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "tcptune.h"
+
+#define XFERLOG_PATH_MAX 256      // 记录中保存的路径长度上限（超出部分截断）
+#define XFERLOG_RING_SLOTS 4096   // 环形缓冲区槽位数（决定内存上限）
+#define XFERLOG_FLUSH_INTERVAL_MS 200
+
+typedef enum
+{
+    XFERLOG_FORMAT_XFERLOG, // wu-ftpd 兼容的 xferlog 格式
+    XFERLOG_FORMAT_JSONL    // 每行一个 JSON 对象
+} xferlog_format_t;
+
+typedef enum
+{
+    XFER_PATH_READ_SEND,  // read() + send()
+    XFER_PATH_RECV_WRITE, // recv() + write()
+    XFER_PATH_SENDFILE,   // sendfile() 零拷贝
+    XFER_PATH_DEFLATE,    // read() + zlib 压缩 + send()
+    XFER_PATH_KTLS_SENDFILE,  // 内核 TLS 加密的 sendfile()
+    XFER_PATH_TLS_READ_SEND,  // read() + 用户态 TLS 加密发送
+    XFER_PATH_TLS_RECV_WRITE, // 用户态 TLS 解密接收 + write()
+    XFER_PATH_DELTA,          // 增量上传：块签名或按增量指令重建文件
+} xfer_path_t;
+
+typedef struct
+{
+    uint64_t start_us;               // 传输开始时间（Unix 时间，微秒）
+    uint64_t duration_us;            // 传输耗时（微秒）
+    uint64_t bytes;                  // 实际传输的字节数
+    struct in_addr client_ip;        // 客户端IP
+    uint16_t client_port;            // 客户端端口（主机字节序）
+    uint16_t result_code;            // 最终响应码，如 226/426/425
+    char direction;                  // 'o' 下载 (RETR)，'i' 上传 (STOR)
+    uint8_t xfer_path;               // 使用的传输路径，见 xfer_path_t
+    char tcp_cc[TCPTUNE_CC_MAX];     // 数据连接的拥塞控制算法，空字符串表示没有采样（如未建立数据连接）
+    uint32_t tcp_rtt_us;             // 传输结束时的平滑 RTT（微秒）
+    uint32_t tcp_buf;                // 显式设置的缓冲区大小，0 表示内核自动调整
+    uint32_t tcp_retrans;            // 重传的报文段数
+    uint64_t tcp_delivery_rate;      // 内核估计的交付速率（字节/秒）
+    char path[XFERLOG_PATH_MAX];     // 文件的绝对路径
+} xfer_record;
+
+int xferlog_init(const char *filename, xferlog_format_t format);
+int xferlog_enabled(void);
+void xferlog_submit(const xfer_record *record);
+uint64_t xferlog_dropped(void);